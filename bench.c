@@ -0,0 +1,797 @@
+/*
+ * End-to-end benchmarks over generated corpora. Each corpus is built from a
+ * fixed seed so runs are comparable between builds; any files given on the
+ * command line are benchmarked as well. Throughput is the input size over the
+ * median time, except for serialize which uses the output size, so lookup and
+ * iteration figures can be compared with parsing the same document.
+ *
+ * The kernels under the parser and builder are timed first on their own, so a
+ * slowdown in one of them shows up even when the end-to-end numbers hide it.
+ * Results can be saved as JSON and later runs compared against them; any
+ * median slower than the baseline by more than the threshold is flagged and
+ * the exit status is 2.
+ *
+ *	./bench [-n runs] [-s megabytes] [-m] [-o results.json]
+ *		[-c baseline.json] [-t percent] [file.json ...]
+ *
+ * -m skips the end-to-end corpora and the threshold defaults to 10%.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#define JSKOROST_IMPLEMENTATION
+#include "jskorost.h"
+
+#include <time.h>
+
+#define BENCH_WARMUP 2
+#define BENCH_MAX_RUNS 1000
+#define BENCH_MAX_RESULTS 256
+
+typedef struct bench_buf {
+	char *data;
+	size_t len;
+	size_t allocated;
+} bench_buf;
+
+static void die(const char *const msg)
+{
+	fprintf(stderr, "%s\n", msg);
+	exit(1);
+}
+
+static void buf_put(bench_buf *b, const char *s, size_t n)
+{
+	if (b->len + n + 1 > b->allocated) {
+		b->allocated = (b->allocated + n + 1) * 2;
+		b->data = (char *)realloc(b->data, b->allocated);
+		if (!b->data)
+			die("Out of memory");
+	}
+	memcpy(&b->data[b->len], s, n);
+	b->len += n;
+	b->data[b->len] = 0;
+}
+
+#define buf_puts(b, s) buf_put(b, s, strlen(s))
+
+__attribute__((__format__ (__printf__, 2, 3)))
+static void buf_printf(bench_buf *b, const char *const fmt, ...)
+{
+	char tmp[256];
+	va_list args;
+	va_start(args, fmt);
+	const int n = vsnprintf(tmp, sizeof(tmp), fmt, args);
+	va_end(args);
+	buf_put(b, tmp, n);
+}
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ull;
+
+static unsigned rng(unsigned n)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (unsigned)(rng_state >> 32) % n;
+}
+
+static double rng_float(void)
+{
+	return (double)rng(1u << 30) / (double)(1u << 30);
+}
+
+static const char *const words[] = {
+	"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+	"json", "parser", "fast", "heap", "\\u00e9t\\u00e9", "caf\xc3\xa9",
+	"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82",
+	"\xe6\x97\xa5\xe6\x9c\xac", "line\\nbreak", "\\\"quoted\\\"",
+	"http:\\/\\/example.com", "\xf0\x9f\x98\x80",
+};
+
+static void put_text(bench_buf *b, unsigned n)
+{
+	buf_puts(b, "\"");
+	for (unsigned i = 0; i < n; i++) {
+		const char *w = words[rng(sizeof(words) / sizeof(words[0]))];
+		if (i)
+			buf_puts(b, " ");
+		buf_puts(b, w);
+	}
+	buf_puts(b, "\"");
+}
+
+/* String-heavy status updates with nested user objects */
+static void gen_twitter(bench_buf *b, size_t size)
+{
+	buf_puts(b, "{\"statuses\": [");
+	for (unsigned i = 0; b->len < size; i++) {
+		buf_printf(b, "%s{\"id\": %u%09u, \"id_str\": \"%u%09u\", "
+				"\"created_at\": \"Sun Aug 31 00:29:%02u +0000 2014\", "
+				"\"text\": ", i ? ", " : "", 505874 + i,
+				rng(1000000000), 505874 + i, rng(1000000000),
+				rng(60));
+		put_text(b, 5 + rng(20));
+		buf_printf(b, ", \"truncated\": false, "
+				"\"in_reply_to_status_id\": null, "
+				"\"user\": {\"id\": %u, \"name\": ", rng(1u << 31));
+		put_text(b, 2);
+		buf_puts(b, ", \"description\": ");
+		put_text(b, rng(15));
+		buf_printf(b, ", \"followers_count\": %u, "
+				"\"friends_count\": %u, \"verified\": %s, "
+				"\"lang\": \"ja\"}, \"entities\": {\"hashtags\": [], "
+				"\"urls\": [], \"user_mentions\": [{\"screen_name\": ",
+				rng(100000), rng(5000),
+				rng(2) ? "true" : "false");
+		put_text(b, 1);
+		buf_printf(b, ", \"indices\": [%u, %u]}]}, "
+				"\"retweet_count\": %u, \"favorited\": false}",
+				rng(10), 10 + rng(10), rng(100));
+	}
+	buf_puts(b, "]}");
+}
+
+/* Float-heavy polygon coordinates */
+static void gen_canada(bench_buf *b, size_t size)
+{
+	buf_puts(b, "{\"type\": \"FeatureCollection\", \"features\": [{"
+			"\"type\": \"Feature\", \"properties\": {\"name\": "
+			"\"Canada\"}, \"geometry\": {\"type\": \"Polygon\", "
+			"\"coordinates\": [");
+	for (unsigned i = 0; b->len < size; i++) {
+		buf_puts(b, i ? ", [" : "[");
+		for (unsigned j = 0; j < 256; j++)
+			buf_printf(b, "%s[%.15g, %.14g]", j ? ", " : "",
+					-141.0 + 88.0 * rng_float(),
+					41.0 + 42.0 * rng_float());
+		buf_puts(b, "]");
+	}
+	buf_puts(b, "]}}]}");
+}
+
+/* Nested lookup tables keyed by numeric ids, as in citm_catalog */
+static void gen_citm(bench_buf *b, size_t size)
+{
+	buf_puts(b, "{\"areaNames\": {");
+	for (unsigned i = 0; i < 64; i++) {
+		buf_printf(b, "%s\"%u\": ", i ? ", " : "", 205705993 + i);
+		put_text(b, 2);
+	}
+	buf_puts(b, "}, \"events\": {");
+	for (unsigned i = 0; b->len < size; i++) {
+		const unsigned id = 138586341 + i;
+		buf_printf(b, "%s\"%u\": {\"description\": null, \"id\": %u, "
+				"\"logo\": null, \"name\": ", i ? ", " : "",
+				id, id);
+		put_text(b, 3);
+		buf_puts(b, ", \"subTopicIds\": [");
+		for (unsigned j = 0, n = 1 + rng(6); j < n; j++)
+			buf_printf(b, "%s%u", j ? ", " : "",
+					337184262 + rng(100));
+		buf_puts(b, "], \"performances\": [");
+		for (unsigned j = 0, n = 1 + rng(4); j < n; j++)
+			buf_printf(b, "%s{\"prices\": [{\"amount\": %u, "
+					"\"audienceSubCategoryId\": %u, "
+					"\"seatCategoryId\": %u}], "
+					"\"seatMapImage\": null, \"start\": %u%03u}",
+					j ? ", " : "", 9000 + rng(90000),
+					337100890, 338937295 + rng(10),
+					1372354200 + rng(1000000), 0);
+		buf_puts(b, "]}");
+	}
+	buf_puts(b, "}}");
+}
+
+/* One flat log record per line */
+static void gen_ndjson(bench_buf *b, size_t size)
+{
+	static const char *const levels[] = {
+		"debug", "info", "warn", "error",
+	};
+	while (b->len < size) {
+		buf_printf(b, "{\"ts\": \"2021-03-%02uT%02u:%02u:%02u.%03uZ\", "
+				"\"level\": \"%s\", \"service\": \"api-%u\", "
+				"\"latency_ms\": %.3f, \"status\": %u, "
+				"\"request_id\": \"%08x-%04x\", \"msg\": ",
+				1 + rng(28), rng(24), rng(60), rng(60),
+				rng(1000), levels[rng(4)], rng(16),
+				rng_float() * 250.0, 200 + 100 * rng(4),
+				rng(1u << 31), rng(1u << 16));
+		put_text(b, 3 + rng(8));
+		buf_puts(b, "}\n");
+	}
+}
+
+/* Many short chains of alternating arrays and objects */
+static void gen_deep(bench_buf *b, size_t size)
+{
+	buf_puts(b, "[");
+	for (unsigned i = 0; b->len < size; i++) {
+		const unsigned depth = 64 + rng(448);
+		if (i)
+			buf_puts(b, ", ");
+		for (unsigned j = 0; j < depth; j++)
+			buf_puts(b, j & 1 ? "{\"k\": " : "[");
+		buf_printf(b, "%u", i);
+		for (unsigned j = depth; j-- > 0;)
+			buf_puts(b, j & 1 ? "}" : "]");
+	}
+	buf_puts(b, "]");
+}
+
+typedef struct bench_corpus {
+	const char *name;
+	char *json;
+	size_t len;
+	int ndjson;
+} bench_corpus;
+
+/* NDJSON records are collected into one array so every op sees a tree */
+static jsk_result parse_corpus(jsk_heap *h, const bench_corpus *c)
+{
+	if (!c->ndjson)
+		return jsk_parse(h, c->json, c->len);
+
+	jsk_value all = jsk_new_array();
+	jsk_stream s = jsk_stream_new(h, c->json, c->len);
+	jsk_result res;
+
+	while (jsk_stream_next(&s, &res)) {
+		if (res.status != JSK_OK)
+			return res;
+		jsk_array_push(h, &all, res.data.value);
+	}
+
+	res.status = JSK_OK;
+	res.data.value = all;
+	return res;
+}
+
+static double walk(jsk_value v)
+{
+	switch (v.type) {
+	case JSK_OBJECT: {
+		double sum = 0;
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it)))
+			sum += strlen(e->key) + walk(e->value);
+		return sum;
+	}
+
+	case JSK_ARRAY: {
+		double sum = 0;
+		const unsigned len = jsk_array_length(v);
+		for (unsigned i = 0; i < len; i++)
+			sum += walk(jsk_array_at(v, i));
+		return sum;
+	}
+
+	case JSK_STRING:
+		return strlen(jsk_get_string(v));
+
+	case JSK_INT:
+		return jsk_get_int(v);
+
+	case JSK_FLOAT:
+		return jsk_get_float(v);
+
+	case JSK_BOOL:
+		return jsk_get_bool(v);
+
+	default:
+		return 0;
+	}
+}
+
+/* Looks every key of every object up again by name */
+static unsigned long long lookup_all(jsk_value v)
+{
+	unsigned long long found = 0;
+
+	if (v.type == JSK_OBJECT) {
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it))) {
+			found += jsk_object_get(v, e->key) != NULL;
+			found += lookup_all(e->value);
+		}
+	} else if (v.type == JSK_ARRAY) {
+		const unsigned len = jsk_array_length(v);
+		for (unsigned i = 0; i < len; i++)
+			found += lookup_all(jsk_array_at(v, i));
+	}
+
+	return found;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+typedef struct bench_result {
+	char name[64];
+	double median_ns;
+	double p99_ns;
+	double rate;
+} bench_result;
+
+static bench_result results[BENCH_MAX_RESULTS];
+static unsigned result_count;
+
+/*
+ * Times are per op, where an end-to-end op is one pass over the corpus. The
+ * rate is GB/s when bytes is non-zero and millions of ops per second if not.
+ */
+static void report(const char *name, double *t, unsigned runs, double ops,
+		double bytes, double scale)
+{
+	qsort(t, runs, sizeof(double), cmp_double);
+	const double median = t[runs / 2] / ops;
+	const double p99 = t[(runs * 99 + 99) / 100 - 1] / ops;
+	const double rate = bytes ? bytes / ops / median * 1e-9 :
+		1e-6 / median;
+
+	printf("%-22s %12.3f %12.3f %9.3f %s\n", name, median * scale,
+			p99 * scale, rate, bytes ? "GB/s" : "Mop/s");
+
+	if (result_count == BENCH_MAX_RESULTS)
+		return;
+
+	bench_result *r = &results[result_count++];
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->median_ns = median * 1e9;
+	r->p99_ns = p99 * 1e9;
+	r->rate = rate;
+}
+
+/* Runs body BENCH_WARMUP + runs times, keeping the timings after warmup */
+#define BENCH_TIME(t, runs, setup, body, teardown)			\
+	for (unsigned run_ = 0; run_ < BENCH_WARMUP + (runs); run_++) {	\
+		setup;							\
+		const double start_ = now();				\
+		body;							\
+		const double end_ = now();				\
+		teardown;						\
+		if (run_ >= BENCH_WARMUP)				\
+			(t)[run_ - BENCH_WARMUP] = end_ - start_;	\
+	}
+
+/* Volatile sink so the compiler can't drop the measured work */
+static volatile double sink;
+
+static void bench_corpus_run(const bench_corpus *c, unsigned runs)
+{
+	double t[BENCH_MAX_RUNS];
+	char name[64];
+	jsk_heap_stats st = { 0 };
+	size_t out_len = 0;
+
+	BENCH_TIME(t, runs, jsk_heap *h = jsk_heap_new(NULL),
+		jsk_result res = parse_corpus(h, c),
+		jsk_heap_get_stats(h, &st);
+		jsk_heap_free(h);
+		if (res.status != JSK_OK)
+			die("Failed to parse corpus"));
+	snprintf(name, sizeof(name), "%s/parse", c->name);
+	report(name, t, runs, 1, c->len, 1e3);
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	const jsk_value root = parse_corpus(h, c).data.value;
+
+	BENCH_TIME(t, runs, (void)0,
+		char *s = jsk_to_string(h, root),
+		if (!s)
+			die("Out of memory");
+		out_len = strlen(s);
+		free(s));
+	snprintf(name, sizeof(name), "%s/serialize", c->name);
+	report(name, t, runs, 1, out_len, 1e3);
+
+	BENCH_TIME(t, runs, (void)0, sink = (double)lookup_all(root), (void)0);
+	snprintf(name, sizeof(name), "%s/lookup", c->name);
+	report(name, t, runs, 1, c->len, 1e3);
+
+	BENCH_TIME(t, runs, (void)0, sink = walk(root), (void)0);
+	snprintf(name, sizeof(name), "%s/iterate", c->name);
+	report(name, t, runs, 1, c->len, 1e3);
+
+	printf("%-22s %zu input bytes, %llu peak heap bytes, %llu used, "
+			"%llu abandoned\n", c->name, c->len, st.reserved,
+			st.used, st.abandoned);
+
+	/* Flat records can skip the tree and go straight to columns */
+	if (c->ndjson) {
+		BENCH_TIME(t, runs, jsk_heap *s = jsk_heap_new(NULL),
+			jsk_columns cols;
+			jsk_result res = jsk_shred(s, c->json, c->len, NULL,
+				&cols),
+			jsk_heap_get_stats(s, &st);
+			jsk_heap_free(s);
+			if (res.status != JSK_OK)
+				die("Failed to shred corpus"));
+		snprintf(name, sizeof(name), "%s/shred", c->name);
+		report(name, t, runs, 1, c->len, 1e3);
+
+		printf("%-22s %llu peak heap bytes when shredded\n",
+				c->name, st.reserved);
+	}
+
+	printf("\n");
+
+	jsk_heap_free(h);
+}
+
+/* Lexes the whole input, returning the number of tokens */
+static unsigned long long lex_all(const char *json, size_t len)
+{
+	jsk_context ctx = (jsk_context){
+		NULL,
+		json,
+		len,
+		0,
+		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		NULL,
+		0,
+	};
+
+	unsigned long long n = 0;
+	do {
+		jsk_lex(&ctx);
+		n++;
+	} while (ctx.tkn.type != JSKT_EOF && ctx.tkn.type != JSKT_INVALID);
+
+	return n;
+}
+
+#define QUERY_EXPR \
+	"statuses[?retweet_count > `50` && user.verified].user.id"
+
+/* QUERY_EXPR written out by hand */
+static jsk_value query_by_hand(jsk_heap *h, jsk_value doc)
+{
+	const jsk_key statuses = jsk_key_make("statuses");
+	const jsk_key retweets = jsk_key_make("retweet_count");
+	const jsk_key user = jsk_key_make("user");
+	const jsk_key verified = jsk_key_make("verified");
+	const jsk_key id = jsk_key_make("id");
+	jsk_value out = jsk_new_array();
+
+	const jsk_value *s = jsk_object_get_key(doc, &statuses);
+	if (!s || s->type != JSK_ARRAY)
+		return out;
+
+	for (unsigned i = 0; i < jsk_array_length(*s); i++) {
+		const jsk_value e = jsk_array_at(*s, i);
+		if (e.type != JSK_OBJECT)
+			continue;
+
+		const jsk_value *r = jsk_object_get_key(e, &retweets);
+		if (!r || r->type != JSK_INT || jsk_get_int_p(r) <= 50)
+			continue;
+
+		const jsk_value *u = jsk_object_get_key(e, &user);
+		if (!u || u->type != JSK_OBJECT)
+			continue;
+
+		const jsk_value *v = jsk_object_get_key(*u, &verified);
+		if (!v || v->type != JSK_BOOL || !jsk_get_bool_p(v))
+			continue;
+
+		const jsk_value *x = jsk_object_get_key(*u, &id);
+		if (x)
+			jsk_array_push(h, &out, *x);
+	}
+
+	return out;
+}
+
+/*
+ * Micro-benchmarks for the kernels under the parser and builder, reporting
+ * time per token, number, hash, lookup, push or allocation, or per byte of
+ * string.
+ */
+static void bench_micro(unsigned runs)
+{
+	double t[BENCH_MAX_RUNS];
+	bench_buf b = { NULL, 0, 0 };
+
+	printf("%-22s %12s %12s %9s\n", "kernel", "median ns/op",
+			"p99 ns/op", "rate");
+
+	gen_twitter(&b, 1 << 20);
+	const unsigned long long tokens = lex_all(b.data, b.len);
+	BENCH_TIME(t, runs, (void)0, sink = lex_all(b.data, b.len), (void)0);
+	report("lex", t, runs, tokens, 0, 1e9);
+
+	b.len = 0;
+	buf_puts(&b, "[");
+	for (unsigned i = 0; i < 1 << 16; i++) {
+		if (i & 1)
+			buf_printf(&b, "%s%d", i ? ", " : "",
+					(int)rng(1u << 31) - (1 << 30));
+		else
+			buf_printf(&b, "%s%.17g", i ? ", " : "",
+					(rng_float() - 0.5) * 1e6);
+	}
+	buf_puts(&b, "]");
+	BENCH_TIME(t, runs, (void)0, sink = lex_all(b.data, b.len), (void)0);
+	report("number", t, runs, 1 << 16, 0, 1e9);
+
+	enum { NKEYS = 256, REPS = 64 };
+	static char keys[NKEYS][48], misses[NKEYS][48];
+	unsigned lens[NKEYS];
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_value obj = jsk_new_object(h);
+	for (unsigned i = 0; i < NKEYS; i++) {
+		lens[i] = snprintf(keys[i], sizeof(keys[i]), "%.*s_%u",
+				(int)rng(32), "abcdefghijklmnopqrstuvwxyz0123456",
+				i);
+		snprintf(misses[i], sizeof(misses[i]), "missing_%u", i);
+		jsk_object_insert(&obj, keys[i], jsk_new_int(i));
+	}
+
+	BENCH_TIME(t, runs, jsk_u64 x = 0,
+		for (unsigned r = 0; r < REPS; r++)
+			for (unsigned i = 0; i < NKEYS; i++)
+				x ^= JSK_HASH_LEN(keys[i], lens[i]),
+		sink = (double)x);
+	report("hash", t, runs, NKEYS * REPS, 0, 1e9);
+
+	BENCH_TIME(t, runs, unsigned long long x = 0,
+		for (unsigned r = 0; r < REPS; r++)
+			for (unsigned i = 0; i < NKEYS; i++)
+				x += jsk_object_get(obj, keys[i]) != NULL,
+		sink = (double)x);
+	report("object_get/hit", t, runs, NKEYS * REPS, 0, 1e9);
+
+	BENCH_TIME(t, runs, unsigned long long x = 0,
+		for (unsigned r = 0; r < REPS; r++)
+			for (unsigned i = 0; i < NKEYS; i++)
+				x += jsk_object_get(obj, misses[i]) != NULL,
+		sink = (double)x);
+	report("object_get/miss", t, runs, NKEYS * REPS, 0, 1e9);
+
+	jsk_heap_free(h);
+
+	enum { NPUSH = 1 << 20 };
+	BENCH_TIME(t, runs,
+		jsk_heap *a = jsk_heap_new(NULL);
+		jsk_value arr = jsk_new_array(),
+		for (unsigned i = 0; i < NPUSH; i++)
+			jsk_array_push(a, &arr, jsk_new_int(i)),
+		sink = jsk_array_length(arr);
+		jsk_heap_free(a));
+	report("array_push", t, runs, NPUSH, 0, 1e9);
+
+	BENCH_TIME(t, runs, jsk_heap *a = jsk_heap_new(NULL),
+		for (unsigned i = 0; i < NPUSH; i++)
+			sink = (double)(size_t)jsk_heap_alloc(a, 24,
+				JSK_VALUE_ALIGN),
+		jsk_heap_free(a));
+	report("heap_alloc", t, runs, NPUSH, 0, 1e9);
+
+	/* Strings as the lexer hands them over, and as they come back out */
+	b.len = 0;
+	while (b.len < 1 << 16)
+		buf_printf(&b, "%s ",
+				words[rng(sizeof(words) / sizeof(words[0]))]);
+	BENCH_TIME(t, runs, jsk_heap *a = jsk_heap_new(NULL),
+		jsk_value v = jsk_new_string_escaped(a, b.data, b.len),
+		sink = v.type;
+		jsk_heap_free(a));
+	report("unescape", t, runs, b.len, b.len, 1e9);
+
+	h = jsk_heap_new(NULL);
+	const jsk_value text = jsk_new_string_escaped(h, b.data, b.len);
+	const char *const raw = jsk_get_string(text);
+	const size_t raw_len = strlen(raw);
+	BENCH_TIME(t, runs, jsk_heap *a = jsk_heap_new(NULL),
+		sink = jsk_write_escaped(a, raw, raw_len, 0),
+		jsk_heap_free(a));
+	report("escape", t, runs, raw_len, raw_len, 1e9);
+	jsk_heap_free(h);
+
+	/* A compiled query against the same walk by hand, per status */
+	b.len = 0;
+	gen_twitter(&b, 1 << 20);
+	h = jsk_heap_new(NULL);
+	const jsk_value doc = jsk_parse(h, b.data, b.len).data.value;
+	const unsigned statuses = jsk_array_length(
+			*jsk_object_get(doc, "statuses"));
+	const jsk_query *q = jsk_query_compile(h, QUERY_EXPR, NULL);
+	if (!q || jsk_array_length(jsk_query_eval(h, q, doc)) !=
+			jsk_array_length(query_by_hand(h, doc)))
+		die("Query benchmark is broken");
+
+	BENCH_TIME(t, runs, jsk_heap *a = jsk_heap_new(NULL),
+		sink = jsk_array_length(jsk_query_eval(a, q, doc)),
+		jsk_heap_free(a));
+	report("query/compiled", t, runs, statuses, 0, 1e9);
+
+	BENCH_TIME(t, runs, jsk_heap *a = jsk_heap_new(NULL),
+		sink = jsk_array_length(query_by_hand(a, doc)),
+		jsk_heap_free(a));
+	report("query/hand", t, runs, statuses, 0, 1e9);
+
+	BENCH_TIME(t, runs, jsk_heap *a = jsk_heap_new(NULL),
+		sink = jsk_query_compile(a, QUERY_EXPR, NULL) != NULL,
+		jsk_heap_free(a));
+	report("query/compile", t, runs, 1, 0, 1e9);
+	jsk_heap_free(h);
+
+	printf("\n");
+	free(b.data);
+}
+
+static int read_file(const char *const filename, bench_corpus *c)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		return 1;
+
+	fseek(f, 0, SEEK_END);
+	const long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	c->name = filename;
+	c->json = (char *)malloc(length + 1);
+	c->len = length;
+	c->ndjson = 0;
+
+	const int err = !c->json || fread(c->json, 1, length, f) !=
+		(size_t)length;
+	fclose(f);
+	return err;
+}
+
+static int write_results(const char *const filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f)
+		return 1;
+
+	fprintf(f, "{\n");
+	for (unsigned i = 0; i < result_count; i++) {
+		const bench_result *r = &results[i];
+		fprintf(f, "\t\"%s\": { \"median_ns\": %.3f, "
+				"\"p99_ns\": %.3f, \"rate\": %.6f }%s\n",
+				r->name, r->median_ns, r->p99_ns, r->rate,
+				i + 1 < result_count ? "," : "");
+	}
+	fprintf(f, "}\n");
+
+	return fclose(f) != 0;
+}
+
+/* Returns the number of results slower than the baseline by over threshold */
+static int compare_results(const char *const filename, double threshold)
+{
+	bench_corpus c;
+	if (read_file(filename, &c)) {
+		fprintf(stderr, "Couldn't read baseline '%s'\n", filename);
+		exit(1);
+	}
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_result res = jsk_parse(h, c.json, c.len);
+	if (res.status != JSK_OK || res.data.value.type != JSK_OBJECT) {
+		fprintf(stderr, "Invalid baseline '%s'\n", filename);
+		exit(1);
+	}
+
+	printf("Against %s (threshold %.1f%%):\n", filename, threshold);
+
+	int regressions = 0;
+	for (unsigned i = 0; i < result_count; i++) {
+		const bench_result *r = &results[i];
+		jsk_value *e = jsk_object_get(res.data.value, r->name);
+		jsk_value *m = e && e->type == JSK_OBJECT ?
+			jsk_object_get(*e, "median_ns") : NULL;
+		if (!m || (m->type != JSK_FLOAT && m->type != JSK_INT))
+			continue;
+
+		const double base = m->type == JSK_FLOAT ?
+			jsk_get_float_p(m) : (double)jsk_get_int_p(m);
+		const double change = (r->median_ns / base - 1.0) * 100.0;
+		const int slower = change > threshold;
+		regressions += slower;
+
+		printf("%-22s %14.3f %14.3f %+7.1f%%%s\n", r->name, base,
+				r->median_ns, change,
+				slower ? "  REGRESSION" : "");
+	}
+
+	jsk_heap_free(h);
+	free(c.json);
+	return regressions;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned runs = 20;
+	size_t size = 4 << 20;
+	int micro_only = 0;
+	const char *output = NULL, *baseline = NULL;
+	double threshold = 10.0;
+	int first_file = argc;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			size = (size_t)(atof(argv[++i]) * (1 << 20));
+		} else if (!strcmp(argv[i], "-m")) {
+			micro_only = 1;
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			output = argv[++i];
+		} else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			baseline = argv[++i];
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else {
+			first_file = i;
+			break;
+		}
+	}
+
+	if (runs < 1 || runs > BENCH_MAX_RUNS)
+		die("Runs must be between 1 and 1000");
+
+	bench_micro(runs);
+
+	static const struct {
+		const char *name;
+		void (*gen)(bench_buf *, size_t);
+		int ndjson;
+	} gens[] = {
+		{ "twitter", gen_twitter, 0 },
+		{ "canada", gen_canada, 0 },
+		{ "citm", gen_citm, 0 },
+		{ "ndjson", gen_ndjson, 1 },
+		{ "deep", gen_deep, 0 },
+	};
+
+	if (!micro_only) {
+		printf("%-22s %12s %12s %9s\n", "corpus/op", "median ms",
+				"p99 ms", "rate");
+
+		for (unsigned i = 0; i < sizeof(gens) / sizeof(gens[0]); i++) {
+			bench_buf b = { NULL, 0, 0 };
+			gens[i].gen(&b, size);
+			const bench_corpus c = { gens[i].name, b.data, b.len,
+				gens[i].ndjson };
+			bench_corpus_run(&c, runs);
+			free(b.data);
+		}
+
+		for (int i = first_file; i < argc; i++) {
+			bench_corpus c;
+			if (read_file(argv[i], &c)) {
+				fprintf(stderr, "Couldn't read file '%s'\n",
+						argv[i]);
+				return 1;
+			}
+			bench_corpus_run(&c, runs);
+			free(c.json);
+		}
+	}
+
+	if (output && write_results(output)) {
+		fprintf(stderr, "Couldn't write results to '%s'\n", output);
+		return 1;
+	}
+
+	return baseline && compare_results(baseline, threshold) ? 2 : 0;
+}
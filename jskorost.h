@@ -21,9 +21,18 @@
  * COMPILE-TIME CONFIGURATION:
  *  - JSKOROST_IMPLEMENTATION
  *  - JSK_HASH
+ *  - JSK_HASH_LEN (must agree with JSK_HASH)
+ *  - JSK_SEEDED_HASH
  *  - JSK_LOAD_FACTOR
  *  - JSK_DEFAULT_ARRAY_SIZE
- *  - JSK_DEFAULT_OBJECT_SIZE
+ *  - JSK_DEFAULT_OBJECT_SIZE (a power of two)
+ *  - JSK_DOM_STACK_SIZE
+ *  - JSK_NDJSON_BATCH
+ *  - JSK_PARALLEL_MIN_PART
+ *  - JSK_POINTER_MAX_SEGMENT
+ *  - JSK_VALIDATE_MAX_DEPTH
+ *  - JSK_BINARY_MAX_DEPTH
+ *  - JSK_QUERY_MAX_STACK
  *  - JSK_HEAP_CHUNK_SIZE
  *  - JSK_HEAP_MIN_OVERSIZED
  *  - JSK_RESTRICT
@@ -31,6 +40,9 @@
  *  - JSK_FREE
  *  - JSK_EXPORT
  *  - JSK_NO_STDLIB
+ *  - JSK_NO_SIMD
+ *  - JSK_THREADS
+ *  - JSK_PARSE_STATS
  *  - JSK_DEBUG
  *  - JSK_DEBUG_VERBOSE
  *  - JSK_DEBUG_ALLOC
@@ -53,11 +65,11 @@
 #endif
 
 #ifndef JSK_MALLOC
-#define JSK_MALLOC(ctx, bytes) malloc(bytes)
+#define JSK_MALLOC(ctx, bytes) ((void)(ctx), malloc(bytes))
 #endif
 
 #ifndef JSK_FREE
-#define JSK_FREE(ctx, ptr) free(ptr)
+#define JSK_FREE(ctx, ptr) ((void)(ctx), free(ptr))
 #endif
 
 #ifndef JSK_EXPORT
@@ -65,7 +77,17 @@
 #endif
 
 #ifndef JSK_HASH
+#ifdef JSK_SEEDED_HASH
+#define JSK_HASH(s) jsk_hash_seeded(s, strlen(s))
+#define JSK_HASH_LEN(s, len) jsk_hash_seeded(s, len)
+#else
 #define JSK_HASH(s) jsk_hash(s)
+#define JSK_KEY_FNV1A
+#endif
+#endif
+
+#ifndef JSK_HASH_LEN
+#define JSK_HASH_LEN(s, len) jsk_hash_len(s, len)
 #endif
 
 #ifndef JSK_LOAD_FACTOR
@@ -80,6 +102,34 @@
 #define JSK_DEFAULT_OBJECT_SIZE 16
 #endif
 
+#ifndef JSK_NDJSON_BATCH
+#define JSK_NDJSON_BATCH (1 << 20)
+#endif
+
+#ifndef JSK_PARALLEL_MIN_PART
+#define JSK_PARALLEL_MIN_PART (1 << 20)
+#endif
+
+#ifndef JSK_POINTER_MAX_SEGMENT
+#define JSK_POINTER_MAX_SEGMENT 256
+#endif
+
+#ifndef JSK_VALIDATE_MAX_DEPTH
+#define JSK_VALIDATE_MAX_DEPTH 1024
+#endif
+
+#ifndef JSK_BINARY_MAX_DEPTH
+#define JSK_BINARY_MAX_DEPTH 1024
+#endif
+
+#ifndef JSK_QUERY_MAX_STACK
+#define JSK_QUERY_MAX_STACK 32
+#endif
+
+#ifndef JSK_DOM_STACK_SIZE
+#define JSK_DOM_STACK_SIZE 32
+#endif
+
 #define JSK_VALUE_ALIGN 8
 
 #ifdef JSK_DEBUG_VERBOSE
@@ -107,6 +157,24 @@ typedef struct jsk_oversized {
 	char data[];
 } jsk_oversized;
 
+/*
+ * Counters kept by the parser when JSK_PARSE_STATS is defined. Each heap
+ * accumulates them over every parse into it.
+ */
+typedef struct jsk_parse_stats {
+	unsigned long long nulls;
+	unsigned long long booleans;
+	unsigned long long integers;
+	unsigned long long floats;
+	unsigned long long strings;
+	unsigned long long keys;
+	unsigned long long objects;
+	unsigned long long arrays;
+	unsigned long long numbers; /* Kept as text by lazy_numbers */
+	unsigned long long rehashes;
+	unsigned max_depth;
+} jsk_parse_stats;
+
 typedef struct jsk_heap {
 	struct jsk_heap *next;
 	struct jsk_heap *head;
@@ -115,12 +183,43 @@ typedef struct jsk_heap {
 	unsigned ptr;
 	char *chunk;
 	jsk_oversized *oversized;
+	/* The rest is only kept up to date on the head */
+	unsigned long long bytes; /* Taken from JSK_MALLOC */
+	unsigned long long limit; /* Cap on bytes, 0 for none */
+	unsigned long long oversized_bytes;
+	unsigned oversized_count;
+	unsigned long long padding;
+	unsigned long long abandoned;
+#ifdef JSK_PARSE_STATS
+	jsk_parse_stats parse;
+#endif
 } jsk_heap;
 
 JSK_EXPORT jsk_heap *jsk_heap_new(void *ctx);
 JSK_EXPORT void jsk_heap_free(jsk_heap *h);
 JSK_EXPORT void *jsk_heap_alloc(jsk_heap *h, unsigned bytes, unsigned align);
 
+/*
+ * Where a heap's memory went. Reserved is what was taken from JSK_MALLOC for
+ * chunks and oversized allocations, and used is what was handed out of it,
+ * including alignment padding; the difference is left at the ends of
+ * chunks. Abandoned counts the buffers left behind when arrays, object
+ * tables and the DOM builder's stack outgrow them. The parse counters are
+ * only filled in when JSK_PARSE_STATS is defined.
+ */
+typedef struct jsk_heap_stats {
+	unsigned chunks;
+	unsigned long long reserved;
+	unsigned long long used;
+	unsigned oversized_count;
+	unsigned long long oversized_bytes;
+	unsigned long long padding;
+	unsigned long long abandoned;
+	jsk_parse_stats parse;
+} jsk_heap_stats;
+
+JSK_EXPORT void jsk_heap_get_stats(const jsk_heap *h, jsk_heap_stats *stats);
+
 typedef enum jsk_type {
 	JSK_OBJECT,
 	JSK_ARRAY,
@@ -129,6 +228,9 @@ typedef enum jsk_type {
 	JSK_FLOAT,
 	JSK_BOOL,
 	JSK_NULL,
+	JSK_NUMBER,
+	JSK_INT_ARRAY,
+	JSK_FLOAT_ARRAY,
 } jsk_type;
 
 typedef struct jsk_value {
@@ -161,8 +263,41 @@ typedef struct jsk_object_iter {
 JSK_EXPORT jsk_value jsk_new_int(long long v);
 JSK_EXPORT jsk_value jsk_new_float(double f);
 
+/*
+ * Numbers parsed with the lazy_numbers option are kept as their JSON text,
+ * with type JSK_NUMBER, and only converted when they are read. jsk_as_int()
+ * and jsk_as_float() accept any of the three number types, and
+ * jsk_number_value() turns a JSK_NUMBER into JSK_INT, or JSK_FLOAT if it
+ * has a fraction, an exponent or doesn't fit in a long long. The conversion
+ * is the parser's own, so it doesn't depend on the locale, and it is cached
+ * with atomic stores, so a lazy tree can be read from several threads at
+ * once. jsk_to_string() writes the text back verbatim, so big integers and
+ * long decimals pass through exactly. jsk_new_number() takes text that must
+ * already be a valid JSON number.
+ */
+typedef struct jsk_number {
+	union {
+		long long i;
+		double f;
+		jsk_u64 bits;
+	} cached;
+	jsk_type type;
+	char text[];
+} jsk_number;
+
+#define jsk_get_number(v) (((jsk_number *)(v).value)->text)
+#define jsk_get_number_p(v) (((jsk_number *)(v)->value)->text)
+
+JSK_EXPORT jsk_value jsk_new_number(jsk_heap *h, const char *const s,
+		unsigned len);
+JSK_EXPORT jsk_value jsk_number_value(jsk_value v);
+JSK_EXPORT long long jsk_as_int(jsk_value v);
+JSK_EXPORT double jsk_as_float(jsk_value v);
+
 JSK_EXPORT jsk_value jsk_new_string_escaped(jsk_heap *h, const char *const s,
 		unsigned len);
+JSK_EXPORT unsigned jsk_unescape_string(char *JSK_RESTRICT dest,
+		const char *JSK_RESTRICT s, unsigned len);
 JSK_EXPORT jsk_value jsk_new_string_len(jsk_heap *h, const char *const s,
 		unsigned len);
 JSK_EXPORT jsk_value jsk_new_string(jsk_heap *h, const char *const s);
@@ -171,6 +306,35 @@ JSK_EXPORT jsk_value jsk_new_object(jsk_heap *h);
 JSK_EXPORT void jsk_object_insert(jsk_value *object,
 		const char *const name, jsk_value value);
 JSK_EXPORT jsk_value *jsk_object_get(jsk_value object, const char *const name);
+JSK_EXPORT jsk_value *jsk_object_get_len(jsk_value object,
+		const char *const name, unsigned len);
+
+/*
+ * A key name with its hash worked out ahead of time, for names that are looked
+ * up over and over. The name isn't copied and needn't be NUL-terminated.
+ * JSK_KEY_FNV1A is defined while JSK_HASH is the default, in which case keys
+ * can also be built at compile time (see jsk::key in jskorost.hpp).
+ */
+typedef struct jsk_key {
+	const char *name;
+	unsigned len;
+	jsk_u64 hash;
+} jsk_key;
+
+JSK_EXPORT jsk_key jsk_key_make(const char *const name);
+JSK_EXPORT jsk_key jsk_key_make_len(const char *const name, unsigned len);
+JSK_EXPORT jsk_value *jsk_object_get_key(jsk_value object,
+		const jsk_key *key);
+
+/*
+ * Object keys are hashed with unseeded FNV-1a by default, which lets jsk_key
+ * hashes be compile-time constants but lets anyone who can choose the keys
+ * make them collide. Defining JSK_SEEDED_HASH switches to wyhash with a
+ * per-process seed, read from /dev/urandom on first use. jsk_hash_seed()
+ * replaces the seed; it must be called before any object or jsk_key is made.
+ */
+JSK_EXPORT void jsk_hash_seed(jsk_u64 seed);
+
 JSK_EXPORT jsk_object_iter jsk_object_iterate(jsk_value object);
 JSK_EXPORT jsk_object_entry *jsk_object_next(jsk_object_iter *i);
 
@@ -193,9 +357,29 @@ JSK_EXPORT unsigned jsk_array_length(jsk_value array);
 JSK_EXPORT void jsk_array_push(jsk_heap *h, jsk_value *array, jsk_value value);
 #define jsk_array_at(a, i) (((jsk_value *)((a).value))[i])
 
+/*
+ * With the pack_arrays parse option, arrays of nothing but integers or
+ * floats are stored packed as JSK_INT_ARRAY or JSK_FLOAT_ARRAY, eight bytes
+ * per element. The first element of another type, including a float in an
+ * int array or an int in a float one, unpacks the array into a JSK_ARRAY so
+ * that every element keeps its type. jsk_array_i64_data() and
+ * jsk_array_f64_data() return the elements of a packed array, storing the
+ * length in len, and NULL for anything else. jsk_array_length(),
+ * jsk_array_get() and jsk_array_push() work on every kind of array, but
+ * jsk_array_at() only on JSK_ARRAY.
+ */
+#define jsk_is_array(v) ((v).type == JSK_ARRAY ||			\
+		(v).type == JSK_INT_ARRAY || (v).type == JSK_FLOAT_ARRAY)
+
+JSK_EXPORT jsk_value jsk_array_get(jsk_value array, unsigned i);
+JSK_EXPORT long long *jsk_array_i64_data(jsk_value array, unsigned *len);
+JSK_EXPORT double *jsk_array_f64_data(jsk_value array, unsigned *len);
+
 typedef enum jsk_status {
 	JSK_OK,
 	JSK_ERROR,
+	JSK_LIMIT,
+	JSK_SCHEMA,
 } jsk_status;
 
 typedef struct jsk_result {
@@ -211,6 +395,455 @@ JSK_EXPORT jsk_result jsk_parse(jsk_heap *heap,
 		const char *const json, unsigned len);
 JSK_EXPORT char *jsk_to_string(jsk_heap *heap, jsk_value v);
 
+/*
+ * Like jsk_to_string(), but characters outside ASCII are written as \uXXXX
+ * escapes (surrogate pairs above U+FFFF), so the output is plain ASCII.
+ */
+JSK_EXPORT char *jsk_to_string_ascii(jsk_heap *heap, jsk_value v);
+
+/*
+ * jsk_clone() deep-copies a value into another heap, sizing every array and
+ * object table to fit its contents; it returns null if the heap runs out of
+ * memory. Mutating a tree leaves the buffers that arrays and objects outgrow
+ * behind in its heap, so jsk_compact() clones v into a fresh heap with the
+ * same allocator context, frees the old heap and updates both pointers. On
+ * failure the old heap and value are left untouched.
+ */
+JSK_EXPORT jsk_value jsk_clone(jsk_heap *h, jsk_value v);
+JSK_EXPORT jsk_status jsk_compact(jsk_heap **heap, jsk_value *v);
+
+/*
+ * SAX-style interface: the parser reports each value to the handler as it is
+ * lexed instead of building a tree. String and key callbacks receive the raw
+ * span from the input, still escaped (see jsk_new_string_escaped). Any
+ * callback may be NULL; returning non-zero from a callback aborts the parse.
+ * The heap is only used for error messages. With the lazy_numbers option the
+ * number callback gets the raw text of each number instead; if it is NULL the
+ * text is converted and passed to integer or floating as usual.
+ */
+typedef struct jsk_handler {
+	int (*null)(void *user);
+	int (*boolean)(void *user, int value);
+	int (*integer)(void *user, long long value);
+	int (*floating)(void *user, double value);
+	int (*string)(void *user, const char *s, unsigned len);
+	int (*key)(void *user, const char *s, unsigned len);
+	int (*start_object)(void *user);
+	int (*end_object)(void *user, unsigned count);
+	int (*start_array)(void *user);
+	int (*end_array)(void *user, unsigned count);
+	int (*number)(void *user, const char *s, unsigned len);
+} jsk_handler;
+
+JSK_EXPORT jsk_result jsk_parse_sax(jsk_heap *heap,
+		const char *const json, unsigned len,
+		const jsk_handler *handler, void *user);
+
+/*
+ * Resource budgets for untrusted input. A zero field means no limit. Going
+ * over any of them stops the parse at once with status JSK_LIMIT and an error
+ * naming the limit and the input index. Lengths are in bytes of the raw
+ * input, so escapes count as written. max_heap_bytes caps the memory the
+ * heap takes from JSK_MALLOC while the document is built (allocation is in
+ * whole chunks, see JSK_HEAP_CHUNK_SIZE) and only applies to jsk_parse_opts().
+ *
+ * Setting lazy_numbers keeps numbers as text (see jsk_number), checking them
+ * against the strict JSON grammar instead of converting them as they're lexed.
+ * Setting pack_arrays stores numeric arrays packed (see jsk_array_f64_data).
+ * Setting schema validates the document as it is parsed (see jsk_schema).
+ */
+typedef struct jsk_parse_options {
+	unsigned max_depth;
+	unsigned max_string_length;
+	unsigned max_elements;
+	unsigned max_number_length;
+	unsigned long long max_heap_bytes;
+	int lazy_numbers;
+	int pack_arrays;
+	const struct jsk_schema *schema;
+} jsk_parse_options;
+
+JSK_EXPORT jsk_result jsk_parse_opts(jsk_heap *heap,
+		const char *const json, unsigned len,
+		const jsk_parse_options *opts);
+JSK_EXPORT jsk_result jsk_parse_sax_opts(jsk_heap *heap,
+		const char *const json, unsigned len,
+		const jsk_handler *handler, void *user,
+		const jsk_parse_options *opts);
+
+/*
+ * JSON Schema validation fused into the parse. jsk_schema_compile() turns a
+ * parsed schema into a table of nodes; with it set in jsk_parse_options, the
+ * parse stops at the first violation with status JSK_SCHEMA and an error
+ * giving the reason and input index. Subtrees the schema doesn't constrain
+ * are parsed without any checking.
+ *
+ * Supported keywords are type, enum, const, minimum, maximum,
+ * exclusiveMinimum, exclusiveMaximum, minLength, maxLength (in code points),
+ * minItems, maxItems, minProperties, maxProperties, required (at most 64 keys
+ * per object), properties, additionalProperties and single-schema items, plus
+ * true and false schemas. Annotations such as title are ignored; any other
+ * keyword fails compilation, storing a message in error. Property names are
+ * matched after unescaping, so an escaped key can't dodge its schema. The
+ * compiled schema lives on the heap and doesn't refer back to the schema
+ * value.
+ */
+typedef struct jsk_schema_node {
+	unsigned types;
+	unsigned bounds;
+	double minimum;
+	double maximum;
+	double exclusive_minimum;
+	double exclusive_maximum;
+	unsigned min_length;
+	unsigned max_length;
+	unsigned min_items;
+	unsigned max_items;
+	unsigned min_properties;
+	unsigned max_properties;
+	jsk_value enums;
+	jsk_value properties;
+	const char **required;
+	unsigned required_count;
+	unsigned additional;
+	unsigned items;
+} jsk_schema_node;
+
+typedef struct jsk_schema {
+	jsk_schema_node *nodes;
+	unsigned count;
+	unsigned root;
+	unsigned depth;
+} jsk_schema;
+
+JSK_EXPORT jsk_schema *jsk_schema_compile(jsk_heap *h, jsk_value schema,
+		char **error);
+
+/*
+ * Checks that the input is exactly one well-formed JSON document (strict
+ * number grammar, no control characters in strings, valid escapes and UTF-8)
+ * without allocating. On failure the offset of the offending byte is stored
+ * in error_offset if it isn't NULL.
+ */
+JSK_EXPORT jsk_status jsk_validate(const char *const json,
+		unsigned long long len, unsigned long long *error_offset);
+
+/*
+ * String scanning, UTF-8 validation and escaping use SIMD kernels picked on
+ * first use from what the CPU supports (x86 only; elsewhere they are scalar).
+ * The JSK_SIMD environment variable ("scalar", "sse4.2", "avx2" or "avx512")
+ * caps the choice, and jsk_simd_set() overrides it at any time, which is mostly
+ * useful for testing each path. Levels the CPU lacks are clamped down, and both
+ * functions return the level in use.
+ */
+typedef enum jsk_simd_level {
+	JSK_SIMD_SCALAR,
+	JSK_SIMD_SSE42,
+	JSK_SIMD_AVX2,
+	JSK_SIMD_AVX512,
+} jsk_simd_level;
+
+JSK_EXPORT jsk_simd_level jsk_simd_get(void);
+JSK_EXPORT jsk_simd_level jsk_simd_set(jsk_simd_level level);
+
+/*
+ * Multi-document input (NDJSON / JSON Lines, or any whitespace separated
+ * sequence of values). jsk_stream_next() returns 0 once the input is
+ * exhausted. After a document fails to parse the stream skips to the start of
+ * the next line, so one bad record doesn't lose the rest.
+ */
+typedef struct jsk_stream {
+	jsk_heap *heap;
+	const char *json;
+	unsigned long long len;
+	unsigned long long ptr;
+} jsk_stream;
+
+JSK_EXPORT jsk_stream jsk_stream_new(jsk_heap *heap,
+		const char *const json, unsigned long long len);
+JSK_EXPORT int jsk_stream_next(jsk_stream *s, jsk_result *res);
+
+/*
+ * On-demand access: a cursor points at a value in the input text and nothing
+ * is parsed until it is asked for. Iteration and field lookup step over
+ * untouched members by bracket matching, so only what is read pays for
+ * lexing; skipped values are not validated. Object keys are compared as they
+ * appear in the input, without unescaping.
+ */
+typedef struct jsk_cursor {
+	const char *json;
+	unsigned long long len;
+	unsigned long long ptr;
+} jsk_cursor;
+
+typedef struct jsk_cursor_iter {
+	const char *json;
+	unsigned long long len;
+	unsigned long long ptr;
+	jsk_status status;
+	int first;
+} jsk_cursor_iter;
+
+JSK_EXPORT jsk_cursor jsk_cursor_new(const char *const json,
+		unsigned long long len);
+JSK_EXPORT jsk_status jsk_cursor_type(jsk_cursor c, jsk_type *type);
+JSK_EXPORT jsk_status jsk_cursor_get_int(jsk_cursor c, long long *v);
+JSK_EXPORT jsk_status jsk_cursor_get_float(jsk_cursor c, double *v);
+JSK_EXPORT jsk_status jsk_cursor_get_bool(jsk_cursor c, int *v);
+JSK_EXPORT int jsk_cursor_is_null(jsk_cursor c);
+JSK_EXPORT jsk_status jsk_cursor_get_raw_string(jsk_cursor c,
+		const char **s, unsigned *len);
+JSK_EXPORT jsk_status jsk_cursor_get_string(jsk_heap *h, jsk_cursor c,
+		char **s);
+JSK_EXPORT jsk_result jsk_cursor_value(jsk_heap *h, jsk_cursor c);
+JSK_EXPORT jsk_status jsk_cursor_find_field(jsk_cursor object,
+		const char *const name, jsk_cursor *value);
+JSK_EXPORT jsk_status jsk_cursor_at(jsk_cursor array, unsigned index,
+		jsk_cursor *value);
+JSK_EXPORT jsk_cursor_iter jsk_cursor_iterate(jsk_cursor c);
+JSK_EXPORT int jsk_cursor_next(jsk_cursor_iter *i, jsk_cursor *value);
+JSK_EXPORT int jsk_cursor_next_field(jsk_cursor_iter *i,
+		const char **key, unsigned *len, jsk_cursor *value);
+
+/*
+ * Extracts the values at a set of JSON Pointers (RFC 6901) without building
+ * the rest of the document. The pointers are compiled into a trie that is
+ * walked alongside a cursor, so subtrees no pointer descends into are skipped
+ * without allocating, and scanning stops once every pointer has matched. The
+ * result is an array with one entry per pointer, in order; pointers that
+ * match nothing yield null. When a key repeats, the first occurrence wins, as
+ * with jsk_object_get(). A matcher can be compiled once and reused.
+ */
+typedef struct jsk_pointer_node {
+	const char *segment;
+	unsigned len;
+	long long index;
+	int target;
+	struct jsk_pointer_node *child;
+	struct jsk_pointer_node *sibling;
+} jsk_pointer_node;
+
+typedef struct jsk_matcher {
+	jsk_pointer_node root;
+	unsigned count;
+	unsigned targets;
+	unsigned *slots;
+} jsk_matcher;
+
+JSK_EXPORT jsk_matcher *jsk_matcher_compile(jsk_heap *h,
+		const char *const *paths, unsigned n);
+JSK_EXPORT jsk_result jsk_extract_matcher(jsk_heap *h,
+		const jsk_matcher *m, const char *const json, unsigned len);
+JSK_EXPORT jsk_result jsk_extract(jsk_heap *h, const char *const json,
+		unsigned len, const char *const *paths, unsigned n);
+
+/*
+ * Binary snapshots: jsk_save_binary() writes a value tree into a single
+ * position-independent image (offsets from the start of the image instead of
+ * pointers) allocated with JSK_MALLOC, and jsk_load_binary() checks such an
+ * image and returns a view of its root. Images can be written to disk and
+ * mmap'd back; views read them in place without parsing. Loading walks the
+ * whole image once to check that every offset and length stays inside it, so
+ * a truncated or corrupted image is rejected rather than read out of bounds.
+ * Images are only portable between machines with the same byte order.
+ * jsk_bin_to_value() copies a view into a value tree on the heap, returning
+ * JSK_ERROR if the heap is exhausted.
+ */
+typedef struct jsk_bin_node {
+	unsigned type;
+	unsigned count;
+	jsk_u64 payload;
+} jsk_bin_node;
+
+typedef struct jsk_bin_entry {
+	jsk_u64 hash;
+	jsk_u64 key;
+	unsigned key_len;
+	unsigned reserved;
+	jsk_bin_node value;
+} jsk_bin_entry;
+
+typedef struct jsk_image_header {
+	char magic[4];
+	unsigned version;
+	unsigned bom;
+	unsigned reserved;
+	jsk_u64 size;
+	jsk_bin_node root;
+} jsk_image_header;
+
+typedef struct jsk_bin_value {
+	const char *base;
+	const jsk_bin_node *node;
+} jsk_bin_value;
+
+JSK_EXPORT void *jsk_save_binary(jsk_heap *h, jsk_value v,
+		unsigned long long *size);
+JSK_EXPORT jsk_status jsk_load_binary(const void *image,
+		unsigned long long size, jsk_bin_value *root);
+JSK_EXPORT jsk_status jsk_bin_object_get(jsk_bin_value object,
+		const char *const name, jsk_bin_value *value);
+JSK_EXPORT int jsk_bin_object_next(jsk_bin_value object, unsigned *bucket,
+		const char **key, jsk_bin_value *value);
+JSK_EXPORT jsk_status jsk_bin_to_value(jsk_heap *h, jsk_bin_value v,
+		jsk_value *out);
+
+#define jsk_bin_type(v) ((jsk_type)(v).node->type)
+#define jsk_bin_length(v) ((v).node->count)
+#define jsk_bin_get_bool(v) ((int)(v).node->payload)
+#define jsk_bin_get_int(v) (*(const long long *)&(v).node->payload)
+#define jsk_bin_get_float(v) (*(const double *)&(v).node->payload)
+#define jsk_bin_get_string(v) ((v).base + (v).node->payload)
+#define jsk_bin_at(v, i) ((jsk_bin_value){ (v).base,			\
+	&((const jsk_bin_node *)((v).base + (v).node->payload))[i] })
+
+/*
+ * CBOR (RFC 8949) and MessagePack. The encoders return a buffer allocated with
+ * JSK_MALLOC and store its length in size; the decoders build a tree on the
+ * heap just like jsk_parse(). Byte strings are decoded as text, tags are
+ * dropped and undefined becomes null; MessagePack extension types are
+ * rejected. Map keys must be strings.
+ *
+ * jsk_json_to_cbor() and jsk_cbor_to_json() transcode without building a tree
+ * in between. On success the result holds null and the output (JSK_MALLOC'd,
+ * NUL-terminated in the JSON case) is stored through the last arguments.
+ */
+JSK_EXPORT void *jsk_to_cbor(jsk_heap *h, jsk_value v,
+		unsigned long long *size);
+JSK_EXPORT void *jsk_to_msgpack(jsk_heap *h, jsk_value v,
+		unsigned long long *size);
+JSK_EXPORT jsk_result jsk_parse_cbor(jsk_heap *heap, const void *data,
+		unsigned long long size);
+JSK_EXPORT jsk_result jsk_parse_msgpack(jsk_heap *heap, const void *data,
+		unsigned long long size);
+JSK_EXPORT jsk_result jsk_json_to_cbor(jsk_heap *h, const char *const json,
+		unsigned len, void **cbor, unsigned long long *size);
+JSK_EXPORT jsk_result jsk_cbor_to_json(jsk_heap *h, const void *cbor,
+		unsigned long long size, char **json);
+
+/*
+ * Columnar shredding: turns records, either one array of objects or a
+ * sequence of objects such as NDJSON, straight into one column per key
+ * without building the records. Each column has a validity bitmap (bit i of
+ * byte i / 8 is set if row i has a non-null value) and, depending on type,
+ * rows values in values.i, values.f or values.b (one byte per bool), or rows
+ * + 1 offsets into data for strings, which are unescaped and not
+ * NUL-terminated. Null rows hold zero or an empty string.
+ *
+ * A column takes its type from its first non-null value. Integers are
+ * converted in a float column, and the first float turns an integer column
+ * into a float one; any other mix of types is an error, as are nested objects
+ * or arrays. Keys missing from a record are null, and a repeated key keeps its
+ * first non-null value. Everything is allocated on the heap. On success the
+ * result holds null; opts may be NULL.
+ */
+typedef struct jsk_column {
+	const char *name;
+	jsk_type type;
+	unsigned null_count;
+	unsigned char *validity;
+	union {
+		long long *i;
+		double *f;
+		unsigned char *b;
+	} values;
+	unsigned *offsets;
+	char *data;
+} jsk_column;
+
+typedef struct jsk_columns {
+	unsigned rows;
+	unsigned count;
+	jsk_column *columns;
+} jsk_columns;
+
+JSK_EXPORT jsk_result jsk_shred(jsk_heap *h, const char *const json,
+		unsigned len, const jsk_parse_options *opts,
+		jsk_columns *columns);
+
+#define jsk_column_is_valid(c, i) (((c)->validity[(i) / 8] >> ((i) % 8)) & 1)
+
+/*
+ * Compiled queries over value trees, in a subset of JMESPath: identifiers
+ * (bare or "quoted") joined by '.', [n] indexes counting back from the end
+ * when negative, [*] and .* projections, [?cond] filters and [], which
+ * flattens the result of everything before it and projects what follows.
+ * A condition compares paths relative to the element, such as @ or a.b[0],
+ * with literals ('raw string' or `json`) using == != < <= > >=, and combines
+ * the results with && || ! and parentheses. As in JMESPath, a projection
+ * applies the rest of the expression to each element and drops null results,
+ * ordering only holds between numbers and missing values are null.
+ *
+ * jsk_query_compile() turns an expression into bytecode on the heap, hashing
+ * every key up front, or returns NULL and stores a message in error.
+ * jsk_query_eval() allocates nothing but the arrays that projections build,
+ * on h; other results point into the tree. Keys are matched as they appear in
+ * the input, without unescaping.
+ */
+typedef enum jsk_query_opcode {
+	JSK_QUERY_FIELD,
+	JSK_QUERY_INDEX,
+	JSK_QUERY_PROJECT,
+	JSK_QUERY_VALUES,
+	JSK_QUERY_FLATTEN,
+	JSK_QUERY_FILTER,
+	JSK_QUERY_SELF,
+	JSK_QUERY_PUSH,
+	JSK_QUERY_LITERAL,
+	JSK_QUERY_COMPARE,
+	JSK_QUERY_NOT,
+	JSK_QUERY_AND,
+	JSK_QUERY_OR,
+} jsk_query_opcode;
+
+typedef struct jsk_query_op {
+	jsk_query_opcode code;
+	unsigned arg;
+
+	union {
+		jsk_key key;
+		long long index;
+		jsk_value literal;
+	} data;
+} jsk_query_op;
+
+typedef struct jsk_query {
+	jsk_query_op *ops;
+	unsigned count;
+} jsk_query;
+
+JSK_EXPORT jsk_query *jsk_query_compile(jsk_heap *h, const char *const expr,
+		char **error);
+JSK_EXPORT jsk_value jsk_query_eval(jsk_heap *h, const jsk_query *q,
+		jsk_value v);
+
+#ifdef JSK_THREADS
+/*
+ * Splits newline-delimited input into batches of roughly JSK_NDJSON_BATCH
+ * bytes and parses them on up to `threads` threads (0 means one per online
+ * CPU), each into its own jsk_heap. Documents are delivered to the callback
+ * in input order; a value is only valid until the callback returns. Returning
+ * non-zero from the callback stops the parse and yields JSK_ERROR.
+ */
+typedef int (*jsk_document_callback)(void *user, unsigned long long index,
+		jsk_result res);
+
+JSK_EXPORT jsk_status jsk_parse_ndjson_parallel(void *ctx,
+		const char *const json, unsigned long long len,
+		unsigned threads, jsk_document_callback callback, void *user);
+
+/*
+ * Parses a document whose root is a large array by pre-scanning for commas
+ * between top-level elements, parsing the slices concurrently into per-thread
+ * heaps and stitching the elements into one array. The worker heaps are
+ * chained onto `heap` and released with it. Inputs that aren't an array or
+ * are smaller than two JSK_PARALLEL_MIN_PART slices are parsed serially.
+ */
+JSK_EXPORT jsk_result jsk_parse_array_parallel(jsk_heap *heap,
+		const char *const json, unsigned long long len,
+		unsigned threads);
+#endif
+
 #ifdef JSKOROST_IMPLEMENTATION
 
 #ifndef JSK_NO_STDLIB
@@ -218,6 +851,20 @@ JSK_EXPORT char *jsk_to_string(jsk_heap *heap, jsk_value v);
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <time.h>
+#endif
+
+#include <float.h>
+
+#ifdef JSK_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(JSK_NO_SIMD)
+#define JSK_X86
+#include <immintrin.h>
+#include <cpuid.h>
 #endif
 
 #if defined(__GNUC__)
@@ -251,24 +898,35 @@ JSK_EXPORT jsk_heap *jsk_heap_new(void *ctx)
 	h->ctx = ctx;
 	h->ptr = 0;
 	h->oversized = NULL;
+	h->bytes = JSK_HEAP_CHUNK_SIZE;
+	h->limit = 0;
+	h->oversized_bytes = 0;
+	h->oversized_count = 0;
+	h->padding = 0;
+	h->abandoned = 0;
+#ifdef JSK_PARSE_STATS
+	memset(&h->parse, 0, sizeof(h->parse));
+#endif
 
 	return h;
 }
 
 JSK_EXPORT void jsk_heap_free(jsk_heap *h)
 {
-	while (h->oversized) {
-		jsk_oversized *o = h->oversized;
-		h->oversized = o->next;
-		JSK_FREE(h->ctx, o);
-	}
+	while (h) {
+		jsk_heap *next = h->next;
 
-	JSK_FREE(h->ctx, h->chunk);
+		while (h->oversized) {
+			jsk_oversized *o = h->oversized;
+			h->oversized = o->next;
+			JSK_FREE(h->ctx, o);
+		}
 
-	if (h->next)
-		jsk_heap_free(h->next);
+		JSK_FREE(h->ctx, h->chunk);
+		JSK_FREE(h->ctx, h);
 
-	JSK_FREE(h->ctx, h);
+		h = next;
+	}
 }
 
 JSK_EXPORT void *jsk_heap_alloc(jsk_heap *h, unsigned bytes, unsigned align)
@@ -282,24 +940,35 @@ JSK_EXPORT void *jsk_heap_alloc(jsk_heap *h, unsigned bytes, unsigned align)
 
 	if (bytes >= JSK_HEAP_MIN_OVERSIZED) {
 		const unsigned n = bytes + sizeof(jsk_oversized *);
+		if (JSK_UNLIKELY(head->limit && head->bytes + n > head->limit))
+			return NULL;
 		jsk_oversized *o = (jsk_oversized *)JSK_MALLOC(h->ctx, n);
 		if (JSK_UNLIKELY(!o))
 			return NULL;
 		o->next = h->oversized;
 		h->oversized = o;
+		head->bytes += n;
+		head->oversized_bytes += n;
+		head->oversized_count++;
 		return o->data;
 	}
 
 	if (align > 1 && h->ptr & (align - 1)) {
+		head->padding += align - (h->ptr & (align - 1));
 		h->ptr &= ~(align - 1);
 		h->ptr += align;
 	}
 
 	if (h->ptr + bytes > JSK_HEAP_CHUNK_SIZE) {
+		if (JSK_UNLIKELY(head->limit && head->bytes +
+					JSK_HEAP_CHUNK_SIZE > head->limit))
+			return NULL;
+
 		jsk_heap *h0 = jsk_heap_new(h->ctx);
 		if (JSK_UNLIKELY(!h0))
 			return NULL;
 
+		head->bytes += JSK_HEAP_CHUNK_SIZE;
 		h0->head = head;
 		head->tail = h0;
 		h->next = h0;
@@ -311,6 +980,26 @@ JSK_EXPORT void *jsk_heap_alloc(jsk_heap *h, unsigned bytes, unsigned align)
 	return alloc;
 }
 
+JSK_EXPORT void jsk_heap_get_stats(const jsk_heap *h, jsk_heap_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	stats->reserved = h->bytes;
+	stats->used = h->oversized_bytes;
+	stats->oversized_count = h->oversized_count;
+	stats->oversized_bytes = h->oversized_bytes;
+	stats->padding = h->padding;
+	stats->abandoned = h->abandoned;
+#ifdef JSK_PARSE_STATS
+	stats->parse = h->parse;
+#endif
+
+	for (const jsk_heap *c = h; c; c = c->next) {
+		stats->chunks++;
+		stats->used += c->ptr;
+	}
+}
+
 static void *jsk_heap_unify(jsk_heap *heap, int null_terminate)
 {
 	unsigned bytes = !!null_terminate;
@@ -339,6 +1028,42 @@ static void *jsk_heap_unify(jsk_heap *heap, int null_terminate)
 	return mem;
 }
 
+/*
+ * Appends bytes to a heap that is being used as an output buffer, spilling
+ * into new chunks so that jsk_heap_unify() sees one contiguous stream.
+ */
+static int jsk_heap_write(jsk_heap *h, const void *data,
+		unsigned long long len)
+{
+	const char *src = (const char *)data;
+
+	while (len) {
+		jsk_heap *tail = h->tail;
+
+		if (JSK_UNLIKELY(tail->ptr == JSK_HEAP_CHUNK_SIZE)) {
+			jsk_heap *h0 = jsk_heap_new(h->ctx);
+			if (JSK_UNLIKELY(!h0))
+				return 1;
+
+			h0->head = h;
+			tail->next = h0;
+			h->tail = h0;
+			continue;
+		}
+
+		unsigned n = JSK_HEAP_CHUNK_SIZE - tail->ptr;
+		if (n > len)
+			n = len;
+
+		memcpy(&tail->chunk[tail->ptr], src, n);
+		tail->ptr += n;
+		src += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
 static char *jsk_vprintf(jsk_heap *h, int null_terminate,
 		const char *const fmt, va_list args)
 {
@@ -351,26 +1076,37 @@ static char *jsk_vprintf(jsk_heap *h, int null_terminate,
 	char *s = &tail->chunk[tail->ptr];
 #endif
 
+	/* The first pass consumes args, so a retry needs its own copy */
+	va_list retry;
+	va_copy(retry, args);
+
 	const unsigned needed = vsnprintf(s, len, fmt, args) + 1;
 
 	if (needed > len) {
 		s = (char *)jsk_heap_alloc(h, needed, 1);
-		vsnprintf(s, needed, fmt, args);
+		if (JSK_LIKELY(s != NULL))
+			vsnprintf(s, needed, fmt, retry);
+		va_end(retry);
 		return s;
 	}
 
+	va_end(retry);
 	tail->ptr += needed - (null_terminate ? 0 : 1);
 	return s;
 }
 
-__attribute__((__format__ (__printf__, 3, 4)))
-static char *jsk_printf(jsk_heap *h, int null_terminate,
-		const char *const fmt, ...)
+/* Joins two strings into a new NUL-terminated one on the heap */
+static char *jsk_concat(jsk_heap *h, const char *const a, const char *const b)
 {
-	va_list args;
-	va_start(args, fmt);
-	char *s = jsk_vprintf(h, null_terminate, fmt, args);
-	va_end(args);
+	const size_t alen = strlen(a);
+	const size_t blen = strlen(b);
+
+	char *s = (char *)jsk_heap_alloc(h, alen + blen + 1, 1);
+	if (JSK_UNLIKELY(!s))
+		return NULL;
+
+	memcpy(s, a, alen);
+	memcpy(&s[alen], b, blen + 1);
 	return s;
 }
 
@@ -388,6 +1124,184 @@ static jsk_u64 jsk_hash(const char *const str) /* Simple FNV-1a */
 	return val;
 }
 
+__attribute__((__unused__))
+static jsk_u64 jsk_hash_len(const char *const str, unsigned len)
+{
+	const unsigned char *s = (const unsigned char *)str;
+
+	jsk_u64 val = 0xcbf29ce484222325ULL;
+
+	for (unsigned i = 0; i < len; i++) {
+		val ^= (jsk_u64)s[i];
+		val *= 0x100000001b3ULL;
+	}
+
+	return val;
+}
+
+/* Table lookups use the hash 0 to mark empty buckets */
+static inline jsk_u64 jsk_hash_nonzero(jsk_u64 hash)
+{
+	return hash ? hash : 1;
+}
+
+/*
+ * wyhash (final version 4), by Wang Yi, which is public domain: fast on short
+ * keys and, with a secret seed, hard to force collisions in.
+ */
+static const jsk_u64 jsk_wy_secret[4] = {
+	0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+	0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL,
+};
+
+static inline void jsk_wy_mum(jsk_u64 *a, jsk_u64 *b)
+{
+#ifdef __SIZEOF_INT128__
+	const __uint128_t r = (__uint128_t)*a * *b;
+	*a = (jsk_u64)r;
+	*b = (jsk_u64)(r >> 64);
+#else
+	const jsk_u64 ha = *a >> 32, hb = *b >> 32;
+	const jsk_u64 la = (unsigned)*a, lb = (unsigned)*b;
+	const jsk_u64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	const jsk_u64 t = rl + (rm0 << 32);
+	jsk_u64 lo = t + (rm1 << 32);
+	jsk_u64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+static inline jsk_u64 jsk_wy_mix(jsk_u64 a, jsk_u64 b)
+{
+	jsk_wy_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline jsk_u64 jsk_wy_r8(const unsigned char *p)
+{
+	jsk_u64 v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline jsk_u64 jsk_wy_r4(const unsigned char *p)
+{
+	unsigned v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static jsk_u64 jsk_wyhash(const void *key, unsigned long long len,
+		jsk_u64 seed)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	const jsk_u64 *secret = jsk_wy_secret;
+	jsk_u64 a, b;
+
+	seed ^= jsk_wy_mix(seed ^ secret[0], secret[1]);
+
+	if (JSK_LIKELY(len <= 16)) {
+		if (JSK_LIKELY(len >= 4)) {
+			const unsigned long long q = (len >> 3) << 2;
+			a = (jsk_wy_r4(p) << 32) | jsk_wy_r4(p + q);
+			b = (jsk_wy_r4(p + len - 4) << 32) |
+				jsk_wy_r4(p + len - 4 - q);
+		} else if (JSK_LIKELY(len > 0)) {
+			a = ((jsk_u64)p[0] << 16) | ((jsk_u64)p[len >> 1] << 8) |
+				p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		unsigned long long i = len;
+
+		if (JSK_UNLIKELY(i > 48)) {
+			jsk_u64 see1 = seed, see2 = seed;
+
+			do {
+				seed = jsk_wy_mix(jsk_wy_r8(p) ^ secret[1],
+						jsk_wy_r8(p + 8) ^ seed);
+				see1 = jsk_wy_mix(jsk_wy_r8(p + 16) ^ secret[2],
+						jsk_wy_r8(p + 24) ^ see1);
+				see2 = jsk_wy_mix(jsk_wy_r8(p + 32) ^ secret[3],
+						jsk_wy_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (JSK_LIKELY(i > 48));
+
+			seed ^= see1 ^ see2;
+		}
+
+		while (JSK_UNLIKELY(i > 16)) {
+			seed = jsk_wy_mix(jsk_wy_r8(p) ^ secret[1],
+					jsk_wy_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = jsk_wy_r8(p + i - 16);
+		b = jsk_wy_r8(p + i - 8);
+	}
+
+	a ^= secret[1];
+	b ^= seed;
+	jsk_wy_mum(&a, &b);
+
+	return jsk_wy_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+/* 0 until the first seeded hash or jsk_hash_seed() call */
+static jsk_u64 jsk_seed;
+
+JSK_EXPORT void jsk_hash_seed(jsk_u64 seed)
+{
+	__atomic_store_n(&jsk_seed, jsk_hash_nonzero(seed), __ATOMIC_RELEASE);
+}
+
+static jsk_u64 jsk_seed_init(void)
+{
+	jsk_u64 fresh = 0;
+
+#ifndef JSK_NO_STDLIB
+	FILE *f = fopen("/dev/urandom", "rb");
+	if (f) {
+		if (fread(&fresh, sizeof(fresh), 1, f) != 1)
+			fresh = 0;
+		fclose(f);
+	}
+
+	/* Fall back on whatever address space layout randomization gives */
+	if (!fresh)
+		fresh = jsk_wy_mix((jsk_u64)(size_t)&fresh ^ (jsk_u64)time(NULL),
+				(jsk_u64)(size_t)&jsk_seed ^ (jsk_u64)clock());
+#else
+	fresh = jsk_wy_mix((jsk_u64)(size_t)&fresh, (jsk_u64)(size_t)&jsk_seed);
+#endif
+
+	fresh = jsk_hash_nonzero(fresh);
+
+	/* Racing threads must all end up with the same seed */
+	jsk_u64 expected = 0;
+	if (!__atomic_compare_exchange_n(&jsk_seed, &expected, fresh, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return expected;
+
+	return fresh;
+}
+
+__attribute__((__unused__))
+static jsk_u64 jsk_hash_seeded(const char *const str, unsigned long long len)
+{
+	jsk_u64 seed = __atomic_load_n(&jsk_seed, __ATOMIC_ACQUIRE);
+
+	if (JSK_UNLIKELY(!seed))
+		seed = jsk_seed_init();
+
+	return jsk_wyhash(str, len, seed);
+}
+
 #define JSK_TOKENS                                 \
 	JSK_X(JSKT_EOF,     0,   "end of file")    \
 	JSK_X(JSKT_INVALID, 1,   "invalid token")  \
@@ -397,6 +1311,7 @@ static jsk_u64 jsk_hash(const char *const str) /* Simple FNV-1a */
 	JSK_X(JSKT_TRUE,    5,   "true")           \
 	JSK_X(JSKT_FALSE,   6,   "false")          \
 	JSK_X(JSKT_NULL,    7,   "null")           \
+	JSK_X(JSKT_NUMBER,  8,   "number")         \
 	JSK_X(JSKT_LBRACK,  '[', "left bracket")   \
 	JSK_X(JSKT_RBRACK,  ']', "right bracket")  \
 	JSK_X(JSKT_LBRACE,  '{', "left brace")     \
@@ -410,11 +1325,16 @@ typedef enum jsk_token_type {
 #undef JSK_X
 } jsk_token_type;
 
-static const char *jsk_token_names[] = {
-#define JSK_X(t, n, s) s,
+static const char *jsk_token_name(jsk_token_type type)
+{
+	switch (type) {
+#define JSK_X(t, n, s) case t: return s;
 	JSK_TOKENS
 #undef JSK_X
-};
+	}
+
+	return "unknown token";
+}
 
 typedef struct jks_token {
 	jsk_token_type type;
@@ -428,267 +1348,418 @@ typedef struct jsk_context {
 	unsigned long long len;
 	unsigned long long ptr;
 	jsk_token tkn;
+	unsigned long long start;
+	const struct jsk_parse_options *opts;
+	unsigned depth;
 } jsk_context;
 
-static double jsk_ten_pow(int exponent)
-{
-	int recip;
-	if (exponent < 0) {
-		exponent = -exponent;
-		recip = 1;
-	} else {
-		recip = 0;
-	}
-
-	if (JSK_UNLIKELY(exponent > 325))
-		exponent = 325;
+/*
+ * Just enough arbitrary precision for jsk_decimal_exact(): unsigned integers
+ * of up to JSK_BIG_LIMBS 32-bit limbs, least significant first. Its
+ * comparisons stay under 4000 bits.
+ */
+#define JSK_BIG_LIMBS 160
+#define JSK_BIG_DIGITS 800
 
-	double result = 1;
+typedef struct jsk_big {
+	unsigned n;
+	unsigned d[JSK_BIG_LIMBS];
+} jsk_big;
 
-	while (exponent > 100) {
-		result *= 10e100;
-		exponent -= 100;
-	}
+static void jsk_big_mul_add(jsk_big *b, unsigned mul, unsigned add)
+{
+	jsk_u64 carry = add;
 
-	while (exponent > 33) {
-		result *= 10e33;
-		exponent -= 33;
+	for (unsigned i = 0; i < b->n; i++) {
+		carry += (jsk_u64)b->d[i] * mul;
+		b->d[i] = (unsigned)carry;
+		carry >>= 32;
 	}
 
-	while (exponent > 10) {
-		result *= 10e10;
-		exponent -= 10;
-	}
+	if (carry && b->n < JSK_BIG_LIMBS)
+		b->d[b->n++] = (unsigned)carry;
+}
 
-	static const double m[] = {
-		1, 10, 100, 1000, 10e3, 10e4, 10e5, 10e6, 10e7, 10e8, 10e9,
+static void jsk_big_pow5(jsk_big *b, unsigned long e)
+{
+	static const unsigned pow5[] = {
+		1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 1953125,
+		9765625, 48828125, 244140625, 1220703125,
 	};
 
-	result *= m[exponent];
-	return recip ? 1.f / result : result;
+	for (; e >= 13; e -= 13)
+		jsk_big_mul_add(b, pow5[13], 0);
+	jsk_big_mul_add(b, pow5[e], 0);
 }
 
-static void jsk_lex(jsk_context *ctx)
+static void jsk_big_shl(jsk_big *b, unsigned long bits)
 {
-	enum {
-		L_INV, /* invalid */
-		L_SKP, /* skip */
-		L_CHR, /* immediate character */
-		L_STR, /* string */
-		L_NUM, /* number */
-		L_FLS, /* false */
-		L_TRU, /* true */
-		L_NUL, /* null */
-	};
-
-	static const char dispatch[] = {
-		L_CHR, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
-		L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
-		L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
-		L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
-		L_SKP, L_INV, L_STR, L_INV, L_INV, L_INV, L_INV, L_INV,
-		L_CHR, L_CHR, L_INV, L_INV, L_CHR, L_NUM, L_INV, L_INV,
-		L_NUM, L_NUM, L_NUM, L_NUM, L_NUM, L_NUM, L_NUM, L_NUM,
-		L_NUM, L_NUM, L_CHR, L_INV, L_INV, L_INV, L_INV, L_INV,
-		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV,
-		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV,
-		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV,
-		L_INV, L_INV, L_INV, L_CHR, L_INV, L_CHR, L_INV, L_INV,
-		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_FLS, L_INV,
-		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_NUL, L_INV,
-		L_INV, L_INV, L_INV, L_INV, L_TRU, L_INV, L_INV, L_INV,
-		L_INV, L_INV, L_INV, L_CHR, L_INV, L_CHR, L_INV, L_SKP,
-	};
+	const unsigned limbs = bits / 32, shift = bits % 32;
 
-lex_next:
-	if (JSK_UNLIKELY(ctx->ptr == ctx->len)) {
-		ctx->tkn.type = JSKT_EOF;
+	if (!b->n || b->n + limbs + 1 > JSK_BIG_LIMBS)
 		return;
-	}
 
-	const char c = ctx->json[ctx->ptr];
-
-	if (JSK_UNLIKELY(c < 0)) {
-		ctx->tkn.type = JSKT_INVALID;
-		return;
+	if (shift) {
+		unsigned carry = 0;
+		for (unsigned i = 0; i < b->n; i++) {
+			const unsigned x = b->d[i];
+			b->d[i] = x << shift | carry;
+			carry = x >> (32 - shift);
+		}
+		if (carry)
+			b->d[b->n++] = carry;
 	}
 
-	switch (dispatch[(int)c]) {
-	case L_INV:
-		ctx->tkn.type = JSKT_INVALID;
-		return;
-
-	case L_SKP:
-		ctx->ptr++;
-		goto lex_next;
-
-	case L_CHR:
-		ctx->tkn.type = (jsk_token_type)c;
-		ctx->ptr++;
-		return;
-
-	case L_STR:
-		ctx->ptr++;
-		ctx->tkn.data = &ctx->json[ctx->ptr];
+	memmove(&b->d[limbs], b->d, b->n * sizeof(unsigned));
+	memset(b->d, 0, limbs * sizeof(unsigned));
+	b->n += limbs;
+}
 
-		for (unsigned escapes = 0; 1; ctx->ptr++) {
-			if (JSK_UNLIKELY(ctx->ptr == ctx->len)) {
-				ctx->tkn.type = JSKT_INVALID;
-				return;
-			}
+/* The sign of digits * 10^e - a * 2^q */
+static int jsk_big_compare(const jsk_big *digits, long e, jsk_u64 a, long q)
+{
+	jsk_big l = *digits, r;
+	r.d[0] = (unsigned)a;
+	r.d[1] = (unsigned)(a >> 32);
+	r.n = a >> 32 ? 2 : a ? 1 : 0;
+
+	if (e >= 0)
+		jsk_big_pow5(&l, e);
+	else
+		jsk_big_pow5(&r, -e);
+
+	if (e >= q)
+		jsk_big_shl(&l, e - q);
+	else
+		jsk_big_shl(&r, q - e);
+
+	if (l.n != r.n)
+		return l.n < r.n ? -1 : 1;
+	for (unsigned i = l.n; i-- > 0;)
+		if (l.d[i] != r.d[i])
+			return l.d[i] < r.d[i] ? -1 : 1;
+	return 0;
+}
 
-			const char c0 = ctx->json[ctx->ptr];
+static double jsk_double_bits(jsk_u64 bits)
+{
+	double d;
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+}
 
-			if (c0 == c && ~escapes & 1) {
-				const char *end = &ctx->json[ctx->ptr];
-				ctx->tkn.len = end - ctx->tkn.data;
-				ctx->tkn.type = JSKT_STRING;
-				ctx->ptr++;
-				return;
-			} else if (c0 == '\\') {
-				escapes++;
-			} else {
-				escapes = 0;
-			}
+/*
+ * Rounds the mantissa digits at p, times 10^e10, to the nearest double. The
+ * guess must be within a few ulps; it is walked up or down until the value
+ * lies between the midpoints with its neighbours. Digits past the first
+ * JSK_BIG_DIGITS only matter as a sticky digit, since no midpoint between
+ * doubles needs more than 767 significant digits.
+ */
+static double jsk_decimal_exact(const char *p, long e10, double guess)
+{
+	const jsk_u64 hidden = 1ULL << 52;
+	jsk_big d = { 0, { 0 } };
+	unsigned n = 0, chunk = 0, scale = 1;
+	int fraction = 0, sticky = 0;
+	long e = e10;
+
+	for (; (*p >= '0' && *p <= '9') || (*p == '.' && !fraction); p++) {
+		if (*p == '.') {
+			fraction = 1;
+			continue;
 		}
 
-	case L_NUM: {
-		long long multiplier;
-		if (ctx->json[ctx->ptr] == '-') {
-			multiplier = -1;
-			ctx->ptr++;
-		} else {
-			multiplier = 1;
+		if (n == JSK_BIG_DIGITS) {
+			sticky |= *p != '0';
+			e += !fraction;
+			continue;
 		}
 
-		long long n = 0;
-		ctx->tkn.type = JSKT_INT;
+		e -= fraction;
+		if (!n && *p == '0')
+			continue;
 
-		char digit;
-		while ((digit = ctx->json[ctx->ptr]) >= '0' && digit <= '9') {
-			n = n * 10 + digit - '0';
-			ctx->ptr++;
+		chunk = chunk * 10 + (unsigned)(*p - '0');
+		scale *= 10;
+		n++;
+		if (scale == 1000000000) {
+			jsk_big_mul_add(&d, scale, chunk);
+			chunk = 0;
+			scale = 1;
 		}
+	}
 
-		n *= multiplier;
-
-		double f;
-		if (ctx->json[ctx->ptr] == '.') {
-			ctx->tkn.type = JSKT_FLOAT;
-			f = n;
-			ctx->ptr++;
+	if (sticky) {
+		chunk = chunk * 10 + 1;
+		scale *= 10;
+		n++;
+		e--;
+	}
+	jsk_big_mul_add(&d, scale, chunk);
+
+	/* The value is at least 10^(e + n - 1) and below 10^(e + n) */
+	if (!n || e + (long)n < -324)
+		return 0;
+	if (e + (long)n - 1 > 308)
+		return jsk_double_bits(0x7ffULL << 52);
+
+	/* The guess as m * 2^k, on the grid of its binade */
+	jsk_u64 bits;
+	memcpy(&bits, &guess, sizeof(bits));
+	const long biased = (long)(bits >> 52 & 0x7ff);
+	jsk_u64 m = bits & (hidden - 1);
+	long k = -1074;
+	if (biased == 0x7ff) {
+		m = 2 * hidden - 1;
+		k = 971;
+	} else if (biased) {
+		m |= hidden;
+		k = biased - 1075;
+	}
 
-			double magnitude = 0.1;
-			while ((digit = ctx->json[ctx->ptr]) >= '0' &&
-					digit <= '9') {
-				f += (digit - '0') * magnitude;
-				magnitude /= 10;
-				ctx->ptr++;
+	while (1) {
+		/* Past the midpoint above, or on it with m odd, rounds up */
+		int c = jsk_big_compare(&d, e, 2 * m + 1, k - 1);
+		if (c > 0 || (c == 0 && (m & 1))) {
+			if (++m == 2 * hidden) {
+				m = hidden;
+				k++;
 			}
+			if (k > 971)
+				return jsk_double_bits(0x7ffULL << 52);
+			continue;
 		}
 
-		if (ctx->json[ctx->ptr] == 'e' || ctx->json[ctx->ptr] == 'E') {
-			if (ctx->tkn.type != JSKT_FLOAT) {
-				ctx->tkn.type = JSKT_FLOAT;
-				f = n;
-			}
-
-			ctx->ptr++;
+		if (!m)
+			break;
 
-			if (ctx->json[ctx->ptr] == '-') {
-				multiplier = -1;
-				ctx->ptr++;
-			} else if (ctx->json[ctx->ptr] == '+') {
-				ctx->ptr++;
-				multiplier = 1;
+		/* Below a power of two the spacing halves */
+		const int edge = m == hidden && k > -1074;
+		c = edge ? jsk_big_compare(&d, e, 4 * m - 1, k - 2) :
+			jsk_big_compare(&d, e, 2 * m - 1, k - 1);
+		if (c < 0 || (c == 0 && (m & 1))) {
+			if (edge) {
+				m = 2 * hidden - 1;
+				k--;
 			} else {
-				multiplier = 1;
-			}
-
-			int exponent = 0;
-			while ((digit = ctx->json[ctx->ptr]) >= '0' &&
-					digit <= '9') {
-				exponent = exponent * 10 + digit - '0';
-				ctx->ptr++;
+				m--;
 			}
-
-			f *= jsk_ten_pow(exponent * multiplier);
+			continue;
 		}
 
-		if (ctx->tkn.type == JSKT_FLOAT)
-			ctx->tkn.data = (char *)*(void**)&f;
-		else
-			ctx->tkn.data = (char *)*(void**)&n;
+		break;
+	}
 
-		ctx->tkn.len = 0;
+	return jsk_double_bits(m >= hidden ?
+			(jsk_u64)(k + 1075) << 52 | (m & (hidden - 1)) : m);
+}
 
-		return;
-	}
+/*
+ * Whether x, carrying some rounding error of its own, certainly rounds to r:
+ * it isn't within an eighth of an ulp of a midpoint, and r is finite and not
+ * a power of two, where the spacing changes.
+ */
+static int jsk_decimal_certain(long double x, double r)
+{
+	jsk_u64 bits;
+	memcpy(&bits, &r, sizeof(bits));
+	if (!(bits & ((1ULL << 52) - 1)) || (bits >> 52 & 0x7ff) == 0x7ff)
+		return 0;
+
+	const double next = jsk_double_bits(bits + 1);
+	if (next - next != 0)
+		return 0;
+
+	const long double ulp = (long double)next - r;
+	long double off = x - r;
+	if (off < 0)
+		off = -off;
+	off -= ulp / 2;
+	if (off < 0)
+		off = -off;
+	return off > ulp / 8;
+}
 
-	case L_FLS:
-		if (JSK_LIKELY(ctx->ptr + 4 < ctx->len &&
-					ctx->json[ctx->ptr + 1] == 'a' &&
-					ctx->json[ctx->ptr + 2] == 'l' &&
-					ctx->json[ctx->ptr + 3] == 's' &&
-					ctx->json[ctx->ptr + 4] == 'e')) {
-			ctx->tkn.type = JSKT_FALSE;
-			ctx->ptr += 5;
-		} else {
-			ctx->tkn.type = JSKT_INVALID;
-		}
-		return;
+/*
+ * Converts the valid JSON number at s without going through the C library,
+ * whose strtod() follows LC_NUMERIC, and stores where it ends in *end. Up to
+ * 19 significant digits are kept for a first result. When they fit in a
+ * double's mantissa and the exponent is within 22, both factors are exact
+ * and so is the result. Otherwise it is scaled in long double, and settled
+ * with jsk_decimal_exact() whenever that may not round correctly, which is
+ * always where long double is no wider than double.
+ */
+static double jsk_decimal(const char *s, const char **end)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+		1e22,
+	};
 
-	case L_TRU:
-		if (JSK_LIKELY(ctx->ptr + 3 < ctx->len &&
-					ctx->json[ctx->ptr + 1] == 'r' &&
-					ctx->json[ctx->ptr + 2] == 'u' &&
-					ctx->json[ctx->ptr + 3] == 'e')) {
-			ctx->tkn.type = JSKT_TRUE;
-			ctx->ptr += 4;
+	const int negative = *s == '-';
+	const char *p = s + negative;
+	jsk_u64 m = 0;
+	int digits = 0;
+	long exponent = 0;
+	long e = 0;
+
+	for (; *p >= '0' && *p <= '9'; p++) {
+		if (digits < 19) {
+			m = m * 10 + (unsigned)(*p - '0');
+			digits += m != 0;
 		} else {
-			ctx->tkn.type = JSKT_INVALID;
+			exponent++;
 		}
-		return;
+	}
 
-	case L_NUL:
-		if (JSK_LIKELY(ctx->ptr + 3 < ctx->len &&
-					ctx->json[ctx->ptr + 1] == 'u' &&
-					ctx->json[ctx->ptr + 2] == 'l' &&
-					ctx->json[ctx->ptr + 3] == 'l')) {
-			ctx->tkn.type = JSKT_NULL;
-			ctx->ptr += 4;
-		} else {
-			ctx->tkn.type = JSKT_INVALID;
+	if (*p == '.') {
+		for (p++; *p >= '0' && *p <= '9'; p++) {
+			if (digits < 19) {
+				m = m * 10 + (unsigned)(*p - '0');
+				digits += m != 0;
+				exponent--;
+			}
 		}
-		return;
 	}
-}
 
-#define jsk_success(v) ((jsk_result){ JSK_OK, { .value = v } })
+	if (*p == 'e' || *p == 'E') {
+		p++;
+		const int down = *p == '-';
+		if (*p == '-' || *p == '+')
+			p++;
 
-__attribute__((__format__ (__printf__, 2, 3)))
-static jsk_result jsk_error(jsk_context *ctx, const char *const fmt, ...)
+		for (; *p >= '0' && *p <= '9'; p++)
+			if (e < 100000)
+				e = e * 10 + (*p - '0');
+
+		if (down)
+			e = -e;
+		exponent += e;
+	}
+
+	*end = p;
+
+	double r;
+
+	if (JSK_LIKELY(m <= (1ULL << 53) && exponent >= -22 &&
+				exponent <= 22)) {
+		r = exponent < 0 ? (double)m / pow10[-exponent] :
+			(double)m * pow10[exponent];
+	} else {
+		/* Anything past +-400 is infinite or zero either way */
+		if (exponent > 400)
+			exponent = 400;
+		if (exponent < -400)
+			exponent = -400;
+
+		long double x = (long double)m;
+		for (; exponent >= 22; exponent -= 22)
+			x *= 1e22L;
+		for (; exponent <= -22; exponent += 22)
+			x /= 1e22L;
+
+		x = exponent < 0 ? x / pow10[-exponent] : x * pow10[exponent];
+		r = (double)x;
+#if LDBL_MANT_DIG >= 64
+		if (m && !jsk_decimal_certain(x, r))
+#else
+		if (m)
+#endif
+			r = jsk_decimal_exact(s + negative, e, r);
+	}
+
+	return negative ? -r : r;
+}
+
+/*
+ * Converts a valid JSON number, which must be followed by a non-number byte,
+ * to an integer if it is one that fits, else to a double. end may be NULL.
+ */
+static jsk_type jsk_number_convert(const char *s, long long *i, double *f,
+		const char **end)
 {
-	va_list args;
-	va_start(args, fmt);
-	char *s = jsk_vprintf(ctx->heap, 1, fmt, args);
-	va_end(args);
-	return (jsk_result){ JSK_ERROR, { .error = s } };
+	const int negative = *s == '-';
+	const unsigned long long max = (~0ULL >> 1) + negative;
+	const char *p = s + negative;
+	unsigned long long n = 0;
+
+	while (*p >= '0' && *p <= '9' &&
+			n <= (max - (unsigned)(*p - '0')) / 10)
+		n = n * 10 + (unsigned)(*p++ - '0');
+
+	if (!(*p >= '0' && *p <= '9') && *p != '.' && *p != 'e' && *p != 'E') {
+		*i = !negative ? (long long)n :
+			n ? -(long long)(n - 1) - 1 : 0;
+		if (end)
+			*end = p;
+		return JSK_INT;
+	}
+
+	const char *stop;
+	*f = jsk_decimal(s, &stop);
+	if (end)
+		*end = stop;
+	return JSK_FLOAT;
 }
 
-JSK_EXPORT jsk_value jsk_new_int(long long v)
+/* The UTF-16 code unit in four hex digits, or -1 */
+static long jsk_hex4(const char *s)
 {
-	return (jsk_value){ JSK_INT, *(void **)(&(v)) };
+	long v = 0;
+
+	for (int i = 0; i < 4; i++) {
+		const char c = s[i];
+		v <<= 4;
+
+		if (c >= '0' && c <= '9')
+			v |= c - '0';
+		else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+			v |= (c | 0x20) - 'a' + 10;
+		else
+			return -1;
+	}
+
+	return v;
 }
 
-JSK_EXPORT jsk_value jsk_new_float(double f)
+static unsigned jsk_utf8_encode(char *dest, unsigned long cp)
 {
-	return (jsk_value){ JSK_FLOAT, *(void **)(&(f)) };
+	unsigned char *d = (unsigned char *)dest;
+
+	if (cp < 0x80) {
+		d[0] = cp;
+		return 1;
+	} else if (cp < 0x800) {
+		d[0] = 0xc0 | (cp >> 6);
+		d[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	} else if (cp < 0x10000) {
+		d[0] = 0xe0 | (cp >> 12);
+		d[1] = 0x80 | ((cp >> 6) & 0x3f);
+		d[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+
+	d[0] = 0xf0 | (cp >> 18);
+	d[1] = 0x80 | ((cp >> 12) & 0x3f);
+	d[2] = 0x80 | ((cp >> 6) & 0x3f);
+	d[3] = 0x80 | (cp & 0x3f);
+	return 4;
 }
 
+/*
+ * Decodes the escape sequence after a backslash. src has n bytes left; the
+ * number consumed is stored in *used. Returns the number of bytes written to
+ * dest, which is never more than were consumed, or 0 if the escape is
+ * invalid. A \u escape that is half of a surrogate pair without its other
+ * half becomes U+FFFD. \u0000 is invalid too, since strings end at a NUL.
+ */
 static unsigned jsk_unescape(char *JSK_RESTRICT dest,
-		const char *JSK_RESTRICT src)
+		const char *JSK_RESTRICT src, unsigned n, unsigned *used)
 {
+	*used = 1;
+
 	switch (*src) {
 	case '"':	*dest = '"';	return 1;
 	case '\\':	*dest = '\\';	return 1;
@@ -698,92 +1769,1254 @@ static unsigned jsk_unescape(char *JSK_RESTRICT dest,
 	case 'n':	*dest = '\n';	return 1;
 	case 'r':	*dest = '\r';	return 1;
 	case 't':	*dest = '\t';	return 1;
-	case 'u':	// TODO: Unicode escape sequences
-	default:
-		break;
+	case 'u':	break;
+	default:	return 0;
 	}
 
-	return 0;
-}
+	const long hi = n >= 5 ? jsk_hex4(&src[1]) : -1;
+	if (JSK_UNLIKELY(hi <= 0))
+		return 0;
 
-JSK_EXPORT jsk_value jsk_new_string_escaped(jsk_heap *h, const char *const s,
-		unsigned len)
-{
-	char *mem = (char *)jsk_heap_alloc(h, len + 1, 1);
+	*used = 5;
 
-	unsigned dest = 0, src = 0;
+	if (JSK_LIKELY(hi < 0xd800 || hi > 0xdfff))
+		return jsk_utf8_encode(dest, hi);
 
-	while (src < len) {
-		if (s[src] == '\\') {
-			src++;
-			if (JSK_UNLIKELY(src >= len))
-				break;
-			const unsigned b = jsk_unescape(&mem[dest], &s[src]);
-			if (JSK_UNLIKELY(b == 0))
-				break;
-			src++;
-			dest += b;
-		} else {
-			mem[dest++] = s[src++];
+	if (hi <= 0xdbff && n >= 11 && src[5] == '\\' && src[6] == 'u') {
+		const long lo = jsk_hex4(&src[7]);
+
+		if (lo >= 0xdc00 && lo <= 0xdfff) {
+			*used = 11;
+			return jsk_utf8_encode(dest, 0x10000 +
+					((hi - 0xd800) << 10) + (lo - 0xdc00));
 		}
 	}
 
-	mem[dest] = 0;
-
-	return (jsk_value){ JSK_STRING, mem };
+	return jsk_utf8_encode(dest, 0xfffd);
 }
 
-JSK_EXPORT jsk_value jsk_new_string_len(jsk_heap *h, const char *const s,
-		unsigned len)
+#define JSK_ONES  0x0101010101010101ULL
+#define JSK_HIGHS 0x8080808080808080ULL
+
+/*
+ * Non-zero if any of the eight bytes in x needs a closer look inside a string:
+ * a quote, a backslash, a control character or a non-ASCII byte.
+ */
+static jsk_u64 jsk_swar_string_special(jsk_u64 x)
 {
-	char *mem = (char *)jsk_heap_alloc(h, len + 1, 1);
-	memcpy(mem, s, len);
-	mem[len] = 0;
-	return (jsk_value){ JSK_STRING, mem };
+	const jsk_u64 q = x ^ (JSK_ONES * '"');
+	const jsk_u64 b = x ^ (JSK_ONES * '\\');
+
+	return (((q - JSK_ONES) & ~q) | ((b - JSK_ONES) & ~b) |
+			((x - JSK_ONES * 0x20) & ~x) | x) & JSK_HIGHS;
 }
 
-JSK_EXPORT jsk_value jsk_new_string(jsk_heap *h, const char *const s)
+/*
+ * Returns the length of the well-formed UTF-8 sequence at s (at most n
+ * bytes), or 0 if it is overlong, truncated, a surrogate or out of range.
+ */
+static unsigned jsk_utf8_sequence(const unsigned char *s,
+		unsigned long long n)
 {
-	return jsk_new_string_len(h, s, strlen(s));
+	const unsigned char c = s[0];
+	unsigned len;
+	unsigned char lo = 0x80, hi = 0xbf;
+
+	if (c < 0x80)
+		return 1;
+	else if (c < 0xc2)
+		return 0;
+	else if (c < 0xe0)
+		len = 2;
+	else if (c < 0xf0)
+		len = 3;
+	else if (c < 0xf5)
+		len = 4;
+	else
+		return 0;
+
+	if (JSK_UNLIKELY(n < len))
+		return 0;
+
+	if (c == 0xe0)
+		lo = 0xa0;
+	else if (c == 0xed)
+		hi = 0x9f;
+	else if (c == 0xf0)
+		lo = 0x90;
+	else if (c == 0xf4)
+		hi = 0x8f;
+
+	if (s[1] < lo || s[1] > hi)
+		return 0;
+
+	for (unsigned i = 2; i < len; i++)
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+
+	return len;
 }
 
-JSK_EXPORT jsk_value jsk_new_object(jsk_heap *h)
-{
-	jsk_object *obj = (jsk_object *)jsk_heap_alloc(h, sizeof(jsk_object),
-			JSK_VALUE_ALIGN);
+/*
+ * For each byte, 0 if it can be written into a JSON string as it is,
+ * otherwise the character that follows the backslash ('u' for \u00XX).
+ */
+static const char jsk_escapes[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, '/',
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, '\\', 0, 0, 0,
+};
 
-	if (JSK_UNLIKELY(!obj))
-		return jsk_new_null();
+static void jsk_escape_char(char *dest, unsigned char c)
+{
+	static const char hex[] = "0123456789abcdef";
 
-	obj->heap = h;
-	obj->allocated = JSK_DEFAULT_OBJECT_SIZE;
-	obj->count = 0;
+	dest[0] = '\\';
+	dest[1] = jsk_escapes[c];
 
-	const unsigned bytes = obj->allocated * sizeof(jsk_object_entry);
-	obj->entries = (jsk_object_entry *)jsk_heap_alloc(h, bytes,
-			JSK_VALUE_ALIGN);
+	if (dest[1] == 'u') {
+		dest[2] = '0';
+		dest[3] = '0';
+		dest[4] = hex[c >> 4];
+		dest[5] = hex[c & 15];
+	}
+}
 
-	if (JSK_UNLIKELY(!obj->entries))
-		return jsk_new_null();
+/*
+ * Returns the offset of the first byte at or after p that needs escaping (or,
+ * if ascii is set, is non-ASCII), or len if there is none.
+ */
+static unsigned long long jsk_escape_scan_scalar(const char *const s,
+		unsigned long long len, unsigned long long p, int ascii)
+{
+	const jsk_u64 high = ascii ? JSK_HIGHS : 0;
 
-	memset(obj->entries, 0, bytes);
+	while (p + 8 <= len) {
+		jsk_u64 x;
+		memcpy(&x, &s[p], 8);
 
-	return (jsk_value){ JSK_OBJECT, obj };
-}
+		const jsk_u64 q = x ^ (JSK_ONES * '"');
+		const jsk_u64 b = x ^ (JSK_ONES * '\\');
+		const jsk_u64 f = x ^ (JSK_ONES * '/');
 
-static void jsk_object_insert_unsafe(jsk_object *obj,
-		char *name, jsk_value value)
-{
-	const jsk_u64 hash = JSK_HASH(name);
+		if (((((q - JSK_ONES) & ~q) | ((b - JSK_ONES) & ~b) |
+				((f - JSK_ONES) & ~f) |
+				((x - JSK_ONES * 0x20) & ~x)) & JSK_HIGHS) |
+				(x & high))
+			break;
 
-	jsk_u64 bucket = hash % obj->allocated;
+		p += 8;
+	}
 
-	while (obj->entries[bucket].hash != 0) {
-		bucket++;
-		if (bucket == obj->allocated)
-			bucket = 0;
+	for (; p < len; p++) {
+		const unsigned char c = s[p];
+		if (jsk_escapes[c] || (ascii && c >= 0x80))
+			return p;
 	}
 
+	return len;
+}
+
+/*
+ * Returns the offset of the first quote or backslash at or after p, or len if
+ * there is none. Bytes >= 0x80 before it are ORed into *high.
+ */
+static unsigned long long jsk_string_end_scalar(const char *const json,
+		unsigned long long len, unsigned long long p, jsk_u64 *high)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (p + 8 <= len) {
+		jsk_u64 x;
+		memcpy(&x, &json[p], 8);
+
+		const jsk_u64 q = x ^ (JSK_ONES * '"');
+		const jsk_u64 b = x ^ (JSK_ONES * '\\');
+		const jsk_u64 stop = (((q - JSK_ONES) & ~q) |
+				((b - JSK_ONES) & ~b)) & JSK_HIGHS;
+
+		/* Only bytes above the first match can be misflagged */
+		if (stop) {
+			*high |= x & JSK_HIGHS & ((stop & -stop) - 1);
+			return p + (__builtin_ctzll(stop) >> 3);
+		}
+
+		*high |= x & JSK_HIGHS;
+		p += 8;
+	}
+#endif
+
+	for (; p < len; p++) {
+		const unsigned char c = json[p];
+		if (c == '"' || c == '\\')
+			return p;
+		*high |= c & 0x80;
+	}
+
+	return p;
+}
+
+/*
+ * Returns the offset of the first byte in s that doesn't start a well-formed
+ * UTF-8 sequence, or n if all of s is valid.
+ */
+static unsigned long long jsk_utf8_find_error(const unsigned char *s,
+		unsigned long long n)
+{
+	unsigned long long p = 0;
+
+	while (p < n) {
+		while (p + 8 <= n) {
+			jsk_u64 x;
+			memcpy(&x, &s[p], 8);
+			if (x & JSK_HIGHS)
+				break;
+			p += 8;
+		}
+
+		if (p >= n)
+			break;
+
+		const unsigned len = jsk_utf8_sequence(&s[p], n - p);
+		if (JSK_UNLIKELY(!len))
+			return p;
+		p += len;
+	}
+
+	return n;
+}
+
+static int jsk_utf8_valid_scalar(const unsigned char *s, unsigned long long n)
+{
+	return jsk_utf8_find_error(s, n) == n;
+}
+
+#ifdef JSK_X86
+#define JSK_TARGET(isa) __attribute__((__target__(isa)))
+
+/*
+ * The SSE and AVX versions only differ in width. Each hands what is left
+ * after its last full block to a narrower kernel; the AVX ones keep to
+ * VEX-encoded code for that to avoid SSE/AVX transition stalls.
+ */
+#define JSK_STRING_END_BODY(vec, width, set1, loadu, vor, veq, vmask, next) \
+	const vec quote = set1('"');					\
+	const vec backslash = set1('\\');				\
+									\
+	while (p + width <= len) {					\
+		const vec x = loadu((const vec *)&json[p]);		\
+		const jsk_u64 hi = (unsigned)vmask(x);			\
+		const jsk_u64 stop = (unsigned)vmask(			\
+				vor(veq(x, quote), veq(x, backslash)));	\
+									\
+		if (stop) {						\
+			*high |= hi & ((stop & -stop) - 1);		\
+			return p + __builtin_ctzll(stop);		\
+		}							\
+									\
+		*high |= hi;						\
+		p += width;						\
+	}								\
+									\
+	return next(json, len, p, high)
+
+#define JSK_ESCAPE_SCAN_BODY(vec, width, set1, loadu, vor, veq, vmin, vmask, \
+		next)								\
+	const vec quote = set1('"');					\
+	const vec backslash = set1('\\');				\
+	const vec slash = set1('/');					\
+	const vec control = set1(0x1f);					\
+	const jsk_u64 high = ascii ? ~0ULL : 0;				\
+									\
+	while (p + width <= len) {					\
+		const vec x = loadu((const vec *)&s[p]);		\
+		const vec special = vor(				\
+				vor(veq(x, quote), veq(x, backslash)),	\
+				vor(veq(x, slash),			\
+					veq(vmin(x, control), x)));	\
+		const jsk_u64 mask = (unsigned)vmask(special) |		\
+			((unsigned)vmask(x) & high);			\
+									\
+		if (mask)						\
+			return p + __builtin_ctzll(mask);		\
+									\
+		p += width;						\
+	}								\
+									\
+	return next(s, len, p, ascii)
+
+JSK_TARGET("sse4.2")
+static unsigned long long jsk_string_end_sse42(const char *const json,
+		unsigned long long len, unsigned long long p, jsk_u64 *high)
+{
+	JSK_STRING_END_BODY(__m128i, 16, _mm_set1_epi8, _mm_loadu_si128,
+			_mm_or_si128, _mm_cmpeq_epi8, _mm_movemask_epi8,
+			jsk_string_end_scalar);
+}
+
+JSK_TARGET("avx2")
+static unsigned long long jsk_string_end_avx2_16(const char *const json,
+		unsigned long long len, unsigned long long p, jsk_u64 *high)
+{
+	JSK_STRING_END_BODY(__m128i, 16, _mm_set1_epi8, _mm_loadu_si128,
+			_mm_or_si128, _mm_cmpeq_epi8, _mm_movemask_epi8,
+			jsk_string_end_scalar);
+}
+
+JSK_TARGET("avx2")
+static unsigned long long jsk_string_end_avx2(const char *const json,
+		unsigned long long len, unsigned long long p, jsk_u64 *high)
+{
+	JSK_STRING_END_BODY(__m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256,
+			_mm256_or_si256, _mm256_cmpeq_epi8,
+			_mm256_movemask_epi8, jsk_string_end_avx2_16);
+}
+
+JSK_TARGET("avx512f,avx512bw")
+static unsigned long long jsk_string_end_avx512(const char *const json,
+		unsigned long long len, unsigned long long p, jsk_u64 *high)
+{
+	const __m512i quote = _mm512_set1_epi8('"');
+	const __m512i backslash = _mm512_set1_epi8('\\');
+
+	while (p + 64 <= len) {
+		const __m512i x = _mm512_loadu_si512((const void *)&json[p]);
+		const jsk_u64 hi = _mm512_movepi8_mask(x);
+		const jsk_u64 stop = _mm512_cmpeq_epi8_mask(x, quote) |
+			_mm512_cmpeq_epi8_mask(x, backslash);
+
+		if (stop) {
+			*high |= hi & ((stop & -stop) - 1);
+			return p + __builtin_ctzll(stop);
+		}
+
+		*high |= hi;
+		p += 64;
+	}
+
+	return jsk_string_end_avx2(json, len, p, high);
+}
+
+JSK_TARGET("sse4.2")
+static unsigned long long jsk_escape_scan_sse42(const char *const s,
+		unsigned long long len, unsigned long long p, int ascii)
+{
+	JSK_ESCAPE_SCAN_BODY(__m128i, 16, _mm_set1_epi8, _mm_loadu_si128,
+			_mm_or_si128, _mm_cmpeq_epi8, _mm_min_epu8,
+			_mm_movemask_epi8, jsk_escape_scan_scalar);
+}
+
+JSK_TARGET("avx2")
+static unsigned long long jsk_escape_scan_avx2_16(const char *const s,
+		unsigned long long len, unsigned long long p, int ascii)
+{
+	JSK_ESCAPE_SCAN_BODY(__m128i, 16, _mm_set1_epi8, _mm_loadu_si128,
+			_mm_or_si128, _mm_cmpeq_epi8, _mm_min_epu8,
+			_mm_movemask_epi8, jsk_escape_scan_scalar);
+}
+
+JSK_TARGET("avx2")
+static unsigned long long jsk_escape_scan_avx2(const char *const s,
+		unsigned long long len, unsigned long long p, int ascii)
+{
+	JSK_ESCAPE_SCAN_BODY(__m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256,
+			_mm256_or_si256, _mm256_cmpeq_epi8, _mm256_min_epu8,
+			_mm256_movemask_epi8, jsk_escape_scan_avx2_16);
+}
+
+JSK_TARGET("avx512f,avx512bw")
+static unsigned long long jsk_escape_scan_avx512(const char *const s,
+		unsigned long long len, unsigned long long p, int ascii)
+{
+	const __m512i quote = _mm512_set1_epi8('"');
+	const __m512i backslash = _mm512_set1_epi8('\\');
+	const __m512i slash = _mm512_set1_epi8('/');
+	const __m512i control = _mm512_set1_epi8(0x1f);
+	const jsk_u64 high = ascii ? ~0ULL : 0;
+
+	while (p + 64 <= len) {
+		const __m512i x = _mm512_loadu_si512((const void *)&s[p]);
+		const jsk_u64 mask = _mm512_cmpeq_epi8_mask(x, quote) |
+			_mm512_cmpeq_epi8_mask(x, backslash) |
+			_mm512_cmpeq_epi8_mask(x, slash) |
+			_mm512_cmple_epu8_mask(x, control) |
+			(_mm512_movepi8_mask(x) & high);
+
+		if (mask)
+			return p + __builtin_ctzll(mask);
+
+		p += 64;
+	}
+
+	return jsk_escape_scan_avx2(s, len, p, ascii);
+}
+
+#undef JSK_STRING_END_BODY
+#undef JSK_ESCAPE_SCAN_BODY
+
+/*
+ * The lookup algorithm from Keiser & Lemire, "Validating UTF-8 In Less Than
+ * One Instruction Per Byte": three table lookups on the high and low nibbles
+ * of each byte and the one before it classify every two-byte window, and a
+ * check on the bytes two and three back catches missing continuations.
+ */
+#define JSK_U8_TOO_SHORT	(1 << 0)
+#define JSK_U8_TOO_LONG		(1 << 1)
+#define JSK_U8_OVERLONG_3	(1 << 2)
+#define JSK_U8_TOO_LARGE	(1 << 3)
+#define JSK_U8_SURROGATE	(1 << 4)
+#define JSK_U8_OVERLONG_2	(1 << 5)
+#define JSK_U8_TOO_LARGE_1000	(1 << 6)
+#define JSK_U8_OVERLONG_4	(1 << 6)
+#define JSK_U8_TWO_CONTS	(1 << 7)
+#define JSK_U8_CARRY \
+	(JSK_U8_TOO_SHORT | JSK_U8_TOO_LONG | JSK_U8_TWO_CONTS)
+
+#define JSK_U8_BYTE_1_HIGH						\
+	JSK_U8_TOO_LONG, JSK_U8_TOO_LONG, JSK_U8_TOO_LONG,		\
+	JSK_U8_TOO_LONG, JSK_U8_TOO_LONG, JSK_U8_TOO_LONG,		\
+	JSK_U8_TOO_LONG, JSK_U8_TOO_LONG,				\
+	JSK_U8_TWO_CONTS, JSK_U8_TWO_CONTS, JSK_U8_TWO_CONTS,		\
+	JSK_U8_TWO_CONTS,						\
+	JSK_U8_TOO_SHORT | JSK_U8_OVERLONG_2,				\
+	JSK_U8_TOO_SHORT,						\
+	JSK_U8_TOO_SHORT | JSK_U8_OVERLONG_3 | JSK_U8_SURROGATE,	\
+	JSK_U8_TOO_SHORT | JSK_U8_TOO_LARGE | JSK_U8_TOO_LARGE_1000 |	\
+		JSK_U8_OVERLONG_4
+
+#define JSK_U8_TL (JSK_U8_CARRY | JSK_U8_TOO_LARGE | JSK_U8_TOO_LARGE_1000)
+
+#define JSK_U8_BYTE_1_LOW						\
+	JSK_U8_CARRY | JSK_U8_OVERLONG_3 | JSK_U8_OVERLONG_2 |		\
+		JSK_U8_OVERLONG_4,					\
+	JSK_U8_CARRY | JSK_U8_OVERLONG_2,				\
+	JSK_U8_CARRY,							\
+	JSK_U8_CARRY,							\
+	JSK_U8_CARRY | JSK_U8_TOO_LARGE,				\
+	JSK_U8_TL, JSK_U8_TL, JSK_U8_TL, JSK_U8_TL, JSK_U8_TL,		\
+	JSK_U8_TL, JSK_U8_TL, JSK_U8_TL,				\
+	JSK_U8_TL | JSK_U8_SURROGATE,					\
+	JSK_U8_TL, JSK_U8_TL
+
+#define JSK_U8_BYTE_2_HIGH						\
+	JSK_U8_TOO_SHORT, JSK_U8_TOO_SHORT, JSK_U8_TOO_SHORT,		\
+	JSK_U8_TOO_SHORT, JSK_U8_TOO_SHORT, JSK_U8_TOO_SHORT,		\
+	JSK_U8_TOO_SHORT, JSK_U8_TOO_SHORT,				\
+	JSK_U8_TOO_LONG | JSK_U8_OVERLONG_2 | JSK_U8_TWO_CONTS |	\
+		JSK_U8_OVERLONG_3 | JSK_U8_TOO_LARGE_1000 |		\
+		JSK_U8_OVERLONG_4,					\
+	JSK_U8_TOO_LONG | JSK_U8_OVERLONG_2 | JSK_U8_TWO_CONTS |	\
+		JSK_U8_OVERLONG_3 | JSK_U8_TOO_LARGE,			\
+	JSK_U8_TOO_LONG | JSK_U8_OVERLONG_2 | JSK_U8_TWO_CONTS |	\
+		JSK_U8_SURROGATE | JSK_U8_TOO_LARGE,			\
+	JSK_U8_TOO_LONG | JSK_U8_OVERLONG_2 | JSK_U8_TWO_CONTS |	\
+		JSK_U8_SURROGATE | JSK_U8_TOO_LARGE,			\
+	JSK_U8_TOO_SHORT, JSK_U8_TOO_SHORT, JSK_U8_TOO_SHORT,		\
+	JSK_U8_TOO_SHORT
+
+static const unsigned char jsk_u8_byte_1_high[16] = { JSK_U8_BYTE_1_HIGH };
+static const unsigned char jsk_u8_byte_1_low[16] = { JSK_U8_BYTE_1_LOW };
+static const unsigned char jsk_u8_byte_2_high[16] = { JSK_U8_BYTE_2_HIGH };
+
+JSK_TARGET("sse4.2")
+static __m128i jsk_utf8_block_sse42(__m128i input, __m128i prev_input)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i byte_1_high = _mm_loadu_si128(
+			(const __m128i *)jsk_u8_byte_1_high);
+	const __m128i byte_1_low = _mm_loadu_si128(
+			(const __m128i *)jsk_u8_byte_1_low);
+	const __m128i byte_2_high = _mm_loadu_si128(
+			(const __m128i *)jsk_u8_byte_2_high);
+
+	const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+	const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+	const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+	const __m128i sc = _mm_and_si128(_mm_and_si128(
+			_mm_shuffle_epi8(byte_1_high, _mm_and_si128(
+					_mm_srli_epi16(prev1, 4), nibble)),
+			_mm_shuffle_epi8(byte_1_low,
+				_mm_and_si128(prev1, nibble))),
+			_mm_shuffle_epi8(byte_2_high, _mm_and_si128(
+					_mm_srli_epi16(input, 4), nibble)));
+
+	/* Only bytes two back >= 0xe0 or three back >= 0xf0 end up >= 0x80 */
+	const __m128i must23 = _mm_or_si128(
+			_mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80)),
+			_mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80)));
+
+	return _mm_xor_si128(_mm_and_si128(must23,
+				_mm_set1_epi8((char)0x80)), sc);
+}
+
+JSK_TARGET("sse4.2")
+static int jsk_utf8_valid_sse42(const unsigned char *s, unsigned long long n)
+{
+	/* A lead byte this close to the end needs more bytes than are left */
+	const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, (char)(0xf0 - 1), (char)(0xe0 - 1),
+			(char)(0xc0 - 1));
+
+	__m128i error = _mm_setzero_si128();
+	__m128i prev = _mm_setzero_si128();
+	__m128i incomplete = _mm_setzero_si128();
+
+	for (unsigned long long p = 0; p < n; p += 16) {
+		__m128i input;
+
+		if (p + 16 <= n) {
+			input = _mm_loadu_si128((const __m128i *)&s[p]);
+		} else {
+			unsigned char tail[16] = { 0 };
+			memcpy(tail, &s[p], n - p);
+			input = _mm_loadu_si128((const __m128i *)tail);
+		}
+
+		if (!_mm_movemask_epi8(input)) {
+			error = _mm_or_si128(error, incomplete);
+			incomplete = _mm_setzero_si128();
+		} else {
+			error = _mm_or_si128(error,
+					jsk_utf8_block_sse42(input, prev));
+			incomplete = _mm_subs_epu8(input, max);
+		}
+
+		prev = input;
+	}
+
+	return _mm_testz_si128(_mm_or_si128(error, incomplete),
+			_mm_set1_epi8(-1));
+}
+
+JSK_TARGET("avx2")
+static __m256i jsk_utf8_block_avx2(__m256i input, __m256i prev_input)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i byte_1_high = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i *)jsk_u8_byte_1_high));
+	const __m256i byte_1_low = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i *)jsk_u8_byte_1_low));
+	const __m256i byte_2_high = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i *)jsk_u8_byte_2_high));
+
+	/* alignr works within 128-bit lanes, so line up the lane below */
+	const __m256i below = _mm256_permute2x128_si256(prev_input, input,
+			0x21);
+	const __m256i prev1 = _mm256_alignr_epi8(input, below, 15);
+	const __m256i prev2 = _mm256_alignr_epi8(input, below, 14);
+	const __m256i prev3 = _mm256_alignr_epi8(input, below, 13);
+
+	const __m256i sc = _mm256_and_si256(_mm256_and_si256(
+			_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(
+					_mm256_srli_epi16(prev1, 4), nibble)),
+			_mm256_shuffle_epi8(byte_1_low,
+				_mm256_and_si256(prev1, nibble))),
+			_mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(
+					_mm256_srli_epi16(input, 4), nibble)));
+
+	const __m256i must23 = _mm256_or_si256(
+			_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80)),
+			_mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80)));
+
+	return _mm256_xor_si256(_mm256_and_si256(must23,
+				_mm256_set1_epi8((char)0x80)), sc);
+}
+
+JSK_TARGET("avx2")
+static int jsk_utf8_valid_avx2(const unsigned char *s, unsigned long long n)
+{
+	const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, (char)(0xf0 - 1),
+			(char)(0xe0 - 1), (char)(0xc0 - 1));
+
+	__m256i error = _mm256_setzero_si256();
+	__m256i prev = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+
+	for (unsigned long long p = 0; p < n; p += 32) {
+		__m256i input;
+
+		if (p + 32 <= n) {
+			input = _mm256_loadu_si256((const __m256i *)&s[p]);
+		} else {
+			unsigned char tail[32] = { 0 };
+			memcpy(tail, &s[p], n - p);
+			input = _mm256_loadu_si256((const __m256i *)tail);
+		}
+
+		if (!_mm256_movemask_epi8(input)) {
+			error = _mm256_or_si256(error, incomplete);
+			incomplete = _mm256_setzero_si256();
+		} else {
+			error = _mm256_or_si256(error,
+					jsk_utf8_block_avx2(input, prev));
+			incomplete = _mm256_subs_epu8(input, max);
+		}
+
+		prev = input;
+	}
+
+	return _mm256_testz_si256(_mm256_or_si256(error, incomplete),
+			_mm256_set1_epi8(-1));
+}
+
+#undef JSK_U8_BYTE_1_HIGH
+#undef JSK_U8_BYTE_1_LOW
+#undef JSK_U8_BYTE_2_HIGH
+#undef JSK_U8_TL
+#endif /* JSK_X86 */
+
+typedef struct jsk_kernels {
+	unsigned long long (*string_end)(const char *const json,
+			unsigned long long len, unsigned long long p,
+			jsk_u64 *high);
+	unsigned long long (*escape_scan)(const char *const s,
+			unsigned long long len, unsigned long long p,
+			int ascii);
+	int (*utf8_valid)(const unsigned char *s, unsigned long long n);
+} jsk_kernels;
+
+/* Indexed by jsk_simd_level; AVX-512 reuses the AVX2 UTF-8 validator */
+static const jsk_kernels jsk_kernel_table[] = {
+	{ jsk_string_end_scalar, jsk_escape_scan_scalar,
+		jsk_utf8_valid_scalar },
+#ifdef JSK_X86
+	{ jsk_string_end_sse42, jsk_escape_scan_sse42, jsk_utf8_valid_sse42 },
+	{ jsk_string_end_avx2, jsk_escape_scan_avx2, jsk_utf8_valid_avx2 },
+	{ jsk_string_end_avx512, jsk_escape_scan_avx512, jsk_utf8_valid_avx2 },
+#endif
+};
+
+static const jsk_kernels *jsk_kernels_active;
+
+static jsk_simd_level jsk_simd_supported(void)
+{
+#ifdef JSK_X86
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_2) ||
+			!(c & bit_SSSE3))
+		return JSK_SIMD_SCALAR;
+
+	/* The OS has to save the wider registers too */
+	if (!(c & bit_OSXSAVE) || !(c & bit_AVX))
+		return JSK_SIMD_SSE42;
+
+	unsigned xcr0, xcr0_hi;
+	__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+
+	if ((xcr0 & 0x6) != 0x6 || !__get_cpuid_count(7, 0, &a, &b, &c, &d) ||
+			!(b & bit_AVX2))
+		return JSK_SIMD_SSE42;
+
+	if ((xcr0 & 0xe0) != 0xe0 || !(b & bit_AVX512F) ||
+			!(b & bit_AVX512BW))
+		return JSK_SIMD_AVX2;
+
+	return JSK_SIMD_AVX512;
+#else
+	return JSK_SIMD_SCALAR;
+#endif
+}
+
+static jsk_simd_level jsk_simd_clamp(jsk_simd_level level)
+{
+	const jsk_simd_level supported = jsk_simd_supported();
+
+	return (unsigned)level > (unsigned)supported ? supported : level;
+}
+
+JSK_EXPORT jsk_simd_level jsk_simd_set(jsk_simd_level level)
+{
+	level = jsk_simd_clamp(level);
+	__atomic_store_n(&jsk_kernels_active, &jsk_kernel_table[level],
+			__ATOMIC_RELEASE);
+	return level;
+}
+
+#ifndef JSK_NO_STDLIB
+/* Parses a JSK_SIMD name, leaving level alone if it isn't one */
+static int jsk_simd_parse(const char *const name, jsk_simd_level *level)
+{
+	static const char *const names[] = {
+		"scalar", "sse4.2", "avx2", "avx512",
+	};
+
+	for (unsigned i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (!strcmp(name, names[i])) {
+			*level = (jsk_simd_level)i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+static const jsk_kernels *jsk_kernels_init(void)
+{
+	jsk_simd_level level = JSK_SIMD_AVX512;
+
+#ifndef JSK_NO_STDLIB
+	const char *env = getenv("JSK_SIMD");
+	if (env)
+		jsk_simd_parse(env, &level);
+#endif
+
+	/* Only installed if nothing is yet, so jsk_simd_set() always wins */
+	const jsk_kernels *k = &jsk_kernel_table[jsk_simd_clamp(level)];
+	const jsk_kernels *expected = NULL;
+	if (!__atomic_compare_exchange_n(&jsk_kernels_active, &expected, k, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		k = expected;
+	return k;
+}
+
+static inline const jsk_kernels *jsk_kernels_get(void)
+{
+	const jsk_kernels *k = __atomic_load_n(&jsk_kernels_active,
+			__ATOMIC_ACQUIRE);
+
+	if (JSK_UNLIKELY(!k))
+		k = jsk_kernels_init();
+
+	return k;
+}
+
+JSK_EXPORT jsk_simd_level jsk_simd_get(void)
+{
+	return (jsk_simd_level)(jsk_kernels_get() - jsk_kernel_table);
+}
+
+static inline unsigned long long jsk_escape_scan(const char *const s,
+		unsigned long long len, unsigned long long p, int ascii)
+{
+	return jsk_kernels_get()->escape_scan(s, len, p, ascii);
+}
+
+static inline unsigned long long jsk_string_end(const char *const json,
+		unsigned long long len, unsigned long long p, jsk_u64 *high)
+{
+	return jsk_kernels_get()->string_end(json, len, p, high);
+}
+
+/* Offset of the first invalid UTF-8 byte in s, or n if there is none */
+static unsigned long long jsk_utf8_check(const unsigned char *s,
+		unsigned long long n)
+{
+	if (JSK_LIKELY(jsk_kernels_get()->utf8_valid(s, n)))
+		return n;
+
+	return jsk_utf8_find_error(s, n);
+}
+
+static void jsk_escape_u16(char *dest, unsigned v)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	dest[0] = '\\';
+	dest[1] = 'u';
+	dest[2] = hex[(v >> 12) & 15];
+	dest[3] = hex[(v >> 8) & 15];
+	dest[4] = hex[(v >> 4) & 15];
+	dest[5] = hex[v & 15];
+}
+
+/*
+ * Writes the UTF-8 sequence at s as \uXXXX (or a surrogate pair) into dest,
+ * returning the number of bytes written. Malformed input becomes U+FFFD.
+ */
+static unsigned jsk_escape_utf8(char *dest, const char *s,
+		unsigned long long n, unsigned *used)
+{
+	const unsigned char *u = (const unsigned char *)s;
+	unsigned cp;
+
+	*used = jsk_utf8_sequence(u, n);
+
+	switch (*used) {
+	case 0:
+		*used = 1;
+		cp = 0xfffd;
+		break;
+	case 1:
+		cp = u[0];
+		break;
+	case 2:
+		cp = ((u[0] & 0x1f) << 6) | (u[1] & 0x3f);
+		break;
+	case 3:
+		cp = ((u[0] & 0x0f) << 12) | ((u[1] & 0x3f) << 6) |
+			(u[2] & 0x3f);
+		break;
+	default:
+		cp = ((u[0] & 0x07) << 18) | ((u[1] & 0x3f) << 12) |
+			((u[2] & 0x3f) << 6) | (u[3] & 0x3f);
+		break;
+	}
+
+	if (cp < 0x10000) {
+		jsk_escape_u16(dest, cp);
+		return 6;
+	}
+
+	cp -= 0x10000;
+	jsk_escape_u16(dest, 0xd800 | (cp >> 10));
+	jsk_escape_u16(&dest[6], 0xdc00 | (cp & 0x3ff));
+	return 12;
+}
+
+/*
+ * Appends s to out with JSON escaping. Clean runs are found a block at a time
+ * and copied in one go; if ascii is set, non-ASCII characters are escaped too.
+ */
+static int jsk_write_escaped(jsk_heap *out, const char *s,
+		unsigned long long len, int ascii)
+{
+	unsigned long long start = 0, i = 0;
+
+	while ((i = jsk_escape_scan(s, len, i, ascii)) < len) {
+		const unsigned char c = s[i];
+		char buf[12];
+		unsigned n, used = 1;
+
+		if (c < 0x80) {
+			jsk_escape_char(buf, c);
+			n = jsk_escapes[c] == 'u' ? 6 : 2;
+		} else {
+			n = jsk_escape_utf8(buf, &s[i], len - i, &used);
+		}
+
+		if (jsk_heap_write(out, &s[start], i - start) ||
+				jsk_heap_write(out, buf, n))
+			return 1;
+
+		i += used;
+		start = i;
+	}
+
+	return jsk_heap_write(out, &s[start], len - start);
+}
+
+#define JSK_SKIP_ERROR (~0ULL)
+
+static unsigned long long jsk_validate_number(const char *const json,
+		unsigned long long len, unsigned long long p);
+
+static void jsk_lex(jsk_context *ctx)
+{
+	enum {
+		L_INV, /* invalid */
+		L_SKP, /* skip */
+		L_CHR, /* immediate character */
+		L_STR, /* string */
+		L_NUM, /* number */
+		L_FLS, /* false */
+		L_TRU, /* true */
+		L_NUL, /* null */
+	};
+
+	static const char dispatch[] = {
+		L_CHR, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
+		L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
+		L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
+		L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP, L_SKP,
+		L_SKP, L_INV, L_STR, L_INV, L_INV, L_INV, L_INV, L_INV,
+		L_CHR, L_CHR, L_INV, L_INV, L_CHR, L_NUM, L_INV, L_INV,
+		L_NUM, L_NUM, L_NUM, L_NUM, L_NUM, L_NUM, L_NUM, L_NUM,
+		L_NUM, L_NUM, L_CHR, L_INV, L_INV, L_INV, L_INV, L_INV,
+		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV,
+		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV,
+		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_INV,
+		L_INV, L_INV, L_INV, L_CHR, L_INV, L_CHR, L_INV, L_INV,
+		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_FLS, L_INV,
+		L_INV, L_INV, L_INV, L_INV, L_INV, L_INV, L_NUL, L_INV,
+		L_INV, L_INV, L_INV, L_INV, L_TRU, L_INV, L_INV, L_INV,
+		L_INV, L_INV, L_INV, L_CHR, L_INV, L_CHR, L_INV, L_SKP,
+	};
+
+lex_next:
+	ctx->start = ctx->ptr;
+
+	if (JSK_UNLIKELY(ctx->ptr == ctx->len)) {
+		ctx->tkn.type = JSKT_EOF;
+		return;
+	}
+
+	const char c = ctx->json[ctx->ptr];
+
+	if (JSK_UNLIKELY(c < 0)) {
+		ctx->tkn.type = JSKT_INVALID;
+		return;
+	}
+
+	switch (dispatch[(int)c]) {
+	case L_INV:
+		ctx->tkn.type = JSKT_INVALID;
+		return;
+
+	case L_SKP:
+		ctx->ptr++;
+		goto lex_next;
+
+	case L_CHR:
+		ctx->tkn.type = (jsk_token_type)c;
+		ctx->ptr++;
+		return;
+
+	case L_STR: {
+		unsigned long long p = ctx->ptr + 1;
+		jsk_u64 high = 0;
+
+		ctx->tkn.data = &ctx->json[p];
+
+		while (1) {
+			p = jsk_string_end(ctx->json, ctx->len, p, &high);
+
+			if (JSK_UNLIKELY(p >= ctx->len)) {
+				ctx->tkn.type = JSKT_INVALID;
+				ctx->ptr = ctx->len;
+				return;
+			}
+
+			if (ctx->json[p] == '"')
+				break;
+
+			/* Validated here so that unescaping can't fail */
+			unsigned used;
+			char scratch[4];
+
+			if (JSK_UNLIKELY(p + 1 >= ctx->len ||
+					!jsk_unescape(scratch, &ctx->json[p + 1],
+						ctx->len - p - 1, &used))) {
+				ctx->tkn.type = JSKT_INVALID;
+				ctx->ptr = p + 1;
+				return;
+			}
+
+			p += 1 + used;
+		}
+
+		ctx->tkn.len = &ctx->json[p] - ctx->tkn.data;
+
+		if (high) {
+			const unsigned long long bad = jsk_utf8_check(
+					(const unsigned char *)ctx->tkn.data,
+					ctx->tkn.len);
+
+			if (JSK_UNLIKELY(bad != (unsigned long long)ctx->tkn.len)) {
+				ctx->tkn.type = JSKT_INVALID;
+				ctx->ptr = ctx->tkn.data - ctx->json + bad + 1;
+				return;
+			}
+		}
+
+		ctx->tkn.type = JSKT_STRING;
+		ctx->ptr = p + 1;
+		return;
+	}
+
+	case L_NUM: {
+		if (JSK_UNLIKELY(ctx->opts != NULL) && ctx->opts->lazy_numbers) {
+			const unsigned long long end = jsk_validate_number(
+					ctx->json, ctx->len, ctx->ptr);
+			if (JSK_UNLIKELY(end == JSK_SKIP_ERROR)) {
+				ctx->tkn.type = JSKT_INVALID;
+				return;
+			}
+
+			ctx->tkn.type = JSKT_NUMBER;
+			ctx->tkn.data = (char *)&ctx->json[ctx->ptr];
+			ctx->tkn.len = end - ctx->ptr;
+			ctx->ptr = end;
+			return;
+		}
+
+		const char *const start = &ctx->json[ctx->ptr];
+
+		long long multiplier;
+		if (ctx->json[ctx->ptr] == '-') {
+			multiplier = -1;
+			ctx->ptr++;
+		} else {
+			multiplier = 1;
+		}
+
+		long long n = 0;
+		ctx->tkn.type = JSKT_INT;
+
+		/* 18 digits can't overflow; anything longer takes the slow path */
+		const unsigned long long first = ctx->ptr;
+		char digit;
+		while ((digit = ctx->json[ctx->ptr]) >= '0' && digit <= '9' &&
+				ctx->ptr - first < 18) {
+			n = n * 10 + digit - '0';
+			ctx->ptr++;
+		}
+
+		n *= multiplier;
+
+		double f = 0;
+		if (JSK_UNLIKELY(digit >= '0' && digit <= '9') || digit == '.' ||
+				digit == 'e' || digit == 'E') {
+			const char *end;
+			if (jsk_number_convert(start, &n, &f, &end) == JSK_FLOAT)
+				ctx->tkn.type = JSKT_FLOAT;
+			ctx->ptr = end - ctx->json;
+		}
+
+		if (ctx->tkn.type == JSKT_FLOAT)
+			ctx->tkn.data = (char *)*(void**)&f;
+		else
+			ctx->tkn.data = (char *)*(void**)&n;
+
+		ctx->tkn.len = 0;
+
+		return;
+	}
+
+	case L_FLS:
+		if (JSK_LIKELY(ctx->ptr + 4 < ctx->len &&
+					ctx->json[ctx->ptr + 1] == 'a' &&
+					ctx->json[ctx->ptr + 2] == 'l' &&
+					ctx->json[ctx->ptr + 3] == 's' &&
+					ctx->json[ctx->ptr + 4] == 'e')) {
+			ctx->tkn.type = JSKT_FALSE;
+			ctx->ptr += 5;
+		} else {
+			ctx->tkn.type = JSKT_INVALID;
+		}
+		return;
+
+	case L_TRU:
+		if (JSK_LIKELY(ctx->ptr + 3 < ctx->len &&
+					ctx->json[ctx->ptr + 1] == 'r' &&
+					ctx->json[ctx->ptr + 2] == 'u' &&
+					ctx->json[ctx->ptr + 3] == 'e')) {
+			ctx->tkn.type = JSKT_TRUE;
+			ctx->ptr += 4;
+		} else {
+			ctx->tkn.type = JSKT_INVALID;
+		}
+		return;
+
+	case L_NUL:
+		if (JSK_LIKELY(ctx->ptr + 3 < ctx->len &&
+					ctx->json[ctx->ptr + 1] == 'u' &&
+					ctx->json[ctx->ptr + 2] == 'l' &&
+					ctx->json[ctx->ptr + 3] == 'l')) {
+			ctx->tkn.type = JSKT_NULL;
+			ctx->ptr += 4;
+		} else {
+			ctx->tkn.type = JSKT_INVALID;
+		}
+		return;
+	}
+}
+
+#define jsk_success(v) ((jsk_result){ JSK_OK, { .value = v } })
+
+__attribute__((__format__ (__printf__, 2, 3)))
+static jsk_result jsk_error(jsk_context *ctx, const char *const fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	char *s = jsk_vprintf(ctx->heap, 1, fmt, args);
+	va_end(args);
+	return (jsk_result){ JSK_ERROR, { .error = s } };
+}
+
+JSK_EXPORT jsk_value jsk_new_int(long long v)
+{
+	return (jsk_value){ JSK_INT, *(void **)(&(v)) };
+}
+
+JSK_EXPORT jsk_value jsk_new_float(double f)
+{
+	return (jsk_value){ JSK_FLOAT, *(void **)(&(f)) };
+}
+
+JSK_EXPORT jsk_value jsk_new_number(jsk_heap *h, const char *const s,
+		unsigned len)
+{
+	jsk_number *num = (jsk_number *)jsk_heap_alloc(h,
+			sizeof(jsk_number) + len + 1, JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!num))
+		return jsk_new_null();
+
+	num->type = JSK_NUMBER;
+	memcpy(num->text, s, len);
+	num->text[len] = 0;
+	return (jsk_value){ JSK_NUMBER, num };
+}
+
+JSK_EXPORT jsk_value jsk_number_value(jsk_value v)
+{
+	if (v.type != JSK_NUMBER)
+		return v;
+
+	/*
+	 * Readers may race to fill in the cache, but they all store the same
+	 * bits, and the type is only published once they are in place.
+	 */
+	jsk_number *num = (jsk_number *)v.value;
+	jsk_type type = __atomic_load_n(&num->type, __ATOMIC_ACQUIRE);
+
+	if (type == JSK_NUMBER) {
+		long long i = 0;
+		double f = 0;
+		type = jsk_number_convert(num->text, &i, &f, NULL);
+
+		jsk_u64 bits;
+		if (type == JSK_INT)
+			memcpy(&bits, &i, sizeof(bits));
+		else
+			memcpy(&bits, &f, sizeof(bits));
+
+		__atomic_store_n(&num->cached.bits, bits, __ATOMIC_RELAXED);
+		__atomic_store_n(&num->type, type, __ATOMIC_RELEASE);
+
+		return type == JSK_INT ? jsk_new_int(i) : jsk_new_float(f);
+	}
+
+	const jsk_u64 bits = __atomic_load_n(&num->cached.bits,
+			__ATOMIC_RELAXED);
+
+	if (type == JSK_INT) {
+		long long i;
+		memcpy(&i, &bits, sizeof(i));
+		return jsk_new_int(i);
+	}
+
+	double f;
+	memcpy(&f, &bits, sizeof(f));
+	return jsk_new_float(f);
+}
+
+JSK_EXPORT long long jsk_as_int(jsk_value v)
+{
+	v = jsk_number_value(v);
+	switch (v.type) {
+	case JSK_INT:	return jsk_get_int(v);
+	case JSK_FLOAT:	return (long long)jsk_get_float(v);
+	default:	return 0;
+	}
+}
+
+JSK_EXPORT double jsk_as_float(jsk_value v)
+{
+	v = jsk_number_value(v);
+	switch (v.type) {
+	case JSK_INT:	return (double)jsk_get_int(v);
+	case JSK_FLOAT:	return jsk_get_float(v);
+	default:	return 0;
+	}
+}
+
+/*
+ * Unescapes a raw string span, as handed to SAX handlers, writing at most len
+ * bytes to dest and returning how many
+ */
+JSK_EXPORT unsigned jsk_unescape_string(char *JSK_RESTRICT dest,
+		const char *JSK_RESTRICT s, unsigned len)
+{
+	unsigned n = 0, src = 0;
+
+	while (src < len) {
+		if (s[src] == '\\') {
+			src++;
+			if (JSK_UNLIKELY(src >= len))
+				break;
+			unsigned used;
+			const unsigned b = jsk_unescape(&dest[n], &s[src],
+					len - src, &used);
+			if (JSK_UNLIKELY(b == 0))
+				break;
+			src += used;
+			n += b;
+		} else {
+			dest[n++] = s[src++];
+		}
+	}
+
+	return n;
+}
+
+JSK_EXPORT jsk_value jsk_new_string_escaped(jsk_heap *h, const char *const s,
+		unsigned len)
+{
+	char *mem = (char *)jsk_heap_alloc(h, len + 1, 1);
+	if (JSK_UNLIKELY(!mem))
+		return jsk_new_null();
+
+	mem[jsk_unescape_string(mem, s, len)] = 0;
+
+	return (jsk_value){ JSK_STRING, mem };
+}
+
+JSK_EXPORT jsk_value jsk_new_string_len(jsk_heap *h, const char *const s,
+		unsigned len)
+{
+	char *mem = (char *)jsk_heap_alloc(h, len + 1, 1);
+	if (JSK_UNLIKELY(!mem))
+		return jsk_new_null();
+	memcpy(mem, s, len);
+	mem[len] = 0;
+	return (jsk_value){ JSK_STRING, mem };
+}
+
+JSK_EXPORT jsk_value jsk_new_string(jsk_heap *h, const char *const s)
+{
+	return jsk_new_string_len(h, s, strlen(s));
+}
+
+#if JSK_DEFAULT_OBJECT_SIZE & (JSK_DEFAULT_OBJECT_SIZE - 1)
+#error "JSK_DEFAULT_OBJECT_SIZE must be a power of two"
+#endif
+
+JSK_EXPORT jsk_value jsk_new_object(jsk_heap *h)
+{
+	jsk_object *obj = (jsk_object *)jsk_heap_alloc(h, sizeof(jsk_object),
+			JSK_VALUE_ALIGN);
+
+	if (JSK_UNLIKELY(!obj))
+		return jsk_new_null();
+
+	obj->heap = h;
+	obj->allocated = JSK_DEFAULT_OBJECT_SIZE;
+	obj->count = 0;
+
+	const unsigned bytes = obj->allocated * sizeof(jsk_object_entry);
+	obj->entries = (jsk_object_entry *)jsk_heap_alloc(h, bytes,
+			JSK_VALUE_ALIGN);
+
+	if (JSK_UNLIKELY(!obj->entries))
+		return jsk_new_null();
+
+	memset(obj->entries, 0, bytes);
+
+	return (jsk_value){ JSK_OBJECT, obj };
+}
+
+static void jsk_object_place(jsk_object *obj, jsk_u64 hash,
+		char *name, jsk_value value)
+{
+	const jsk_u64 mask = obj->allocated - 1;
+	jsk_u64 bucket = hash & mask;
+
+	while (obj->entries[bucket].hash != 0)
+		bucket = (bucket + 1) & mask;
+
 	obj->entries[bucket] = (jsk_object_entry){
 		hash,
 		name,
@@ -791,368 +3024,5945 @@ static void jsk_object_insert_unsafe(jsk_object *obj,
 	};
 }
 
-static void jsk_object_grow_and_rehash(jsk_object *obj)
+static void jsk_object_insert_unsafe(jsk_object *obj,
+		char *name, jsk_value value)
+{
+	jsk_object_place(obj, jsk_hash_nonzero(JSK_HASH(name)), name, value);
+}
+
+static int jsk_object_grow_and_rehash(jsk_object *obj)
+{
+	jsk_object_entry *old = obj->entries;
+	const unsigned old_allocated = obj->allocated;
+
+	const unsigned bytes = 2 * old_allocated * sizeof(jsk_object_entry);
+	jsk_object_entry *entries = (jsk_object_entry *)jsk_heap_alloc(
+			obj->heap, bytes, JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!entries))
+		return 1;
+
+	memset(entries, 0, bytes);
+	obj->entries = entries;
+	obj->allocated *= 2;
+
+	obj->heap->abandoned += old_allocated * sizeof(jsk_object_entry);
+#ifdef JSK_PARSE_STATS
+	obj->heap->parse.rehashes++;
+#endif
+
+	for (unsigned i = 0; i < old_allocated; i++) {
+		if (old[i].hash == 0)
+			continue;
+		jsk_object_place(obj, old[i].hash, old[i].key, old[i].value);
+	}
+
+	return 0;
+}
+
+/* Returns non-zero, leaving the object as it was, if the heap is exhausted */
+static int jsk_object_add(jsk_object *obj, char *name, jsk_value value)
+{
+	const float load = (float)(obj->count + 1) / (float)obj->allocated;
+	if (JSK_UNLIKELY(load >= JSK_LOAD_FACTOR) &&
+			jsk_object_grow_and_rehash(obj))
+		return 1;
+
+	obj->count++;
+	jsk_object_insert_unsafe(obj, name, value);
+	return 0;
+}
+
+JSK_EXPORT void jsk_object_insert(jsk_value *object,
+		const char *const name, jsk_value value)
+{
+	jsk_object_add((jsk_object *)object->value, (char *)name, value);
+}
+
+JSK_EXPORT jsk_value *jsk_object_get(jsk_value object, const char *const name)
+{
+	jsk_object *obj = (jsk_object *)object.value;
+
+	const jsk_u64 hash = jsk_hash_nonzero(JSK_HASH(name));
+	const jsk_u64 mask = obj->allocated - 1;
+
+	jsk_u64 bucket = hash & mask;
+
+	while (1) {
+		jsk_object_entry *e = &obj->entries[bucket];
+
+		if (e->hash == hash && !strcmp(e->key, name))
+			return &e->value;
+		else if (e->hash == 0)
+			return NULL;
+
+		bucket = (bucket + 1) & mask;
+	}
+}
+
+static jsk_value *jsk_object_find(jsk_object *obj, jsk_u64 hash,
+		const char *const name, unsigned len)
+{
+	const jsk_u64 mask = obj->allocated - 1;
+
+	jsk_u64 bucket = hash & mask;
+
+	while (1) {
+		jsk_object_entry *e = &obj->entries[bucket];
+
+		if (e->hash == hash && !strncmp(e->key, name, len) &&
+				!e->key[len])
+			return &e->value;
+		else if (e->hash == 0)
+			return NULL;
+
+		bucket = (bucket + 1) & mask;
+	}
+}
+
+/* For names that aren't NUL-terminated, such as a std::string_view */
+JSK_EXPORT jsk_value *jsk_object_get_len(jsk_value object,
+		const char *const name, unsigned len)
+{
+	return jsk_object_find((jsk_object *)object.value,
+			jsk_hash_nonzero(JSK_HASH_LEN(name, len)), name, len);
+}
+
+JSK_EXPORT jsk_key jsk_key_make_len(const char *const name, unsigned len)
+{
+	jsk_key key;
+
+	key.name = name;
+	key.len = len;
+	key.hash = jsk_hash_nonzero(JSK_HASH_LEN(name, len));
+
+	return key;
+}
+
+JSK_EXPORT jsk_key jsk_key_make(const char *const name)
+{
+	return jsk_key_make_len(name, strlen(name));
+}
+
+JSK_EXPORT jsk_value *jsk_object_get_key(jsk_value object,
+		const jsk_key *key)
+{
+	return jsk_object_find((jsk_object *)object.value, key->hash,
+			key->name, key->len);
+}
+
+JSK_EXPORT jsk_object_iter jsk_object_iterate(jsk_value object)
+{
+	return (jsk_object_iter){ (jsk_object *)object.value, 0, };
+}
+
+JSK_EXPORT jsk_object_entry *jsk_object_next(jsk_object_iter *i)
+{
+	while (i->bucket < i->obj->allocated) {
+		if (i->obj->entries[i->bucket].hash) {
+			jsk_object_entry *e = &i->obj->entries[i->bucket];
+			i->bucket++;
+			return e;
+		}
+
+		i->bucket++;
+	}
+
+	return NULL;
+}
+
+JSK_EXPORT unsigned jsk_array_length(jsk_value array)
+{
+	return array.value ? ((unsigned *)array.value)[-1] : 0;
+}
+
+/*
+ * Makes room for one more element of the given size, returning its slot, or
+ * NULL with the array left as it was if the heap is exhausted. Packed and
+ * generic arrays share the [allocated, length] header before the elements.
+ */
+static void *jsk_array_slot(jsk_heap *h, jsk_value *array, unsigned size)
+{
+	if (array->value) {
+		char *vs = (char *)array->value;
+		const unsigned allocated = ((unsigned *)vs)[-2];
+		const unsigned len = ((unsigned *)vs)[-1];
+
+		if (JSK_LIKELY(len < allocated)) {
+			((unsigned *)vs)[-1]++;
+			return &vs[len * size];
+		}
+
+		const unsigned n = allocated * 2;
+		const unsigned b = 2 * sizeof(unsigned) + n * size;
+		unsigned *mem = (unsigned *)jsk_heap_alloc(h, b,
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!mem))
+			return NULL;
+		mem[0] = n;
+		mem[1] = len + 1;
+		char *new_vs = (char *)&mem[2];
+		memcpy(new_vs, vs, allocated * size);
+		array->value = new_vs;
+		h->abandoned += 2 * sizeof(unsigned) + allocated * size;
+		return &new_vs[allocated * size];
+	} else {
+		const unsigned n = JSK_DEFAULT_ARRAY_SIZE;
+		const unsigned b = 2 * sizeof(unsigned) + n * size;
+		unsigned *mem = (unsigned *)jsk_heap_alloc(h, b,
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!mem))
+			return NULL;
+		mem[0] = n;
+		mem[1] = 1;
+		array->value = &mem[2];
+		return &mem[2];
+	}
+}
+
+/* Rewrites a packed array as jsk_values */
+static int jsk_array_unpack(jsk_heap *h, jsk_value *array)
+{
+	if (!array->value) {
+		array->type = JSK_ARRAY;
+		return 0;
+	}
+
+	const unsigned allocated = ((unsigned *)array->value)[-2];
+	const unsigned len = ((unsigned *)array->value)[-1];
+	const unsigned b = 2 * sizeof(unsigned) + allocated * sizeof(jsk_value);
+	unsigned *mem = (unsigned *)jsk_heap_alloc(h, b, JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!mem))
+		return 1;
+
+	mem[0] = allocated;
+	mem[1] = len;
+	jsk_value *vs = (jsk_value *)&mem[2];
+	for (unsigned i = 0; i < len; i++)
+		vs[i] = jsk_array_get(*array, i);
+
+	h->abandoned += 2 * sizeof(unsigned) + allocated * sizeof(jsk_u64);
+	*array = (jsk_value){ JSK_ARRAY, vs };
+	return 0;
+}
+
+/* The value has already been checked to match the packed array's type */
+static void jsk_packed_store(void *slot, jsk_value array, jsk_value value)
+{
+	if (array.type == JSK_INT_ARRAY)
+		*(long long *)slot = jsk_get_int(value);
+	else
+		*(double *)slot = jsk_get_float(value);
+}
+
+/*
+ * Appends to any kind of array. With pack set, an empty JSK_ARRAY takes a
+ * first int or float as the start of a packed array. Returns non-zero if
+ * the heap is exhausted.
+ */
+static int jsk_array_add(jsk_heap *h, jsk_value *array, jsk_value value,
+		int pack)
+{
+	void *slot;
+
+	switch (array->type) {
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY:
+		if (JSK_LIKELY(value.type == (array->type == JSK_INT_ARRAY ?
+						JSK_INT : JSK_FLOAT)))
+			break;
+		if (jsk_array_unpack(h, array))
+			return 1;
+		return jsk_array_add(h, array, value, 0);
+
+	default:
+		if (pack && !array->value &&
+				(value.type == JSK_INT || value.type == JSK_FLOAT)) {
+			slot = jsk_array_slot(h, array, sizeof(jsk_u64));
+			if (JSK_UNLIKELY(!slot))
+				return 1;
+			array->type = value.type == JSK_INT ?
+				JSK_INT_ARRAY : JSK_FLOAT_ARRAY;
+			jsk_packed_store(slot, *array, value);
+			return 0;
+		}
+
+		slot = jsk_array_slot(h, array, sizeof(jsk_value));
+		if (JSK_UNLIKELY(!slot))
+			return 1;
+		*(jsk_value *)slot = value;
+		return 0;
+	}
+
+	slot = jsk_array_slot(h, array, sizeof(jsk_u64));
+	if (JSK_UNLIKELY(!slot))
+		return 1;
+	jsk_packed_store(slot, *array, value);
+	return 0;
+}
+
+JSK_EXPORT void jsk_array_push(jsk_heap *h, jsk_value *array, jsk_value value)
+{
+	jsk_array_add(h, array, value, 0);
+}
+
+JSK_EXPORT jsk_value jsk_array_get(jsk_value array, unsigned i)
+{
+	switch (array.type) {
+	case JSK_ARRAY:
+		return jsk_array_at(array, i);
+	case JSK_INT_ARRAY:
+		return jsk_new_int(((long long *)array.value)[i]);
+	case JSK_FLOAT_ARRAY:
+		return jsk_new_float(((double *)array.value)[i]);
+	default:
+		return jsk_new_null();
+	}
+}
+
+JSK_EXPORT long long *jsk_array_i64_data(jsk_value array, unsigned *len)
+{
+	if (array.type != JSK_INT_ARRAY)
+		return NULL;
+	*len = jsk_array_length(array);
+	return (long long *)array.value;
+}
+
+JSK_EXPORT double *jsk_array_f64_data(jsk_value array, unsigned *len)
+{
+	if (array.type != JSK_FLOAT_ARRAY)
+		return NULL;
+	*len = jsk_array_length(array);
+	return (double *)array.value;
+}
+
+static int jsk_clone_into(jsk_heap *h, jsk_value v, jsk_value *out)
+{
+	switch (v.type) {
+	case JSK_STRING: {
+		const char *s = jsk_get_string(v);
+		const unsigned len = strlen(s) + 1;
+		char *mem = (char *)jsk_heap_alloc(h, len, 1);
+		if (JSK_UNLIKELY(!mem))
+			return 1;
+		memcpy(mem, s, len);
+		*out = (jsk_value){ JSK_STRING, mem };
+		return 0;
+	}
+
+	case JSK_ARRAY: {
+		const unsigned len = jsk_array_length(v);
+		*out = jsk_new_array();
+		if (!len)
+			return 0;
+
+		const unsigned b = 2 * sizeof(unsigned) + len * sizeof(jsk_value);
+		unsigned *mem = (unsigned *)jsk_heap_alloc(h, b,
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!mem))
+			return 1;
+
+		mem[0] = len;
+		mem[1] = len;
+		jsk_value *vs = (jsk_value *)&mem[2];
+		for (unsigned i = 0; i < len; i++)
+			if (jsk_clone_into(h, jsk_array_at(v, i), &vs[i]))
+				return 1;
+
+		out->value = vs;
+		return 0;
+	}
+
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY: {
+		const unsigned len = jsk_array_length(v);
+		*out = (jsk_value){ v.type, NULL };
+		if (!len)
+			return 0;
+
+		const unsigned b = 2 * sizeof(unsigned) + len * sizeof(jsk_u64);
+		unsigned *mem = (unsigned *)jsk_heap_alloc(h, b,
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!mem))
+			return 1;
+
+		mem[0] = len;
+		mem[1] = len;
+		memcpy(&mem[2], v.value, len * sizeof(jsk_u64));
+		out->value = &mem[2];
+		return 0;
+	}
+
+	case JSK_OBJECT: {
+		const jsk_object *src = jsk_get_object(v);
+
+		/* The smallest table that stays under the load factor */
+		unsigned n = 1;
+		while ((float)src->count / (float)n >= JSK_LOAD_FACTOR)
+			n *= 2;
+
+		jsk_object *obj = (jsk_object *)jsk_heap_alloc(h,
+				sizeof(jsk_object), JSK_VALUE_ALIGN);
+		const unsigned bytes = n * sizeof(jsk_object_entry);
+		jsk_object_entry *entries = (jsk_object_entry *)
+			jsk_heap_alloc(h, bytes, JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!obj || !entries))
+			return 1;
+
+		memset(entries, 0, bytes);
+		*obj = (jsk_object){ h, n, src->count, entries };
+
+		for (unsigned i = 0; i < src->allocated; i++) {
+			const jsk_object_entry *e = &src->entries[i];
+			if (!e->hash)
+				continue;
+
+			const unsigned len = strlen(e->key) + 1;
+			char *key = (char *)jsk_heap_alloc(h, len, 1);
+			jsk_value value;
+			if (JSK_UNLIKELY(!key) ||
+					jsk_clone_into(h, e->value, &value))
+				return 1;
+
+			memcpy(key, e->key, len);
+			jsk_object_place(obj, e->hash, key, value);
+		}
+
+		*out = (jsk_value){ JSK_OBJECT, obj };
+		return 0;
+	}
+
+	case JSK_NUMBER: {
+		const char *s = jsk_get_number(v);
+		*out = jsk_new_number(h, s, strlen(s));
+		return out->type == JSK_NULL;
+	}
+
+	default:
+		*out = v;
+		return 0;
+	}
+}
+
+JSK_EXPORT jsk_value jsk_clone(jsk_heap *h, jsk_value v)
+{
+	jsk_value out;
+	if (JSK_UNLIKELY(jsk_clone_into(h, v, &out)))
+		return jsk_new_null();
+	return out;
+}
+
+JSK_EXPORT jsk_status jsk_compact(jsk_heap **heap, jsk_value *v)
+{
+	jsk_heap *h = jsk_heap_new((*heap)->ctx);
+	if (JSK_UNLIKELY(!h))
+		return JSK_ERROR;
+
+	jsk_value out;
+	if (JSK_UNLIKELY(jsk_clone_into(h, *v, &out))) {
+		jsk_heap_free(h);
+		return JSK_ERROR;
+	}
+
+	jsk_heap_free(*heap);
+	*heap = h;
+	*v = out;
+	return JSK_OK;
+}
+
+static jsk_result jsk_expected(jsk_context *ctx, const char *const what)
+{
+	return jsk_error(ctx, "Expected %s at index %llu but found %s",
+			what, ctx->ptr - 1, jsk_token_name(ctx->tkn.type));
+}
+
+#define JSK_EMIT(cb, args)					\
+	do {							\
+		if (h->cb && JSK_UNLIKELY(h->cb args))		\
+			return jsk_aborted(ctx);		\
+	} while (0)
+
+static jsk_result jsk_aborted(jsk_context *ctx)
+{
+	return jsk_error(ctx, "Aborted by handler at index %llu",
+			ctx->ptr - 1);
+}
+
+/* Converts a lazy number for handlers that have no number callback */
+static jsk_result jsk_emit_number(jsk_context *ctx, const jsk_handler *h,
+		void *user)
+{
+	char buf[64];
+	char *s = buf;
+	const unsigned len = ctx->tkn.len;
+
+	if (JSK_UNLIKELY(len >= sizeof(buf))) {
+		s = (char *)jsk_heap_alloc(ctx->heap, len + 1, 1);
+		if (JSK_UNLIKELY(!s))
+			return jsk_error(ctx, "Out of memory at index %llu",
+					ctx->start);
+	}
+
+	memcpy(s, ctx->tkn.data, len);
+	s[len] = 0;
+
+	long long i;
+	double f;
+	if (jsk_number_convert(s, &i, &f, NULL) == JSK_INT)
+		JSK_EMIT(integer, (user, i));
+	else
+		JSK_EMIT(floating, (user, f));
+
+	return jsk_success(jsk_new_null());
+}
+
+static jsk_result jsk_limit(jsk_context *ctx, const char *const what,
+		unsigned long long limit)
+{
+	jsk_result res = jsk_error(ctx, "%s limit of %llu exceeded at index %llu",
+			what, limit, ctx->start);
+	res.status = JSK_LIMIT;
+	return res;
+}
+
+#ifdef JSK_PARSE_STATS
+#define JSK_COUNT(stat) (ctx->heap->parse.stat++)
+#define JSK_COUNT_DEPTH()						\
+	do {								\
+		if (ctx->depth > ctx->heap->parse.max_depth)		\
+			ctx->heap->parse.max_depth = ctx->depth;	\
+	} while (0)
+#else
+#define JSK_COUNT(stat) ((void)0)
+#define JSK_COUNT_DEPTH() ((void)0)
+#endif
+
+#define JSK_CHECK_LIMIT(field, n, what)					\
+	do {								\
+		if (JSK_UNLIKELY(ctx->opts != NULL) &&			\
+				ctx->opts->field && (n) > ctx->opts->field) \
+			return jsk_limit(ctx, what, ctx->opts->field);	\
+	} while (0)
+
+static jsk_result jsk_parse_value(jsk_context *ctx, const jsk_handler *h,
+		void *user)
+{
+	switch (ctx->tkn.type) {
+	case JSKT_INT:
+		jsk_verbose("D INT %lld @ %llu\n",
+				*(long long *)&ctx->tkn.data, ctx->ptr);
+		JSK_CHECK_LIMIT(max_number_length, ctx->ptr - ctx->start,
+				"Number length");
+		JSK_COUNT(integers);
+		JSK_EMIT(integer, (user, *(long long *)&ctx->tkn.data));
+		jsk_lex(ctx);
+		return jsk_success(jsk_new_null());
+
+	case JSKT_FLOAT:
+		jsk_verbose("D FLT %f @ %llu\n",
+				*(double *)&ctx->tkn.data, ctx->ptr);
+		JSK_CHECK_LIMIT(max_number_length, ctx->ptr - ctx->start,
+				"Number length");
+		JSK_COUNT(floats);
+		JSK_EMIT(floating, (user, *(double *)&ctx->tkn.data));
+		jsk_lex(ctx);
+		return jsk_success(jsk_new_null());
+
+	case JSKT_NUMBER:
+		jsk_verbose("D NUM %.*s @ %llu\n", ctx->tkn.len,
+				ctx->tkn.data, ctx->ptr);
+		JSK_CHECK_LIMIT(max_number_length, (unsigned)ctx->tkn.len,
+				"Number length");
+		JSK_COUNT(numbers);
+		if (h->number) {
+			JSK_EMIT(number, (user, ctx->tkn.data, ctx->tkn.len));
+		} else if (h->integer || h->floating) {
+			jsk_result res = jsk_emit_number(ctx, h, user);
+			if (res.status != JSK_OK)
+				return res;
+		}
+		jsk_lex(ctx);
+		return jsk_success(jsk_new_null());
+
+	case JSKT_STRING:
+		jsk_verbose("D STR %.*s @ %llu\n", ctx->tkn.len,
+				ctx->tkn.data, ctx->ptr);
+		JSK_CHECK_LIMIT(max_string_length, (unsigned)ctx->tkn.len,
+				"String length");
+		JSK_COUNT(strings);
+		JSK_EMIT(string, (user, ctx->tkn.data, ctx->tkn.len));
+		jsk_lex(ctx);
+		return jsk_success(jsk_new_null());
+
+	case JSKT_TRUE:
+		jsk_verbose("D TRUE @ %llu\n", ctx->ptr);
+		JSK_COUNT(booleans);
+		JSK_EMIT(boolean, (user, 1));
+		jsk_lex(ctx);
+		return jsk_success(jsk_new_null());
+
+	case JSKT_FALSE:
+		jsk_verbose("D FALSE @ %llu\n", ctx->ptr);
+		JSK_COUNT(booleans);
+		JSK_EMIT(boolean, (user, 0));
+		jsk_lex(ctx);
+		return jsk_success(jsk_new_null());
+
+	case JSKT_NULL:
+		jsk_verbose("D NULL @ %llu\n", ctx->ptr);
+		JSK_COUNT(nulls);
+		JSK_EMIT(null, (user));
+		jsk_lex(ctx);
+		return jsk_success(jsk_new_null());
+
+	case JSKT_LBRACK: {
+		jsk_verbose("D ARRAY @ %llu\n", ctx->ptr);
+
+		JSK_CHECK_LIMIT(max_depth, ctx->depth + 1, "Nesting depth");
+		JSK_COUNT(arrays);
+		JSK_EMIT(start_array, (user));
+		ctx->depth++;
+		JSK_COUNT_DEPTH();
+
+		unsigned count = 0;
+
+		do {
+			jsk_lex(ctx);
+
+			if (JSK_UNLIKELY(ctx->tkn.type == JSKT_RBRACK))
+				break;
+
+			JSK_CHECK_LIMIT(max_elements, count + 1,
+					"Element count");
+
+			jsk_result res = jsk_parse_value(ctx, h, user);
+			if (res.status != JSK_OK)
+				return res;
+
+			count++;
+		} while (ctx->tkn.type == JSKT_COMMA);
+
+		if (ctx->tkn.type != JSKT_RBRACK)
+			return jsk_expected(ctx, "']' after array");
+
+		JSK_EMIT(end_array, (user, count));
+		ctx->depth--;
+
+		jsk_lex(ctx);
+
+		return jsk_success(jsk_new_null());
+	}
+
+	case JSKT_LBRACE: {
+		jsk_verbose("D OBJECT @ %llu\n", ctx->ptr);
+
+		JSK_CHECK_LIMIT(max_depth, ctx->depth + 1, "Nesting depth");
+		JSK_COUNT(objects);
+		JSK_EMIT(start_object, (user));
+		ctx->depth++;
+		JSK_COUNT_DEPTH();
+
+		unsigned count = 0;
+
+		do {
+			jsk_lex(ctx);
+
+			if (JSK_UNLIKELY(ctx->tkn.type == JSKT_RBRACE))
+				break;
+
+			if (ctx->tkn.type != JSKT_STRING)
+				return jsk_expected(ctx, "object key");
+
+			jsk_verbose("D OBJECT KEY %.*s @ %llu\n",
+					ctx->tkn.len, ctx->tkn.data, ctx->ptr);
+
+			JSK_CHECK_LIMIT(max_string_length, (unsigned)ctx->tkn.len,
+					"String length");
+
+			JSK_COUNT(keys);
+			JSK_EMIT(key, (user, ctx->tkn.data, ctx->tkn.len));
+
+			jsk_lex(ctx);
+
+			if (ctx->tkn.type != JSKT_COLON)
+				return jsk_expected(ctx, "':'");
+
+			jsk_lex(ctx);
+
+			JSK_CHECK_LIMIT(max_elements, count + 1,
+					"Element count");
+
+			jsk_result res = jsk_parse_value(ctx, h, user);
+			if (res.status != JSK_OK)
+				return res;
+
+			count++;
+		} while (ctx->tkn.type == JSKT_COMMA);
+
+		if (ctx->tkn.type != JSKT_RBRACE)
+			return jsk_expected(ctx, "'}' after object");
+
+		JSK_EMIT(end_object, (user, count));
+		ctx->depth--;
+
+		jsk_lex(ctx);
+
+		return jsk_success(jsk_new_null());
+	}
+
+	default:
+		return jsk_error(ctx, "Unexpected %s at index %llu",
+			jsk_token_name(ctx->tkn.type), ctx->ptr - 1);
+	}
+}
+
+#undef JSK_CHECK_LIMIT
+#undef JSK_COUNT_DEPTH
+#undef JSK_COUNT
+#undef JSK_EMIT
+
+/*
+ * Schema nodes 0 and 1 are the true and false schemas. A node that turns out
+ * not to constrain anything is replaced by node 0, so the validator can skip
+ * the values it covers wholesale.
+ */
+#define JSK_SCHEMA_ANY  0
+#define JSK_SCHEMA_NONE 1
+
+#define JSK_SCHEMA_T_NULL    (1 << 0)
+#define JSK_SCHEMA_T_BOOLEAN (1 << 1)
+#define JSK_SCHEMA_T_INTEGER (1 << 2)
+#define JSK_SCHEMA_T_NUMBER  (1 << 3)
+#define JSK_SCHEMA_T_STRING  (1 << 4)
+#define JSK_SCHEMA_T_ARRAY   (1 << 5)
+#define JSK_SCHEMA_T_OBJECT  (1 << 6)
+#define JSK_SCHEMA_T_ALL     ((1 << 7) - 1)
+
+#define JSK_SCHEMA_MINIMUM           (1 << 0)
+#define JSK_SCHEMA_MAXIMUM           (1 << 1)
+#define JSK_SCHEMA_EXCLUSIVE_MINIMUM (1 << 2)
+#define JSK_SCHEMA_EXCLUSIVE_MAXIMUM (1 << 3)
+
+typedef struct jsk_schema_compiler {
+	jsk_heap *heap;
+	jsk_schema_node *nodes;
+	unsigned count;
+	unsigned allocated;
+	unsigned depth;
+	char *error;
+} jsk_schema_compiler;
+
+static const char *const jsk_schema_type_names[] = {
+	"null", "boolean", "integer", "number", "string", "array", "object",
+};
+
+static const char *const jsk_schema_annotations[] = {
+	"$schema", "$id", "$comment", "title", "description", "default",
+	"examples", "format", "readOnly", "writeOnly", "deprecated",
+};
+
+__attribute__((__format__ (__printf__, 2, 3)))
+static long long jsk_schema_error(jsk_schema_compiler *c,
+		const char *const fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	c->error = jsk_vprintf(c->heap, 1, fmt, args);
+	va_end(args);
+	return -1;
+}
+
+static long long jsk_schema_new_node(jsk_schema_compiler *c)
+{
+	if (c->count == c->allocated) {
+		const unsigned n = c->allocated ? c->allocated * 2 : 16;
+		jsk_schema_node *nodes = (jsk_schema_node *)jsk_heap_alloc(
+				c->heap, n * sizeof(jsk_schema_node),
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!nodes))
+			return jsk_schema_error(c, "Out of memory");
+		if (c->count)
+			memcpy(nodes, c->nodes,
+					c->count * sizeof(jsk_schema_node));
+		c->heap->abandoned += c->allocated * sizeof(jsk_schema_node);
+		c->nodes = nodes;
+		c->allocated = n;
+	}
+
+	jsk_schema_node *n = &c->nodes[c->count];
+	memset(n, 0, sizeof(*n));
+	n->types = JSK_SCHEMA_T_ALL;
+	n->max_length = (unsigned)-1;
+	n->max_items = (unsigned)-1;
+	n->max_properties = (unsigned)-1;
+	n->enums = jsk_new_null();
+	n->properties = jsk_new_null();
+	return c->count++;
+}
+
+static int jsk_schema_type_bit(const char *name)
+{
+	for (unsigned i = 0; i < sizeof(jsk_schema_type_names) /
+			sizeof(*jsk_schema_type_names); i++)
+		if (!strcmp(name, jsk_schema_type_names[i]))
+			return 1 << i;
+	return 0;
+}
+
+static int jsk_schema_is_number(jsk_value v)
+{
+	return v.type == JSK_INT || v.type == JSK_FLOAT ||
+		v.type == JSK_NUMBER;
+}
+
+static int jsk_schema_count(jsk_schema_compiler *c, const char *key,
+		jsk_value v, unsigned *out)
+{
+	v = jsk_number_value(v);
+	if (v.type != JSK_INT || jsk_get_int(v) < 0) {
+		jsk_schema_error(c, "Schema keyword \"%s\" must be a "
+				"non-negative integer", key);
+		return 1;
+	}
+	*out = jsk_get_int(v) > (long long)(unsigned)-1 ?
+		(unsigned)-1 : (unsigned)jsk_get_int(v);
+	return 0;
+}
+
+static long long jsk_schema_compile_node(jsk_schema_compiler *c,
+		jsk_value v, unsigned depth);
+
+/*
+ * Property values are packed as child | (required bit + 1) << 32. A key that
+ * is only required starts out with the additionalProperties schema, which is
+ * final by then since required is compiled last.
+ */
+static jsk_value *jsk_schema_property(jsk_schema_compiler *c, unsigned node,
+		const char *key)
+{
+	jsk_schema_node *n = &c->nodes[node];
+
+	if (n->properties.type != JSK_OBJECT)
+		n->properties = jsk_new_object(c->heap);
+
+	jsk_value *e = jsk_object_get(n->properties, key);
+	if (e)
+		return e;
+
+	const jsk_value name = jsk_new_string(c->heap, key);
+	if (JSK_UNLIKELY(name.type != JSK_STRING))
+		return NULL;
+	jsk_object_insert(&n->properties, jsk_get_string(name),
+			jsk_new_int(n->additional));
+	return jsk_object_get(n->properties, key);
+}
+
+static int jsk_schema_keyword(jsk_schema_compiler *c, unsigned node,
+		const char *key, jsk_value v, unsigned depth)
+{
+	jsk_schema_node *n = &c->nodes[node];
+
+	if (!strcmp(key, "type")) {
+		const unsigned count = v.type == JSK_ARRAY ?
+			jsk_array_length(v) : 1;
+		n->types = 0;
+		for (unsigned i = 0; i < count; i++) {
+			const jsk_value t = v.type == JSK_ARRAY ?
+				jsk_array_at(v, i) : v;
+			const int bit = t.type == JSK_STRING ?
+				jsk_schema_type_bit(jsk_get_string(t)) : 0;
+			if (!bit)
+				return jsk_schema_error(c, "Invalid schema "
+						"type") < 0;
+			n->types |= bit;
+		}
+		/* Integers are numbers too */
+		if (n->types & JSK_SCHEMA_T_NUMBER)
+			n->types |= JSK_SCHEMA_T_INTEGER;
+		return 0;
+	}
+
+	if (!strcmp(key, "enum") || !strcmp(key, "const")) {
+		jsk_value e = v;
+		if (key[0] == 'c') {
+			e = jsk_new_array();
+			jsk_array_push(c->heap, &e, v);
+		} else if (!jsk_is_array(v)) {
+			return jsk_schema_error(c, "Schema keyword \"enum\" "
+					"must be an array") < 0;
+		}
+
+		for (unsigned i = 0; i < jsk_array_length(e); i++) {
+			const jsk_value x = jsk_array_get(e, i);
+			if (x.type == JSK_OBJECT || jsk_is_array(x))
+				return jsk_schema_error(c, "Unsupported "
+						"container in schema \"%s\"",
+						key) < 0;
+		}
+
+		n->enums = jsk_clone(c->heap, e);
+		return 0;
+	}
+
+	static const struct {
+		const char *key;
+		unsigned flag;
+	} bounds[] = {
+		{ "minimum", JSK_SCHEMA_MINIMUM },
+		{ "maximum", JSK_SCHEMA_MAXIMUM },
+		{ "exclusiveMinimum", JSK_SCHEMA_EXCLUSIVE_MINIMUM },
+		{ "exclusiveMaximum", JSK_SCHEMA_EXCLUSIVE_MAXIMUM },
+	};
+
+	for (unsigned i = 0; i < sizeof(bounds) / sizeof(*bounds); i++) {
+		if (strcmp(key, bounds[i].key))
+			continue;
+		if (!jsk_schema_is_number(v))
+			return jsk_schema_error(c, "Schema keyword \"%s\" "
+					"must be a number", key) < 0;
+		const double d = jsk_as_float(v);
+		switch (bounds[i].flag) {
+		case JSK_SCHEMA_MINIMUM:	n->minimum = d;		break;
+		case JSK_SCHEMA_MAXIMUM:	n->maximum = d;		break;
+		case JSK_SCHEMA_EXCLUSIVE_MINIMUM:
+			n->exclusive_minimum = d;
+			break;
+		default:
+			n->exclusive_maximum = d;
+			break;
+		}
+		n->bounds |= bounds[i].flag;
+		return 0;
+	}
+
+	if (!strcmp(key, "minLength"))
+		return jsk_schema_count(c, key, v, &n->min_length);
+	if (!strcmp(key, "maxLength"))
+		return jsk_schema_count(c, key, v, &n->max_length);
+	if (!strcmp(key, "minItems"))
+		return jsk_schema_count(c, key, v, &n->min_items);
+	if (!strcmp(key, "maxItems"))
+		return jsk_schema_count(c, key, v, &n->max_items);
+	if (!strcmp(key, "minProperties"))
+		return jsk_schema_count(c, key, v, &n->min_properties);
+	if (!strcmp(key, "maxProperties"))
+		return jsk_schema_count(c, key, v, &n->max_properties);
+
+	if (!strcmp(key, "properties")) {
+		if (v.type != JSK_OBJECT)
+			return jsk_schema_error(c, "Schema keyword "
+					"\"properties\" must be an object") < 0;
+
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it))) {
+			const long long child = jsk_schema_compile_node(c,
+					e->value, depth + 1);
+			if (child < 0)
+				return 1;
+			jsk_value *p = jsk_schema_property(c, node, e->key);
+			if (JSK_UNLIKELY(!p))
+				return jsk_schema_error(c, "Out of memory") < 0;
+			*p = jsk_new_int(child);
+		}
+		return 0;
+	}
+
+	if (!strcmp(key, "additionalProperties") || !strcmp(key, "items")) {
+		if (v.type != JSK_OBJECT && v.type != JSK_BOOL)
+			return jsk_schema_error(c, "Unsupported schema "
+					"\"%s\"", key) < 0;
+		const long long child = jsk_schema_compile_node(c, v,
+				depth + 1);
+		if (child < 0)
+			return 1;
+		if (key[0] == 'a')
+			c->nodes[node].additional = child;
+		else
+			c->nodes[node].items = child;
+		return 0;
+	}
+
+	for (unsigned i = 0; i < sizeof(jsk_schema_annotations) /
+			sizeof(*jsk_schema_annotations); i++)
+		if (!strcmp(key, jsk_schema_annotations[i]))
+			return 0;
+
+	return jsk_schema_error(c, "Unsupported schema keyword \"%s\"",
+			key) < 0;
+}
+
+static int jsk_schema_required(jsk_schema_compiler *c, unsigned node,
+		jsk_value v)
+{
+	if (v.type != JSK_ARRAY)
+		return jsk_schema_error(c, "Schema keyword \"required\" must "
+				"be an array") < 0;
+
+	const unsigned count = jsk_array_length(v);
+	if (count > 64)
+		return jsk_schema_error(c, "Too many required keys") < 0;
+
+	const char **names = (const char **)jsk_heap_alloc(c->heap,
+			(count ? count : 1) * sizeof(char *), JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!names))
+		return jsk_schema_error(c, "Out of memory") < 0;
+
+	for (unsigned i = 0; i < count; i++) {
+		const jsk_value name = jsk_array_at(v, i);
+		if (name.type != JSK_STRING)
+			return jsk_schema_error(c, "Required keys must be "
+					"strings") < 0;
+
+		jsk_value *p = jsk_schema_property(c, node,
+				jsk_get_string(name));
+		if (JSK_UNLIKELY(!p))
+			return jsk_schema_error(c, "Out of memory") < 0;
+		*p = jsk_new_int(jsk_get_int(*p) | (long long)(i + 1) << 32);
+		names[i] = jsk_get_string(name);
+	}
+
+	c->nodes[node].required = names;
+	c->nodes[node].required_count = count;
+	return 0;
+}
+
+static int jsk_schema_unconstrained(const jsk_schema_node *n)
+{
+	return n->types == JSK_SCHEMA_T_ALL && !n->bounds &&
+		!n->min_length && n->max_length == (unsigned)-1 &&
+		!n->min_items && n->max_items == (unsigned)-1 &&
+		!n->min_properties && n->max_properties == (unsigned)-1 &&
+		n->enums.type == JSK_NULL && n->properties.type == JSK_NULL &&
+		n->additional == JSK_SCHEMA_ANY && n->items == JSK_SCHEMA_ANY;
+}
+
+static long long jsk_schema_compile_node(jsk_schema_compiler *c,
+		jsk_value v, unsigned depth)
+{
+	if (v.type == JSK_BOOL)
+		return jsk_get_bool(v) ? JSK_SCHEMA_ANY : JSK_SCHEMA_NONE;
+	if (v.type != JSK_OBJECT)
+		return jsk_schema_error(c, "Schema must be an object or "
+				"boolean");
+	if (depth > JSK_VALIDATE_MAX_DEPTH)
+		return jsk_schema_error(c, "Schema nested too deeply");
+
+	const long long node = jsk_schema_new_node(c);
+	if (node < 0)
+		return -1;
+
+	if (depth + 1 > c->depth)
+		c->depth = depth + 1;
+
+	/* required goes last so that it can mark compiled properties */
+	const jsk_value *required = NULL;
+
+	jsk_object_iter it = jsk_object_iterate(v);
+	jsk_object_entry *e;
+	while ((e = jsk_object_next(&it))) {
+		if (!strcmp(e->key, "required"))
+			required = &e->value;
+		else if (jsk_schema_keyword(c, node, e->key, e->value, depth))
+			return -1;
+	}
+
+	if (required && jsk_schema_required(c, node, *required))
+		return -1;
+
+	if (jsk_schema_unconstrained(&c->nodes[node])) {
+		if (node == c->count - 1)
+			c->count--;
+		return JSK_SCHEMA_ANY;
+	}
+
+	return node;
+}
+
+JSK_EXPORT jsk_schema *jsk_schema_compile(jsk_heap *h, jsk_value schema,
+		char **error)
+{
+	jsk_schema_compiler c;
+	memset(&c, 0, sizeof(c));
+	c.heap = h;
+
+	jsk_schema *s = (jsk_schema *)jsk_heap_alloc(h, sizeof(jsk_schema),
+			JSK_VALUE_ALIGN);
+	long long root = JSK_UNLIKELY(!s) ?
+		jsk_schema_error(&c, "Out of memory") : 0;
+
+	/* The true and false schemas */
+	if (root == 0 && jsk_schema_new_node(&c) == JSK_SCHEMA_ANY &&
+			jsk_schema_new_node(&c) == JSK_SCHEMA_NONE) {
+		c.nodes[JSK_SCHEMA_NONE].types = 0;
+		root = jsk_schema_compile_node(&c, schema, 0);
+	}
+
+	if (root < 0) {
+		if (error)
+			*error = c.error;
+		return NULL;
+	}
+
+	*s = (jsk_schema){ c.nodes, c.count, (unsigned)root, c.depth };
+	return s;
+}
+
+/*
+ * The validator sits between the parser and the real handler, checking each
+ * event before passing it on. Frames track the open containers that the
+ * schema constrains; anything under an unconstrained node is only counted in
+ * skip, so matching ends and passing events along is all that's left to do.
+ */
+typedef struct jsk_schema_frame {
+	unsigned node;
+	unsigned child;
+	jsk_u64 seen;
+} jsk_schema_frame;
+
+typedef struct jsk_schema_run {
+	const jsk_schema *schema;
+	const jsk_handler *inner;
+	void *user;
+	jsk_context *ctx;
+	jsk_schema_frame *frames;
+	unsigned depth;
+	unsigned skip;
+	char *error;
+} jsk_schema_run;
+
+__attribute__((__format__ (__printf__, 2, 3)))
+static int jsk_schema_fail(jsk_schema_run *r, const char *const fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	const char *why = jsk_vprintf(r->ctx->heap, 1, fmt, args);
+	va_end(args);
+
+	char at[32];
+	snprintf(at, sizeof(at), " at index %llu", r->ctx->start);
+	r->error = jsk_concat(r->ctx->heap, why ? why : "Schema violation",
+			at);
+	return 1;
+}
+
+/* The node for the value about to start, or NULL if it is unconstrained */
+static const jsk_schema_node *jsk_schema_next(const jsk_schema_run *r)
+{
+	if (r->skip)
+		return NULL;
+
+	const unsigned i = r->depth ? r->frames[r->depth - 1].child :
+		r->schema->root;
+	return i == JSK_SCHEMA_ANY ? NULL : &r->schema->nodes[i];
+}
+
+static int jsk_schema_type(jsk_schema_run *r, const jsk_schema_node *n,
+		unsigned mask, const char *name)
+{
+	if (JSK_UNLIKELY(!(n->types & mask)))
+		return jsk_schema_fail(r, "Schema does not allow %s", name);
+	return 0;
+}
+
+static int jsk_schema_enum_number(const jsk_schema_node *n, long long i,
+		double f, int integer)
+{
+	for (unsigned k = 0; k < jsk_array_length(n->enums); k++) {
+		const jsk_value e = jsk_number_value(jsk_array_get(n->enums, k));
+		if (e.type == JSK_INT && integer) {
+			if (jsk_get_int(e) == i)
+				return 1;
+		} else if (e.type == JSK_INT || e.type == JSK_FLOAT) {
+			if (jsk_as_float(e) == (integer ? (double)i : f))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static int jsk_schema_check_number(jsk_schema_run *r, long long i, double f,
+		int integer)
+{
+	const jsk_schema_node *n = jsk_schema_next(r);
+	if (!n)
+		return 0;
+
+	/* Finite doubles of 2^53 and up have no fraction, and may not cast */
+	const double d = integer ? (double)i : f;
+	const int integral = integer || (d - d == 0 &&
+			(d >= 9007199254740992.0 || d <= -9007199254740992.0 ||
+			 d == (double)(long long)d));
+	if (jsk_schema_type(r, n, integral ? JSK_SCHEMA_T_INTEGER |
+				JSK_SCHEMA_T_NUMBER : JSK_SCHEMA_T_NUMBER,
+				integral ? "integer" : "number"))
+		return 1;
+
+	if (n->bounds) {
+		if ((n->bounds & JSK_SCHEMA_MINIMUM) && d < n->minimum)
+			return jsk_schema_fail(r, "Value violates minimum");
+		if ((n->bounds & JSK_SCHEMA_MAXIMUM) && d > n->maximum)
+			return jsk_schema_fail(r, "Value violates maximum");
+		if ((n->bounds & JSK_SCHEMA_EXCLUSIVE_MINIMUM) &&
+				d <= n->exclusive_minimum)
+			return jsk_schema_fail(r, "Value violates "
+					"exclusiveMinimum");
+		if ((n->bounds & JSK_SCHEMA_EXCLUSIVE_MAXIMUM) &&
+				d >= n->exclusive_maximum)
+			return jsk_schema_fail(r, "Value violates "
+					"exclusiveMaximum");
+	}
+
+	if (n->enums.type != JSK_NULL &&
+			!jsk_schema_enum_number(n, i, f, integer))
+		return jsk_schema_fail(r, "Value not in schema enum");
+	return 0;
+}
+
+/* Scalars other than numbers and strings can only fail on type and enum */
+static int jsk_schema_check_literal(jsk_schema_run *r, jsk_value v,
+		unsigned mask, const char *name)
+{
+	const jsk_schema_node *n = jsk_schema_next(r);
+	if (!n)
+		return 0;
+
+	if (jsk_schema_type(r, n, mask, name))
+		return 1;
+
+	if (n->enums.type == JSK_NULL)
+		return 0;
+	for (unsigned k = 0; k < jsk_array_length(n->enums); k++) {
+		const jsk_value e = jsk_array_get(n->enums, k);
+		if (e.type == v.type && (v.type == JSK_NULL ||
+					jsk_get_bool(e) == jsk_get_bool(v)))
+			return 0;
+	}
+	return jsk_schema_fail(r, "Value not in schema enum");
+}
+
+/* Code points in a raw string, counting each escape as what it encodes */
+static unsigned jsk_schema_strlen(const char *s, unsigned len)
+{
+	unsigned n = 0;
+
+	for (unsigned i = 0; i < len; n++) {
+		if (s[i] != '\\') {
+			for (i++; i < len && ((unsigned char)s[i] & 0xc0) ==
+					0x80; i++)
+				;
+			continue;
+		}
+
+		if (s[i + 1] != 'u') {
+			i += 2;
+			continue;
+		}
+
+		const long hi = jsk_hex4(&s[i + 2]);
+		i += 6;
+		if (hi >= 0xd800 && hi <= 0xdbff && i + 6 <= len &&
+				s[i] == '\\' && s[i + 1] == 'u') {
+			const long lo = jsk_hex4(&s[i + 2]);
+			if (lo >= 0xdc00 && lo <= 0xdfff)
+				i += 6;
+		}
+	}
+
+	return n;
+}
+
+static int jsk_schema_check_string(jsk_schema_run *r, const char *s,
+		unsigned len)
+{
+	const jsk_schema_node *n = jsk_schema_next(r);
+	if (!n)
+		return 0;
+
+	if (jsk_schema_type(r, n, JSK_SCHEMA_T_STRING, "string"))
+		return 1;
+
+	if (n->min_length || n->max_length != (unsigned)-1) {
+		const unsigned cps = jsk_schema_strlen(s, len);
+		if (cps < n->min_length)
+			return jsk_schema_fail(r, "Value violates minLength");
+		if (cps > n->max_length)
+			return jsk_schema_fail(r, "Value violates maxLength");
+	}
+
+	if (n->enums.type == JSK_NULL)
+		return 0;
+
+	if (memchr(s, '\\', len)) {
+		const jsk_value u = jsk_new_string_escaped(r->ctx->heap, s,
+				len);
+		if (JSK_UNLIKELY(u.type != JSK_STRING))
+			return jsk_schema_fail(r, "Out of memory");
+		s = jsk_get_string(u);
+		len = strlen(s);
+	}
+
+	for (unsigned k = 0; k < jsk_array_length(n->enums); k++) {
+		const jsk_value e = jsk_array_get(n->enums, k);
+		if (e.type == JSK_STRING && !strncmp(jsk_get_string(e), s,
+					len) && !jsk_get_string(e)[len])
+			return 0;
+	}
+	return jsk_schema_fail(r, "Value not in schema enum");
+}
+
+/* Opens a frame for a container whose node has constraints */
+static int jsk_schema_open(jsk_schema_run *r, unsigned mask,
+		const char *name)
+{
+	const jsk_schema_node *n = jsk_schema_next(r);
+	if (!n) {
+		r->skip++;
+		return 0;
+	}
+
+	if (jsk_schema_type(r, n, mask, name))
+		return 1;
+
+	const unsigned node = (unsigned)(n - r->schema->nodes);
+	r->frames[r->depth++] = (jsk_schema_frame){ node, n->items, 0 };
+	return 0;
+}
+
+#define JSK_SCHEMA_FORWARD(cb, args)					\
+	return r->inner->cb ? r->inner->cb args : 0
+
+static int jsk_schema_null(void *user)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	if (jsk_schema_check_literal(r, jsk_new_null(), JSK_SCHEMA_T_NULL,
+				"null"))
+		return 1;
+	JSK_SCHEMA_FORWARD(null, (r->user));
+}
+
+static int jsk_schema_boolean(void *user, int value)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	if (jsk_schema_check_literal(r, jsk_new_bool((long long)value),
+				JSK_SCHEMA_T_BOOLEAN, "boolean"))
+		return 1;
+	JSK_SCHEMA_FORWARD(boolean, (r->user, value));
+}
+
+static int jsk_schema_integer(void *user, long long value)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	if (jsk_schema_check_number(r, value, 0, 1))
+		return 1;
+	JSK_SCHEMA_FORWARD(integer, (r->user, value));
+}
+
+static int jsk_schema_floating(void *user, double value)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	if (jsk_schema_check_number(r, 0, value, 0))
+		return 1;
+	JSK_SCHEMA_FORWARD(floating, (r->user, value));
+}
+
+/* Lazy numbers are converted for checking but passed on as text */
+static int jsk_schema_number(void *user, const char *s, unsigned len)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	char buf[64];
+	char *text = buf;
+
+	if (JSK_UNLIKELY(len >= sizeof(buf))) {
+		text = (char *)jsk_heap_alloc(r->ctx->heap, len + 1, 1);
+		if (JSK_UNLIKELY(!text))
+			return jsk_schema_fail(r, "Out of memory");
+	}
+
+	memcpy(text, s, len);
+	text[len] = 0;
+
+	long long i = 0;
+	double f = 0;
+	const int integer = jsk_number_convert(text, &i, &f, NULL) == JSK_INT;
+	if (jsk_schema_check_number(r, i, f, integer))
+		return 1;
+
+	if (r->inner->number)
+		return r->inner->number(r->user, s, len);
+	if (integer)
+		JSK_SCHEMA_FORWARD(integer, (r->user, i));
+	JSK_SCHEMA_FORWARD(floating, (r->user, f));
+}
+
+static int jsk_schema_string(void *user, const char *s, unsigned len)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	if (jsk_schema_check_string(r, s, len))
+		return 1;
+	JSK_SCHEMA_FORWARD(string, (r->user, s, len));
+}
+
+static int jsk_schema_key(void *user, const char *s, unsigned len)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+
+	if (!r->skip) {
+		jsk_schema_frame *f = &r->frames[r->depth - 1];
+		const jsk_schema_node *n = &r->schema->nodes[f->node];
+		const char *name = s;
+		unsigned name_len = len;
+		char buf[64];
+
+		/* Keys are passed on as they are, but matched unescaped */
+		if (memchr(s, '\\', len)) {
+			char *u = buf;
+			if (JSK_UNLIKELY(len >= sizeof(buf))) {
+				u = (char *)jsk_heap_alloc(r->ctx->heap, len, 1);
+				if (JSK_UNLIKELY(!u))
+					return jsk_schema_fail(r,
+							"Out of memory");
+			}
+			name_len = jsk_unescape_string(u, s, len);
+			name = u;
+		}
+
+		const jsk_value *e = n->properties.type == JSK_OBJECT ?
+			jsk_object_get_len(n->properties, name, name_len) :
+			NULL;
+
+		f->child = n->additional;
+		if (e) {
+			const jsk_u64 p = (jsk_u64)jsk_get_int(*e);
+			f->child = (unsigned)p;
+			if (p >> 32)
+				f->seen |= 1ULL << ((p >> 32) - 1);
+		}
+
+		if (JSK_UNLIKELY(f->child == JSK_SCHEMA_NONE))
+			return jsk_schema_fail(r, "Key \"%.*s\" not allowed by "
+					"schema", (int)name_len, name);
+	}
+
+	JSK_SCHEMA_FORWARD(key, (r->user, s, len));
+}
+
+static int jsk_schema_start_object(void *user)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	if (jsk_schema_open(r, JSK_SCHEMA_T_OBJECT, "object"))
+		return 1;
+	JSK_SCHEMA_FORWARD(start_object, (r->user));
+}
+
+static int jsk_schema_end_object(void *user, unsigned count)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+
+	if (r->skip) {
+		r->skip--;
+	} else {
+		const jsk_schema_frame *f = &r->frames[--r->depth];
+		const jsk_schema_node *n = &r->schema->nodes[f->node];
+
+		if (count < n->min_properties)
+			return jsk_schema_fail(r, "Value violates "
+					"minProperties");
+		if (count > n->max_properties)
+			return jsk_schema_fail(r, "Value violates "
+					"maxProperties");
+
+		for (unsigned i = 0; i < n->required_count; i++)
+			if (!(f->seen >> i & 1))
+				return jsk_schema_fail(r, "Missing required "
+						"key \"%s\"", n->required[i]);
+	}
+
+	JSK_SCHEMA_FORWARD(end_object, (r->user, count));
+}
+
+static int jsk_schema_start_array(void *user)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+	if (jsk_schema_open(r, JSK_SCHEMA_T_ARRAY, "array"))
+		return 1;
+	JSK_SCHEMA_FORWARD(start_array, (r->user));
+}
+
+static int jsk_schema_end_array(void *user, unsigned count)
+{
+	jsk_schema_run *r = (jsk_schema_run *)user;
+
+	if (r->skip) {
+		r->skip--;
+	} else {
+		const jsk_schema_node *n =
+			&r->schema->nodes[r->frames[--r->depth].node];
+
+		if (count < n->min_items)
+			return jsk_schema_fail(r, "Value violates minItems");
+		if (count > n->max_items)
+			return jsk_schema_fail(r, "Value violates maxItems");
+	}
+
+	JSK_SCHEMA_FORWARD(end_array, (r->user, count));
+}
+
+#undef JSK_SCHEMA_FORWARD
+
+static const jsk_handler jsk_schema_handler = {
+	jsk_schema_null,
+	jsk_schema_boolean,
+	jsk_schema_integer,
+	jsk_schema_floating,
+	jsk_schema_string,
+	jsk_schema_key,
+	jsk_schema_start_object,
+	jsk_schema_end_object,
+	jsk_schema_start_array,
+	jsk_schema_end_array,
+	jsk_schema_number,
+};
+
+/* Parses one document, validating it if the options carry a schema */
+static jsk_result jsk_parse_root(jsk_context *ctx, const jsk_handler *h,
+		void *user)
+{
+	if (JSK_LIKELY(!ctx->opts || !ctx->opts->schema))
+		return jsk_parse_value(ctx, h, user);
+
+	const jsk_schema *schema = ctx->opts->schema;
+	jsk_schema_frame initial[JSK_DOM_STACK_SIZE];
+	jsk_schema_run r = (jsk_schema_run){
+		schema, h, user, ctx, initial, 0, 0, NULL,
+	};
+
+	if (schema->depth > JSK_DOM_STACK_SIZE) {
+		r.frames = (jsk_schema_frame *)jsk_heap_alloc(ctx->heap,
+				schema->depth * sizeof(jsk_schema_frame),
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!r.frames))
+			return jsk_error(ctx, "Out of memory");
+	}
+
+	jsk_result res = jsk_parse_value(ctx, &jsk_schema_handler, &r);
+	if (JSK_UNLIKELY(r.error != NULL))
+		return (jsk_result){ JSK_SCHEMA, { .error = r.error } };
+	return res;
+}
+
+JSK_EXPORT jsk_result jsk_parse_sax_opts(jsk_heap *heap,
+		const char *const json, unsigned len,
+		const jsk_handler *handler, void *user,
+		const jsk_parse_options *opts)
+{
+	jsk_context ctx = (jsk_context){
+		heap,
+		json,
+		len,
+		0,
+		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		opts,
+		0,
+	};
+
+	jsk_lex(&ctx);
+	return jsk_parse_root(&ctx, handler, user);
+}
+
+JSK_EXPORT jsk_result jsk_parse_sax(jsk_heap *heap,
+		const char *const json, unsigned len,
+		const jsk_handler *handler, void *user)
+{
+	return jsk_parse_sax_opts(heap, json, len, handler, user, NULL);
+}
+
+/*
+ * The DOM builder is just another SAX consumer. Open containers are kept on
+ * an explicit stack so that each completed value can be attached to its
+ * parent as soon as it is seen.
+ */
+
+typedef struct jsk_dom_frame {
+	jsk_value container;
+	char *key;
+} jsk_dom_frame;
+
+typedef struct jsk_dom_builder {
+	jsk_heap *heap;
+	jsk_dom_frame *stack;
+	unsigned depth;
+	unsigned allocated;
+	jsk_value root;
+	int oom;
+	int pack;
+	jsk_dom_frame initial[JSK_DOM_STACK_SIZE];
+} jsk_dom_builder;
+
+/* Every way the builder can fail is the heap running out */
+static int jsk_dom_oom(jsk_dom_builder *b)
+{
+	b->oom = 1;
+	return 1;
+}
+
+static int jsk_dom_emit(jsk_dom_builder *b, jsk_value v)
+{
+	if (JSK_UNLIKELY(b->depth == 0)) {
+		b->root = v;
+		return 0;
+	}
+
+	jsk_dom_frame *f = &b->stack[b->depth - 1];
+
+	const int err = f->container.type == JSK_OBJECT ?
+		jsk_object_add((jsk_object *)f->container.value, f->key, v) :
+		jsk_array_add(b->heap, &f->container, v, b->pack);
+
+	return JSK_UNLIKELY(err) ? jsk_dom_oom(b) : 0;
+}
+
+static int jsk_dom_open(jsk_dom_builder *b, jsk_value container)
+{
+	if (JSK_UNLIKELY(container.type == JSK_NULL))
+		return jsk_dom_oom(b);
+
+	if (JSK_UNLIKELY(b->depth == b->allocated)) {
+		const unsigned n = b->allocated * 2;
+		jsk_dom_frame *s = (jsk_dom_frame *)jsk_heap_alloc(b->heap,
+				n * sizeof(jsk_dom_frame), JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!s))
+			return jsk_dom_oom(b);
+		memcpy(s, b->stack, b->depth * sizeof(jsk_dom_frame));
+		if (b->stack != b->initial)
+			b->heap->abandoned +=
+				b->allocated * sizeof(jsk_dom_frame);
+		b->stack = s;
+		b->allocated = n;
+	}
+
+	b->stack[b->depth++] = (jsk_dom_frame){ container, NULL };
+	return 0;
+}
+
+static int jsk_dom_close(jsk_dom_builder *b)
+{
+	b->depth--;
+	return jsk_dom_emit(b, b->stack[b->depth].container);
+}
+
+static int jsk_dom_null(void *user)
+{
+	return jsk_dom_emit((jsk_dom_builder *)user, jsk_new_null());
+}
+
+static int jsk_dom_boolean(void *user, int value)
+{
+	return jsk_dom_emit((jsk_dom_builder *)user,
+			jsk_new_bool((long long)value));
+}
+
+static int jsk_dom_integer(void *user, long long value)
+{
+	return jsk_dom_emit((jsk_dom_builder *)user, jsk_new_int(value));
+}
+
+static int jsk_dom_floating(void *user, double value)
+{
+	return jsk_dom_emit((jsk_dom_builder *)user, jsk_new_float(value));
+}
+
+static int jsk_dom_string(void *user, const char *s, unsigned len)
+{
+	jsk_dom_builder *b = (jsk_dom_builder *)user;
+	const jsk_value v = jsk_new_string_escaped(b->heap, s, len);
+	if (JSK_UNLIKELY(v.type == JSK_NULL))
+		return jsk_dom_oom(b);
+	return jsk_dom_emit(b, v);
+}
+
+static int jsk_dom_number(void *user, const char *s, unsigned len)
+{
+	jsk_dom_builder *b = (jsk_dom_builder *)user;
+	const jsk_value v = jsk_new_number(b->heap, s, len);
+	if (JSK_UNLIKELY(v.type == JSK_NULL))
+		return jsk_dom_oom(b);
+	return jsk_dom_emit(b, v);
+}
+
+static int jsk_dom_key(void *user, const char *s, unsigned len)
+{
+	jsk_dom_builder *b = (jsk_dom_builder *)user;
+
+	char *name = (char *)jsk_heap_alloc(b->heap, len + 1, 1);
+	if (JSK_UNLIKELY(!name))
+		return jsk_dom_oom(b);
+	memcpy(name, s, len);
+	name[len] = 0;
+
+	b->stack[b->depth - 1].key = name;
+	return 0;
+}
+
+static int jsk_dom_start_object(void *user)
+{
+	jsk_dom_builder *b = (jsk_dom_builder *)user;
+	return jsk_dom_open(b, jsk_new_object(b->heap));
+}
+
+static int jsk_dom_start_array(void *user)
+{
+	return jsk_dom_open((jsk_dom_builder *)user, jsk_new_array());
+}
+
+static int jsk_dom_end(void *user, unsigned count)
+{
+	(void)count;
+	return jsk_dom_close((jsk_dom_builder *)user);
+}
+
+static const jsk_handler jsk_dom_handler = {
+	jsk_dom_null,
+	jsk_dom_boolean,
+	jsk_dom_integer,
+	jsk_dom_floating,
+	jsk_dom_string,
+	jsk_dom_key,
+	jsk_dom_start_object,
+	jsk_dom_end,
+	jsk_dom_start_array,
+	jsk_dom_end,
+	jsk_dom_number,
+};
+
+static void jsk_dom_init(jsk_dom_builder *b, jsk_heap *heap)
+{
+	b->heap = heap;
+	b->stack = b->initial;
+	b->depth = 0;
+	b->allocated = JSK_DOM_STACK_SIZE;
+	b->root = jsk_new_null();
+	b->oom = 0;
+	b->pack = 0;
+}
+
+static jsk_result jsk_parse_dom(jsk_heap *heap,
+		const char *const json, unsigned long long len,
+		const jsk_parse_options *opts)
+{
+	jsk_context ctx = (jsk_context){
+		heap,
+		json,
+		len,
+		0,
+		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		opts,
+		0,
+	};
+
+	jsk_dom_builder b;
+	jsk_dom_init(&b, heap);
+	b.pack = opts && opts->pack_arrays;
+
+	const unsigned long long limit = heap->limit;
+	if (opts && opts->max_heap_bytes)
+		heap->limit = heap->bytes + opts->max_heap_bytes;
+
+	jsk_lex(&ctx);
+
+	jsk_result res = jsk_parse_root(&ctx, &jsk_dom_handler, &b);
+
+	heap->limit = limit;
+
+	if (JSK_UNLIKELY(b.oom)) {
+		if (opts && opts->max_heap_bytes) {
+			ctx.start = ctx.ptr - 1;
+			return jsk_limit(&ctx, "Heap", opts->max_heap_bytes);
+		}
+		return jsk_error(&ctx, "Out of memory at index %llu",
+				ctx.ptr - 1);
+	}
+
+	if (res.status != JSK_OK)
+		return res;
+
+	return jsk_success(b.root);
+}
+
+JSK_EXPORT jsk_result jsk_parse(jsk_heap *heap,
+		const char *const json, unsigned len)
+{
+	return jsk_parse_dom(heap, json, len, NULL);
+}
+
+JSK_EXPORT jsk_result jsk_parse_opts(jsk_heap *heap,
+		const char *const json, unsigned len,
+		const jsk_parse_options *opts)
+{
+	return jsk_parse_dom(heap, json, len, opts);
+}
+
+JSK_EXPORT jsk_stream jsk_stream_new(jsk_heap *heap,
+		const char *const json, unsigned long long len)
+{
+	return (jsk_stream){ heap, json, len, 0 };
+}
+
+JSK_EXPORT int jsk_stream_next(jsk_stream *s, jsk_result *res)
+{
+	jsk_context ctx = (jsk_context){
+		s->heap,
+		s->json,
+		s->len,
+		s->ptr,
+		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		NULL,
+		0,
+	};
+
+	jsk_lex(&ctx);
+
+	if (ctx.tkn.type == JSKT_EOF) {
+		s->ptr = s->len;
+		return 0;
+	}
+
+	const unsigned long long start = ctx.start;
+
+	jsk_dom_builder b;
+	jsk_dom_init(&b, s->heap);
+
+	*res = jsk_parse_value(&ctx, &jsk_dom_handler, &b);
+
+	if (JSK_LIKELY(res->status == JSK_OK)) {
+		res->data.value = b.root;
+		s->ptr = ctx.start;
+		return 1;
+	}
+
+	/* Resynchronise on the line after the broken document */
+	const char *nl = (const char *)memchr(&s->json[start], '\n',
+			s->len - start);
+	s->ptr = nl ? (unsigned long long)(nl - s->json) + 1 : s->len;
+
+	return 1;
+}
+
+static unsigned long long jsk_skip_ws(const char *const json,
+		unsigned long long len, unsigned long long ptr)
+{
+	while (ptr < len && (json[ptr] == ' ' || json[ptr] == '\t' ||
+				json[ptr] == '\n' || json[ptr] == '\r'))
+		ptr++;
+	return ptr;
+}
+
+/* Returns the offset of the closing quote of the string opened at ptr */
+static unsigned long long jsk_skip_string(const char *const json,
+		unsigned long long len, unsigned long long ptr)
+{
+	while (1) {
+		const char *q = (const char *)memchr(&json[ptr + 1], '"',
+				len - ptr - 1);
+		if (JSK_UNLIKELY(!q))
+			return JSK_SKIP_ERROR;
+		ptr = q - json;
+
+		unsigned long long b = ptr;
+		while (json[b - 1] == '\\')
+			b--;
+		if ((ptr - b) % 2 == 0)
+			return ptr;
+	}
+}
+
+/*
+ * Returns the offset just past the value starting at ptr, matching brackets
+ * without looking inside scalars. Only the structure needed to find the end
+ * is checked; the skipped value is otherwise not validated.
+ */
+static unsigned long long jsk_skip_value(const char *const json,
+		unsigned long long len, unsigned long long ptr)
+{
+	if (JSK_UNLIKELY(ptr >= len))
+		return JSK_SKIP_ERROR;
+
+	switch (json[ptr]) {
+	case '"': {
+		const unsigned long long end = jsk_skip_string(json, len, ptr);
+		return end == JSK_SKIP_ERROR ? end : end + 1;
+	}
+
+	case '[':
+	case '{': {
+		unsigned depth = 0;
+
+		for (; ptr < len; ptr++) {
+			switch (json[ptr]) {
+			case '"':
+				ptr = jsk_skip_string(json, len, ptr);
+				if (JSK_UNLIKELY(ptr == JSK_SKIP_ERROR))
+					return ptr;
+				break;
+
+			case '[':
+			case '{':
+				depth++;
+				break;
+
+			case ']':
+			case '}':
+				if (--depth == 0)
+					return ptr + 1;
+				break;
+			}
+		}
+
+		return JSK_SKIP_ERROR;
+	}
+
+	case ',':
+	case ':':
+	case ']':
+	case '}':
+		return JSK_SKIP_ERROR;
+
+	default: {
+		const unsigned long long start = ptr;
+
+		while (ptr < len && json[ptr] != ',' && json[ptr] != ']' &&
+				json[ptr] != '}' && json[ptr] != ' ' &&
+				json[ptr] != '\t' && json[ptr] != '\n' &&
+				json[ptr] != '\r')
+			ptr++;
+
+		return ptr == start ? JSK_SKIP_ERROR : ptr;
+	}
+	}
+}
+
+static int jsk_is_hex(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+		(c >= 'A' && c <= 'F');
+}
+
+/*
+ * Validates the string whose opening quote is at p, returning the offset just
+ * past the closing quote or JSK_SKIP_ERROR with the offending offset in *at.
+ */
+static unsigned long long jsk_validate_string(const char *const json,
+		unsigned long long len, unsigned long long p,
+		unsigned long long *at)
+{
+	const unsigned char *s = (const unsigned char *)json;
+
+	p++;
+
+	while (1) {
+		while (p + 8 <= len) {
+			jsk_u64 x;
+			memcpy(&x, &s[p], 8);
+			if (jsk_swar_string_special(x))
+				break;
+			p += 8;
+		}
+
+		if (JSK_UNLIKELY(p >= len))
+			break;
+
+		const unsigned char c = s[p];
+
+		if (c == '"') {
+			return p + 1;
+		} else if (c == '\\') {
+			if (JSK_UNLIKELY(p + 1 >= len))
+				break;
+
+			switch (s[p + 1]) {
+			case '"': case '\\': case '/': case 'b':
+			case 'f': case 'n': case 'r': case 't':
+				p += 2;
+				continue;
+
+			case 'u':
+				if (JSK_UNLIKELY(p + 6 > len ||
+							!jsk_is_hex(s[p + 2]) ||
+							!jsk_is_hex(s[p + 3]) ||
+							!jsk_is_hex(s[p + 4]) ||
+							!jsk_is_hex(s[p + 5]) ||
+							!memcmp(&s[p + 2], "0000", 4))) {
+					*at = p;
+					return JSK_SKIP_ERROR;
+				}
+				p += 6;
+				continue;
+
+			default:
+				*at = p;
+				return JSK_SKIP_ERROR;
+			}
+		} else if (c < 0x20) {
+			*at = p;
+			return JSK_SKIP_ERROR;
+		} else if (c >= 0x80) {
+			const unsigned n = jsk_utf8_sequence(&s[p], len - p);
+			if (JSK_UNLIKELY(!n)) {
+				*at = p;
+				return JSK_SKIP_ERROR;
+			}
+			p += n;
+		} else {
+			p++;
+		}
+	}
+
+	*at = len;
+	return JSK_SKIP_ERROR;
+}
+
+static unsigned long long jsk_validate_number(const char *const json,
+		unsigned long long len, unsigned long long p)
+{
+#define JSK_DIGIT(i) ((i) < len && json[i] >= '0' && json[i] <= '9')
+
+	if (json[p] == '-')
+		p++;
+
+	if (p < len && json[p] == '0')
+		p++;
+	else if (JSK_DIGIT(p))
+		while (JSK_DIGIT(p))
+			p++;
+	else
+		return JSK_SKIP_ERROR;
+
+	if (p < len && json[p] == '.') {
+		p++;
+		if (!JSK_DIGIT(p))
+			return JSK_SKIP_ERROR;
+		while (JSK_DIGIT(p))
+			p++;
+	}
+
+	if (p < len && (json[p] == 'e' || json[p] == 'E')) {
+		p++;
+		if (p < len && (json[p] == '+' || json[p] == '-'))
+			p++;
+		if (!JSK_DIGIT(p))
+			return JSK_SKIP_ERROR;
+		while (JSK_DIGIT(p))
+			p++;
+	}
+
+	return p;
+
+#undef JSK_DIGIT
+}
+
+JSK_EXPORT jsk_status jsk_validate(const char *const json,
+		unsigned long long len, unsigned long long *error_offset)
+{
+	enum {
+		V_VALUE,	/* expecting a value */
+		V_KEY,		/* expecting an object key */
+		V_AFTER,	/* after a complete value */
+	};
+
+	/* One bit per open container: set for objects, clear for arrays */
+	unsigned char stack[(JSK_VALIDATE_MAX_DEPTH + 7) / 8];
+	unsigned depth = 0;
+	unsigned long long p = 0, at = 0;
+	int state = V_VALUE;
+
+	while (1) {
+		p = jsk_skip_ws(json, len, p);
+		at = p;
+
+		if (JSK_UNLIKELY(p >= len)) {
+			if (state == V_AFTER && depth == 0)
+				return JSK_OK;
+			goto fail;
+		}
+
+		const char c = json[p];
+
+		switch (state) {
+		case V_VALUE:
+			switch (c) {
+			case '{':
+			case '[':
+				if (JSK_UNLIKELY(depth == JSK_VALIDATE_MAX_DEPTH))
+					goto fail;
+
+				if (c == '{')
+					stack[depth / 8] |= 1 << (depth % 8);
+				else
+					stack[depth / 8] &= ~(1 << (depth % 8));
+				depth++;
+
+				p = jsk_skip_ws(json, len, p + 1);
+				if (p < len && json[p] == (c == '{' ? '}' : ']')) {
+					depth--;
+					p++;
+					state = V_AFTER;
+				} else {
+					state = c == '{' ? V_KEY : V_VALUE;
+				}
+				continue;
+
+			case '"':
+				p = jsk_validate_string(json, len, p, &at);
+				break;
+
+			case 't':
+				p = p + 4 <= len && !memcmp(&json[p], "true", 4) ?
+					p + 4 : JSK_SKIP_ERROR;
+				break;
+
+			case 'f':
+				p = p + 5 <= len && !memcmp(&json[p], "false", 5) ?
+					p + 5 : JSK_SKIP_ERROR;
+				break;
+
+			case 'n':
+				p = p + 4 <= len && !memcmp(&json[p], "null", 4) ?
+					p + 4 : JSK_SKIP_ERROR;
+				break;
+
+			default:
+				p = jsk_validate_number(json, len, p);
+				break;
+			}
+
+			if (JSK_UNLIKELY(p == JSK_SKIP_ERROR))
+				goto fail;
+
+			state = V_AFTER;
+			continue;
+
+		case V_KEY:
+			if (JSK_UNLIKELY(c != '"'))
+				goto fail;
+
+			p = jsk_validate_string(json, len, p, &at);
+			if (JSK_UNLIKELY(p == JSK_SKIP_ERROR))
+				goto fail;
+
+			p = jsk_skip_ws(json, len, p);
+			at = p;
+			if (JSK_UNLIKELY(p >= len || json[p] != ':'))
+				goto fail;
+
+			p++;
+			state = V_VALUE;
+			continue;
+
+		case V_AFTER: {
+			if (JSK_UNLIKELY(depth == 0))
+				goto fail;
+
+			const int object = stack[(depth - 1) / 8] &
+				(1 << ((depth - 1) % 8));
+
+			if (c == ',') {
+				p++;
+				state = object ? V_KEY : V_VALUE;
+			} else if (c == (object ? '}' : ']')) {
+				p++;
+				depth--;
+			} else {
+				goto fail;
+			}
+			continue;
+		}
+		}
+	}
+
+fail:
+	if (error_offset)
+		*error_offset = at;
+	return JSK_ERROR;
+}
+
+JSK_EXPORT jsk_cursor jsk_cursor_new(const char *const json,
+		unsigned long long len)
+{
+	return (jsk_cursor){ json, len, jsk_skip_ws(json, len, 0) };
+}
+
+static jsk_context jsk_cursor_lex(jsk_cursor c)
+{
+	jsk_context ctx = (jsk_context){
+		NULL,
+		c.json,
+		c.len,
+		c.ptr,
+		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		NULL,
+		0,
+	};
+
+	jsk_lex(&ctx);
+	return ctx;
+}
+
+JSK_EXPORT jsk_status jsk_cursor_type(jsk_cursor c, jsk_type *type)
+{
+	if (JSK_UNLIKELY(c.ptr >= c.len))
+		return JSK_ERROR;
+
+	switch (c.json[c.ptr]) {
+	case '{':	*type = JSK_OBJECT;	return JSK_OK;
+	case '[':	*type = JSK_ARRAY;	return JSK_OK;
+	case '"':	*type = JSK_STRING;	return JSK_OK;
+	case 't':
+	case 'f':	*type = JSK_BOOL;	return JSK_OK;
+	case 'n':	*type = JSK_NULL;	return JSK_OK;
+	default:
+		break;
+	}
+
+	const jsk_context ctx = jsk_cursor_lex(c);
+
+	switch (ctx.tkn.type) {
+	case JSKT_INT:		*type = JSK_INT;	return JSK_OK;
+	case JSKT_FLOAT:	*type = JSK_FLOAT;	return JSK_OK;
+	default:					return JSK_ERROR;
+	}
+}
+
+JSK_EXPORT jsk_status jsk_cursor_get_int(jsk_cursor c, long long *v)
+{
+	const jsk_context ctx = jsk_cursor_lex(c);
+	if (JSK_UNLIKELY(ctx.tkn.type != JSKT_INT))
+		return JSK_ERROR;
+	*v = *(long long *)&ctx.tkn.data;
+	return JSK_OK;
+}
+
+JSK_EXPORT jsk_status jsk_cursor_get_float(jsk_cursor c, double *v)
+{
+	const jsk_context ctx = jsk_cursor_lex(c);
+	if (ctx.tkn.type == JSKT_FLOAT)
+		*v = *(double *)&ctx.tkn.data;
+	else if (ctx.tkn.type == JSKT_INT)
+		*v = (double)*(long long *)&ctx.tkn.data;
+	else
+		return JSK_ERROR;
+	return JSK_OK;
+}
+
+JSK_EXPORT jsk_status jsk_cursor_get_bool(jsk_cursor c, int *v)
+{
+	const jsk_context ctx = jsk_cursor_lex(c);
+	if (ctx.tkn.type == JSKT_TRUE)
+		*v = 1;
+	else if (ctx.tkn.type == JSKT_FALSE)
+		*v = 0;
+	else
+		return JSK_ERROR;
+	return JSK_OK;
+}
+
+JSK_EXPORT int jsk_cursor_is_null(jsk_cursor c)
+{
+	return jsk_cursor_lex(c).tkn.type == JSKT_NULL;
+}
+
+JSK_EXPORT jsk_status jsk_cursor_get_raw_string(jsk_cursor c,
+		const char **s, unsigned *len)
+{
+	const jsk_context ctx = jsk_cursor_lex(c);
+	if (JSK_UNLIKELY(ctx.tkn.type != JSKT_STRING))
+		return JSK_ERROR;
+	*s = ctx.tkn.data;
+	*len = ctx.tkn.len;
+	return JSK_OK;
+}
+
+JSK_EXPORT jsk_status jsk_cursor_get_string(jsk_heap *h, jsk_cursor c,
+		char **s)
+{
+	const jsk_context ctx = jsk_cursor_lex(c);
+	if (JSK_UNLIKELY(ctx.tkn.type != JSKT_STRING))
+		return JSK_ERROR;
+	*s = jsk_get_string(jsk_new_string_escaped(h, ctx.tkn.data,
+				ctx.tkn.len));
+	return JSK_OK;
+}
+
+JSK_EXPORT jsk_result jsk_cursor_value(jsk_heap *h, jsk_cursor c)
+{
+	unsigned long long end = jsk_skip_value(c.json, c.len, c.ptr);
+	if (JSK_UNLIKELY(end == JSK_SKIP_ERROR))
+		end = c.len;
+
+	jsk_context ctx = (jsk_context){
+		h,
+		c.json,
+		end,
+		c.ptr,
+		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		NULL,
+		0,
+	};
+
+	jsk_dom_builder b;
+	jsk_dom_init(&b, h);
+
+	jsk_lex(&ctx);
+
+	jsk_result res = jsk_parse_value(&ctx, &jsk_dom_handler, &b);
+	if (res.status != JSK_OK)
+		return res;
+
+	return jsk_success(b.root);
+}
+
+JSK_EXPORT jsk_cursor_iter jsk_cursor_iterate(jsk_cursor c)
+{
+	jsk_cursor_iter i = { c.json, c.len, c.ptr + 1, JSK_OK, 1 };
+
+	if (JSK_UNLIKELY(c.ptr >= c.len ||
+				(c.json[c.ptr] != '[' && c.json[c.ptr] != '{')))
+		i.status = JSK_ERROR;
+
+	return i;
+}
+
+static int jsk_cursor_fail(jsk_cursor_iter *i)
+{
+	i->status = JSK_ERROR;
+	return 0;
+}
+
+/* Moves to the start of the next member, returning 0 at the end */
+static int jsk_cursor_advance(jsk_cursor_iter *i, char close)
+{
+	if (JSK_UNLIKELY(i->status != JSK_OK))
+		return 0;
+
+	unsigned long long ptr = jsk_skip_ws(i->json, i->len, i->ptr);
+
+	if (JSK_UNLIKELY(ptr >= i->len))
+		return jsk_cursor_fail(i);
+
+	if (i->json[ptr] == close) {
+		i->ptr = ptr;
+		return 0;
+	}
+
+	if (!i->first) {
+		if (JSK_UNLIKELY(i->json[ptr] != ','))
+			return jsk_cursor_fail(i);
+		ptr = jsk_skip_ws(i->json, i->len, ptr + 1);
+	}
+
+	i->first = 0;
+	i->ptr = ptr;
+	return 1;
+}
+
+JSK_EXPORT int jsk_cursor_next(jsk_cursor_iter *i, jsk_cursor *value)
+{
+	if (!jsk_cursor_advance(i, ']'))
+		return 0;
+
+	*value = (jsk_cursor){ i->json, i->len, i->ptr };
+
+	i->ptr = jsk_skip_value(i->json, i->len, i->ptr);
+	if (JSK_UNLIKELY(i->ptr == JSK_SKIP_ERROR))
+		return jsk_cursor_fail(i);
+
+	return 1;
+}
+
+JSK_EXPORT int jsk_cursor_next_field(jsk_cursor_iter *i,
+		const char **key, unsigned *len, jsk_cursor *value)
+{
+	if (!jsk_cursor_advance(i, '}'))
+		return 0;
+
+	unsigned long long ptr = i->ptr;
+
+	if (JSK_UNLIKELY(i->json[ptr] != '"'))
+		return jsk_cursor_fail(i);
+
+	const unsigned long long end = jsk_skip_string(i->json, i->len, ptr);
+	if (JSK_UNLIKELY(end == JSK_SKIP_ERROR))
+		return jsk_cursor_fail(i);
+
+	*key = &i->json[ptr + 1];
+	*len = end - ptr - 1;
+
+	ptr = jsk_skip_ws(i->json, i->len, end + 1);
+	if (JSK_UNLIKELY(ptr >= i->len || i->json[ptr] != ':'))
+		return jsk_cursor_fail(i);
+
+	ptr = jsk_skip_ws(i->json, i->len, ptr + 1);
+	*value = (jsk_cursor){ i->json, i->len, ptr };
+
+	i->ptr = jsk_skip_value(i->json, i->len, ptr);
+	if (JSK_UNLIKELY(i->ptr == JSK_SKIP_ERROR))
+		return jsk_cursor_fail(i);
+
+	return 1;
+}
+
+JSK_EXPORT jsk_status jsk_cursor_find_field(jsk_cursor object,
+		const char *const name, jsk_cursor *value)
+{
+	const unsigned name_len = strlen(name);
+
+	if (JSK_UNLIKELY(object.ptr >= object.len ||
+				object.json[object.ptr] != '{'))
+		return JSK_ERROR;
+
+	jsk_cursor_iter i = jsk_cursor_iterate(object);
+	const char *key;
+	unsigned len;
+
+	while (jsk_cursor_next_field(&i, &key, &len, value))
+		if (len == name_len && !memcmp(key, name, len))
+			return JSK_OK;
+
+	return JSK_ERROR;
+}
+
+JSK_EXPORT jsk_status jsk_cursor_at(jsk_cursor array, unsigned index,
+		jsk_cursor *value)
+{
+	if (JSK_UNLIKELY(array.ptr >= array.len ||
+				array.json[array.ptr] != '['))
+		return JSK_ERROR;
+
+	jsk_cursor_iter i = jsk_cursor_iterate(array);
+
+	while (jsk_cursor_next(&i, value))
+		if (index-- == 0)
+			return JSK_OK;
+
+	return JSK_ERROR;
+}
+
+static jsk_pointer_node *jsk_pointer_child(jsk_heap *h,
+		jsk_pointer_node *parent, const char *segment, unsigned len)
+{
+	jsk_pointer_node *n = parent->child;
+
+	for (; n; n = n->sibling)
+		if (n->len == len && !memcmp(n->segment, segment, len))
+			return n;
+
+	n = (jsk_pointer_node *)jsk_heap_alloc(h, sizeof(jsk_pointer_node),
+			JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!n))
+		return NULL;
+
+	char *s = (char *)jsk_heap_alloc(h, len + 1, 1);
+	if (JSK_UNLIKELY(!s))
+		return NULL;
+	memcpy(s, segment, len);
+	s[len] = 0;
+
+	/* Array indices are "0" or digits without a leading zero */
+	long long index = len ? 0 : -1;
+	for (unsigned i = 0; i < len && index >= 0; i++) {
+		if (segment[i] < '0' || segment[i] > '9' ||
+				(i == 0 && segment[i] == '0' && len > 1) ||
+				index > 0xfffffff)
+			index = -1;
+		else
+			index = index * 10 + segment[i] - '0';
+	}
+
+	*n = (jsk_pointer_node){ s, len, index, -1, NULL, parent->child };
+	parent->child = n;
+
+	return n;
+}
+
+JSK_EXPORT jsk_matcher *jsk_matcher_compile(jsk_heap *h,
+		const char *const *paths, unsigned n)
+{
+	jsk_matcher *m = (jsk_matcher *)jsk_heap_alloc(h, sizeof(jsk_matcher),
+			JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!m))
+		return NULL;
+
+	m->root = (jsk_pointer_node){ "", 0, -1, -1, NULL, NULL };
+	m->count = n;
+	m->targets = 0;
+	m->slots = (unsigned *)jsk_heap_alloc(h, n * sizeof(unsigned) + 1,
+			JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!m->slots))
+		return NULL;
+
+	for (unsigned i = 0; i < n; i++) {
+		const char *p = paths[i];
+		jsk_pointer_node *node = &m->root;
+
+		if (*p && *p != '/')
+			return NULL;
+
+		while (*p) {
+			char segment[JSK_POINTER_MAX_SEGMENT];
+			unsigned len = 0;
+
+			for (p++; *p && *p != '/'; p++) {
+				char c = *p;
+
+				if (c == '~') {
+					if (p[1] == '0')
+						c = '~';
+					else if (p[1] == '1')
+						c = '/';
+					else
+						return NULL;
+					p++;
+				}
+
+				if (JSK_UNLIKELY(len == sizeof(segment)))
+					return NULL;
+				segment[len++] = c;
+			}
+
+			node = jsk_pointer_child(h, node, segment, len);
+			if (JSK_UNLIKELY(!node))
+				return NULL;
+		}
+
+		if (node->target < 0)
+			node->target = m->targets++;
+
+		m->slots[i] = node->target;
+	}
+
+	return m;
+}
+
+typedef struct jsk_extract_state {
+	jsk_heap *heap;
+	jsk_value *values;
+	unsigned char *filled;
+	unsigned remaining;
+	jsk_result error;
+} jsk_extract_state;
+
+/* Only the first match of a target counts, so repeated keys can't stop the
+ * walk before the other pointers have been seen */
+static void jsk_extract_fill(jsk_extract_state *st, int target, jsk_value v)
+{
+	if (!st->filled[target]) {
+		st->filled[target] = 1;
+		st->values[target] = v;
+		st->remaining--;
+	}
+}
+
+/* Resolves pointers that continue below a value that was materialised */
+static void jsk_extract_dom(jsk_extract_state *st,
+		const jsk_pointer_node *node, jsk_value v)
+{
+	for (const jsk_pointer_node *n = node->child; n; n = n->sibling) {
+		jsk_value *child = NULL;
+		jsk_value element;
+
+		if (v.type == JSK_OBJECT) {
+			child = jsk_object_get(v, n->segment);
+		} else if (jsk_is_array(v) && n->index >= 0 &&
+				n->index < jsk_array_length(v)) {
+			element = jsk_array_get(v, n->index);
+			child = &element;
+		}
+
+		if (!child)
+			continue;
+
+		if (n->target >= 0)
+			jsk_extract_fill(st, n->target, *child);
+
+		jsk_extract_dom(st, n, *child);
+	}
+}
+
+static int jsk_extract_node(jsk_extract_state *st,
+		const jsk_pointer_node *node, jsk_cursor c)
+{
+	if (node->target >= 0) {
+		/* Everything below was resolved with the first occurrence */
+		if (st->filled[node->target])
+			return 0;
+
+		jsk_result res = jsk_cursor_value(st->heap, c);
+		if (JSK_UNLIKELY(res.status != JSK_OK)) {
+			st->error = res;
+			return 1;
+		}
+
+		jsk_extract_fill(st, node->target, res.data.value);
+		jsk_extract_dom(st, node, res.data.value);
+		return 0;
+	}
+
+	if (c.ptr >= c.len || (c.json[c.ptr] != '{' && c.json[c.ptr] != '['))
+		return 0;
+
+	jsk_cursor_iter it = jsk_cursor_iterate(c);
+	jsk_cursor v;
+
+	if (c.json[c.ptr] == '{') {
+		const char *key;
+		unsigned len;
+
+		while (st->remaining && jsk_cursor_next_field(&it, &key, &len,
+					&v)) {
+			const jsk_pointer_node *n = node->child;
+			while (n && (n->len != len || memcmp(n->segment, key, len)))
+				n = n->sibling;
+
+			if (n && jsk_extract_node(st, n, v))
+				return 1;
+		}
+	} else {
+		for (long long i = 0; st->remaining &&
+				jsk_cursor_next(&it, &v); i++) {
+			const jsk_pointer_node *n = node->child;
+			while (n && n->index != i)
+				n = n->sibling;
+
+			if (n && jsk_extract_node(st, n, v))
+				return 1;
+		}
+	}
+
+	if (JSK_UNLIKELY(it.status != JSK_OK)) {
+		jsk_context ctx = (jsk_context){ st->heap, c.json, c.len,
+			it.ptr + 1, (jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL, 0, };
+		st->error = jsk_error(&ctx, "Malformed %s at index %llu",
+				c.json[c.ptr] == '{' ? "object" : "array",
+				it.ptr);
+		return 1;
+	}
+
+	return 0;
+}
+
+JSK_EXPORT jsk_result jsk_extract_matcher(jsk_heap *h,
+		const jsk_matcher *m, const char *const json, unsigned len)
+{
+	jsk_value *values = (jsk_value *)jsk_heap_alloc(h,
+			m->targets * (sizeof(jsk_value) + 1) + 1,
+			JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!values)) {
+		jsk_context ctx = (jsk_context){ h, json, len, 0,
+			(jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL, 0, };
+		return jsk_error(&ctx, "Out of memory");
+	}
+
+	unsigned char *filled = (unsigned char *)&values[m->targets];
+
+	for (unsigned i = 0; i < m->targets; i++) {
+		values[i] = jsk_new_null();
+		filled[i] = 0;
+	}
+
+	jsk_extract_state st = (jsk_extract_state){
+		h,
+		values,
+		filled,
+		m->targets,
+		jsk_success(jsk_new_null()),
+	};
+
+	if (jsk_extract_node(&st, &m->root, jsk_cursor_new(json, len)))
+		return st.error;
+
+	jsk_value a = jsk_new_array();
+	for (unsigned i = 0; i < m->count; i++)
+		jsk_array_push(h, &a, values[m->slots[i]]);
+
+	return jsk_success(a);
+}
+
+JSK_EXPORT jsk_result jsk_extract(jsk_heap *h, const char *const json,
+		unsigned len, const char *const *paths, unsigned n)
+{
+	const jsk_matcher *m = jsk_matcher_compile(h, paths, n);
+
+	if (JSK_UNLIKELY(!m)) {
+		jsk_context ctx = (jsk_context){ h, json, len, 0,
+			(jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL, 0, };
+		return jsk_error(&ctx, "Invalid JSON pointer");
+	}
+
+	return jsk_extract_matcher(h, m, json, len);
+}
+
+#define JSK_IMAGE_MAGIC "JSKB"
+#define JSK_IMAGE_VERSION 1
+#define JSK_IMAGE_BOM 0x01020304u
+
+#define jsk_bin_align(n) (((n) + 7) & ~7ULL)
+
+static unsigned jsk_bin_table_size(unsigned count)
+{
+	unsigned n = 1;
+	while (n * 3 / 4 <= count)
+		n *= 2;
+	return n;
+}
+
+/* Bytes needed for everything v refers to, not counting its own node */
+static unsigned long long jsk_bin_extent(jsk_value v)
+{
+	switch (v.type) {
+	case JSK_STRING:
+		return jsk_bin_align(strlen(jsk_get_string(v)) + 1);
+
+	case JSK_ARRAY: {
+		const unsigned len = jsk_array_length(v);
+		unsigned long long n = len * sizeof(jsk_bin_node);
+		for (unsigned i = 0; i < len; i++)
+			n += jsk_bin_extent(jsk_array_at(v, i));
+		return n;
+	}
+
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY:
+		return jsk_array_length(v) * sizeof(jsk_bin_node);
+
+	case JSK_OBJECT: {
+		const unsigned allocated = jsk_bin_table_size(
+				jsk_object_count(v));
+		unsigned long long n = sizeof(jsk_u64) +
+			allocated * sizeof(jsk_bin_entry);
+
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it)))
+			n += jsk_bin_align(strlen(e->key) + 1) +
+				jsk_bin_extent(e->value);
+		return n;
+	}
+
+	default:
+		return 0;
+	}
+}
+
+static unsigned long long jsk_bin_put_string(char *base,
+		unsigned long long *top, const char *s, unsigned len)
+{
+	const unsigned long long offset = *top;
+	memcpy(&base[offset], s, len);
+	base[offset + len] = 0;
+	*top += jsk_bin_align(len + 1);
+	return offset;
+}
+
+static void jsk_bin_write(char *base, unsigned long long *top,
+		jsk_bin_node *node, jsk_value v)
+{
+	v = jsk_number_value(v);
+
+	/* Packed arrays are written out element by element */
+	node->type = jsk_is_array(v) ? JSK_ARRAY : v.type;
+	node->count = 0;
+	node->payload = 0;
+
+	switch (v.type) {
+	case JSK_STRING: {
+		const unsigned len = strlen(jsk_get_string(v));
+		node->count = len;
+		node->payload = jsk_bin_put_string(base, top,
+				jsk_get_string(v), len);
+		return;
+	}
+
+	case JSK_ARRAY:
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY: {
+		const unsigned len = jsk_array_length(v);
+		node->count = len;
+		if (!len)
+			return;
+
+		node->payload = *top;
+		*top += len * sizeof(jsk_bin_node);
+
+		jsk_bin_node *nodes = (jsk_bin_node *)&base[node->payload];
+		for (unsigned i = 0; i < len; i++)
+			jsk_bin_write(base, top, &nodes[i], jsk_array_get(v, i));
+		return;
+	}
+
+	case JSK_OBJECT: {
+		const unsigned allocated = jsk_bin_table_size(
+				jsk_object_count(v));
+		const unsigned long long table = *top;
+
+		node->count = jsk_object_count(v);
+		node->payload = table;
+		*(jsk_u64 *)&base[table] = allocated;
+		*top += sizeof(jsk_u64) + allocated * sizeof(jsk_bin_entry);
+
+		jsk_bin_entry *entries = (jsk_bin_entry *)
+			&base[table + sizeof(jsk_u64)];
+
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it))) {
+			const unsigned len = strlen(e->key);
+			const jsk_u64 hash = jsk_hash(e->key);
+
+			unsigned bucket = hash & (allocated - 1);
+			while (entries[bucket].key)
+				bucket = (bucket + 1) & (allocated - 1);
+
+			entries[bucket].hash = hash;
+			entries[bucket].key_len = len;
+			entries[bucket].key = jsk_bin_put_string(base, top,
+					e->key, len);
+			jsk_bin_write(base, top, &entries[bucket].value,
+					e->value);
+		}
+		return;
+	}
+
+	default:
+		node->payload = (jsk_u64)v.value;
+		return;
+	}
+}
+
+JSK_EXPORT void *jsk_save_binary(jsk_heap *h, jsk_value v,
+		unsigned long long *size)
+{
+	const unsigned long long n = sizeof(jsk_image_header) +
+		jsk_bin_extent(v);
+
+	char *base = (char *)JSK_MALLOC(h->ctx, n);
+	if (JSK_UNLIKELY(!base))
+		return NULL;
+
+	/* Zero everything so that padding and empty buckets are stable */
+	memset(base, 0, n);
+
+	jsk_image_header *hdr = (jsk_image_header *)base;
+	memcpy(hdr->magic, JSK_IMAGE_MAGIC, 4);
+	hdr->version = JSK_IMAGE_VERSION;
+	hdr->bom = JSK_IMAGE_BOM;
+	hdr->size = n;
+
+	unsigned long long top = sizeof(jsk_image_header);
+	jsk_bin_write(base, &top, &hdr->root, v);
+
+	*size = n;
+	return base;
+}
+
+/*
+ * Claims n bytes at offset for one node. Every region is charged against the
+ * budget, so offsets that are shared or loop back can't make the check walk
+ * more than the image itself.
+ */
+static int jsk_bin_take(unsigned long long size, unsigned long long *budget,
+		jsk_u64 offset, jsk_u64 n)
+{
+	if (JSK_UNLIKELY(offset < sizeof(jsk_image_header) || (offset & 7) ||
+				offset > size || n > size - offset ||
+				jsk_bin_align(n) > *budget))
+		return 1;
+
+	*budget -= jsk_bin_align(n);
+	return 0;
+}
+
+static int jsk_bin_check(const char *base, unsigned long long size,
+		const jsk_bin_node *node, unsigned long long *budget,
+		unsigned depth)
+{
+	if (JSK_UNLIKELY(depth > JSK_BINARY_MAX_DEPTH))
+		return 1;
+
+	switch (node->type) {
+	case JSK_STRING:
+		return jsk_bin_take(size, budget, node->payload,
+				(jsk_u64)node->count + 1) ||
+			base[node->payload + node->count];
+
+	case JSK_ARRAY: {
+		if (!node->count)
+			return 0;
+
+		if (jsk_bin_take(size, budget, node->payload,
+					(jsk_u64)node->count *
+					sizeof(jsk_bin_node)))
+			return 1;
+
+		const jsk_bin_node *nodes = (const jsk_bin_node *)
+			&base[node->payload];
+		for (unsigned i = 0; i < node->count; i++)
+			if (jsk_bin_check(base, size, &nodes[i], budget,
+						depth + 1))
+				return 1;
+		return 0;
+	}
+
+	case JSK_OBJECT: {
+		if (jsk_bin_take(size, budget, node->payload, sizeof(jsk_u64)))
+			return 1;
+
+		/* Lookups probe until an empty bucket, so one must exist */
+		const jsk_u64 allocated = *(const jsk_u64 *)&base[node->payload];
+		if (JSK_UNLIKELY(!allocated || (allocated & (allocated - 1)) ||
+					node->count >= allocated ||
+					allocated > size / sizeof(jsk_bin_entry) ||
+					jsk_bin_take(size, budget,
+						node->payload + sizeof(jsk_u64),
+						allocated *
+						sizeof(jsk_bin_entry))))
+			return 1;
+
+		const jsk_bin_entry *entries = (const jsk_bin_entry *)
+			&base[node->payload + sizeof(jsk_u64)];
+		unsigned used = 0;
+
+		for (jsk_u64 i = 0; i < allocated; i++) {
+			const jsk_bin_entry *e = &entries[i];
+			if (!e->key)
+				continue;
+
+			used++;
+			if (jsk_bin_take(size, budget, e->key,
+						(jsk_u64)e->key_len + 1) ||
+					base[e->key + e->key_len] ||
+					jsk_bin_check(base, size, &e->value,
+						budget, depth + 1))
+				return 1;
+		}
+
+		return used != node->count;
+	}
+
+	case JSK_INT:
+	case JSK_FLOAT:
+	case JSK_BOOL:
+	case JSK_NULL:
+		return 0;
+
+	default:
+		return 1;
+	}
+}
+
+JSK_EXPORT jsk_status jsk_load_binary(const void *image,
+		unsigned long long size, jsk_bin_value *root)
+{
+	const jsk_image_header *hdr = (const jsk_image_header *)image;
+
+	if (JSK_UNLIKELY(size < sizeof(jsk_image_header) ||
+				memcmp(hdr->magic, JSK_IMAGE_MAGIC, 4) ||
+				hdr->version != JSK_IMAGE_VERSION ||
+				hdr->bom != JSK_IMAGE_BOM ||
+				hdr->size != size))
+		return JSK_ERROR;
+
+	unsigned long long budget = size - sizeof(jsk_image_header);
+	if (JSK_UNLIKELY(jsk_bin_check((const char *)image, size, &hdr->root,
+					&budget, 0)))
+		return JSK_ERROR;
+
+	*root = (jsk_bin_value){ (const char *)image, &hdr->root };
+	return JSK_OK;
+}
+
+JSK_EXPORT jsk_status jsk_bin_object_get(jsk_bin_value object,
+		const char *const name, jsk_bin_value *value)
+{
+	const char *table = object.base + object.node->payload;
+	const jsk_u64 allocated = *(const jsk_u64 *)table;
+	const jsk_bin_entry *entries = (const jsk_bin_entry *)
+		(table + sizeof(jsk_u64));
+
+	const jsk_u64 hash = jsk_hash(name);
+	jsk_u64 bucket = hash & (allocated - 1);
+
+	while (entries[bucket].key) {
+		const jsk_bin_entry *e = &entries[bucket];
+
+		if (e->hash == hash && !strcmp(object.base + e->key, name)) {
+			*value = (jsk_bin_value){ object.base, &e->value };
+			return JSK_OK;
+		}
+
+		bucket = (bucket + 1) & (allocated - 1);
+	}
+
+	return JSK_ERROR;
+}
+
+JSK_EXPORT int jsk_bin_object_next(jsk_bin_value object, unsigned *bucket,
+		const char **key, jsk_bin_value *value)
+{
+	const char *table = object.base + object.node->payload;
+	const jsk_u64 allocated = *(const jsk_u64 *)table;
+	const jsk_bin_entry *entries = (const jsk_bin_entry *)
+		(table + sizeof(jsk_u64));
+
+	for (; *bucket < allocated; (*bucket)++) {
+		const jsk_bin_entry *e = &entries[*bucket];
+
+		if (e->key) {
+			*key = object.base + e->key;
+			*value = (jsk_bin_value){ object.base, &e->value };
+			(*bucket)++;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+JSK_EXPORT jsk_status jsk_bin_to_value(jsk_heap *h, jsk_bin_value v,
+		jsk_value *out)
+{
+	jsk_value x;
+
+	switch (jsk_bin_type(v)) {
+	case JSK_STRING:
+		*out = jsk_new_string_len(h, jsk_bin_get_string(v),
+				jsk_bin_length(v));
+		return out->type == JSK_STRING ? JSK_OK : JSK_ERROR;
+
+	case JSK_ARRAY:
+		*out = jsk_new_array();
+		for (unsigned i = 0; i < jsk_bin_length(v); i++)
+			if (jsk_bin_to_value(h, jsk_bin_at(v, i), &x) !=
+					JSK_OK || jsk_array_add(h, out, x, 0))
+				return JSK_ERROR;
+		return JSK_OK;
+
+	case JSK_OBJECT: {
+		*out = jsk_new_object(h);
+		if (JSK_UNLIKELY(out->type != JSK_OBJECT))
+			return JSK_ERROR;
+
+		unsigned bucket = 0;
+		const char *key;
+		jsk_bin_value e;
+
+		while (jsk_bin_object_next(v, &bucket, &key, &e)) {
+			const unsigned len = strlen(key);
+			char *name = (char *)jsk_heap_alloc(h, len + 1, 1);
+			if (JSK_UNLIKELY(!name))
+				return JSK_ERROR;
+			memcpy(name, key, len + 1);
+			if (jsk_bin_to_value(h, e, &x) != JSK_OK ||
+					jsk_object_add((jsk_object *)out->value,
+						name, x))
+				return JSK_ERROR;
+		}
+		return JSK_OK;
+	}
+
+	default:
+		*out = (jsk_value){ jsk_bin_type(v), (void *)v.node->payload };
+		return JSK_OK;
+	}
+}
+
+/*
+ * CBOR and MessagePack. The decoders drive a jsk_handler just like
+ * jsk_parse_value() does, except that strings are reported unescaped, so the
+ * consumers below come in a second flavour for unescaped input.
+ */
+
+typedef struct jsk_decoder {
+	const unsigned char *data;
+	unsigned long long len;
+	unsigned long long ptr;
+	const jsk_handler *h;
+	void *user;
+	jsk_heap *heap;
+	unsigned depth;
+	const char *error;
+} jsk_decoder;
+
+#define JSK_DECODE_EMIT(cb, args)				\
+	do {							\
+		if (d->h->cb && JSK_UNLIKELY(d->h->cb args))	\
+			return jsk_decode_fail(d, "Aborted by handler"); \
+	} while (0)
+
+static int jsk_decode_fail(jsk_decoder *d, const char *const error)
+{
+	d->error = error;
+	return 1;
+}
+
+static int jsk_decode_need(jsk_decoder *d, unsigned long long n)
+{
+	if (JSK_UNLIKELY(d->len - d->ptr < n))
+		return jsk_decode_fail(d, "Unexpected end of input");
+	return 0;
+}
+
+static int jsk_decode_be(jsk_decoder *d, unsigned n, jsk_u64 *v)
+{
+	if (jsk_decode_need(d, n))
+		return 1;
+
+	jsk_u64 r = 0;
+	for (unsigned i = 0; i < n; i++)
+		r = (r << 8) | d->data[d->ptr++];
+
+	*v = r;
+	return 0;
+}
+
+static int jsk_decode_enter(jsk_decoder *d)
+{
+	if (JSK_UNLIKELY(++d->depth > JSK_BINARY_MAX_DEPTH))
+		return jsk_decode_fail(d, "Too deeply nested");
+	return 0;
+}
+
+static int jsk_decode_string(jsk_decoder *d, const char *s,
+		unsigned long long len, int key)
+{
+	if (JSK_UNLIKELY(len > 0xffffffffULL))
+		return jsk_decode_fail(d, "String too long");
+
+	if (key)
+		JSK_DECODE_EMIT(key, (d->user, s, (unsigned)len));
+	else
+		JSK_DECODE_EMIT(string, (d->user, s, (unsigned)len));
+
+	return 0;
+}
+
+static int jsk_decode_uint(jsk_decoder *d, jsk_u64 v)
+{
+	if (v > 0x7fffffffffffffffULL)
+		JSK_DECODE_EMIT(floating, (d->user, (double)v));
+	else
+		JSK_DECODE_EMIT(integer, (d->user, (long long)v));
+	return 0;
+}
+
+static double jsk_f32_bits(jsk_u64 bits)
+{
+	const unsigned u = (unsigned)bits;
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+static double jsk_f64_bits(jsk_u64 bits)
+{
+	double f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static double jsk_f16_bits(jsk_u64 bits)
+{
+	const unsigned e = (bits >> 10) & 31;
+	const jsk_u64 m = bits & 1023;
+	double f;
+
+	if (e == 0) {
+		f = (double)m / 16777216.0;
+	} else {
+		const jsk_u64 e64 = e == 31 ? 2047 : e - 15 + 1023;
+		f = jsk_f64_bits((e64 << 52) | (m << 42));
+	}
+
+	return bits & 0x8000 ? -f : f;
+}
+
+static int jsk_cbor_item(jsk_decoder *d);
+
+static int jsk_cbor_arg(jsk_decoder *d, unsigned info, jsk_u64 *arg)
+{
+	if (info < 24) {
+		*arg = info;
+		return 0;
+	}
+
+	if (JSK_UNLIKELY(info > 27))
+		return jsk_decode_fail(d, "Invalid CBOR argument");
+
+	return jsk_decode_be(d, 1u << (info - 24), arg);
+}
+
+static int jsk_cbor_string(jsk_decoder *d, unsigned ib, int key)
+{
+	jsk_u64 len;
+
+	if ((ib & 31) != 31) {
+		if (jsk_cbor_arg(d, ib & 31, &len) || jsk_decode_need(d, len))
+			return 1;
+
+		const char *s = (const char *)&d->data[d->ptr];
+		d->ptr += len;
+		return jsk_decode_string(d, s, len, key);
+	}
+
+	/* Indefinite length: measure the chunks, then join them */
+	const unsigned long long start = d->ptr;
+	unsigned long long total = 0;
+
+	for (int pass = 0; pass < 2; pass++) {
+		char *mem = NULL;
+
+		if (pass) {
+			if (JSK_UNLIKELY(total > 0xffffffffULL))
+				return jsk_decode_fail(d, "String too long");
+			mem = (char *)jsk_heap_alloc(d->heap,
+					(unsigned)total + 1, 1);
+			if (JSK_UNLIKELY(!mem))
+				return jsk_decode_fail(d, "Out of memory");
+			d->ptr = start;
+			total = 0;
+		}
+
+		while (1) {
+			if (jsk_decode_need(d, 1))
+				return 1;
+
+			const unsigned chunk = d->data[d->ptr++];
+			if (chunk == 0xff)
+				break;
+
+			if (JSK_UNLIKELY((chunk & 0xe0) != (ib & 0xe0) ||
+						(chunk & 31) == 31))
+				return jsk_decode_fail(d,
+						"Malformed CBOR string chunk");
+
+			if (jsk_cbor_arg(d, chunk & 31, &len) ||
+					jsk_decode_need(d, len))
+				return 1;
+
+			if (mem)
+				memcpy(&mem[total], &d->data[d->ptr], len);
+
+			total += len;
+			d->ptr += len;
+		}
+
+		if (mem) {
+			mem[total] = 0;
+			return jsk_decode_string(d, mem, total, key);
+		}
+	}
+
+	return 0;
+}
+
+static int jsk_cbor_break(jsk_decoder *d, unsigned info,
+		unsigned long long i, jsk_u64 n)
+{
+	if (info != 31)
+		return i == n;
+
+	if (jsk_decode_need(d, 1))
+		return -1;
+
+	if (d->data[d->ptr] != 0xff)
+		return 0;
+
+	d->ptr++;
+	return 1;
+}
+
+static int jsk_cbor_container(jsk_decoder *d, unsigned ib)
+{
+	const unsigned info = ib & 31;
+	const int map = (ib >> 5) == 5;
+	jsk_u64 n = 0;
+
+	if (info != 31) {
+		if (jsk_cbor_arg(d, info, &n))
+			return 1;
+
+		/* Each element takes at least a byte; reject bogus counts */
+		if (JSK_UNLIKELY(n > d->len - d->ptr))
+			return jsk_decode_fail(d, "Unexpected end of input");
+	}
+
+	if (jsk_decode_enter(d))
+		return 1;
+
+	if (map)
+		JSK_DECODE_EMIT(start_object, (d->user));
+	else
+		JSK_DECODE_EMIT(start_array, (d->user));
+
+	unsigned long long i = 0;
+	int done;
+
+	while (!(done = jsk_cbor_break(d, info, i, n))) {
+		if (map) {
+			if (jsk_decode_need(d, 1))
+				return 1;
+
+			if (JSK_UNLIKELY((d->data[d->ptr] >> 5) != 3))
+				return jsk_decode_fail(d,
+						"CBOR map keys must be strings");
+
+			if (jsk_cbor_string(d, d->data[d->ptr++], 1))
+				return 1;
+		}
+
+		if (jsk_cbor_item(d))
+			return 1;
+
+		i++;
+	}
+
+	if (done < 0)
+		return 1;
+
+	if (map)
+		JSK_DECODE_EMIT(end_object, (d->user, (unsigned)i));
+	else
+		JSK_DECODE_EMIT(end_array, (d->user, (unsigned)i));
+
+	d->depth--;
+	return 0;
+}
+
+static int jsk_cbor_item(jsk_decoder *d)
+{
+	if (jsk_decode_need(d, 1))
+		return 1;
+
+	const unsigned ib = d->data[d->ptr++];
+	const unsigned info = ib & 31;
+	jsk_u64 arg;
+
+	switch (ib >> 5) {
+	case 0:
+		if (jsk_cbor_arg(d, info, &arg))
+			return 1;
+		return jsk_decode_uint(d, arg);
+
+	case 1:
+		if (jsk_cbor_arg(d, info, &arg))
+			return 1;
+		if (arg > 0x7fffffffffffffffULL)
+			JSK_DECODE_EMIT(floating, (d->user, -1.0 - (double)arg));
+		else
+			JSK_DECODE_EMIT(integer, (d->user, -1 - (long long)arg));
+		return 0;
+
+	case 2: /* Byte strings have no JSON equivalent; pass them as text */
+	case 3:
+		return jsk_cbor_string(d, ib, 0);
+
+	case 4:
+	case 5:
+		return jsk_cbor_container(d, ib);
+
+	case 6: /* Tags are dropped, leaving the tagged item */
+		if (jsk_cbor_arg(d, info, &arg) || jsk_decode_enter(d) ||
+				jsk_cbor_item(d))
+			return 1;
+		d->depth--;
+		return 0;
+
+	default:
+		break;
+	}
+
+	switch (info) {
+	case 20:
+	case 21:
+		JSK_DECODE_EMIT(boolean, (d->user, info == 21));
+		return 0;
+
+	case 22:
+	case 23: /* undefined */
+		JSK_DECODE_EMIT(null, (d->user));
+		return 0;
+
+	case 25:
+	case 26:
+	case 27:
+		if (jsk_cbor_arg(d, info, &arg))
+			return 1;
+
+		JSK_DECODE_EMIT(floating, (d->user,
+			info == 25 ? jsk_f16_bits(arg) :
+			info == 26 ? jsk_f32_bits(arg) : jsk_f64_bits(arg)));
+		return 0;
+
+	case 31:
+		d->ptr--;
+		return jsk_decode_fail(d, "Unexpected CBOR break");
+
+	default:
+		d->ptr--;
+		return jsk_decode_fail(d, "Unsupported CBOR simple value");
+	}
+}
+
+static int jsk_msgpack_item(jsk_decoder *d);
+
+static int jsk_msgpack_string(jsk_decoder *d, unsigned width,
+		jsk_u64 len, int key)
+{
+	if ((width && jsk_decode_be(d, width, &len)) ||
+			jsk_decode_need(d, len))
+		return 1;
+
+	const char *s = (const char *)&d->data[d->ptr];
+	d->ptr += len;
+	return jsk_decode_string(d, s, len, key);
+}
+
+static int jsk_msgpack_container(jsk_decoder *d, unsigned width,
+		jsk_u64 n, int map)
+{
+	if (width && jsk_decode_be(d, width, &n))
+		return 1;
+
+	if (JSK_UNLIKELY(n > d->len - d->ptr))
+		return jsk_decode_fail(d, "Unexpected end of input");
+
+	if (jsk_decode_enter(d))
+		return 1;
+
+	if (map)
+		JSK_DECODE_EMIT(start_object, (d->user));
+	else
+		JSK_DECODE_EMIT(start_array, (d->user));
+
+	for (jsk_u64 i = 0; i < n; i++) {
+		if (map) {
+			if (jsk_decode_need(d, 1))
+				return 1;
+
+			const unsigned b = d->data[d->ptr++];
+			int err;
+
+			if ((b & 0xe0) == 0xa0)
+				err = jsk_msgpack_string(d, 0, b & 31, 1);
+			else if (b >= 0xd9 && b <= 0xdb)
+				err = jsk_msgpack_string(d, 1u << (b - 0xd9),
+						0, 1);
+			else
+				err = jsk_decode_fail(d,
+					"MessagePack map keys must be strings");
+
+			if (err)
+				return 1;
+		}
+
+		if (jsk_msgpack_item(d))
+			return 1;
+	}
+
+	if (map)
+		JSK_DECODE_EMIT(end_object, (d->user, (unsigned)n));
+	else
+		JSK_DECODE_EMIT(end_array, (d->user, (unsigned)n));
+
+	d->depth--;
+	return 0;
+}
+
+static int jsk_msgpack_item(jsk_decoder *d)
+{
+	if (jsk_decode_need(d, 1))
+		return 1;
+
+	const unsigned b = d->data[d->ptr++];
+	jsk_u64 v;
+
+	if (b <= 0x7f) {
+		JSK_DECODE_EMIT(integer, (d->user, b));
+		return 0;
+	}
+
+	if (b >= 0xe0) {
+		JSK_DECODE_EMIT(integer, (d->user, (long long)b - 256));
+		return 0;
+	}
+
+	if ((b & 0xf0) == 0x80)
+		return jsk_msgpack_container(d, 0, b & 15, 1);
+
+	if ((b & 0xf0) == 0x90)
+		return jsk_msgpack_container(d, 0, b & 15, 0);
+
+	if ((b & 0xe0) == 0xa0)
+		return jsk_msgpack_string(d, 0, b & 31, 0);
+
+	switch (b) {
+	case 0xc0:
+		JSK_DECODE_EMIT(null, (d->user));
+		return 0;
+
+	case 0xc2:
+	case 0xc3:
+		JSK_DECODE_EMIT(boolean, (d->user, b & 1));
+		return 0;
+
+	case 0xc4: /* bin 8/16/32 are passed as text */
+	case 0xc5:
+	case 0xc6:
+		return jsk_msgpack_string(d, 1u << (b - 0xc4), 0, 0);
+
+	case 0xd9:
+	case 0xda:
+	case 0xdb:
+		return jsk_msgpack_string(d, 1u << (b - 0xd9), 0, 0);
+
+	case 0xca:
+	case 0xcb:
+		if (jsk_decode_be(d, b == 0xca ? 4 : 8, &v))
+			return 1;
+		JSK_DECODE_EMIT(floating, (d->user,
+			b == 0xca ? jsk_f32_bits(v) : jsk_f64_bits(v)));
+		return 0;
+
+	case 0xcc:
+	case 0xcd:
+	case 0xce:
+	case 0xcf:
+		if (jsk_decode_be(d, 1u << (b - 0xcc), &v))
+			return 1;
+		return jsk_decode_uint(d, v);
+
+	case 0xd0:
+	case 0xd1:
+	case 0xd2:
+	case 0xd3: {
+		const unsigned bits = 8u << (b - 0xd0);
+		if (jsk_decode_be(d, bits / 8, &v))
+			return 1;
+
+		/* Sign-extend from the encoded width */
+		if (bits < 64 && (v >> (bits - 1)))
+			v |= ~0ULL << bits;
+
+		JSK_DECODE_EMIT(integer, (d->user, (long long)v));
+		return 0;
+	}
+
+	case 0xdc:
+	case 0xdd:
+		return jsk_msgpack_container(d, b == 0xdc ? 2 : 4, 0, 0);
+
+	case 0xde:
+	case 0xdf:
+		return jsk_msgpack_container(d, b == 0xde ? 2 : 4, 0, 1);
+
+	default:
+		d->ptr--;
+		return jsk_decode_fail(d, "Unsupported MessagePack type");
+	}
+}
+
+#undef JSK_DECODE_EMIT
+
+static jsk_result jsk_decode(jsk_heap *heap, const void *data,
+		unsigned long long size, int (*item)(jsk_decoder *),
+		const jsk_handler *h, void *user)
+{
+	jsk_decoder d = (jsk_decoder){
+		(const unsigned char *)data,
+		size,
+		0,
+		h,
+		user,
+		heap,
+		0,
+		NULL,
+	};
+
+	if (!item(&d) && d.ptr != size)
+		jsk_decode_fail(&d, "Unexpected trailing data");
+
+	if (d.error) {
+		jsk_context ctx = (jsk_context){ heap, (const char *)data,
+			size, d.ptr, (jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL, 0, };
+		return jsk_error(&ctx, "%s at index %llu", d.error, d.ptr);
+	}
+
+	return jsk_success(jsk_new_null());
+}
+
+/*
+ * Object keys are stored the way they appear in JSON text, so keys that come
+ * from a binary format are escaped on the way in and unescaped on the way out.
+ * Solidus is left alone since it doesn't need escaping.
+ */
+static char *jsk_escape_alloc(jsk_heap *h, const char *s, unsigned len)
+{
+	unsigned n = len;
+	for (unsigned i = 0; i < len; i++) {
+		const char e = jsk_escapes[(unsigned char)s[i]];
+		if (e && e != '/')
+			n += e == 'u' ? 5 : 1;
+	}
+
+	char *mem = (char *)jsk_heap_alloc(h, n + 1, 1);
+	if (JSK_UNLIKELY(!mem))
+		return NULL;
+
+	if (n == len) {
+		memcpy(mem, s, len);
+	} else {
+		char *dest = mem;
+		for (unsigned i = 0; i < len; i++) {
+			const char e = jsk_escapes[(unsigned char)s[i]];
+			if (e && e != '/') {
+				jsk_escape_char(dest, s[i]);
+				dest += e == 'u' ? 6 : 2;
+			} else {
+				*dest++ = s[i];
+			}
+		}
+	}
+
+	mem[n] = 0;
+	return mem;
+}
+
+static const char *jsk_unescape_key(jsk_heap *h, const char *key)
+{
+	if (!strchr(key, '\\'))
+		return key;
+	return jsk_get_string(jsk_new_string_escaped(h, key, strlen(key)));
+}
+
+static int jsk_dom_plain_string(void *user, const char *s, unsigned len)
+{
+	jsk_dom_builder *b = (jsk_dom_builder *)user;
+	const jsk_value v = jsk_new_string_len(b->heap, s, len);
+	if (JSK_UNLIKELY(v.type == JSK_NULL))
+		return jsk_dom_oom(b);
+	return jsk_dom_emit(b, v);
+}
+
+static int jsk_dom_plain_key(void *user, const char *s, unsigned len)
+{
+	jsk_dom_builder *b = (jsk_dom_builder *)user;
+	char *name = jsk_escape_alloc(b->heap, s, len);
+	if (JSK_UNLIKELY(!name))
+		return jsk_dom_oom(b);
+
+	b->stack[b->depth - 1].key = name;
+	return 0;
+}
+
+static const jsk_handler jsk_dom_plain_handler = {
+	jsk_dom_null,
+	jsk_dom_boolean,
+	jsk_dom_integer,
+	jsk_dom_floating,
+	jsk_dom_plain_string,
+	jsk_dom_plain_key,
+	jsk_dom_start_object,
+	jsk_dom_end,
+	jsk_dom_start_array,
+	jsk_dom_end,
+	jsk_dom_number,
+};
+
+static jsk_result jsk_decode_dom(jsk_heap *heap, const void *data,
+		unsigned long long size, int (*item)(jsk_decoder *))
+{
+	jsk_dom_builder b;
+	jsk_dom_init(&b, heap);
+
+	jsk_result res = jsk_decode(heap, data, size, item,
+			&jsk_dom_plain_handler, &b);
+	if (res.status != JSK_OK)
+		return res;
+
+	return jsk_success(b.root);
+}
+
+JSK_EXPORT jsk_result jsk_parse_cbor(jsk_heap *heap, const void *data,
+		unsigned long long size)
+{
+	return jsk_decode_dom(heap, data, size, jsk_cbor_item);
+}
+
+JSK_EXPORT jsk_result jsk_parse_msgpack(jsk_heap *heap, const void *data,
+		unsigned long long size)
+{
+	return jsk_decode_dom(heap, data, size, jsk_msgpack_item);
+}
+
+static int jsk_put_be(jsk_heap *out, unsigned lead, jsk_u64 v, unsigned n)
+{
+	unsigned char buf[9];
+
+	buf[0] = lead;
+	for (unsigned i = n; i > 0; i--) {
+		buf[i] = v & 255;
+		v >>= 8;
+	}
+
+	return jsk_heap_write(out, buf, n + 1);
+}
+
+static int jsk_cbor_head(jsk_heap *out, unsigned major, jsk_u64 arg)
+{
+	major <<= 5;
+
+	if (arg < 24)
+		return jsk_put_be(out, major | arg, 0, 0);
+	if (arg <= 0xff)
+		return jsk_put_be(out, major | 24, arg, 1);
+	if (arg <= 0xffff)
+		return jsk_put_be(out, major | 25, arg, 2);
+	if (arg <= 0xffffffffULL)
+		return jsk_put_be(out, major | 26, arg, 4);
+	return jsk_put_be(out, major | 27, arg, 8);
+}
+
+static int jsk_cbor_int(jsk_heap *out, long long v)
+{
+	return v < 0 ? jsk_cbor_head(out, 1, (jsk_u64)(-1 - v)) :
+		jsk_cbor_head(out, 0, (jsk_u64)v);
+}
+
+/* Shrinks to single precision when that loses nothing */
+static int jsk_cbor_float(jsk_heap *out, double f)
+{
+	const float s = (float)f;
+
+	if ((double)s == f) {
+		unsigned u;
+		memcpy(&u, &s, sizeof(u));
+		return jsk_put_be(out, 0xfa, u, 4);
+	}
+
+	jsk_u64 u;
+	memcpy(&u, &f, sizeof(u));
+	return jsk_put_be(out, 0xfb, u, 8);
+}
+
+static int jsk_cbor_text(jsk_heap *out, const char *s, unsigned long long len)
+{
+	return jsk_cbor_head(out, 3, len) || jsk_heap_write(out, s, len);
+}
+
+static int jsk_cbor_put(jsk_heap *h, jsk_heap *out, jsk_value v)
+{
+	switch (v.type) {
+	case JSK_OBJECT: {
+		if (jsk_cbor_head(out, 5, jsk_object_count(v)))
+			return 1;
+
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it))) {
+			const char *key = jsk_unescape_key(h, e->key);
+			if (jsk_cbor_text(out, key, strlen(key)) ||
+					jsk_cbor_put(h, out, e->value))
+				return 1;
+		}
+		return 0;
+	}
+
+	case JSK_ARRAY:
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY: {
+		const unsigned len = jsk_array_length(v);
+		if (jsk_cbor_head(out, 4, len))
+			return 1;
+
+		for (unsigned i = 0; i < len; i++)
+			if (jsk_cbor_put(h, out, jsk_array_get(v, i)))
+				return 1;
+		return 0;
+	}
+
+	case JSK_STRING:
+		return jsk_cbor_text(out, jsk_get_string(v),
+				strlen(jsk_get_string(v)));
+
+	case JSK_INT:
+		return jsk_cbor_int(out, jsk_get_int(v));
+
+	case JSK_FLOAT:
+		return jsk_cbor_float(out, jsk_get_float(v));
+
+	case JSK_BOOL:
+		return jsk_put_be(out, jsk_get_bool(v) ? 0xf5 : 0xf4, 0, 0);
+
+	case JSK_NULL:
+		return jsk_put_be(out, 0xf6, 0, 0);
+
+	case JSK_NUMBER:
+		return jsk_cbor_put(h, out, jsk_number_value(v));
+	}
+
+	return 1;
+}
+
+static int jsk_msgpack_int(jsk_heap *out, long long v)
+{
+	if (v >= 0) {
+		if (v <= 0x7f)
+			return jsk_put_be(out, (unsigned)v, 0, 0);
+		if (v <= 0xff)
+			return jsk_put_be(out, 0xcc, v, 1);
+		if (v <= 0xffff)
+			return jsk_put_be(out, 0xcd, v, 2);
+		if (v <= 0xffffffffLL)
+			return jsk_put_be(out, 0xce, v, 4);
+		return jsk_put_be(out, 0xcf, v, 8);
+	}
+
+	if (v >= -32)
+		return jsk_put_be(out, (unsigned)(v & 0xff), 0, 0);
+	if (v >= -0x80)
+		return jsk_put_be(out, 0xd0, v & 0xff, 1);
+	if (v >= -0x8000)
+		return jsk_put_be(out, 0xd1, v & 0xffff, 2);
+	if (v >= -0x80000000LL)
+		return jsk_put_be(out, 0xd2, v & 0xffffffffULL, 4);
+	return jsk_put_be(out, 0xd3, (jsk_u64)v, 8);
+}
+
+static int jsk_msgpack_float(jsk_heap *out, double f)
+{
+	const float s = (float)f;
+
+	if ((double)s == f) {
+		unsigned u;
+		memcpy(&u, &s, sizeof(u));
+		return jsk_put_be(out, 0xca, u, 4);
+	}
+
+	jsk_u64 u;
+	memcpy(&u, &f, sizeof(u));
+	return jsk_put_be(out, 0xcb, u, 8);
+}
+
+/* fix is the fixed-size form's type byte, max its largest count */
+static int jsk_msgpack_head(jsk_heap *out, unsigned fix, unsigned max,
+		unsigned lead16, jsk_u64 n)
+{
+	if (n <= max)
+		return jsk_put_be(out, fix | (unsigned)n, 0, 0);
+	if (n <= 0xffff)
+		return jsk_put_be(out, lead16, n, 2);
+	return jsk_put_be(out, lead16 + 1, n, 4);
+}
+
+static int jsk_msgpack_text(jsk_heap *out, const char *s,
+		unsigned long long len)
+{
+	int err;
+
+	if (len < 32)
+		err = jsk_put_be(out, 0xa0 | (unsigned)len, 0, 0);
+	else if (len <= 0xff)
+		err = jsk_put_be(out, 0xd9, len, 1);
+	else
+		err = jsk_msgpack_head(out, 0, 0, 0xda, len);
+
+	return err || jsk_heap_write(out, s, len);
+}
+
+static int jsk_msgpack_put(jsk_heap *h, jsk_heap *out, jsk_value v)
+{
+	switch (v.type) {
+	case JSK_OBJECT: {
+		if (jsk_msgpack_head(out, 0x80, 15, 0xde,
+					jsk_object_count(v)))
+			return 1;
+
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it))) {
+			const char *key = jsk_unescape_key(h, e->key);
+			if (jsk_msgpack_text(out, key, strlen(key)) ||
+					jsk_msgpack_put(h, out, e->value))
+				return 1;
+		}
+		return 0;
+	}
+
+	case JSK_ARRAY:
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY: {
+		const unsigned len = jsk_array_length(v);
+		if (jsk_msgpack_head(out, 0x90, 15, 0xdc, len))
+			return 1;
+
+		for (unsigned i = 0; i < len; i++)
+			if (jsk_msgpack_put(h, out, jsk_array_get(v, i)))
+				return 1;
+		return 0;
+	}
+
+	case JSK_STRING:
+		return jsk_msgpack_text(out, jsk_get_string(v),
+				strlen(jsk_get_string(v)));
+
+	case JSK_INT:
+		return jsk_msgpack_int(out, jsk_get_int(v));
+
+	case JSK_FLOAT:
+		return jsk_msgpack_float(out, jsk_get_float(v));
+
+	case JSK_BOOL:
+		return jsk_put_be(out, jsk_get_bool(v) ? 0xc3 : 0xc2, 0, 0);
+
+	case JSK_NULL:
+		return jsk_put_be(out, 0xc0, 0, 0);
+
+	case JSK_NUMBER:
+		return jsk_msgpack_put(h, out, jsk_number_value(v));
+	}
+
+	return 1;
+}
+
+static void *jsk_encode(jsk_heap *h, jsk_value v, unsigned long long *size,
+		int (*put)(jsk_heap *, jsk_heap *, jsk_value))
+{
+	jsk_heap *out = jsk_heap_new(h->ctx);
+	if (JSK_UNLIKELY(!out))
+		return NULL;
+
+	void *mem = NULL;
+
+	if (!put(h, out, v)) {
+		unsigned long long n = 0;
+		for (jsk_heap *c = out; c; c = c->next)
+			n += c->ptr;
+
+		mem = jsk_heap_unify(out, 0);
+		*size = n;
+	}
+
+	jsk_heap_free(out);
+	return mem;
+}
+
+JSK_EXPORT void *jsk_to_cbor(jsk_heap *h, jsk_value v,
+		unsigned long long *size)
+{
+	return jsk_encode(h, v, size, jsk_cbor_put);
+}
+
+JSK_EXPORT void *jsk_to_msgpack(jsk_heap *h, jsk_value v,
+		unsigned long long *size)
+{
+	return jsk_encode(h, v, size, jsk_msgpack_put);
+}
+
+/*
+ * Streaming JSON -> CBOR. Container sizes aren't known until they are closed,
+ * so arrays and maps are written with indefinite lengths.
+ */
+typedef struct jsk_cbor_writer {
+	jsk_heap *heap;
+	jsk_heap *out;
+} jsk_cbor_writer;
+
+static int jsk_cbor_w_null(void *user)
+{
+	return jsk_put_be(((jsk_cbor_writer *)user)->out, 0xf6, 0, 0);
+}
+
+static int jsk_cbor_w_boolean(void *user, int value)
+{
+	return jsk_put_be(((jsk_cbor_writer *)user)->out,
+			value ? 0xf5 : 0xf4, 0, 0);
+}
+
+static int jsk_cbor_w_integer(void *user, long long value)
+{
+	return jsk_cbor_int(((jsk_cbor_writer *)user)->out, value);
+}
+
+static int jsk_cbor_w_floating(void *user, double value)
+{
+	return jsk_cbor_float(((jsk_cbor_writer *)user)->out, value);
+}
+
+static int jsk_cbor_w_string(void *user, const char *s, unsigned len)
+{
+	jsk_cbor_writer *w = (jsk_cbor_writer *)user;
+
+	if (memchr(s, '\\', len)) {
+		char *u = (char *)jsk_heap_alloc(w->heap, len, 1);
+		if (JSK_UNLIKELY(!u))
+			return 1;
+		len = jsk_unescape_string(u, s, len);
+		s = u;
+	}
+
+	return jsk_cbor_text(w->out, s, len);
+}
+
+static int jsk_cbor_w_start_object(void *user)
+{
+	return jsk_put_be(((jsk_cbor_writer *)user)->out, 0xbf, 0, 0);
+}
+
+static int jsk_cbor_w_start_array(void *user)
+{
+	return jsk_put_be(((jsk_cbor_writer *)user)->out, 0x9f, 0, 0);
+}
+
+static int jsk_cbor_w_end(void *user, unsigned count)
+{
+	(void)count;
+	return jsk_put_be(((jsk_cbor_writer *)user)->out, 0xff, 0, 0);
+}
+
+static const jsk_handler jsk_cbor_writer_handler = {
+	jsk_cbor_w_null,
+	jsk_cbor_w_boolean,
+	jsk_cbor_w_integer,
+	jsk_cbor_w_floating,
+	jsk_cbor_w_string,
+	jsk_cbor_w_string,
+	jsk_cbor_w_start_object,
+	jsk_cbor_w_end,
+	jsk_cbor_w_start_array,
+	jsk_cbor_w_end,
+	NULL,
+};
+
+JSK_EXPORT jsk_result jsk_json_to_cbor(jsk_heap *h, const char *const json,
+		unsigned len, void **cbor, unsigned long long *size)
+{
+	jsk_context ctx = (jsk_context){ h, json, len, 0,
+		(jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL, 0, };
+	jsk_cbor_writer w = (jsk_cbor_writer){ h, jsk_heap_new(h->ctx) };
+	if (JSK_UNLIKELY(!w.out))
+		return jsk_error(&ctx, "Out of memory");
+
+	jsk_result res = jsk_parse_sax(h, json, len,
+			&jsk_cbor_writer_handler, &w);
+
+	if (res.status == JSK_OK) {
+		unsigned long long n = 0;
+		for (jsk_heap *c = w.out; c; c = c->next)
+			n += c->ptr;
+
+		*cbor = jsk_heap_unify(w.out, 0);
+		*size = n;
+		if (JSK_UNLIKELY(!*cbor))
+			res = jsk_error(&ctx, "Out of memory");
+	}
+
+	jsk_heap_free(w.out);
+	return res;
+}
+
+/* Streaming binary -> JSON text, used for CBOR input */
+typedef struct jsk_json_writer {
+	jsk_heap *out;
+	int first;
+	int after_key;
+} jsk_json_writer;
+
+static int jsk_json_w_sep(jsk_json_writer *w)
+{
+	const int comma = !w->first && !w->after_key;
+
+	w->first = 0;
+	w->after_key = 0;
+
+	return comma ? jsk_heap_write(w->out, ",", 1) : 0;
+}
+
+static int jsk_json_w_raw(void *user, const char *s, unsigned len)
+{
+	jsk_json_writer *w = (jsk_json_writer *)user;
+	return jsk_json_w_sep(w) || jsk_heap_write(w->out, s, len);
+}
+
+static int jsk_json_w_null(void *user)
+{
+	return jsk_json_w_raw(user, "null", 4);
+}
+
+static int jsk_json_w_boolean(void *user, int value)
+{
+	return value ? jsk_json_w_raw(user, "true", 4) :
+		jsk_json_w_raw(user, "false", 5);
+}
+
+static int jsk_json_w_integer(void *user, long long value)
+{
+	char buf[32];
+	const int n = snprintf(buf, sizeof(buf), "%lld", value);
+	return jsk_json_w_raw(user, buf, n);
+}
+
+static int jsk_json_w_number(void *user, const char *s, unsigned len)
+{
+	return jsk_json_w_raw(user, s, len);
+}
+
+/* Non-finite values have no JSON spelling and become null */
+static int jsk_json_w_floating(void *user, double value)
+{
+	if (value != value || value - value != 0)
+		return jsk_json_w_null(user);
+
+	/* Shortest of the two precisions that reads back exactly */
+	char buf[40];
+	int n = snprintf(buf, sizeof(buf), "%.15g", value);
+	if (strtod(buf, NULL) != value)
+		n = snprintf(buf, sizeof(buf), "%.17g", value);
+
+	if (!strpbrk(buf, ".e")) {
+		buf[n++] = '.';
+		buf[n++] = '0';
+	}
+
+	return jsk_json_w_raw(user, buf, n);
+}
+
+static int jsk_json_w_string(void *user, const char *s, unsigned len)
+{
+	jsk_json_writer *w = (jsk_json_writer *)user;
+	return jsk_json_w_sep(w) || jsk_heap_write(w->out, "\"", 1) ||
+		jsk_write_escaped(w->out, s, len, 0) ||
+		jsk_heap_write(w->out, "\"", 1);
+}
+
+static int jsk_json_w_key(void *user, const char *s, unsigned len)
+{
+	jsk_json_writer *w = (jsk_json_writer *)user;
+
+	if (jsk_json_w_string(user, s, len) || jsk_heap_write(w->out, ":", 1))
+		return 1;
+
+	w->after_key = 1;
+	return 0;
+}
+
+static int jsk_json_w_open(jsk_json_writer *w, const char *bracket)
+{
+	if (jsk_json_w_sep(w) || jsk_heap_write(w->out, bracket, 1))
+		return 1;
+
+	w->first = 1;
+	return 0;
+}
+
+static int jsk_json_w_start_object(void *user)
+{
+	return jsk_json_w_open((jsk_json_writer *)user, "{");
+}
+
+static int jsk_json_w_start_array(void *user)
+{
+	return jsk_json_w_open((jsk_json_writer *)user, "[");
+}
+
+static int jsk_json_w_end_object(void *user, unsigned count)
+{
+	(void)count;
+	jsk_json_writer *w = (jsk_json_writer *)user;
+	w->first = 0;
+	return jsk_heap_write(w->out, "}", 1);
+}
+
+static int jsk_json_w_end_array(void *user, unsigned count)
+{
+	(void)count;
+	jsk_json_writer *w = (jsk_json_writer *)user;
+	w->first = 0;
+	return jsk_heap_write(w->out, "]", 1);
+}
+
+static const jsk_handler jsk_json_writer_handler = {
+	jsk_json_w_null,
+	jsk_json_w_boolean,
+	jsk_json_w_integer,
+	jsk_json_w_floating,
+	jsk_json_w_string,
+	jsk_json_w_key,
+	jsk_json_w_start_object,
+	jsk_json_w_end_object,
+	jsk_json_w_start_array,
+	jsk_json_w_end_array,
+	jsk_json_w_number,
+};
+
+JSK_EXPORT jsk_result jsk_cbor_to_json(jsk_heap *h, const void *cbor,
+		unsigned long long size, char **json)
+{
+	jsk_context ctx = (jsk_context){ h, (const char *)cbor, size, 0,
+		(jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL, 0, };
+	jsk_json_writer w = (jsk_json_writer){ jsk_heap_new(h->ctx), 1, 0 };
+	if (JSK_UNLIKELY(!w.out))
+		return jsk_error(&ctx, "Out of memory");
+
+	jsk_result res = jsk_decode(h, cbor, size, jsk_cbor_item,
+			&jsk_json_writer_handler, &w);
+
+	if (res.status == JSK_OK) {
+		*json = (char *)jsk_heap_unify(w.out, 1);
+		if (JSK_UNLIKELY(!*json))
+			res = jsk_error(&ctx, "Out of memory");
+	}
+
+	jsk_heap_free(w.out);
+	return res;
+}
+
+/*
+ * The shredder is a SAX consumer. Records are the objects at depth `base`,
+ * which is 1 inside a top-level array and 0 otherwise. Column bookkeeping
+ * lives on a scratch heap; only the buffers handed out go on the caller's.
+ */
+typedef struct jsk_shred_column {
+	jsk_column col;
+	const char *raw;
+	unsigned raw_len;
+	unsigned length;
+	unsigned capacity;
+	unsigned valid;
+	unsigned data_len;
+	unsigned data_cap;
+} jsk_shred_column;
+
+typedef struct jsk_shred_state {
+	jsk_heap *heap;
+	jsk_heap *scratch;
+	jsk_value index;
+	jsk_shred_column *cols;
+	unsigned count;
+	unsigned allocated;
+	unsigned rows;
+	unsigned depth;
+	unsigned base;
+	unsigned column;
+	unsigned cursor;
+	char *error;
+} jsk_shred_state;
+
+__attribute__((__format__ (__printf__, 2, 3)))
+static int jsk_shred_fail(jsk_shred_state *st, const char *const fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	st->error = jsk_vprintf(st->heap, 1, fmt, args);
+	va_end(args);
+	return 1;
+}
+
+/* Grows a zero-filled buffer, leaving the old one abandoned on the heap */
+static void *jsk_shred_grow(jsk_heap *h, void *old, unsigned old_bytes,
+		unsigned bytes, unsigned align)
+{
+	char *mem = (char *)jsk_heap_alloc(h, bytes, align);
+	if (JSK_UNLIKELY(!mem))
+		return NULL;
+
+	if (old_bytes)
+		memcpy(mem, old, old_bytes);
+	memset(&mem[old_bytes], 0, bytes - old_bytes);
+	h->abandoned += old_bytes;
+	return mem;
+}
+
+static unsigned jsk_shred_width(jsk_type type)
+{
+	switch (type) {
+	case JSK_INT:		return sizeof(long long);
+	case JSK_FLOAT:		return sizeof(double);
+	case JSK_BOOL:		return 1;
+	default:		return 0;
+	}
+}
+
+/* Makes room for the given number of rows in a column's typed buffers */
+static int jsk_shred_reserve(jsk_heap *h, jsk_shred_column *c, unsigned rows)
+{
+	if (JSK_LIKELY(rows <= c->capacity))
+		return 0;
+
+	const unsigned cap = c->capacity;
+	unsigned n = cap ? cap : 16;
+	while (n < rows) {
+		if (JSK_UNLIKELY(n > (unsigned)-1 / 16))
+			return 1;
+		n *= 2;
+	}
+
+	c->col.validity = (unsigned char *)jsk_shred_grow(h, c->col.validity,
+			(cap + 7) / 8, (n + 7) / 8, 1);
+	if (JSK_UNLIKELY(!c->col.validity))
+		return 1;
+
+	const unsigned w = jsk_shred_width(c->col.type);
+	if (w) {
+		c->col.values.b = (unsigned char *)jsk_shred_grow(h,
+				c->col.values.b, cap * w, n * w,
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!c->col.values.b))
+			return 1;
+	} else if (c->col.type == JSK_STRING) {
+		c->col.offsets = (unsigned *)jsk_shred_grow(h, c->col.offsets,
+				cap ? (cap + 1) * sizeof(unsigned) : 0,
+				(n + 1) * sizeof(unsigned), sizeof(unsigned));
+		if (JSK_UNLIKELY(!c->col.offsets))
+			return 1;
+	}
+
+	c->capacity = n;
+	return 0;
+}
+
+/* Null rows in a string column are empty strings */
+static void jsk_shred_pad(jsk_shred_column *c, unsigned rows)
+{
+	if (c->col.type == JSK_STRING)
+		for (unsigned i = c->length + 1; i <= rows; i++)
+			c->col.offsets[i] = c->data_len;
+	if (c->length < rows)
+		c->length = rows;
+}
+
+static const char *jsk_shred_type_name(jsk_type type)
+{
+	switch (type) {
+	case JSK_BOOL:		return "boolean";
+	case JSK_INT:		return "integer";
+	case JSK_FLOAT:		return "float";
+	default:		return "string";
+	}
+}
+
+/*
+ * Picks the column for a value of the given type in the current row,
+ * settling the column's type. Stores NULL if the value is to be skipped.
+ */
+static int jsk_shred_target(jsk_shred_state *st, jsk_type type,
+		jsk_shred_column **out)
+{
+	*out = NULL;
+
+	if (JSK_UNLIKELY(st->depth != st->base + 1))
+		return jsk_shred_fail(st, "Row %u is not an object", st->rows);
+
+	jsk_shred_column *c = &st->cols[st->column];
+	const unsigned row = st->rows;
+
+	if (JSK_UNLIKELY(c->length > row))
+		return 0;
+
+	if (JSK_UNLIKELY(c->col.type != type)) {
+		if (c->col.type == JSK_NULL) {
+			c->col.type = type;
+		} else if (c->col.type == JSK_INT && type == JSK_FLOAT) {
+			for (unsigned i = 0; i < c->length; i++)
+				c->col.values.f[i] =
+					(double)c->col.values.i[i];
+			c->col.type = JSK_FLOAT;
+		} else if (c->col.type != JSK_FLOAT || type != JSK_INT) {
+			return jsk_shred_fail(st, "Column \"%s\" has both %s "
+					"and %s values at row %u",
+					c->col.name,
+					jsk_shred_type_name(c->col.type),
+					jsk_shred_type_name(type), row);
+		}
+	}
+
+	if (JSK_UNLIKELY(jsk_shred_reserve(st->heap, c, row + 1)))
+		return jsk_shred_fail(st, "Out of memory at row %u", row);
+
+	jsk_shred_pad(c, row);
+	c->col.validity[row / 8] |= 1 << (row % 8);
+	c->length = row + 1;
+	c->valid++;
+
+	*out = c;
+	return 0;
+}
+
+static int jsk_shred_null(void *user)
+{
+	jsk_shred_state *st = (jsk_shred_state *)user;
+
+	if (JSK_UNLIKELY(st->depth != st->base + 1))
+		return jsk_shred_fail(st, "Row %u is not an object", st->rows);
+	return 0;
+}
+
+static int jsk_shred_boolean(void *user, int value)
+{
+	jsk_shred_column *c;
+	if (jsk_shred_target((jsk_shred_state *)user, JSK_BOOL, &c))
+		return 1;
+	if (c)
+		c->col.values.b[c->length - 1] = value != 0;
+	return 0;
+}
+
+static int jsk_shred_integer(void *user, long long value)
+{
+	jsk_shred_column *c;
+	if (jsk_shred_target((jsk_shred_state *)user, JSK_INT, &c))
+		return 1;
+	if (!c)
+		return 0;
+
+	if (c->col.type == JSK_FLOAT)
+		c->col.values.f[c->length - 1] = (double)value;
+	else
+		c->col.values.i[c->length - 1] = value;
+	return 0;
+}
+
+static int jsk_shred_floating(void *user, double value)
+{
+	jsk_shred_column *c;
+	if (jsk_shred_target((jsk_shred_state *)user, JSK_FLOAT, &c))
+		return 1;
+	if (c)
+		c->col.values.f[c->length - 1] = value;
+	return 0;
+}
+
+static int jsk_shred_string(void *user, const char *s, unsigned len)
+{
+	jsk_shred_state *st = (jsk_shred_state *)user;
+	jsk_shred_column *c;
+	if (jsk_shred_target(st, JSK_STRING, &c))
+		return 1;
+	if (!c)
+		return 0;
+
+	/* Unescaping never lengthens a string */
+	if (JSK_UNLIKELY(!c->col.data || c->data_len + len > c->data_cap)) {
+		unsigned n = c->data_cap ? c->data_cap : 256;
+		while (n < c->data_len + len) {
+			if (JSK_UNLIKELY(n > (unsigned)-1 / 2))
+				return jsk_shred_fail(st,
+						"Out of memory at row %u",
+						st->rows);
+			n *= 2;
+		}
+
+		char *data = (char *)jsk_heap_alloc(st->heap, n, 1);
+		if (JSK_UNLIKELY(!data))
+			return jsk_shred_fail(st, "Out of memory at row %u",
+					st->rows);
+		if (c->data_len)
+			memcpy(data, c->col.data, c->data_len);
+		st->heap->abandoned += c->data_cap;
+		c->col.data = data;
+		c->data_cap = n;
+	}
+
+	char *dest = &c->col.data[c->data_len];
+	if (memchr(s, '\\', len)) {
+		c->data_len += jsk_unescape_string(dest, s, len);
+	} else {
+		memcpy(dest, s, len);
+		c->data_len += len;
+	}
+	c->col.offsets[c->length] = c->data_len;
+	return 0;
+}
+
+static int jsk_shred_new_column(jsk_shred_state *st, const char *s,
+		unsigned len)
+{
+	if (st->count == st->allocated) {
+		const unsigned n = st->allocated ? st->allocated * 2 : 16;
+		jsk_shred_column *cols = (jsk_shred_column *)jsk_heap_alloc(
+				st->scratch, n * sizeof(jsk_shred_column),
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!cols))
+			return 1;
+		if (st->count)
+			memcpy(cols, st->cols,
+					st->count * sizeof(jsk_shred_column));
+		st->cols = cols;
+		st->allocated = n;
+	}
+
+	const jsk_value name = jsk_new_string_escaped(st->heap, s, len);
+	const jsk_value raw = jsk_new_string_len(st->scratch, s, len);
+	if (JSK_UNLIKELY(name.type != JSK_STRING || raw.type != JSK_STRING))
+		return 1;
+
+	jsk_shred_column *c = &st->cols[st->count];
+	memset(c, 0, sizeof(*c));
+	c->col.name = jsk_get_string(name);
+	c->col.type = JSK_NULL;
+	c->raw = jsk_get_string(raw);
+	c->raw_len = len;
+
+	jsk_object_insert(&st->index, c->raw, jsk_new_int(st->count));
+	st->count++;
+	return 0;
+}
+
+/* Records usually repeat their keys in order, so try the next column first */
+static int jsk_shred_key(void *user, const char *s, unsigned len)
+{
+	jsk_shred_state *st = (jsk_shred_state *)user;
+	unsigned i = st->cursor;
+
+	if (JSK_UNLIKELY(i >= st->count || st->cols[i].raw_len != len ||
+				memcmp(st->cols[i].raw, s, len))) {
+		const jsk_value *e = jsk_object_get_len(st->index, s, len);
+		if (e) {
+			i = (unsigned)jsk_get_int(*e);
+		} else {
+			i = st->count;
+			if (JSK_UNLIKELY(jsk_shred_new_column(st, s, len)))
+				return jsk_shred_fail(st,
+						"Out of memory at row %u",
+						st->rows);
+		}
+	}
+
+	st->column = i;
+	st->cursor = i + 1;
+	return 0;
+}
+
+static int jsk_shred_nested(jsk_shred_state *st)
+{
+	if (st->depth == st->base)
+		return jsk_shred_fail(st, "Row %u is not an object", st->rows);
+	return jsk_shred_fail(st, "Nested value in column \"%s\" at row %u",
+			st->cols[st->column].col.name, st->rows);
+}
+
+static int jsk_shred_start_object(void *user)
+{
+	jsk_shred_state *st = (jsk_shred_state *)user;
+
+	if (st->depth == 0)
+		st->base = 0;
+	if (JSK_UNLIKELY(st->depth != st->base))
+		return jsk_shred_nested(st);
+
+	st->depth++;
+	st->cursor = 0;
+	return 0;
+}
+
+static int jsk_shred_end_object(void *user, unsigned count)
+{
+	jsk_shred_state *st = (jsk_shred_state *)user;
+	(void)count;
+
+	st->depth--;
+	st->rows++;
+	return 0;
+}
+
+static int jsk_shred_start_array(void *user)
+{
+	jsk_shred_state *st = (jsk_shred_state *)user;
+
+	if (JSK_UNLIKELY(st->depth != 0))
+		return jsk_shred_nested(st);
+
+	st->base = 1;
+	st->depth++;
+	return 0;
+}
+
+static int jsk_shred_end_array(void *user, unsigned count)
+{
+	(void)count;
+	((jsk_shred_state *)user)->depth--;
+	return 0;
+}
+
+static const jsk_handler jsk_shred_handler = {
+	jsk_shred_null,
+	jsk_shred_boolean,
+	jsk_shred_integer,
+	jsk_shred_floating,
+	jsk_shred_string,
+	jsk_shred_key,
+	jsk_shred_start_object,
+	jsk_shred_end_object,
+	jsk_shred_start_array,
+	jsk_shred_end_array,
+	NULL,
+};
+
+/* Brings every column up to the full row count */
+static int jsk_shred_finish(jsk_shred_state *st, jsk_columns *columns)
+{
+	jsk_column *out = (jsk_column *)jsk_heap_alloc(st->heap,
+			(st->count ? st->count : 1) * sizeof(jsk_column),
+			JSK_VALUE_ALIGN);
+	if (JSK_UNLIKELY(!out))
+		return 1;
+
+	for (unsigned i = 0; i < st->count; i++) {
+		jsk_shred_column *c = &st->cols[i];
+		if (JSK_UNLIKELY(jsk_shred_reserve(st->heap, c, st->rows)))
+			return 1;
+		jsk_shred_pad(c, st->rows);
+		c->col.null_count = st->rows - c->valid;
+		out[i] = c->col;
+	}
+
+	*columns = (jsk_columns){ st->rows, st->count, out };
+	return 0;
+}
+
+JSK_EXPORT jsk_result jsk_shred(jsk_heap *h, const char *const json,
+		unsigned len, const jsk_parse_options *opts,
+		jsk_columns *columns)
+{
+	jsk_context ctx = (jsk_context){
+		h,
+		json,
+		len,
+		0,
+		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		opts,
+		0,
+	};
+
+	jsk_shred_state st;
+	memset(&st, 0, sizeof(st));
+	st.heap = h;
+	st.scratch = jsk_heap_new(h->ctx);
+	if (JSK_UNLIKELY(!st.scratch))
+		return jsk_error(&ctx, "Out of memory");
+	st.index = jsk_new_object(st.scratch);
+
+	jsk_result res = jsk_success(jsk_new_null());
+
+	/* jsk_parse_root() leaves the token after each document lexed */
+	jsk_lex(&ctx);
+	while (ctx.tkn.type != JSKT_EOF) {
+		res = jsk_parse_root(&ctx, &jsk_shred_handler, &st);
+		if (res.status != JSK_OK) {
+			if (st.error)
+				res.data.error = st.error;
+			break;
+		}
+	}
+
+	if (res.status == JSK_OK && jsk_shred_finish(&st, columns))
+		res = jsk_error(&ctx, "Out of memory");
+
+	jsk_heap_free(st.scratch);
+	return res;
+}
+
+/*
+ * Queries compile to a flat list of ops. Path ops move a current value along;
+ * projections and filters run the ops after them once per element. A filter's
+ * arg is where its condition ends: the condition is a little stack machine in
+ * which && and || jump to their end when the left side decides the result.
+ */
+enum {
+	JSK_QUERY_EQ,
+	JSK_QUERY_NE,
+	JSK_QUERY_LT,
+	JSK_QUERY_LE,
+	JSK_QUERY_GT,
+	JSK_QUERY_GE,
+};
+
+typedef struct jsk_query_compiler {
+	jsk_heap *heap;
+	const char *s;
+	unsigned pos;
+	jsk_query_op *ops;
+	unsigned count;
+	unsigned allocated;
+	unsigned depth;
+	unsigned nesting;
+	char *error;
+} jsk_query_compiler;
+
+static int jsk_query_error(jsk_query_compiler *c, const char *const what)
+{
+	if (c->error)
+		return 1;
+
+	char at[40] = " at end of query";
+	if (c->s[c->pos])
+		snprintf(at, sizeof(at), " at offset %u of query", c->pos);
+	c->error = jsk_concat(c->heap, what, at);
+	return 1;
+}
+
+static void jsk_query_ws(jsk_query_compiler *c)
 {
-	jsk_object_entry *old = obj->entries;
-	const unsigned old_allocated = obj->allocated;
+	while (c->s[c->pos] == ' ' || c->s[c->pos] == '\t' ||
+			c->s[c->pos] == '\n' || c->s[c->pos] == '\r')
+		c->pos++;
+}
+
+/* Skips whitespace and consumes tok if it comes next */
+static int jsk_query_accept(jsk_query_compiler *c, const char *tok)
+{
+	jsk_query_ws(c);
+	const unsigned len = strlen(tok);
+	if (strncmp(&c->s[c->pos], tok, len))
+		return 0;
+	c->pos += len;
+	return 1;
+}
+
+static jsk_query_op *jsk_query_emit(jsk_query_compiler *c,
+		jsk_query_opcode code)
+{
+	if (c->count == c->allocated) {
+		const unsigned n = c->allocated ? c->allocated * 2 : 16;
+		jsk_query_op *ops = (jsk_query_op *)jsk_heap_alloc(c->heap,
+				n * sizeof(jsk_query_op), JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!ops)) {
+			jsk_query_error(c, "Out of memory");
+			return NULL;
+		}
+		if (c->count)
+			memcpy(ops, c->ops, c->count * sizeof(jsk_query_op));
+		c->heap->abandoned += c->allocated * sizeof(jsk_query_op);
+		c->ops = ops;
+		c->allocated = n;
+	}
+
+	jsk_query_op *op = &c->ops[c->count++];
+	memset(op, 0, sizeof(*op));
+	op->code = code;
+	return op;
+}
+
+/* Values pushed by a condition, checked against JSK_QUERY_MAX_STACK */
+static int jsk_query_push(jsk_query_compiler *c)
+{
+	if (++c->depth > JSK_QUERY_MAX_STACK)
+		return jsk_query_error(c, "Filter too complex");
+	return 0;
+}
+
+static int jsk_query_is_ident(char ch, int first)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+		ch == '_' || (!first && ch >= '0' && ch <= '9');
+}
+
+/* A bare or "quoted" identifier, kept as written */
+static int jsk_query_field(jsk_query_compiler *c)
+{
+	jsk_query_ws(c);
+	const unsigned start = c->pos;
+	const char *s = c->s;
+	unsigned len;
+
+	if (s[c->pos] == '"') {
+		for (c->pos++; s[c->pos] && s[c->pos] != '"'; c->pos++)
+			if (s[c->pos] == '\\' && s[c->pos + 1])
+				c->pos++;
+		if (s[c->pos] != '"')
+			return jsk_query_error(c, "Unterminated identifier");
+		len = c->pos - start - 1;
+		c->pos++;
+	} else if (jsk_query_is_ident(s[c->pos], 1)) {
+		while (jsk_query_is_ident(s[c->pos], 0))
+			c->pos++;
+		len = c->pos - start;
+	} else {
+		return jsk_query_error(c, "Expected an identifier");
+	}
+
+	jsk_query_op *op = jsk_query_emit(c, JSK_QUERY_FIELD);
+	if (!op)
+		return 1;
+	op->data.key = jsk_key_make_len(&s[start + (s[start] == '"')], len);
+	return 0;
+}
+
+/* The index in [n], with the '[' already consumed */
+static int jsk_query_index(jsk_query_compiler *c)
+{
+	jsk_query_ws(c);
+	const int negative = c->s[c->pos] == '-';
+	unsigned long long n = 0;
+	unsigned digits = 0;
+
+	for (c->pos += negative; c->s[c->pos] >= '0' && c->s[c->pos] <= '9';
+			c->pos++, digits++) {
+		n = n * 10 + (unsigned)(c->s[c->pos] - '0');
+		if (n > 1ULL << 32)
+			return jsk_query_error(c, "Index out of range");
+	}
+
+	if (!digits)
+		return jsk_query_error(c, "Expected an index");
+	if (!jsk_query_accept(c, "]"))
+		return jsk_query_error(c, "Expected ']'");
+
+	jsk_query_op *op = jsk_query_emit(c, JSK_QUERY_INDEX);
+	if (!op)
+		return 1;
+	op->data.index = negative ? -(long long)n : (long long)n;
+	return 0;
+}
+
+static int jsk_query_or(jsk_query_compiler *c);
+
+/* 'raw string' or `json` */
+static int jsk_query_literal(jsk_query_compiler *c)
+{
+	const char quote = c->s[c->pos++];
+	const unsigned start = c->pos;
+	unsigned len = 0;
+
+	for (; c->s[c->pos] && c->s[c->pos] != quote; c->pos++, len++)
+		if (c->s[c->pos] == '\\' && c->s[c->pos + 1] == quote)
+			c->pos++;
+	if (!c->s[c->pos])
+		return jsk_query_error(c, "Unterminated literal");
+
+	/* Only the quote character itself is escaped */
+	char *text = (char *)jsk_heap_alloc(c->heap, len + 1, 1);
+	if (JSK_UNLIKELY(!text))
+		return jsk_query_error(c, "Out of memory");
+	for (unsigned i = start, j = 0; i < c->pos; i++) {
+		if (c->s[i] == '\\' && c->s[i + 1] == quote)
+			i++;
+		text[j++] = c->s[i];
+	}
+	text[len] = 0;
+	c->pos++;
+
+	jsk_value v = jsk_new_null();
+	if (quote == '\'') {
+		v = (jsk_value){ JSK_STRING, text };
+	} else {
+		const jsk_result res = jsk_parse(c->heap, text, len);
+		if (res.status != JSK_OK)
+			return jsk_query_error(c, "Invalid JSON literal");
+		v = res.data.value;
+	}
+
+	jsk_query_op *op = jsk_query_emit(c, JSK_QUERY_LITERAL);
+	if (!op)
+		return 1;
+	op->data.literal = v;
+	return jsk_query_push(c);
+}
+
+/* A literal, a parenthesised condition or a path from the element */
+static int jsk_query_operand(jsk_query_compiler *c)
+{
+	jsk_query_ws(c);
+
+	if (c->s[c->pos] == '\'' || c->s[c->pos] == '`')
+		return jsk_query_literal(c);
+
+	if (jsk_query_accept(c, "(")) {
+		if (++c->nesting > JSK_QUERY_MAX_STACK)
+			return jsk_query_error(c, "Filter too complex");
+		if (jsk_query_or(c))
+			return 1;
+		c->nesting--;
+		if (!jsk_query_accept(c, ")"))
+			return jsk_query_error(c, "Expected ')'");
+		return 0;
+	}
+
+	if (!jsk_query_emit(c, JSK_QUERY_SELF))
+		return 1;
+	if (!jsk_query_accept(c, "@") && jsk_query_field(c))
+		return 1;
+
+	for (;;) {
+		if (jsk_query_accept(c, ".")) {
+			if (jsk_query_field(c))
+				return 1;
+		} else if (jsk_query_accept(c, "[")) {
+			if (jsk_query_index(c))
+				return 1;
+		} else {
+			break;
+		}
+	}
+
+	if (!jsk_query_emit(c, JSK_QUERY_PUSH))
+		return 1;
+	return jsk_query_push(c);
+}
+
+static int jsk_query_compare(jsk_query_compiler *c)
+{
+	static const struct {
+		const char *tok;
+		unsigned op;
+	} ops[] = {
+		{ "==", JSK_QUERY_EQ }, { "!=", JSK_QUERY_NE },
+		{ "<=", JSK_QUERY_LE }, { ">=", JSK_QUERY_GE },
+		{ "<", JSK_QUERY_LT }, { ">", JSK_QUERY_GT },
+	};
+
+	if (jsk_query_operand(c))
+		return 1;
+
+	for (unsigned i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+		if (!jsk_query_accept(c, ops[i].tok))
+			continue;
+		if (jsk_query_operand(c))
+			return 1;
+		jsk_query_op *op = jsk_query_emit(c, JSK_QUERY_COMPARE);
+		if (!op)
+			return 1;
+		op->arg = ops[i].op;
+		c->depth--;
+		return 0;
+	}
+
+	return 0;
+}
+
+static int jsk_query_not(jsk_query_compiler *c)
+{
+	jsk_query_ws(c);
+	if (c->s[c->pos] != '!' || c->s[c->pos + 1] == '=')
+		return jsk_query_compare(c);
+
+	c->pos++;
+	if (++c->nesting > JSK_QUERY_MAX_STACK)
+		return jsk_query_error(c, "Filter too complex");
+	if (jsk_query_not(c))
+		return 1;
+	c->nesting--;
+	return jsk_query_emit(c, JSK_QUERY_NOT) == NULL;
+}
+
+/* The left side stays on the stack if it decides the result */
+static int jsk_query_binary(jsk_query_compiler *c, const char *tok,
+		jsk_query_opcode code, int (*operand)(jsk_query_compiler *))
+{
+	if (operand(c))
+		return 1;
+
+	while (jsk_query_accept(c, tok)) {
+		if (!jsk_query_emit(c, code))
+			return 1;
+		const unsigned jump = c->count - 1;
+		c->depth--;
+		if (operand(c))
+			return 1;
+		c->ops[jump].arg = c->count;
+	}
+
+	return 0;
+}
+
+static int jsk_query_and(jsk_query_compiler *c)
+{
+	return jsk_query_binary(c, "&&", JSK_QUERY_AND, jsk_query_not);
+}
+
+static int jsk_query_or(jsk_query_compiler *c)
+{
+	return jsk_query_binary(c, "||", JSK_QUERY_OR, jsk_query_and);
+}
+
+/* The inside of [...], with the '[' already consumed */
+static int jsk_query_bracket(jsk_query_compiler *c)
+{
+	if (jsk_query_accept(c, "]"))
+		return jsk_query_emit(c, JSK_QUERY_FLATTEN) == NULL;
+
+	if (jsk_query_accept(c, "*")) {
+		if (!jsk_query_accept(c, "]"))
+			return jsk_query_error(c, "Expected ']'");
+		return jsk_query_emit(c, JSK_QUERY_PROJECT) == NULL;
+	}
+
+	if (!jsk_query_accept(c, "?"))
+		return jsk_query_index(c);
+
+	if (!jsk_query_emit(c, JSK_QUERY_FILTER))
+		return 1;
+	const unsigned filter = c->count - 1;
+
+	c->depth = 0;
+	if (jsk_query_or(c))
+		return 1;
+	if (!jsk_query_accept(c, "]"))
+		return jsk_query_error(c, "Expected ']'");
+
+	c->ops[filter].arg = c->count;
+	return 0;
+}
+
+JSK_EXPORT jsk_query *jsk_query_compile(jsk_heap *h, const char *const expr,
+		char **error)
+{
+	jsk_query_compiler c;
+	memset(&c, 0, sizeof(c));
+	c.heap = h;
+
+	/* Keys point into this copy */
+	const jsk_value copy = jsk_new_string(h, expr);
+	jsk_query *q = (jsk_query *)jsk_heap_alloc(h, sizeof(jsk_query),
+			JSK_VALUE_ALIGN);
+	c.s = copy.type == JSK_STRING ? jsk_get_string(copy) : "";
+	int err = !q || copy.type != JSK_STRING ?
+		jsk_query_error(&c, "Out of memory") : 0;
+
+	/* The first step has no '.' before it, and @ is the root */
+	if (!err) {
+		if (jsk_query_accept(&c, "["))
+			err = jsk_query_bracket(&c);
+		else if (jsk_query_accept(&c, "*"))
+			err = jsk_query_emit(&c, JSK_QUERY_VALUES) == NULL;
+		else if (!jsk_query_accept(&c, "@"))
+			err = jsk_query_field(&c);
+	}
+
+	while (!err) {
+		if (jsk_query_accept(&c, ".")) {
+			if (jsk_query_accept(&c, "*"))
+				err = jsk_query_emit(&c, JSK_QUERY_VALUES) ==
+					NULL;
+			else
+				err = jsk_query_field(&c);
+		} else if (jsk_query_accept(&c, "[")) {
+			err = jsk_query_bracket(&c);
+		} else if (c.s[c.pos]) {
+			err = jsk_query_error(&c, "Unexpected character");
+		} else {
+			break;
+		}
+	}
+
+	if (err) {
+		if (error)
+			*error = c.error;
+		return NULL;
+	}
+
+	*q = (jsk_query){ c.ops, c.count };
+	return q;
+}
+
+/* JMESPath's falsy values are null, false and empty strings and containers */
+static int jsk_query_truthy(jsk_value v)
+{
+	switch (v.type) {
+	case JSK_NULL:		return 0;
+	case JSK_BOOL:		return jsk_get_bool(v);
+	case JSK_STRING:	return *jsk_get_string(v) != 0;
+	case JSK_OBJECT:	return jsk_object_count(v) != 0;
+	case JSK_ARRAY:
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY:	return jsk_array_length(v) != 0;
+	default:		return 1;
+	}
+}
+
+static int jsk_query_is_number(jsk_value v)
+{
+	return v.type == JSK_INT || v.type == JSK_FLOAT;
+}
+
+static int jsk_query_equal(jsk_value a, jsk_value b)
+{
+	a = jsk_number_value(a);
+	b = jsk_number_value(b);
+
+	if (jsk_query_is_number(a) && jsk_query_is_number(b))
+		return a.type == JSK_INT && b.type == JSK_INT ?
+			jsk_get_int(a) == jsk_get_int(b) :
+			jsk_as_float(a) == jsk_as_float(b);
+
+	if (jsk_is_array(a) && jsk_is_array(b)) {
+		const unsigned len = jsk_array_length(a);
+		if (len != jsk_array_length(b))
+			return 0;
+		for (unsigned i = 0; i < len; i++)
+			if (!jsk_query_equal(jsk_array_get(a, i),
+						jsk_array_get(b, i)))
+				return 0;
+		return 1;
+	}
+
+	if (a.type != b.type)
+		return 0;
+
+	switch (a.type) {
+	case JSK_NULL:
+		return 1;
+	case JSK_BOOL:
+		return jsk_get_bool(a) == jsk_get_bool(b);
+	case JSK_STRING:
+		return !strcmp(jsk_get_string(a), jsk_get_string(b));
+	case JSK_OBJECT: {
+		if (jsk_object_count(a) != jsk_object_count(b))
+			return 0;
+		jsk_object_iter it = jsk_object_iterate(a);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it))) {
+			const jsk_value *other = jsk_object_get(b, e->key);
+			if (!other || !jsk_query_equal(e->value, *other))
+				return 0;
+		}
+		return 1;
+	}
+	default:
+		return 0;
+	}
+}
+
+static int jsk_query_order(jsk_value a, jsk_value b, unsigned op)
+{
+	a = jsk_number_value(a);
+	b = jsk_number_value(b);
+	if (!jsk_query_is_number(a) || !jsk_query_is_number(b))
+		return 0;
+
+	int cmp;
+	if (a.type == JSK_INT && b.type == JSK_INT)
+		cmp = (jsk_get_int(a) > jsk_get_int(b)) -
+			(jsk_get_int(a) < jsk_get_int(b));
+	else
+		cmp = (jsk_as_float(a) > jsk_as_float(b)) -
+			(jsk_as_float(a) < jsk_as_float(b));
+
+	switch (op) {
+	case JSK_QUERY_LT:	return cmp < 0;
+	case JSK_QUERY_LE:	return cmp <= 0;
+	case JSK_QUERY_GT:	return cmp > 0;
+	default:		return cmp >= 0;
+	}
+}
+
+/* One field or index step; anything missing is null */
+static jsk_value jsk_query_step(const jsk_query_op *op, jsk_value v)
+{
+	if (op->code == JSK_QUERY_FIELD) {
+		if (v.type != JSK_OBJECT)
+			return jsk_new_null();
+		const jsk_value *e = jsk_object_get_key(v, &op->data.key);
+		return e ? *e : jsk_new_null();
+	}
+
+	if (!jsk_is_array(v))
+		return jsk_new_null();
+
+	const long long len = jsk_array_length(v);
+	const long long i = op->data.index < 0 ?
+		len + op->data.index : op->data.index;
+	if (i < 0 || i >= len)
+		return jsk_new_null();
+	return v.type == JSK_ARRAY ? jsk_array_at(v, i) :
+		jsk_array_get(v, (unsigned)i);
+}
+
+static int jsk_query_test(const jsk_query *q, unsigned pc, unsigned end,
+		jsk_value at)
+{
+	jsk_value stack[JSK_QUERY_MAX_STACK];
+	unsigned sp = 0;
+	jsk_value cur = at;
+
+	for (; pc < end; pc++) {
+		const jsk_query_op *op = &q->ops[pc];
+
+		switch (op->code) {
+		case JSK_QUERY_SELF:
+			cur = at;
+			break;
+		case JSK_QUERY_FIELD:
+		case JSK_QUERY_INDEX:
+			cur = jsk_query_step(op, cur);
+			break;
+		case JSK_QUERY_PUSH:
+			stack[sp++] = cur;
+			break;
+		case JSK_QUERY_LITERAL:
+			stack[sp++] = op->data.literal;
+			break;
+		case JSK_QUERY_COMPARE: {
+			const jsk_value b = stack[--sp];
+			const jsk_value a = stack[sp - 1];
+			int r;
+			if (op->arg == JSK_QUERY_EQ || op->arg == JSK_QUERY_NE)
+				r = jsk_query_equal(a, b) ==
+					(op->arg == JSK_QUERY_EQ);
+			else
+				r = jsk_query_order(a, b, op->arg);
+			stack[sp - 1] = jsk_new_bool((long long)r);
+			break;
+		}
+		case JSK_QUERY_NOT:
+			stack[sp - 1] = jsk_new_bool((long long)
+					!jsk_query_truthy(stack[sp - 1]));
+			break;
+		case JSK_QUERY_AND:
+		case JSK_QUERY_OR:
+			if (jsk_query_truthy(stack[sp - 1]) ==
+					(op->code == JSK_QUERY_OR))
+				pc = op->arg - 1;
+			else
+				sp--;
+			break;
+		default:
+			break;
+		}
+	}
 
-	obj->allocated *= 2;
+	return jsk_query_truthy(stack[0]);
+}
 
-	const unsigned bytes = obj->allocated * sizeof(jsk_object_entry);
-	obj->entries = (jsk_object_entry *)jsk_heap_alloc(obj->heap,
-			bytes, JSK_VALUE_ALIGN);
-	memset(obj->entries, 0, bytes);
+static jsk_value jsk_query_run(jsk_heap *h, const jsk_query *q, unsigned pc,
+		unsigned end, jsk_value cur);
 
-	for (unsigned i = 0; i < old_allocated; i++) {
-		if (old[i].hash == 0)
-			continue;
-		jsk_object_insert_unsafe(obj, old[i].key, old[i].value);
-	}
+/* Runs ops [pc, end) on one element, keeping non-null results */
+static void jsk_query_collect(jsk_heap *h, const jsk_query *q, unsigned pc,
+		unsigned end, jsk_value v, jsk_value *out)
+{
+	const jsk_value r = jsk_query_run(h, q, pc, end, v);
+	if (r.type != JSK_NULL)
+		jsk_array_push(h, out, r);
 }
 
-JSK_EXPORT void jsk_object_insert(jsk_value *object,
-		const char *const name, jsk_value value)
+static jsk_value jsk_query_run(jsk_heap *h, const jsk_query *q, unsigned pc,
+		unsigned end, jsk_value cur)
 {
-	jsk_object *obj = (jsk_object *)object->value;
+	for (; pc < end; pc++) {
+		const jsk_query_op *op = &q->ops[pc];
+		jsk_value out = jsk_new_array();
+
+		switch (op->code) {
+		case JSK_QUERY_FIELD:
+		case JSK_QUERY_INDEX:
+			cur = jsk_query_step(op, cur);
+			if (cur.type == JSK_NULL)
+				return cur;
+			break;
 
-	obj->count++;
+		case JSK_QUERY_PROJECT:
+		case JSK_QUERY_FILTER:
+			if (!jsk_is_array(cur))
+				return jsk_new_null();
+			for (unsigned i = 0; i < jsk_array_length(cur); i++) {
+				const jsk_value e = jsk_array_get(cur, i);
+				if (op->code == JSK_QUERY_PROJECT)
+					jsk_query_collect(h, q, pc + 1, end, e,
+							&out);
+				else if (jsk_query_test(q, pc + 1, op->arg, e))
+					jsk_query_collect(h, q, op->arg, end,
+							e, &out);
+			}
+			return out;
+
+		case JSK_QUERY_VALUES: {
+			if (cur.type != JSK_OBJECT)
+				return jsk_new_null();
+			jsk_object_iter it = jsk_object_iterate(cur);
+			jsk_object_entry *e;
+			while ((e = jsk_object_next(&it)))
+				jsk_query_collect(h, q, pc + 1, end, e->value,
+						&out);
+			return out;
+		}
 
-	const float load = (float)obj->count / (float)obj->allocated;
-	if (JSK_UNLIKELY(load >= JSK_LOAD_FACTOR))
-		jsk_object_grow_and_rehash(obj);
+		default:
+			return jsk_new_null();
+		}
+	}
 
-	jsk_object_insert_unsafe(obj, (char *)name, value);
+	return cur;
 }
 
-JSK_EXPORT jsk_value *jsk_object_get(jsk_value object, const char *const name)
+/*
+ * [] flattens everything before it, projections included, and projects what
+ * follows over the result, so the ops are run in stages split at each one.
+ * The flattened list itself is never built unless it is the result.
+ */
+JSK_EXPORT jsk_value jsk_query_eval(jsk_heap *h, const jsk_query *q,
+		jsk_value v)
 {
-	jsk_object *obj = (jsk_object *)object.value;
+	unsigned pc = 0, end = 0;
+
+	while (end < q->count && q->ops[end].code != JSK_QUERY_FLATTEN)
+		end++;
+	v = jsk_query_run(h, q, pc, end, v);
+
+	while (end < q->count) {
+		if (!jsk_is_array(v))
+			return jsk_new_null();
+
+		for (pc = ++end; end < q->count &&
+				q->ops[end].code != JSK_QUERY_FLATTEN; end++)
+			;
+
+		jsk_value out = jsk_new_array();
+		for (unsigned i = 0; i < jsk_array_length(v); i++) {
+			const jsk_value e = jsk_array_get(v, i);
+			if (!jsk_is_array(e)) {
+				jsk_query_collect(h, q, pc, end, e, &out);
+				continue;
+			}
+			for (unsigned j = 0; j < jsk_array_length(e); j++)
+				jsk_query_collect(h, q, pc, end,
+						jsk_array_get(e, j), &out);
+		}
+		v = out;
+	}
 
-	const jsk_u64 hash = JSK_HASH(name);
+	return v;
+}
 
-	jsk_u64 bucket = hash % obj->allocated;
+#ifdef JSK_THREADS
 
-	while (1) {
-		jsk_object_entry *e = &obj->entries[bucket];
+typedef struct jsk_ndjson_worker {
+	void *ctx;
+	const char *json;
+	unsigned long long begin;
+	unsigned long long end;
+	jsk_heap *heap;
+	jsk_result *results;
+	unsigned count;
+	unsigned allocated;
+	int failed;
+} jsk_ndjson_worker;
 
-		if (e->hash == hash && !strcmp(e->key, name))
-			return &e->value;
-		else if (e->hash == 0)
-			return NULL;
+static void *jsk_ndjson_work(void *arg)
+{
+	jsk_ndjson_worker *w = (jsk_ndjson_worker *)arg;
 
-		bucket++;
-		if (JSK_UNLIKELY(bucket == obj->allocated))
-			bucket = 0;
+	w->heap = jsk_heap_new(w->ctx);
+	if (JSK_UNLIKELY(!w->heap)) {
+		w->failed = 1;
+		return NULL;
 	}
-}
-
-JSK_EXPORT jsk_object_iter jsk_object_iterate(jsk_value object)
-{
-	return (jsk_object_iter){ (jsk_object *)object.value, 0, };
-}
 
-JSK_EXPORT jsk_object_entry *jsk_object_next(jsk_object_iter *i)
-{
-	while (i->bucket < i->obj->allocated) {
-		if (i->obj->entries[i->bucket].hash) {
-			jsk_object_entry *e = &i->obj->entries[i->bucket];
-			i->bucket++;
-			return e;
+	jsk_stream s = jsk_stream_new(w->heap, w->json, w->end);
+	s.ptr = w->begin;
+
+	jsk_result res;
+	while (jsk_stream_next(&s, &res)) {
+		if (JSK_UNLIKELY(w->count == w->allocated)) {
+			const unsigned n = w->allocated ? w->allocated * 2 : 64;
+			jsk_result *rs = (jsk_result *)jsk_heap_alloc(w->heap,
+					n * sizeof(jsk_result), JSK_VALUE_ALIGN);
+			if (JSK_UNLIKELY(!rs)) {
+				w->failed = 1;
+				return NULL;
+			}
+			if (w->count)
+				memcpy(rs, w->results,
+						w->count * sizeof(jsk_result));
+			w->results = rs;
+			w->allocated = n;
 		}
 
-		i->bucket++;
+		w->results[w->count++] = res;
 	}
 
 	return NULL;
 }
 
-JSK_EXPORT unsigned jsk_array_length(jsk_value array)
+/*
+ * The worker threads live for the whole stream. Each round the caller fills
+ * in the batches, bumps `round` and waits for `busy` to drop back to zero.
+ */
+typedef struct jsk_ndjson_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	jsk_ndjson_worker *workers;
+	unsigned round;
+	unsigned batches;
+	unsigned busy;
+	int stop;
+} jsk_ndjson_pool;
+
+typedef struct jsk_ndjson_thread {
+	jsk_ndjson_pool *pool;
+	unsigned id;
+	pthread_t tid;
+} jsk_ndjson_thread;
+
+static void *jsk_ndjson_serve(void *arg)
 {
-	return array.value ? ((unsigned *)array.value)[-1] : 0;
-}
+	const jsk_ndjson_thread *t = (const jsk_ndjson_thread *)arg;
+	jsk_ndjson_pool *p = t->pool;
+	unsigned round = 0;
 
-JSK_EXPORT void jsk_array_push(jsk_heap *h, jsk_value *array, jsk_value value)
-{
-	if (array->value) {
-		jsk_value *vs = (jsk_value *)array->value;
-		const unsigned allocated = ((unsigned *)vs)[-2];
-		const unsigned len = ((unsigned *)vs)[-1];
+	pthread_mutex_lock(&p->lock);
 
-		if (JSK_LIKELY(len < allocated)) {
-			vs[len] = value;
-			((unsigned *)vs)[-1]++;
-			return;
+	while (1) {
+		while (p->round == round && !p->stop)
+			pthread_cond_wait(&p->start, &p->lock);
+
+		if (p->stop)
+			break;
+
+		round = p->round;
+
+		if (t->id < p->batches) {
+			pthread_mutex_unlock(&p->lock);
+			jsk_ndjson_work(&p->workers[t->id]);
+			pthread_mutex_lock(&p->lock);
 		}
 
-		const unsigned n = allocated * 2;
-		const unsigned b = 2 * sizeof(unsigned) + n * sizeof(jsk_value);
-		unsigned *mem = (unsigned *)jsk_heap_alloc(h, b,
-				JSK_VALUE_ALIGN);
-		mem[0] = n;
-		mem[1] = len + 1;
-		jsk_value *new_vs = (jsk_value *)&mem[2];
-		memcpy(new_vs, vs, allocated * sizeof(jsk_value));
-		new_vs[allocated] = value;
-		array->value = new_vs;
-	} else {
-		const unsigned n = JSK_DEFAULT_ARRAY_SIZE;
-		const unsigned b = 2 * sizeof(unsigned) + n * sizeof(jsk_value);
-		unsigned *mem = (unsigned *)jsk_heap_alloc(h, b,
-				JSK_VALUE_ALIGN);
-		mem[0] = n;
-		mem[1] = 1;
-		jsk_value *vs = (jsk_value *)&mem[2];
-		vs[0] = value;
-		array->value = vs;
+		if (--p->busy == 0)
+			pthread_cond_signal(&p->done);
 	}
-}
 
-static jsk_result jsk_expected(jsk_context *ctx, const char *const what)
-{
-	return jsk_error(ctx, "Expected %s at index %llu but found %s",
-			what, ctx->ptr - 1, jsk_token_names[ctx->tkn.type]);
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
 }
 
-static jsk_result jsk_parse_value(jsk_context *ctx)
+JSK_EXPORT jsk_status jsk_parse_ndjson_parallel(void *ctx,
+		const char *const json, unsigned long long len,
+		unsigned threads, jsk_document_callback callback, void *user)
 {
-	switch (ctx->tkn.type) {
-	case JSKT_INT: {
-		const jsk_value v = (jsk_value){
-			JSK_INT,
-			(void*)ctx->tkn.data,
-		};
-		jsk_verbose("D INT %lld @ %llu\n", jsk_get_int(v), ctx->ptr);
-		jsk_lex(ctx);
-		return jsk_success(v);
+	if (threads == 0) {
+		const long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = n > 0 ? (unsigned)n : 1;
 	}
 
-	case JSKT_FLOAT: {
-		const jsk_value v = (jsk_value){
-			JSK_FLOAT,
-			(void*)ctx->tkn.data,
-		};
-		jsk_verbose("D FLT %f @ %llu\n", jsk_get_float(v), ctx->ptr);
-		jsk_lex(ctx);
-		return jsk_success(v);
+	jsk_ndjson_worker *workers = (jsk_ndjson_worker *)JSK_MALLOC(ctx,
+			threads * sizeof(jsk_ndjson_worker));
+	jsk_ndjson_thread *pool = (jsk_ndjson_thread *)JSK_MALLOC(ctx,
+			threads * sizeof(jsk_ndjson_thread));
+
+	if (JSK_UNLIKELY(!workers || !pool)) {
+		if (workers)
+			JSK_FREE(ctx, workers);
+		if (pool)
+			JSK_FREE(ctx, pool);
+		return JSK_ERROR;
 	}
 
-	case JSKT_STRING: {
-		const jsk_value v = jsk_new_string_escaped(ctx->heap,
-				ctx->tkn.data, ctx->tkn.len);
-		jsk_verbose("D STR %s @ %llu\n", jsk_get_string(v), ctx->ptr);
-		jsk_lex(ctx);
-		return jsk_success(v);
+	jsk_ndjson_pool p;
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.start, NULL);
+	pthread_cond_init(&p.done, NULL);
+	p.workers = workers;
+	p.round = 0;
+	p.batches = 0;
+	p.busy = 0;
+	p.stop = 0;
+
+	/* Thread 0 is the caller; any that fail to start are run by it */
+	unsigned started = 1;
+	for (; started < threads; started++) {
+		pool[started].pool = &p;
+		pool[started].id = started;
+		if (pthread_create(&pool[started].tid, NULL, jsk_ndjson_serve,
+					&pool[started]))
+			break;
 	}
 
-	case JSKT_TRUE:
-		jsk_verbose("D TRUE @ %llu\n", ctx->ptr);
-		jsk_lex(ctx);
-		return jsk_success(jsk_new_bool(1));
-
-	case JSKT_FALSE:
-		jsk_verbose("D FALSE @ %llu\n", ctx->ptr);
-		jsk_lex(ctx);
-		return jsk_success(jsk_new_bool(0));
-
-	case JSKT_NULL:
-		jsk_verbose("D NULL @ %llu\n", ctx->ptr);
-		jsk_lex(ctx);
-		return jsk_success(jsk_new_null());
+	jsk_status status = JSK_OK;
+	unsigned long long index = 0;
+	unsigned long long ptr = 0;
 
-	case JSKT_LBRACK: {
-		jsk_verbose("D ARRAY @ %llu\n", ctx->ptr);
+	while (ptr < len && status == JSK_OK) {
+		unsigned n = 0;
 
-		jsk_value a = jsk_new_array();
+		/* Hand each worker a batch that ends on a line boundary */
+		while (n < threads && ptr < len) {
+			unsigned long long end = ptr + JSK_NDJSON_BATCH;
 
-		do {
-			jsk_lex(ctx);
+			if (end >= len) {
+				end = len;
+			} else {
+				const char *nl = (const char *)memchr(
+						&json[end], '\n', len - end);
+				end = nl ? (unsigned long long)(nl - json) + 1
+					: len;
+			}
 
-			if (JSK_UNLIKELY(ctx->tkn.type == JSKT_RBRACK))
-				break;
+			workers[n] = (jsk_ndjson_worker){
+				ctx, json, ptr, end, NULL, NULL, 0, 0, 0,
+			};
 
-			jsk_result res = jsk_parse_value(ctx);
-			if (res.status != JSK_OK)
-				return res;
+			ptr = end;
+			n++;
+		}
 
-			jsk_array_push(ctx->heap, &a, res.data.value);
-		} while (ctx->tkn.type == JSKT_COMMA);
+		pthread_mutex_lock(&p.lock);
+		p.batches = n;
+		p.busy = started - 1;
+		p.round++;
+		pthread_cond_broadcast(&p.start);
+		pthread_mutex_unlock(&p.lock);
 
-		if (ctx->tkn.type != JSKT_RBRACK)
-			return jsk_expected(ctx, "']' after array");
+		jsk_ndjson_work(&workers[0]);
 
-		jsk_lex(ctx);
+		for (unsigned i = started; i < n; i++)
+			jsk_ndjson_work(&workers[i]);
 
-		return jsk_success(a);
-	}
+		pthread_mutex_lock(&p.lock);
+		while (p.busy)
+			pthread_cond_wait(&p.done, &p.lock);
+		pthread_mutex_unlock(&p.lock);
 
-	case JSKT_LBRACE: {
-		jsk_verbose("D OBJECT @ %llu\n", ctx->ptr);
+		for (unsigned i = 0; i < n; i++) {
+			jsk_ndjson_worker *w = &workers[i];
 
-		jsk_value o = jsk_new_object(ctx->heap);
+			if (JSK_UNLIKELY(w->failed))
+				status = JSK_ERROR;
 
-		do {
-			jsk_lex(ctx);
+			for (unsigned j = 0; j < w->count && status == JSK_OK;
+					j++)
+				if (callback(user, index++, w->results[j]))
+					status = JSK_ERROR;
 
-			if (JSK_UNLIKELY(ctx->tkn.type == JSKT_RBRACE))
-				break;
+			if (w->heap)
+				jsk_heap_free(w->heap);
+		}
+	}
 
-			if (ctx->tkn.type != JSKT_STRING)
-				return jsk_expected(ctx, "object key");
+	pthread_mutex_lock(&p.lock);
+	p.stop = 1;
+	pthread_cond_broadcast(&p.start);
+	pthread_mutex_unlock(&p.lock);
 
-			char *name = (char *)jsk_heap_alloc(ctx->heap,
-					ctx->tkn.len + 1, 1);
-			memcpy(name, ctx->tkn.data, ctx->tkn.len);
-			name[ctx->tkn.len] = 0;
+	for (unsigned i = 1; i < started; i++)
+		pthread_join(pool[i].tid, NULL);
 
-			jsk_verbose("D OBJECT KEY %s @ %llu\n", name, ctx->ptr);
+	pthread_cond_destroy(&p.done);
+	pthread_cond_destroy(&p.start);
+	pthread_mutex_destroy(&p.lock);
 
-			jsk_lex(ctx);
+	JSK_FREE(ctx, workers);
+	JSK_FREE(ctx, pool);
 
-			if (ctx->tkn.type != JSKT_COLON)
-				return jsk_expected(ctx, "':'");
+	return status;
+}
 
-			jsk_lex(ctx);
+static void jsk_heap_splice(jsk_heap *dst, jsk_heap *src)
+{
+	for (jsk_heap *h = src; h; h = h->next)
+		h->head = dst;
+
+	jsk_heap *tail = src->tail;
+	dst->tail->next = src;
+	dst->tail = tail;
+	dst->bytes += src->bytes;
+	dst->oversized_bytes += src->oversized_bytes;
+	dst->oversized_count += src->oversized_count;
+	dst->padding += src->padding;
+	dst->abandoned += src->abandoned;
+#ifdef JSK_PARSE_STATS
+	jsk_parse_stats *d = &dst->parse;
+	const jsk_parse_stats *st = &src->parse;
+	d->nulls += st->nulls;
+	d->booleans += st->booleans;
+	d->integers += st->integers;
+	d->floats += st->floats;
+	d->strings += st->strings;
+	d->keys += st->keys;
+	d->objects += st->objects;
+	d->arrays += st->arrays;
+	d->numbers += st->numbers;
+	d->rehashes += st->rehashes;
+	if (st->max_depth > d->max_depth)
+		d->max_depth = st->max_depth;
+#endif
+}
 
-			jsk_result res = jsk_parse_value(ctx);
-			if (res.status != JSK_OK)
-				return res;
+/*
+ * Finds up to parts - 1 commas separating top-level elements of the array
+ * whose body starts at `begin`, spaced roughly evenly through the input. Only
+ * brackets and strings are tracked; anything malformed is left for the real
+ * parser to report.
+ */
+static unsigned jsk_array_split(const char *const json,
+		unsigned long long begin, unsigned long long len,
+		unsigned parts, unsigned long long *splits)
+{
+	const unsigned long long step = (len - begin) / parts;
+	unsigned long long target = begin + step;
+	unsigned long long ptr = begin;
+	unsigned depth = 1;
+	unsigned n = 0;
+
+	while (ptr < len && n < parts - 1) {
+		switch (json[ptr]) {
+		case '"':
+			ptr = jsk_skip_string(json, len, ptr);
+			if (JSK_UNLIKELY(ptr == JSK_SKIP_ERROR))
+				return n;
+			break;
 
-			jsk_object_insert(&o, name, res.data.value);
-		} while (ctx->tkn.type == JSKT_COMMA);
+		case '[':
+		case '{':
+			depth++;
+			break;
 
-		if (ctx->tkn.type != JSKT_RBRACE)
-			return jsk_expected(ctx, "'}' after object");
+		case ']':
+		case '}':
+			if (--depth == 0)
+				return n;
+			break;
 
-		jsk_lex(ctx);
+		case ',':
+			if (depth == 1 && ptr >= target) {
+				splits[n++] = ptr;
+				target = ptr + step;
+			}
+			break;
+		}
 
-		return jsk_success(o);
+		ptr++;
 	}
 
-	default:
-		return jsk_error(ctx, "Unexpected %s at index %llu",
-			jsk_token_names[ctx->tkn.type], ctx->ptr - 1);
-	}
+	return n;
 }
 
-JSK_EXPORT jsk_result jsk_parse(jsk_heap *heap,
-		const char *const json, unsigned len)
+typedef struct jsk_array_worker {
+	void *ctx;
+	const char *json;
+	unsigned long long begin;
+	unsigned long long end;
+	int last;
+	jsk_heap *heap;
+	jsk_value elements;
+	jsk_result res;
+} jsk_array_worker;
+
+static void *jsk_array_work(void *arg)
 {
+	jsk_array_worker *w = (jsk_array_worker *)arg;
+
+	w->heap = jsk_heap_new(w->ctx);
+	if (JSK_UNLIKELY(!w->heap)) {
+		w->res = (jsk_result){ JSK_ERROR,
+			{ .error = (char *)"Out of memory" } };
+		return NULL;
+	}
+
 	jsk_context ctx = (jsk_context){
-		heap,
-		json,
-		len,
-		0,
+		w->heap,
+		w->json,
+		w->end,
+		w->begin,
 		(jsk_token){ JSKT_INVALID, 0, 0, },
+		0,
+		NULL,
+		0,
 	};
 
+	/* Every element of the slice is pushed onto a single open array */
+	jsk_dom_builder b;
+	jsk_dom_init(&b, w->heap);
+	jsk_dom_open(&b, jsk_new_array());
+
 	jsk_lex(&ctx);
-	return jsk_parse_value(&ctx);
+
+	/*
+	 * The last slice can end with no element before the ']', either in an
+	 * empty array or after a trailing comma, which jsk_parse() allows too
+	 */
+	while (!w->last || ctx.tkn.type != JSKT_RBRACK) {
+		w->res = jsk_parse_value(&ctx, &jsk_dom_handler, &b);
+		if (w->res.status != JSK_OK)
+			return NULL;
+
+		if (ctx.tkn.type != JSKT_COMMA)
+			break;
+
+		jsk_lex(&ctx);
+	}
+
+	if (w->last && ctx.tkn.type != JSKT_RBRACK)
+		w->res = jsk_expected(&ctx, "']' after array");
+	else if (!w->last && ctx.tkn.type != JSKT_EOF)
+		w->res = jsk_expected(&ctx, "',' after array element");
+
+	w->elements = b.stack[0].container;
+
+	return NULL;
 }
 
-static void jsk_print_unescaped_string(jsk_heap *h, int null_terminate, char *s)
+JSK_EXPORT jsk_result jsk_parse_array_parallel(jsk_heap *heap,
+		const char *const json, unsigned long long len,
+		unsigned threads)
 {
-	jsk_printf(h, 0, "\"");
+	if (threads == 0) {
+		const long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = n > 0 ? (unsigned)n : 1;
+	}
 
-	char *start = s;
+	unsigned long long begin = 0;
+	while (begin < len && (json[begin] == ' ' || json[begin] == '\t' ||
+				json[begin] == '\n' || json[begin] == '\r'))
+		begin++;
+
+	if (len / JSK_PARALLEL_MIN_PART < threads)
+		threads = len / JSK_PARALLEL_MIN_PART;
+
+	if (threads < 2 || begin == len || json[begin] != '[')
+		return jsk_parse_dom(heap, json, len, NULL);
+
+	begin++;
+
+	jsk_array_worker *workers = (jsk_array_worker *)JSK_MALLOC(heap->ctx,
+			threads * (sizeof(jsk_array_worker) +
+				sizeof(unsigned long long) +
+				sizeof(pthread_t)));
+	if (JSK_UNLIKELY(!workers))
+		return jsk_parse_dom(heap, json, len, NULL);
+
+	unsigned long long *splits = (unsigned long long *)&workers[threads];
+	pthread_t *tids = (pthread_t *)&splits[threads];
+
+	const unsigned n = jsk_array_split(json, begin, len, threads,
+			splits) + 1;
+
+	for (unsigned i = 0; i < n; i++) {
+		workers[i] = (jsk_array_worker){
+			heap->ctx,
+			json,
+			i ? splits[i - 1] + 1 : begin,
+			i < n - 1 ? splits[i] : len,
+			i == n - 1,
+			NULL,
+			jsk_new_array(),
+			jsk_success(jsk_new_null()),
+		};
+	}
 
-#define JSK_STR_CASE(fmt)					\
-	jsk_printf(h, 0, fmt, (int)(s - start),  start);	\
-	start = s + 1
+	unsigned started = 1;
+	for (; started < n; started++)
+		if (pthread_create(&tids[started], NULL, jsk_array_work,
+					&workers[started]))
+			break;
 
-	while (1) {
-		switch (*s) {
-		case 0:
-			jsk_printf(h, null_terminate, "%s\"", start);
-			return;
+	jsk_array_work(&workers[0]);
 
-		case '"':	JSK_STR_CASE("%.*s\\\"");	break;
-		case '\\':	JSK_STR_CASE("%.*s\\\\");	break;
-		case '/':	JSK_STR_CASE("%.*s\\/");	break;
-		case '\b':	JSK_STR_CASE("%.*s\\b");	break;
-		case '\f':	JSK_STR_CASE("%.*s\\f");	break;
-		case '\n':	JSK_STR_CASE("%.*s\\n");	break;
-		case '\r':	JSK_STR_CASE("%.*s\\r");	break;
-		case '\t':	JSK_STR_CASE("%.*s\\t");	break;
+	for (unsigned i = started; i < n; i++)
+		jsk_array_work(&workers[i]);
 
-		// TODO: Handle unicode escape sequences
+	for (unsigned i = 1; i < started; i++)
+		pthread_join(tids[i], NULL);
 
-		default:
-			break;
+	jsk_result res = jsk_success(jsk_new_null());
+	unsigned long long total = 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		if (res.status == JSK_OK && workers[i].res.status != JSK_OK)
+			res = workers[i].res;
+		total += jsk_array_length(workers[i].elements);
+	}
+
+	const unsigned long long max = (~0u - 2 * sizeof(unsigned)) /
+		sizeof(jsk_value);
+
+	if (res.status == JSK_OK && JSK_UNLIKELY(total > max)) {
+		jsk_context ctx = (jsk_context){ heap, json, len, len,
+			(jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL, 0, };
+		res = jsk_error(&ctx, "Array of %llu elements is too large",
+				total);
+	}
+
+	/* Stitch the per-thread element lists into one array */
+	if (res.status == JSK_OK && total) {
+		const unsigned b = 2 * sizeof(unsigned) +
+			total * sizeof(jsk_value);
+		unsigned *mem = (unsigned *)jsk_heap_alloc(heap, b,
+				JSK_VALUE_ALIGN);
+		if (JSK_UNLIKELY(!mem)) {
+			jsk_context ctx = (jsk_context){ heap, json, len, len,
+				(jsk_token){ JSKT_INVALID, 0, 0, }, 0, NULL,
+				0, };
+			res = jsk_error(&ctx, "Out of memory");
+		} else {
+			mem[0] = total;
+			mem[1] = total;
+
+			jsk_value *vs = (jsk_value *)&mem[2];
+			for (unsigned i = 0; i < n; i++) {
+				const unsigned count = jsk_array_length(
+						workers[i].elements);
+				if (count)
+					memcpy(vs, workers[i].elements.value,
+							count *
+							sizeof(jsk_value));
+				vs += count;
+			}
+
+			res.data.value = (jsk_value){ JSK_ARRAY, &mem[2] };
+		}
+	} else if (res.status == JSK_OK) {
+		res.data.value = jsk_new_array();
+	}
+
+	/* The elements (and any error message) live on in the worker heaps */
+	for (unsigned i = 0; i < n; i++)
+		if (workers[i].heap)
+			jsk_heap_splice(heap, workers[i].heap);
+
+	JSK_FREE(heap->ctx, workers);
+
+	return res;
+}
+
+#endif /* JSK_THREADS */
+
+/* Appends a raw (still escaped) key, escaping only non-ASCII bytes */
+static int jsk_write_raw_ascii(jsk_heap *out, const char *s,
+		unsigned long long len)
+{
+	unsigned long long start = 0, i = 0;
+
+	while (i < len) {
+		if (JSK_LIKELY((unsigned char)s[i] < 0x80)) {
+			i++;
+			continue;
 		}
 
-		s++;
+		char buf[12];
+		unsigned used;
+		const unsigned n = jsk_escape_utf8(buf, &s[i], len - i, &used);
+
+		if (jsk_heap_write(out, &s[start], i - start) ||
+				jsk_heap_write(out, buf, n))
+			return 1;
+
+		i += used;
+		start = i;
 	}
 
-#undef JSK_STR_CASE
+	return jsk_heap_write(out, &s[start], len - start);
 }
 
-static void jsk_to_string_internal(jsk_heap *h, jsk_value v)
+#define JSK_PUTS(h, s) jsk_heap_write(h, s, sizeof(s) - 1)
+
+static int jsk_to_string_internal(jsk_heap *h, jsk_value v, int ascii)
 {
 	switch (v.type) {
 	case JSK_OBJECT: {
-		jsk_printf(h, 0, "{");
+		if (JSK_PUTS(h, "{"))
+			return 1;
 
 		jsk_object_iter it = jsk_object_iterate(v);
 		jsk_object_entry *e;
-		const char *comma = "";
+		int first = 1;
 		while ((e = jsk_object_next(&it))) {
-			jsk_printf(h, 0, "%s\"%s\":", comma, e->key);
-			jsk_to_string_internal(h, e->value);
-			comma = ",";
+			const unsigned long long len = strlen(e->key);
+
+			if ((!first && JSK_PUTS(h, ",")) || JSK_PUTS(h, "\"") ||
+					(ascii ? jsk_write_raw_ascii(h, e->key, len) :
+					 jsk_heap_write(h, e->key, len)) ||
+					JSK_PUTS(h, "\":") ||
+					jsk_to_string_internal(h, e->value, ascii))
+				return 1;
+			first = 0;
 		}
 
-		jsk_printf(h, 0, "}");
-		return;
+		return JSK_PUTS(h, "}");
 	}
 
-	case JSK_ARRAY: {
-		jsk_printf(h, 0, "[");
+	case JSK_ARRAY:
+	case JSK_INT_ARRAY:
+	case JSK_FLOAT_ARRAY: {
+		if (JSK_PUTS(h, "["))
+			return 1;
 
 		const unsigned len = jsk_array_length(v);
-		if (len) {
-			jsk_to_string_internal(h, jsk_array_at(v, 0));
-			for (unsigned i = 1; i < len; i++) {
-				jsk_printf(h, 0, ",");
-				jsk_to_string_internal(h, jsk_array_at(v, i));
-			}
-		}
+		for (unsigned i = 0; i < len; i++)
+			if ((i && JSK_PUTS(h, ",")) ||
+					jsk_to_string_internal(h,
+						jsk_array_get(v, i), ascii))
+				return 1;
 
-		jsk_printf(h, 0, "]");
-		return;
+		return JSK_PUTS(h, "]");
 	}
 
-	case JSK_STRING:
-		jsk_print_unescaped_string(h, 0, (char *)v.value);
-		return;
+	case JSK_STRING: {
+		const char *s = (const char *)v.value;
 
-	case JSK_INT:
-		jsk_printf(h, 0, "%lld", jsk_get_int(v));
-		return;
+		return JSK_PUTS(h, "\"") ||
+			jsk_write_escaped(h, s, strlen(s), ascii) ||
+			JSK_PUTS(h, "\"");
+	}
 
-	case JSK_FLOAT:
-		jsk_printf(h, 0, "%lf", jsk_get_float(v));
-		return;
+	case JSK_INT: {
+		char buf[24];
+		const int n = snprintf(buf, sizeof(buf), "%lld",
+				jsk_get_int(v));
+		return jsk_heap_write(h, buf, n);
+	}
+
+	case JSK_FLOAT: {
+		char buf[512];
+		const int n = snprintf(buf, sizeof(buf), "%lf",
+				jsk_get_float(v));
+		return jsk_heap_write(h, buf, n);
+	}
+
+	case JSK_NUMBER: {
+		const char *s = jsk_get_number(v);
+		return jsk_heap_write(h, s, strlen(s));
+	}
 
 	case JSK_BOOL:
-		jsk_printf(h, 0, v.value ? "true" : "false");
-		return;
+		return v.value ? JSK_PUTS(h, "true") : JSK_PUTS(h, "false");
 
 	case JSK_NULL:
-		jsk_printf(h, 0, "null");
-		return;
+		return JSK_PUTS(h, "null");
 	}
+
+	return 0;
 }
 
-JSK_EXPORT char *jsk_to_string(jsk_heap *heap, jsk_value v)
+#undef JSK_PUTS
+
+static char *jsk_to_string_with(jsk_heap *heap, jsk_value v, int ascii)
 {
 	jsk_heap *string_heap = jsk_heap_new(heap->ctx);
-	jsk_to_string_internal(string_heap, v);
-	jsk_printf(heap, 1, "");
-	char *s = (char *)jsk_heap_unify(string_heap, 1);
+	if (JSK_UNLIKELY(!string_heap))
+		return NULL;
+
+	char *s = NULL;
+	if (JSK_LIKELY(!jsk_to_string_internal(string_heap, v, ascii)))
+		s = (char *)jsk_heap_unify(string_heap, 1);
+
 	jsk_heap_free(string_heap);
 	return s;
 }
 
+JSK_EXPORT char *jsk_to_string(jsk_heap *heap, jsk_value v)
+{
+	return jsk_to_string_with(heap, v, 0);
+}
+
+JSK_EXPORT char *jsk_to_string_ascii(jsk_heap *heap, jsk_value v)
+{
+	return jsk_to_string_with(heap, v, 1);
+}
+
 #if defined(__GNUC__)
 #pragma GCC diagnostic pop
 #endif
@@ -0,0 +1,1147 @@
+/*
+ * JSkorost - ДжайСкорость
+ * Copyright (C) Ollie Etherington 2021
+ * <https://github.com/oetherington/jskorost>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * C++17 bindings. Requires jskorost.h, with JSKOROST_IMPLEMENTATION defined
+ * in one translation unit as usual.
+ *
+ * Typed binding: list the members of a struct once with JSK_FIELDS, in the
+ * same namespace as the struct, and jsk::read<T>() parses JSON text straight
+ * into it while jsk::write() serializes it, with no jsk_value tree in
+ * between:
+ *
+ *	struct point { int x; int y; std::optional<std::string> label; };
+ *	JSK_FIELDS(point, x, y, label)
+ *
+ *	point p = jsk::read<point>(R"({"x": 1, "y": 2})");
+ *	std::string s = jsk::write(p);
+ *
+ * Supported members are bool, integers, floating point, std::string,
+ * std::optional, std::vector and other structs with field lists. Unknown
+ * keys are skipped, missing ones leave the member as it was, and null resets
+ * an optional. Keys are matched as they appear in the input, without
+ * unescaping, through a hash table of the field names built at compile time.
+ * Errors throw jsk::error.
+ *
+ * For untyped access, jsk::document owns a parsed tree and its heap, and
+ * jsk::value views any jsk_value with std::optional getters, string_view
+ * strings and range-for over elements() and members():
+ *
+ *	jsk::document doc = jsk::document::parse(json);
+ *	for (jsk::member m : doc.root().members())
+ *		if (auto n = m.val.get_int())
+ *			total += *n;
+ */
+
+#ifndef JSKOROST_HPP
+#define JSKOROST_HPP
+
+#include "jskorost.h"
+
+#include <array>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#define JSK_PP_NARGS(...) JSK_PP_NARGS_(__VA_ARGS__, \
+	32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, \
+	16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define JSK_PP_NARGS_( \
+	_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, \
+	_15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, \
+	_27, _28, _29, _30, _31, _32, N, ...) N
+
+#define JSK_PP_MAP_1(m, T, a) m(T, a)
+#define JSK_PP_MAP_2(m, T, a, ...) m(T, a), JSK_PP_MAP_1(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_3(m, T, a, ...) m(T, a), JSK_PP_MAP_2(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_4(m, T, a, ...) m(T, a), JSK_PP_MAP_3(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_5(m, T, a, ...) m(T, a), JSK_PP_MAP_4(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_6(m, T, a, ...) m(T, a), JSK_PP_MAP_5(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_7(m, T, a, ...) m(T, a), JSK_PP_MAP_6(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_8(m, T, a, ...) m(T, a), JSK_PP_MAP_7(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_9(m, T, a, ...) m(T, a), JSK_PP_MAP_8(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_10(m, T, a, ...) m(T, a), JSK_PP_MAP_9(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_11(m, T, a, ...) m(T, a), JSK_PP_MAP_10(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_12(m, T, a, ...) m(T, a), JSK_PP_MAP_11(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_13(m, T, a, ...) m(T, a), JSK_PP_MAP_12(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_14(m, T, a, ...) m(T, a), JSK_PP_MAP_13(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_15(m, T, a, ...) m(T, a), JSK_PP_MAP_14(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_16(m, T, a, ...) m(T, a), JSK_PP_MAP_15(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_17(m, T, a, ...) m(T, a), JSK_PP_MAP_16(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_18(m, T, a, ...) m(T, a), JSK_PP_MAP_17(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_19(m, T, a, ...) m(T, a), JSK_PP_MAP_18(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_20(m, T, a, ...) m(T, a), JSK_PP_MAP_19(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_21(m, T, a, ...) m(T, a), JSK_PP_MAP_20(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_22(m, T, a, ...) m(T, a), JSK_PP_MAP_21(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_23(m, T, a, ...) m(T, a), JSK_PP_MAP_22(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_24(m, T, a, ...) m(T, a), JSK_PP_MAP_23(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_25(m, T, a, ...) m(T, a), JSK_PP_MAP_24(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_26(m, T, a, ...) m(T, a), JSK_PP_MAP_25(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_27(m, T, a, ...) m(T, a), JSK_PP_MAP_26(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_28(m, T, a, ...) m(T, a), JSK_PP_MAP_27(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_29(m, T, a, ...) m(T, a), JSK_PP_MAP_28(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_30(m, T, a, ...) m(T, a), JSK_PP_MAP_29(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_31(m, T, a, ...) m(T, a), JSK_PP_MAP_30(m, T, __VA_ARGS__)
+#define JSK_PP_MAP_32(m, T, a, ...) m(T, a), JSK_PP_MAP_31(m, T, __VA_ARGS__)
+
+#define JSK_PP_CAT(a, b) JSK_PP_CAT_(a, b)
+#define JSK_PP_CAT_(a, b) a##b
+
+#define JSK_FIELD_(T, f) ::jsk::field<T, decltype(T::f)>{ #f, &T::f }
+
+/* Up to 32 members */
+#define JSK_FIELDS(T, ...)						\
+	constexpr auto jsk_fields(const T *)				\
+	{								\
+		return std::make_tuple(JSK_PP_CAT(JSK_PP_MAP_,		\
+			JSK_PP_NARGS(__VA_ARGS__))(JSK_FIELD_, T,	\
+				__VA_ARGS__));				\
+	}
+
+namespace jsk {
+
+class error : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+template <class C, class M>
+struct field {
+	std::string_view name;
+	M C::*member;
+};
+
+class reader;
+
+namespace detail {
+
+template <class T, class = void>
+struct has_fields : std::false_type {};
+
+template <class T>
+struct has_fields<T, std::void_t<decltype(jsk_fields((const T *)nullptr))>>
+	: std::true_type {};
+
+template <class T>
+struct is_optional : std::false_type {};
+
+template <class T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template <class T>
+struct is_vector : std::false_type {};
+
+template <class T, class A>
+struct is_vector<std::vector<T, A>> : std::true_type {};
+
+enum class kind { null, boolean, integer, floating, string };
+
+struct scalar {
+	kind k;
+	long long i;
+	double f;
+	const char *s;
+	unsigned len;
+};
+
+struct vtable;
+
+/* Where the next value goes, and how to store it */
+struct slot {
+	void *target;
+	const vtable *vt;
+};
+
+struct vtable {
+	bool (*value)(reader &r, void *target, const scalar &v);
+	slot (*open)(void *target, bool object);
+	slot (*key)(void *target, const char *s, unsigned len);
+	slot (*element)(void *target);
+};
+
+inline bool skip_value(reader &, void *, const scalar &)
+{
+	return true;
+}
+
+inline slot skip_open(void *, bool);
+
+inline slot skip_child(void *, const char *, unsigned)
+{
+	return skip_open(nullptr, true);
+}
+
+inline slot skip_element(void *)
+{
+	return skip_open(nullptr, false);
+}
+
+inline constexpr vtable skip_vt = {
+	skip_value,
+	skip_open,
+	skip_child,
+	skip_element,
+};
+
+inline slot skip_open(void *, bool)
+{
+	return slot{ nullptr, &skip_vt };
+}
+
+/* FNV-1a, usable in constant expressions */
+constexpr jsk_u64 hash_name(std::string_view s)
+{
+	jsk_u64 val = 0xcbf29ce484222325ULL;
+
+	for (const char c : s) {
+		val ^= (jsk_u64)(unsigned char)c;
+		val *= 0x100000001b3ULL;
+	}
+
+	return val;
+}
+
+template <class T>
+struct binder;
+
+/*
+ * An open-addressed table from field name to a function that binds that
+ * member, laid out at compile time. A key costs one hash and usually one
+ * comparison, however many fields there are.
+ */
+template <class T>
+struct dispatch {
+	static constexpr auto fields = jsk_fields((const T *)nullptr);
+	static constexpr std::size_t count =
+		std::tuple_size_v<std::remove_const_t<decltype(fields)>>;
+
+	static constexpr std::size_t table_size()
+	{
+		std::size_t n = 1;
+		while (n < 2 * count)
+			n *= 2;
+		return n;
+	}
+
+	static constexpr std::size_t size = table_size();
+
+	struct entry {
+		bool used;
+		jsk_u64 hash;
+		std::string_view name;
+		slot (*bind)(void *target);
+	};
+
+	template <std::size_t I>
+	static slot bind(void *target)
+	{
+		auto &m = (*(T *)target).*std::get<I>(fields).member;
+		return slot{ &m, &binder<std::remove_reference_t<
+			decltype(m)>>::vt };
+	}
+
+	template <std::size_t... I>
+	static constexpr std::array<entry, size> build(
+			std::index_sequence<I...>)
+	{
+		std::array<entry, size> t{};
+
+		((t[place(t, hash_name(std::get<I>(fields).name))] = entry{
+			true,
+			hash_name(std::get<I>(fields).name),
+			std::get<I>(fields).name,
+			&bind<I>,
+		}), ...);
+
+		return t;
+	}
+
+	static constexpr std::size_t place(const std::array<entry, size> &t,
+			jsk_u64 hash)
+	{
+		std::size_t b = hash & (size - 1);
+		while (t[b].used)
+			b = (b + 1) & (size - 1);
+		return b;
+	}
+
+	static constexpr std::array<entry, size> table =
+		build(std::make_index_sequence<count>{});
+
+	static slot find(void *target, const char *s, unsigned len)
+	{
+		const std::string_view k(s, len);
+		const jsk_u64 hash = hash_name(k);
+
+		for (std::size_t b = hash & (size - 1); table[b].used;
+				b = (b + 1) & (size - 1))
+			if (table[b].hash == hash && table[b].name == k)
+				return table[b].bind(target);
+
+		return skip_child(nullptr, s, len);
+	}
+};
+
+template <class T>
+struct binder {
+	static_assert(std::is_same_v<T, bool> || std::is_arithmetic_v<T> ||
+			std::is_same_v<T, std::string> || is_optional<T>::value ||
+			is_vector<T>::value || has_fields<T>::value,
+			"Type has no JSK_FIELDS list");
+
+	static bool value(reader &r, void *target, const scalar &v);
+
+	static slot open(void *target, bool object)
+	{
+		T &t = *(T *)target;
+
+		if constexpr (is_optional<T>::value) {
+			using U = typename T::value_type;
+			t.emplace();
+			return binder<U>::vt.open(&*t, object);
+		} else if constexpr (is_vector<T>::value) {
+			if (object)
+				return slot{ nullptr, nullptr };
+			t.clear();
+			return slot{ target, &vt };
+		} else if constexpr (has_fields<T>::value) {
+			if (!object)
+				return slot{ nullptr, nullptr };
+			return slot{ target, &vt };
+		} else {
+			(void)t;
+			return slot{ nullptr, nullptr };
+		}
+	}
+
+	static slot key(void *target, const char *s, unsigned len)
+	{
+		if constexpr (has_fields<T>::value) {
+			return dispatch<T>::find(target, s, len);
+		} else {
+			(void)target;
+			return skip_child(nullptr, s, len);
+		}
+	}
+
+	static slot element(void *target)
+	{
+		if constexpr (is_vector<T>::value) {
+			using U = typename T::value_type;
+			T &t = *(T *)target;
+			t.emplace_back();
+			return slot{ &t.back(), &binder<U>::vt };
+		} else {
+			return skip_element(target);
+		}
+	}
+
+	static constexpr vtable vt = { value, open, key, element };
+};
+
+template <class T>
+void write_value(std::string &out, const T &v);
+
+} /* namespace detail */
+
+/*
+ * Owns the scratch heap used for error messages. Reusing one reader across
+ * many documents avoids setting that up each time.
+ */
+class reader {
+public:
+	reader() : heap(jsk_heap_new(nullptr))
+	{
+		if (!heap)
+			throw std::bad_alloc();
+	}
+
+	~reader()
+	{
+		jsk_heap_free(heap);
+	}
+
+	reader(const reader &) = delete;
+	reader &operator=(const reader &) = delete;
+
+	template <class T>
+	void read(std::string_view json, T &out)
+	{
+		stack.clear();
+		root = detail::slot{ &out, &detail::binder<T>::vt };
+		reason = nullptr;
+
+		jsk_result res = jsk_parse_sax(heap, json.data(),
+				(unsigned)json.size(), &handler, this);
+
+		std::string message;
+		if (res.status != JSK_OK)
+			message = reason ? std::string(reason) + ": " +
+				res.data.error : res.data.error;
+
+		reset();
+
+		if (!message.empty())
+			throw error(message);
+	}
+
+	template <class T>
+	T read(std::string_view json)
+	{
+		T out{};
+		read(json, out);
+		return out;
+	}
+
+	/* Unescapes a raw string span from the input */
+	void unescape(std::string &out, const char *s, unsigned len)
+	{
+		if (!std::memchr(s, '\\', len)) {
+			out.assign(s, len);
+			return;
+		}
+
+		out.resize(len);
+		out.resize(jsk_unescape_string(out.data(), s, len));
+	}
+
+private:
+	struct frame {
+		detail::slot self;
+		detail::slot next;
+		bool object;
+	};
+
+	jsk_heap *heap;
+	std::vector<frame> stack;
+	detail::slot root;
+	const char *reason;
+
+	void reset()
+	{
+		if (heap->ptr || heap->next) {
+			jsk_heap_free(heap);
+			heap = jsk_heap_new(nullptr);
+			if (!heap)
+				throw std::bad_alloc();
+		}
+	}
+
+	detail::slot next_slot()
+	{
+		if (stack.empty())
+			return root;
+
+		frame &f = stack.back();
+		if (f.object)
+			return f.next;
+
+		return f.self.vt->element(f.self.target);
+	}
+
+	int put(const detail::scalar &v)
+	{
+		const detail::slot s = next_slot();
+		if (s.vt->value(*this, s.target, v))
+			return 0;
+
+		reason = "Type mismatch";
+		return 1;
+	}
+
+	int open(bool object)
+	{
+		const detail::slot s = next_slot();
+		const detail::slot self = s.vt->open(s.target, object);
+
+		if (!self.vt) {
+			reason = "Type mismatch";
+			return 1;
+		}
+
+		stack.push_back(frame{ self, detail::slot{}, object });
+		return 0;
+	}
+
+	static int on_null(void *user)
+	{
+		return ((reader *)user)->put(detail::scalar{
+			detail::kind::null, 0, 0, nullptr, 0 });
+	}
+
+	static int on_boolean(void *user, int value)
+	{
+		return ((reader *)user)->put(detail::scalar{
+			detail::kind::boolean, value, 0, nullptr, 0 });
+	}
+
+	static int on_integer(void *user, long long value)
+	{
+		return ((reader *)user)->put(detail::scalar{
+			detail::kind::integer, value, 0, nullptr, 0 });
+	}
+
+	static int on_floating(void *user, double value)
+	{
+		return ((reader *)user)->put(detail::scalar{
+			detail::kind::floating, 0, value, nullptr, 0 });
+	}
+
+	static int on_string(void *user, const char *s, unsigned len)
+	{
+		return ((reader *)user)->put(detail::scalar{
+			detail::kind::string, 0, 0, s, len });
+	}
+
+	static int on_key(void *user, const char *s, unsigned len)
+	{
+		frame &f = ((reader *)user)->stack.back();
+		f.next = f.self.vt->key(f.self.target, s, len);
+		return 0;
+	}
+
+	static int on_start_object(void *user)
+	{
+		return ((reader *)user)->open(true);
+	}
+
+	static int on_start_array(void *user)
+	{
+		return ((reader *)user)->open(false);
+	}
+
+	static int on_end(void *user, unsigned)
+	{
+		((reader *)user)->stack.pop_back();
+		return 0;
+	}
+
+	static constexpr jsk_handler handler = {
+		on_null,
+		on_boolean,
+		on_integer,
+		on_floating,
+		on_string,
+		on_key,
+		on_start_object,
+		on_end,
+		on_start_array,
+		on_end,
+		nullptr,
+	};
+};
+
+namespace detail {
+
+template <class T>
+bool binder<T>::value(reader &r, void *target, const scalar &v)
+{
+	T &t = *(T *)target;
+
+	if constexpr (std::is_same_v<T, bool>) {
+		if (v.k != kind::boolean)
+			return false;
+		t = v.i;
+	} else if constexpr (std::is_integral_v<T>) {
+		if (v.k != kind::integer)
+			return false;
+
+		if constexpr (std::is_signed_v<T>) {
+			if (v.i < (long long)std::numeric_limits<T>::min() ||
+					v.i > (long long)std::numeric_limits<T>::max())
+				return false;
+		} else {
+			if (v.i < 0 || (unsigned long long)v.i >
+					std::numeric_limits<T>::max())
+				return false;
+		}
+
+		t = (T)v.i;
+	} else if constexpr (std::is_floating_point_v<T>) {
+		if (v.k == kind::integer)
+			t = (T)v.i;
+		else if (v.k == kind::floating)
+			t = (T)v.f;
+		else
+			return false;
+	} else if constexpr (std::is_same_v<T, std::string>) {
+		if (v.k != kind::string)
+			return false;
+		r.unescape(t, v.s, v.len);
+	} else if constexpr (is_optional<T>::value) {
+		using U = typename T::value_type;
+		if (v.k == kind::null) {
+			t.reset();
+			return true;
+		}
+		t.emplace();
+		return binder<U>::value(r, &*t, v);
+	} else {
+		(void)r;
+		(void)t;
+		(void)v;
+		return false;
+	}
+
+	return true;
+}
+
+inline void write_string(std::string &out, std::string_view s)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	out += '"';
+
+	size_t start = 0;
+	for (size_t i = 0; i < s.size(); i++) {
+		const unsigned char c = s[i];
+		char e;
+
+		switch (c) {
+		case '"':	e = '"';	break;
+		case '\\':	e = '\\';	break;
+		case '/':	e = '/';	break;
+		case '\b':	e = 'b';	break;
+		case '\f':	e = 'f';	break;
+		case '\n':	e = 'n';	break;
+		case '\r':	e = 'r';	break;
+		case '\t':	e = 't';	break;
+		default:
+			if (c >= 0x20)
+				continue;
+			e = 'u';
+			break;
+		}
+
+		out.append(s, start, i - start);
+		out += '\\';
+		out += e;
+
+		if (e == 'u') {
+			out += "00";
+			out += hex[c >> 4];
+			out += hex[c & 15];
+		}
+
+		start = i + 1;
+	}
+
+	out.append(s, start, s.size() - start);
+	out += '"';
+}
+
+/* Non-finite values have no JSON spelling and become null */
+inline void write_float(std::string &out, double v)
+{
+	if (v != v || v - v != 0) {
+		out += "null";
+		return;
+	}
+
+	char buf[40];
+	int n = std::snprintf(buf, sizeof(buf), "%.15g", v);
+	if (std::strtod(buf, nullptr) != v)
+		n = std::snprintf(buf, sizeof(buf), "%.17g", v);
+
+	out.append(buf, n);
+	if (!std::strpbrk(buf, ".e"))
+		out += ".0";
+}
+
+template <class T>
+void write_value(std::string &out, const T &v)
+{
+	if constexpr (std::is_same_v<T, bool>) {
+		out += v ? "true" : "false";
+	} else if constexpr (std::is_integral_v<T>) {
+		char buf[24];
+		const auto r = std::to_chars(buf, buf + sizeof(buf), v);
+		out.append(buf, r.ptr);
+	} else if constexpr (std::is_floating_point_v<T>) {
+		write_float(out, v);
+	} else if constexpr (std::is_same_v<T, std::string>) {
+		write_string(out, v);
+	} else if constexpr (is_optional<T>::value) {
+		if (v)
+			write_value(out, *v);
+		else
+			out += "null";
+	} else if constexpr (is_vector<T>::value) {
+		out += '[';
+		for (size_t i = 0; i < v.size(); i++) {
+			if (i)
+				out += ',';
+			write_value(out, v[i]);
+		}
+		out += ']';
+	} else {
+		static_assert(has_fields<T>::value,
+				"Type has no JSK_FIELDS list");
+
+		out += '{';
+		std::apply([&](const auto &...f) {
+			const char *comma = "";
+			((out += comma, write_string(out, f.name), out += ':',
+			  write_value(out, v.*f.member), comma = ","), ...);
+		}, jsk_fields((const T *)nullptr));
+		out += '}';
+	}
+}
+
+} /* namespace detail */
+
+/*
+ * Ownership and views. heap and document are move-only owners; value is a
+ * trivially copyable view of a jsk_value that lives in some heap, so it is
+ * only valid as long as that heap. None of these allocate beyond what the C
+ * API does.
+ */
+class heap {
+public:
+	explicit heap(void *ctx = nullptr) : h(jsk_heap_new(ctx))
+	{
+		if (!h)
+			throw std::bad_alloc();
+	}
+
+	~heap()
+	{
+		if (h)
+			jsk_heap_free(h);
+	}
+
+	heap(heap &&o) noexcept : h(o.h)
+	{
+		o.h = nullptr;
+	}
+
+	heap &operator=(heap &&o) noexcept
+	{
+		if (this != &o) {
+			if (h)
+				jsk_heap_free(h);
+			h = o.h;
+			o.h = nullptr;
+		}
+		return *this;
+	}
+
+	heap(const heap &) = delete;
+	heap &operator=(const heap &) = delete;
+
+	/* Takes ownership of a heap allocated with jsk_heap_new() */
+	static heap adopt(jsk_heap *h)
+	{
+		return heap(h, 0);
+	}
+
+	jsk_heap *release()
+	{
+		jsk_heap *p = h;
+		h = nullptr;
+		return p;
+	}
+
+	jsk_heap *get() const
+	{
+		return h;
+	}
+
+private:
+	jsk_heap *h;
+
+	heap(jsk_heap *h, int) : h(h) {}
+};
+
+class value;
+
+struct member;
+
+class array_iterator {
+public:
+	array_iterator(jsk_value array, unsigned i) : array(array), i(i) {}
+
+	value operator*() const;
+
+	array_iterator &operator++()
+	{
+		i++;
+		return *this;
+	}
+
+	bool operator==(const array_iterator &o) const
+	{
+		return i == o.i;
+	}
+
+	bool operator!=(const array_iterator &o) const
+	{
+		return i != o.i;
+	}
+
+private:
+	jsk_value array;
+	unsigned i;
+};
+
+class object_iterator {
+public:
+	object_iterator() : it{ nullptr, 0 }, e(nullptr) {}
+
+	explicit object_iterator(jsk_value object)
+		: it(jsk_object_iterate(object)), e(jsk_object_next(&it)) {}
+
+	member operator*() const;
+
+	object_iterator &operator++()
+	{
+		e = jsk_object_next(&it);
+		return *this;
+	}
+
+	bool operator==(const object_iterator &o) const
+	{
+		return e == o.e;
+	}
+
+	bool operator!=(const object_iterator &o) const
+	{
+		return e != o.e;
+	}
+
+private:
+	jsk_object_iter it;
+	jsk_object_entry *e;
+};
+
+template <class I>
+struct range {
+	I first;
+	I last;
+
+	I begin() const
+	{
+		return first;
+	}
+
+	I end() const
+	{
+		return last;
+	}
+};
+
+/*
+ * A jsk_key for lookups by a fixed name. With the default JSK_HASH the hash
+ * is computed at compile time, so keys can be constexpr:
+ *
+ *	static constexpr jsk::key id("id");
+ *	auto v = doc.root()[id];
+ *
+ * The name must outlive the key.
+ */
+class key {
+public:
+#ifdef JSK_KEY_FNV1A
+	constexpr key(std::string_view name)
+		: k{ name.data(), (unsigned)name.size(), fnv1a(name) } {}
+#else
+	key(std::string_view name)
+		: k(jsk_key_make_len(name.data(), (unsigned)name.size())) {}
+#endif
+
+	constexpr std::string_view name() const
+	{
+		return std::string_view(k.name, k.len);
+	}
+
+	constexpr jsk_u64 hash() const
+	{
+		return k.hash;
+	}
+
+	const jsk_key *c_key() const
+	{
+		return &k;
+	}
+
+private:
+	/* Must match jsk_hash_len(), remapped by jsk_hash_nonzero() */
+	static constexpr jsk_u64 fnv1a(std::string_view s)
+	{
+		const jsk_u64 val = detail::hash_name(s);
+		return val ? val : 1;
+	}
+
+	jsk_key k;
+};
+
+/*
+ * Typed getters return std::nullopt when the value has another type.
+ * Strings and keys are views of the NUL-terminated text in the heap; keys are
+ * still escaped, as in the C API.
+ */
+class value {
+public:
+	value() : v{ JSK_NULL, nullptr } {}
+	value(jsk_value v) : v(v) {}
+
+	jsk_type type() const
+	{
+		return v.type;
+	}
+
+	const jsk_value &c_value() const
+	{
+		return v;
+	}
+
+	bool is_null() const
+	{
+		return v.type == JSK_NULL;
+	}
+
+	bool is_object() const
+	{
+		return v.type == JSK_OBJECT;
+	}
+
+	/* Including packed numeric arrays */
+	bool is_array() const
+	{
+		return jsk_is_array(v);
+	}
+
+	std::optional<bool> get_bool() const
+	{
+		if (v.type != JSK_BOOL)
+			return std::nullopt;
+		return jsk_get_bool(v) != 0;
+	}
+
+	/* Lazy numbers (JSK_NUMBER) are converted on first access */
+	std::optional<long long> get_int() const
+	{
+		jsk_value n = jsk_number_value(v);
+		if (n.type != JSK_INT)
+			return std::nullopt;
+		return jsk_get_int(n);
+	}
+
+	std::optional<double> get_float() const
+	{
+		jsk_value n = jsk_number_value(v);
+		if (n.type != JSK_FLOAT)
+			return std::nullopt;
+		return jsk_get_float(n);
+	}
+
+	/* Any kind of number, as a double */
+	std::optional<double> get_number() const
+	{
+		jsk_value n = jsk_number_value(v);
+		if (n.type == JSK_INT)
+			return (double)jsk_get_int(n);
+		if (n.type != JSK_FLOAT)
+			return std::nullopt;
+		return jsk_get_float(n);
+	}
+
+	std::optional<std::string_view> get_string() const
+	{
+		if (v.type != JSK_STRING)
+			return std::nullopt;
+		return std::string_view(jsk_get_string(v));
+	}
+
+	/* Elements of an array or members of an object, otherwise 0 */
+	size_t size() const
+	{
+		if (jsk_is_array(v))
+			return jsk_array_length(v);
+		if (v.type == JSK_OBJECT)
+			return jsk_object_count(v);
+		return 0;
+	}
+
+	std::optional<value> find(std::string_view key) const
+	{
+		if (v.type != JSK_OBJECT)
+			return std::nullopt;
+
+		const jsk_value *e = jsk_object_get_len(v, key.data(),
+				(unsigned)key.size());
+		if (!e)
+			return std::nullopt;
+		return value(*e);
+	}
+
+	std::optional<value> find(const key &k) const
+	{
+		if (v.type != JSK_OBJECT)
+			return std::nullopt;
+
+		const jsk_value *e = jsk_object_get_key(v, k.c_key());
+		if (!e)
+			return std::nullopt;
+		return value(*e);
+	}
+
+	/* Missing members and non-objects give null */
+	value operator[](std::string_view key) const
+	{
+		return find(key).value_or(value());
+	}
+
+	value operator[](const key &k) const
+	{
+		return find(k).value_or(value());
+	}
+
+	/* Unchecked, like jsk_array_at() */
+	value operator[](size_t i) const
+	{
+		if (JSK_LIKELY(v.type == JSK_ARRAY))
+			return jsk_array_at(v, i);
+		return jsk_array_get(v, (unsigned)i);
+	}
+
+	range<array_iterator> elements() const
+	{
+		const unsigned n = jsk_is_array(v) ? jsk_array_length(v) : 0;
+		return range<array_iterator>{
+			array_iterator(v, 0),
+			array_iterator(v, n),
+		};
+	}
+
+	range<object_iterator> members() const
+	{
+		if (v.type != JSK_OBJECT)
+			return range<object_iterator>{};
+		return range<object_iterator>{
+			object_iterator(v),
+			object_iterator(),
+		};
+	}
+
+private:
+	jsk_value v;
+};
+
+static_assert(sizeof(value) == sizeof(jsk_value),
+		"jsk::value must stay a plain jsk_value");
+
+struct member {
+	std::string_view key;
+	value val;
+};
+
+inline value array_iterator::operator*() const
+{
+	if (JSK_LIKELY(array.type == JSK_ARRAY))
+		return value(jsk_array_at(array, i));
+	return value(jsk_array_get(array, i));
+}
+
+inline member object_iterator::operator*() const
+{
+	return member{ std::string_view(e->key), value(e->value) };
+}
+
+/* A parsed tree together with the heap it lives in */
+class document {
+public:
+	explicit document(void *ctx = nullptr) : h(ctx), r{ JSK_NULL, nullptr }
+	{}
+
+	static document parse(std::string_view json, void *ctx = nullptr)
+	{
+		document d(ctx);
+
+		jsk_result res = jsk_parse(d.h.get(), json.data(),
+				(unsigned)json.size());
+		if (res.status != JSK_OK)
+			throw error(res.data.error);
+
+		d.r = res.data.value;
+		return d;
+	}
+
+	document(document &&) noexcept = default;
+	document &operator=(document &&) noexcept = default;
+
+	value root() const
+	{
+		return value(r);
+	}
+
+	jsk_heap *get_heap() const
+	{
+		return h.get();
+	}
+
+	/* Drops garbage left behind by mutation, see jsk_compact() */
+	void compact()
+	{
+		jsk_heap *p = h.release();
+		const jsk_status status = jsk_compact(&p, &r);
+
+		h = heap::adopt(p);
+		if (status != JSK_OK)
+			throw std::bad_alloc();
+	}
+
+private:
+	heap h;
+	jsk_value r;
+};
+
+template <class T>
+T read(std::string_view json)
+{
+	thread_local reader r;
+	return r.read<T>(json);
+}
+
+template <class T>
+void write(std::string &out, const T &v)
+{
+	detail::write_value(out, v);
+}
+
+template <class T>
+std::string write(const T &v)
+{
+	std::string out;
+	write(out, v);
+	return out;
+}
+
+} /* namespace jsk */
+
+#endif /* JSKOROST_HPP */
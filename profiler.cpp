@@ -1,11 +1,113 @@
 #define JSKOROST_IMPLEMENTATION
-#include "jskorost.h"
+#include "jskorost.hpp"
 #include <time.h>
 
 #include "rapidjson/include/rapidjson/document.h"
 #include "rapidjson/include/rapidjson/writer.h"
 #include "rapidjson/include/rapidjson/stringbuffer.h"
 
+static double walk_c(jsk_value v)
+{
+	switch (v.type) {
+	case JSK_OBJECT: {
+		double sum = 0;
+		jsk_object_iter it = jsk_object_iterate(v);
+		jsk_object_entry *e;
+		while ((e = jsk_object_next(&it)))
+			sum += strlen(e->key) + walk_c(e->value);
+		return sum;
+	}
+
+	case JSK_ARRAY: {
+		double sum = 0;
+		const unsigned len = jsk_array_length(v);
+		for (unsigned i = 0; i < len; i++)
+			sum += walk_c(jsk_array_at(v, i));
+		return sum;
+	}
+
+	case JSK_STRING:
+		return strlen(jsk_get_string(v));
+
+	case JSK_INT:
+		return jsk_get_int(v);
+
+	case JSK_FLOAT:
+		return jsk_get_float(v);
+
+	case JSK_BOOL:
+		return jsk_get_bool(v);
+
+	default:
+		return 0;
+	}
+}
+
+static double walk_cpp(jsk::value v)
+{
+	double sum = 0;
+
+	switch (v.type()) {
+	case JSK_OBJECT:
+		for (jsk::member m : v.members())
+			sum += m.key.size() + walk_cpp(m.val);
+		return sum;
+
+	case JSK_ARRAY:
+		for (jsk::value e : v.elements())
+			sum += walk_cpp(e);
+		return sum;
+
+	case JSK_STRING:
+		return v.get_string()->size();
+
+	case JSK_INT:
+		return *v.get_int();
+
+	case JSK_FLOAT:
+		return *v.get_float();
+
+	case JSK_BOOL:
+		return *v.get_bool();
+
+	default:
+		return 0;
+	}
+}
+
+/* Precomputed keys should beat hashing the name on every lookup */
+static void lookups(void)
+{
+	static const char json[] = "{\"id\": 1, \"user\": 2, \"type\": 3, "
+		"\"timestamp\": 4, \"payload\": 5, \"session\": 6}";
+	static constexpr jsk::key keys[] = {
+		jsk::key("id"), jsk::key("user"), jsk::key("type"),
+		jsk::key("timestamp"), jsk::key("payload"), jsk::key("session"),
+	};
+	const int n = 10000000;
+
+	jsk::document doc = jsk::document::parse(json);
+	const jsk::value root = doc.root();
+	long long sum = 0;
+
+	clock_t start = clock();
+	for (int i = 0; i < n; i++)
+		sum += *root[keys[i % 6].name()].get_int();
+	clock_t end = clock();
+
+	printf("JSkorost lookup by name: %f (checksum %lld)\n",
+			((double)(end - start)) / CLOCKS_PER_SEC, sum);
+
+	sum = 0;
+	start = clock();
+	for (int i = 0; i < n; i++)
+		sum += *root[keys[i % 6]].get_int();
+	end = clock();
+
+	printf("JSkorost lookup by key: %f (checksum %lld)\n",
+			((double)(end - start)) / CLOCKS_PER_SEC, sum);
+}
+
 int main(int argc, char **argv)
 {
 	if (argc < 2) {
@@ -63,12 +165,29 @@ int main(int argc, char **argv)
 
 	end = clock();
 
-	jsk_heap_free(h);
-
 	time_used = ((double)(end - start)) / CLOCKS_PER_SEC;
 
 	printf("JSkorost successfully parsed: %f (%f/sec)\n", time_used,
 			length / time_used);
 
+	/* The C++ wrapper should cost nothing over the C macros */
+	start = clock();
+	const double sum_c = walk_c(res.data.value);
+	end = clock();
+
+	printf("JSkorost C traversal: %f (checksum %f)\n",
+			((double)(end - start)) / CLOCKS_PER_SEC, sum_c);
+
+	start = clock();
+	const double sum_cpp = walk_cpp(res.data.value);
+	end = clock();
+
+	printf("JSkorost C++ traversal: %f (checksum %f)\n",
+			((double)(end - start)) / CLOCKS_PER_SEC, sum_cpp);
+
+	jsk_heap_free(h);
+
+	lookups();
+
 	return 0;
 }
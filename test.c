@@ -1,10 +1,41 @@
 #define JSKOROST_IMPLEMENTATION
 #define JSK_DEBUG
+#define JSK_THREADS
+#define JSK_PARSE_STATS
+#define JSK_NDJSON_BATCH 64
+#define JSK_PARALLEL_MIN_PART 16
+#define JSK_HASH(s) test_hash_len(s, strlen(s))
+#define JSK_HASH_LEN(s, len) test_hash_len(s, len)
+static unsigned long long test_hash_len(const char *s, unsigned len);
+#define JSK_MALLOC(ctx, bytes) test_malloc(ctx, bytes)
+static void *test_malloc(void *ctx, unsigned long long bytes);
 #include "jskorost.h"
+#include <limits.h>
 #include <stdlib.h>
+#include <locale.h>
 #include <setjmp.h>
 #include <cmocka.h>
 
+/* FNV-1a, except that keys starting with "zero" hash to 0 */
+static unsigned long long test_hash_len(const char *s, unsigned len)
+{
+	if (len >= 4 && !memcmp(s, "zero", 4))
+		return 0;
+	return jsk_hash_len(s, len);
+}
+
+/* A heap context, if given, counts down the allocations left to succeed */
+static void *test_malloc(void *ctx, unsigned long long bytes)
+{
+	unsigned *left = (unsigned *)ctx;
+
+	if (left && !(*left)--) {
+		*left = 0;
+		return NULL;
+	}
+	return malloc(bytes);
+}
+
 static void test_heap(void **state)
 {
 	(void)state;
@@ -52,17 +83,81 @@ static void test_heap_oversized(void **state)
 	jsk_heap_free(h);
 }
 
-static void test_string_formatting(void **state)
+static void test_heap_stats(void **state)
 {
 	(void)state;
 
 	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_heap_stats st;
+
+	jsk_heap_alloc(h, 1, 1);
+	jsk_heap_alloc(h, 8, 8);
+	jsk_heap_alloc(h, JSK_HEAP_MIN_OVERSIZED, 8);
+	jsk_heap_get_stats(h, &st);
+	assert_int_equal(st.chunks, 1);
+	assert_int_equal(st.padding, 7);
+	assert_int_equal(st.oversized_count, 1);
+	assert_true(st.oversized_bytes >= JSK_HEAP_MIN_OVERSIZED);
+	assert_int_equal(st.used, 16 + st.oversized_bytes);
+	assert_int_equal(st.reserved,
+			JSK_HEAP_CHUNK_SIZE + st.oversized_bytes);
+	assert_int_equal(st.abandoned, 0);
+
+	const char *json = "[{\"a\": [1, 2, 3, 4, 5, 6, 7, 8, 9], "
+		"\"b\": null, \"c\": [true, 1.5, \"x\"]}]";
+	jsk_result res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
 
-	char *s = jsk_printf(h, 1, "Hello %s", "World");
-	assert_string_equal(s, "Hello World");
+	jsk_heap_get_stats(h, &st);
+	assert_true(st.abandoned > 0);
+	assert_true(st.used <= st.reserved);
+	assert_int_equal(st.parse.arrays, 3);
+	assert_int_equal(st.parse.objects, 1);
+	assert_int_equal(st.parse.keys, 3);
+	assert_int_equal(st.parse.integers, 9);
+	assert_int_equal(st.parse.floats, 1);
+	assert_int_equal(st.parse.strings, 1);
+	assert_int_equal(st.parse.booleans, 1);
+	assert_int_equal(st.parse.nulls, 1);
+	assert_int_equal(st.parse.max_depth, 3);
+
+	const unsigned long long abandoned = st.abandoned;
+	jsk_value o = jsk_new_object(h);
+	char names[JSK_DEFAULT_OBJECT_SIZE][16];
+	for (unsigned i = 0; i < JSK_DEFAULT_OBJECT_SIZE; i++) {
+		snprintf(names[i], sizeof(names[i]), "k%u", i);
+		jsk_object_insert(&o, names[i], jsk_new_int(i));
+	}
+	jsk_heap_get_stats(h, &st);
+	assert_int_equal(st.parse.rehashes, 1);
+	assert_int_equal(st.abandoned - abandoned,
+			JSK_DEFAULT_OBJECT_SIZE * sizeof(jsk_object_entry));
+
+	jsk_heap_free(h);
+}
+
+static void test_string_formatting(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
 
 	jsk_context ctx;
 	ctx.heap = h;
+
+	char *s = jsk_error(&ctx, "Hello %s", "World").data.error;
+	assert_string_equal(s, "Hello World");
+
+	/* Messages that don't fit the current chunk are formatted again */
+	const unsigned len = 3 * JSK_HEAP_CHUNK_SIZE;
+	char *big = malloc(len + 1);
+	memset(big, 'x', len);
+	big[len] = 0;
+	s = jsk_error(&ctx, "<%s>", big).data.error;
+	assert_int_equal(strlen(s), len + 2);
+	assert_memory_equal(&s[1], big, len);
+	free(big);
+
 	ctx.tkn.type = JSKT_INT;
 	ctx.ptr = 1;
 	jsk_result res = jsk_expected(&ctx, "a float");
@@ -212,6 +307,139 @@ static void test_object_rehash(void **state)
 	jsk_heap_free(h);
 }
 
+static void test_object_hashing(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	jsk_value a = jsk_new_object(h);
+	char name[16];
+
+	for (unsigned i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "key%u", i);
+		const unsigned len = strlen(name) + 1;
+		char *key = (char *)jsk_heap_alloc(h, len, 1);
+		memcpy(key, name, len);
+		jsk_object_insert(&a, key, jsk_new_int(i));
+	}
+
+	jsk_value b = jsk_clone(h, a);
+
+	for (unsigned i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "key%u", i);
+		assert_int_equal(jsk_get_int_p(jsk_object_get(a, name)), i);
+		assert_int_equal(jsk_get_int_p(jsk_object_get(b, name)), i);
+	}
+
+	/* Buckets are picked by masking, so tables stay powers of two */
+	const unsigned allocated[] = {
+		jsk_get_object(a)->allocated,
+		jsk_get_object(b)->allocated,
+	};
+	for (unsigned i = 0; i < 2; i++)
+		assert_int_equal(allocated[i] & (allocated[i] - 1), 0);
+
+	/* 0 marks an empty bucket */
+	assert_true(jsk_hash_nonzero(0) != 0);
+	assert_true(jsk_hash_nonzero(42) == 42);
+
+	/* So keys that really hash to 0 still have to be found, rehashes too */
+	static const char *const zeros[] = { "zero", "zero1", "zero22" };
+	jsk_value z = jsk_new_object(h);
+	for (unsigned i = 0; i < 3; i++)
+		jsk_object_insert(&z, zeros[i], jsk_new_int(i));
+	for (unsigned i = 0; i < 64; i++) {
+		snprintf(name, sizeof(name), "other%u", i);
+		const unsigned len = strlen(name) + 1;
+		char *key = (char *)jsk_heap_alloc(h, len, 1);
+		memcpy(key, name, len);
+		jsk_object_insert(&z, key, jsk_new_int(-1));
+	}
+	assert_int_equal(jsk_object_count(z), 67);
+
+	for (unsigned i = 0; i < 3; i++) {
+		assert_int_equal(test_hash_len(zeros[i], strlen(zeros[i])), 0);
+		assert_int_equal(jsk_get_int_p(jsk_object_get(z, zeros[i])), i);
+
+		const jsk_key k = jsk_key_make(zeros[i]);
+		assert_int_equal(jsk_get_int_p(jsk_object_get_key(z, &k)), i);
+	}
+	assert_int_equal(jsk_get_int_p(jsk_object_get_len(z, "zero1x", 5)), 1);
+	assert_null(jsk_object_get(z, "zero3"));
+	assert_int_equal(jsk_get_int_p(jsk_object_get(z, "other63")), -1);
+
+	const char *json = "{\"zero\": 1, \"zero1\": 2, \"other\": 3}";
+	jsk_result res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_get_int_p(jsk_object_get(res.data.value, "zero1")),
+			2);
+
+	jsk_hash_seed(1);
+	const jsk_u64 h1 = jsk_hash_seeded("name", 4);
+	assert_true(h1 == jsk_hash_seeded("name", 4));
+	jsk_hash_seed(2);
+	assert_true(h1 != jsk_hash_seeded("name", 4));
+
+	jsk_heap_free(h);
+}
+
+static void test_object_get_len(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	jsk_value a = jsk_new_object(h);
+	jsk_object_insert(&a, "key", jsk_new_int(1));
+	jsk_object_insert(&a, "keys", jsk_new_int(2));
+
+	const char *name = "keystone";
+
+	jsk_value *v = jsk_object_get_len(a, name, 3);
+	assert_non_null(v);
+	assert_int_equal(jsk_get_int_p(v), 1);
+
+	v = jsk_object_get_len(a, name, 4);
+	assert_non_null(v);
+	assert_int_equal(jsk_get_int_p(v), 2);
+
+	assert_null(jsk_object_get_len(a, name, 2));
+	assert_null(jsk_object_get_len(a, name, 5));
+
+	jsk_heap_free(h);
+}
+
+static void test_object_get_key(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	jsk_value a = jsk_new_object(h);
+	jsk_object_insert(&a, "key", jsk_new_int(1));
+	jsk_object_insert(&a, "keys", jsk_new_int(2));
+
+	const jsk_key key = jsk_key_make("key");
+	const jsk_key keys = jsk_key_make_len("keystone", 4);
+	const jsk_key missing = jsk_key_make("keystone");
+
+	assert_true(key.hash == JSK_HASH("key"));
+	assert_true(keys.hash == JSK_HASH("keys"));
+
+	jsk_value *v = jsk_object_get_key(a, &key);
+	assert_non_null(v);
+	assert_int_equal(jsk_get_int_p(v), 1);
+
+	v = jsk_object_get_key(a, &keys);
+	assert_non_null(v);
+	assert_int_equal(jsk_get_int_p(v), 2);
+
+	assert_null(jsk_object_get_key(a, &missing));
+
+	jsk_heap_free(h);
+}
+
 static void test_parse_simple_values(void **state)
 {
 	(void)state;
@@ -312,6 +540,57 @@ static void test_parse_strings(void **state)
 	jsk_heap_free(h);
 }
 
+static void test_parse_unicode(void **state)
+{
+	(void)state;
+
+	char *json;
+	jsk_result res;
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	json = "\"caf\\u00e9 \\u4E2D \\ud83d\\ude00 \\ud800x \\u0041\"";
+	res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
+	assert_string_equal(jsk_get_string(res.data.value),
+			"caf\xc3\xa9 \xe4\xb8\xad \xf0\x9f\x98\x80 "
+			"\xef\xbf\xbdx A");
+
+	/* Long enough to go through the vector loop on both sides */
+	json = "\"\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82 "
+		"0123456789abcdef \xe4\xb8\x96\xe7\x95\x8c \xf0\x9f\x8c\x8d\"";
+	res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(strlen(jsk_get_string(res.data.value)),
+			strlen(json) - 2);
+
+	const char *invalid[] = {
+		"\"0123456789abcdef\xc3\x28\"",	/* bad continuation */
+		"\"\xc0\xaf\"",			/* overlong */
+		"\"\xed\xa0\x80\"",		/* encoded surrogate */
+		"\"\xf4\x90\x80\x80\"",		/* above U+10FFFF */
+		"\"\xe4\xb8\"",			/* truncated */
+		"\"\\x\"",			/* unknown escape */
+		"\"\\u12G4\"",			/* bad hex */
+		"\"a\\u0000b\"",		/* NUL */
+	};
+
+	for (unsigned i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		res = jsk_parse(h, invalid[i], strlen(invalid[i]));
+		assert_int_equal(res.status, JSK_ERROR);
+	}
+
+	res = jsk_parse(h, invalid[0], strlen(invalid[0]));
+	assert_string_equal(res.data.error,
+			"Unexpected invalid token at index 17");
+
+	json = "[\"a\\u0000b\"]";
+	res = jsk_parse(h, json, strlen(json));
+	assert_string_equal(res.data.error,
+			"Unexpected invalid token at index 3");
+
+	jsk_heap_free(h);
+}
+
 static void test_parse_arrays(void **state)
 {
 	(void)state;
@@ -401,6 +680,1379 @@ static void test_parse_objects(void **state)
 	jsk_heap_free(h);
 }
 
+typedef struct sax_counts {
+	int nulls, bools, ints, floats, strings, keys;
+	int objects, arrays, depth, max_depth;
+	long long int_sum;
+	int abort_after;
+} sax_counts;
+
+static int sax_tick(sax_counts *c)
+{
+	return c->abort_after && --c->abort_after == 0;
+}
+
+static int sax_null(void *u) { ((sax_counts *)u)->nulls++; return sax_tick(u); }
+static int sax_bool(void *u, int v) { (void)v; ((sax_counts *)u)->bools++; return sax_tick(u); }
+static int sax_float(void *u, double v) { (void)v; ((sax_counts *)u)->floats++; return sax_tick(u); }
+
+static int sax_int(void *u, long long v)
+{
+	sax_counts *c = u;
+	c->ints++;
+	c->int_sum += v;
+	return sax_tick(c);
+}
+
+static int sax_string(void *u, const char *s, unsigned len)
+{
+	(void)s;
+	(void)len;
+	((sax_counts *)u)->strings++;
+	return sax_tick(u);
+}
+
+static int sax_key(void *u, const char *s, unsigned len)
+{
+	(void)s;
+	(void)len;
+	((sax_counts *)u)->keys++;
+	return sax_tick(u);
+}
+
+static int sax_start(void *u)
+{
+	sax_counts *c = u;
+	if (++c->depth > c->max_depth)
+		c->max_depth = c->depth;
+	return sax_tick(c);
+}
+
+static int sax_start_object(void *u)
+{
+	((sax_counts *)u)->objects++;
+	return sax_start(u);
+}
+
+static int sax_start_array(void *u)
+{
+	((sax_counts *)u)->arrays++;
+	return sax_start(u);
+}
+
+static int sax_end(void *u, unsigned count)
+{
+	(void)count;
+	((sax_counts *)u)->depth--;
+	return sax_tick(u);
+}
+
+static void test_parse_sax(void **state)
+{
+	(void)state;
+
+	const jsk_handler handler = {
+		sax_null, sax_bool, sax_int, sax_float, sax_string, sax_key,
+		sax_start_object, sax_end, sax_start_array, sax_end, NULL,
+	};
+
+	const char *json =
+		"{"
+		"	\"a\": [1, 2, 3.5, null, true, \"x\"],"
+		"	\"b\": { \"c\": [[]], \"d\": 4 }"
+		"}";
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	sax_counts c = { 0 };
+	jsk_result res = jsk_parse_sax(h, json, strlen(json), &handler, &c);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(c.nulls, 1);
+	assert_int_equal(c.bools, 1);
+	assert_int_equal(c.ints, 3);
+	assert_int_equal(c.int_sum, 7);
+	assert_int_equal(c.floats, 1);
+	assert_int_equal(c.strings, 1);
+	assert_int_equal(c.keys, 4);
+	assert_int_equal(c.objects, 2);
+	assert_int_equal(c.arrays, 3);
+	assert_int_equal(c.depth, 0);
+	assert_int_equal(c.max_depth, 4);
+
+	sax_counts d = { 0 };
+	d.abort_after = 4;
+	res = jsk_parse_sax(h, json, strlen(json), &handler, &d);
+	assert_int_equal(res.status, JSK_ERROR);
+	assert_int_equal(d.ints, 1);
+
+	const jsk_handler empty = { 0 };
+	res = jsk_parse_sax(h, json, strlen(json), &empty, NULL);
+	assert_int_equal(res.status, JSK_OK);
+
+	res = jsk_parse_sax(h, "[1, 2", 5, &empty, NULL);
+	assert_int_equal(res.status, JSK_ERROR);
+
+	jsk_heap_free(h);
+}
+
+static void test_parse_limits(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	const char *json = "{\"a\": [1, 2.5, \"xyz\"], \"b\": {\"c\": [[]]}}";
+	const unsigned len = strlen(json);
+
+	jsk_parse_options opts = { 0 };
+	jsk_result res = jsk_parse_opts(h, json, len, &opts);
+	assert_int_equal(res.status, JSK_OK);
+
+	opts.max_depth = 4;
+	opts.max_string_length = 3;
+	opts.max_elements = 3;
+	opts.max_number_length = 3;
+	res = jsk_parse_opts(h, json, len, &opts);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_array_length(
+				*jsk_object_get(res.data.value, "a")), 3);
+
+	opts.max_depth = 3;
+	res = jsk_parse_opts(h, json, len, &opts);
+	assert_int_equal(res.status, JSK_LIMIT);
+	assert_string_equal(res.data.error,
+			"Nesting depth limit of 3 exceeded at index 35");
+	opts.max_depth = 0;
+
+	opts.max_string_length = 2;
+	res = jsk_parse_opts(h, json, len, &opts);
+	assert_int_equal(res.status, JSK_LIMIT);
+	assert_string_equal(res.data.error,
+			"String length limit of 2 exceeded at index 15");
+	opts.max_string_length = 0;
+
+	opts.max_elements = 2;
+	res = jsk_parse_opts(h, json, len, &opts);
+	assert_int_equal(res.status, JSK_LIMIT);
+	assert_string_equal(res.data.error,
+			"Element count limit of 2 exceeded at index 15");
+	opts.max_elements = 0;
+
+	opts.max_number_length = 2;
+	res = jsk_parse_opts(h, json, len, &opts);
+	assert_int_equal(res.status, JSK_LIMIT);
+	assert_string_equal(res.data.error,
+			"Number length limit of 2 exceeded at index 10");
+	opts.max_number_length = 0;
+
+	/* The SAX parser applies the same structural limits */
+	const jsk_handler empty = { 0 };
+	opts.max_depth = 1;
+	res = jsk_parse_sax_opts(h, json, len, &empty, NULL, &opts);
+	assert_int_equal(res.status, JSK_LIMIT);
+	opts.max_depth = 0;
+
+	/* A long array outgrows a one-chunk heap budget */
+	char big[20001];
+	big[0] = '[';
+	for (unsigned i = 0; i < 9999; i++) {
+		big[2 * i + 1] = '0';
+		big[2 * i + 2] = ',';
+	}
+	big[19999] = '0';
+	big[20000] = ']';
+
+	opts.max_heap_bytes = 4096;
+	res = jsk_parse_opts(h, big, sizeof(big), &opts);
+	assert_int_equal(res.status, JSK_LIMIT);
+	assert_non_null(strstr(res.data.error, "Heap limit of 4096"));
+
+	/* The budget is per parse and lifted afterwards */
+	res = jsk_parse(h, big, sizeof(big));
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_array_length(res.data.value), 10000);
+
+	opts.max_heap_bytes = 1 << 20;
+	res = jsk_parse_opts(h, big, sizeof(big), &opts);
+	assert_int_equal(res.status, JSK_OK);
+
+	jsk_heap_free(h);
+}
+
+static void *read_lazy_number(void *arg)
+{
+	const jsk_value v = *(const jsk_value *)arg;
+	double sum = 0;
+
+	for (unsigned i = 0; i < 1000; i++)
+		sum += jsk_as_float(v);
+
+	return sum == 1500 ? arg : NULL;
+}
+
+static void test_parse_lazy_numbers(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_parse_options opts = { 0 };
+	opts.lazy_numbers = 1;
+
+	const char *json = "[12345678901234567890123,19.99,-42,0.1e-7,-0,"
+		"-9223372036854775808]";
+	jsk_result res = jsk_parse_opts(h, json, strlen(json), &opts);
+	assert_int_equal(res.status, JSK_OK);
+
+	const jsk_value a = res.data.value;
+	assert_int_equal(jsk_array_at(a, 0).type, JSK_NUMBER);
+	assert_string_equal(jsk_get_number(jsk_array_at(a, 0)),
+			"12345678901234567890123");
+	assert_int_equal(jsk_number_value(jsk_array_at(a, 0)).type,
+			JSK_FLOAT);
+	assert_true(jsk_as_float(jsk_array_at(a, 1)) == 19.99);
+	assert_int_equal(jsk_as_int(jsk_array_at(a, 1)), 19);
+	assert_int_equal(jsk_as_int(jsk_array_at(a, 2)), -42);
+	assert_int_equal(jsk_number_value(jsk_array_at(a, 2)).type, JSK_INT);
+	assert_true(jsk_as_float(jsk_array_at(a, 3)) == 0.1e-7);
+	assert_int_equal(jsk_as_int(jsk_array_at(a, 4)), 0);
+	assert_true(jsk_as_int(jsk_array_at(a, 5)) == -9223372036854775807LL - 1);
+	assert_int_equal(jsk_as_int(jsk_new_int(7)), 7);
+
+	/* Written back exactly as they were read, clones included */
+	char *out = jsk_to_string(h, a);
+	assert_string_equal(out, json);
+	free(out);
+	out = jsk_to_string(h, jsk_clone(h, a));
+	assert_string_equal(out, json);
+	free(out);
+
+	/* The strict grammar applies */
+	res = jsk_parse_opts(h, "[01]", 4, &opts);
+	assert_int_equal(res.status, JSK_ERROR);
+	res = jsk_parse_opts(h, "[1.]", 4, &opts);
+	assert_int_equal(res.status, JSK_ERROR);
+	res = jsk_parse_opts(h, "-", 1, &opts);
+	assert_int_equal(res.status, JSK_ERROR);
+
+	/* Handlers without a number callback still see converted values */
+	const jsk_handler handler = {
+		sax_null, sax_bool, sax_int, sax_float, sax_string, sax_key,
+		sax_start_object, sax_end, sax_start_array, sax_end, NULL,
+	};
+	sax_counts c = { 0 };
+	res = jsk_parse_sax_opts(h, "[1,2.5,-3,1e2]", 14, &handler, &c, &opts);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(c.ints, 2);
+	assert_int_equal(c.int_sum, -2);
+	assert_int_equal(c.floats, 2);
+
+	/* Lazy and eager parses round the same way, correctly, ties to even */
+	json = "[-1.5,-0.25e-3,1e40,2.5e-12,1.7976931348623157e308,"
+		"4.9e-324,123456789012345678901234567890,"
+		"100000000000000000000000.5,9007199254740993.0,"
+		"2.4703282292062328e-324,1.7976931348623158e308]";
+	const jsk_value lazy = jsk_parse_opts(h, json, strlen(json),
+			&opts).data.value;
+	const jsk_value eager = jsk_parse(h, json, strlen(json)).data.value;
+	const double expected[] = {
+		-1.5, -0.25e-3, 1e40, 2.5e-12, 1.7976931348623157e308,
+		4.9e-324, 123456789012345678901234567890.0,
+		100000000000000000000000.5, 9007199254740993.0,
+		2.4703282292062328e-324, 1.7976931348623158e308,
+	};
+	for (unsigned i = 0; i < jsk_array_length(eager); i++) {
+		assert_true(jsk_get_float(jsk_array_at(eager, i)) ==
+				expected[i]);
+		assert_true(jsk_as_float(jsk_array_at(lazy, i)) ==
+				expected[i]);
+	}
+
+	/* Integers stay integers up to the edge of 64 bits */
+	json = "[9223372036854775807,-9223372036854775808,"
+		"9223372036854775808]";
+	const jsk_value edge = jsk_parse(h, json, strlen(json)).data.value;
+	assert_true(jsk_get_int(jsk_array_at(edge, 0)) == LLONG_MAX);
+	assert_true(jsk_get_int(jsk_array_at(edge, 1)) == LLONG_MIN);
+	assert_int_equal(jsk_array_at(edge, 2).type, JSK_FLOAT);
+	assert_true(jsk_get_float(jsk_array_at(edge, 2)) ==
+			9223372036854775808.0);
+
+	/* Without regard to the locale's decimal separator */
+	const char *locales[] = { "de_DE.UTF-8", "fr_FR.UTF-8", "de_DE" };
+	for (unsigned i = 0; i < 3; i++) {
+		if (!setlocale(LC_NUMERIC, locales[i]))
+			continue;
+		const jsk_value n = jsk_parse_opts(h, "2.5", 3,
+				&opts).data.value;
+		assert_true(jsk_as_float(n) == 2.5);
+		setlocale(LC_NUMERIC, "C");
+		break;
+	}
+
+	/* Threads may race to fill in the same cached conversion */
+	jsk_value shared = jsk_parse_opts(h, "1.5", 3, &opts).data.value;
+	pthread_t threads[4];
+	for (unsigned i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, read_lazy_number, &shared);
+	for (unsigned i = 0; i < 4; i++) {
+		void *ok;
+		pthread_join(threads[i], &ok);
+		assert_non_null(ok);
+	}
+
+	jsk_heap_free(h);
+}
+
+static void test_parse_packed_arrays(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_parse_options opts = { 0 };
+	opts.pack_arrays = 1;
+
+	const char *json = "{\"i\":[1,-2,3,4,5,6,7,8,9,10],\"f\":[1.5,2.5,-3.0],"
+		"\"m\":[1,\"x\"],\"n\":[[1],[]],\"e\":[]}";
+	jsk_result res = jsk_parse_opts(h, json, strlen(json), &opts);
+	assert_int_equal(res.status, JSK_OK);
+	const jsk_value v = res.data.value;
+
+	/* Integers stay packed past the first growth */
+	jsk_value a = *jsk_object_get(v, "i");
+	unsigned len = 0;
+	const long long *is = jsk_array_i64_data(a, &len);
+	assert_int_equal(a.type, JSK_INT_ARRAY);
+	assert_non_null(is);
+	assert_int_equal(len, 10);
+	assert_int_equal(is[1], -2);
+	assert_int_equal(is[9], 10);
+	assert_null(jsk_array_f64_data(a, &len));
+
+	a = *jsk_object_get(v, "f");
+	const double *fs = jsk_array_f64_data(a, &len);
+	assert_int_equal(a.type, JSK_FLOAT_ARRAY);
+	assert_int_equal(len, 3);
+	assert_true(fs[0] == 1.5 && fs[1] == 2.5 && fs[2] == -3.0);
+	assert_int_equal(jsk_array_get(a, 2).type, JSK_FLOAT);
+
+	/* Anything else falls back to a generic array */
+	a = *jsk_object_get(v, "m");
+	assert_int_equal(a.type, JSK_ARRAY);
+	assert_int_equal(jsk_get_int(jsk_array_at(a, 0)), 1);
+	assert_string_equal(jsk_get_string(jsk_array_at(a, 1)), "x");
+	a = *jsk_object_get(v, "n");
+	assert_int_equal(a.type, JSK_ARRAY);
+	assert_int_equal(jsk_array_at(a, 0).type, JSK_INT_ARRAY);
+	assert_int_equal(jsk_object_get(v, "e")->type, JSK_ARRAY);
+
+	/* Serialising and cloning see the same values */
+	a = *jsk_object_get(v, "i");
+	char *out = jsk_to_string(h, jsk_clone(h, a));
+	assert_string_equal(out, "[1,-2,3,4,5,6,7,8,9,10]");
+	free(out);
+	a = jsk_clone(h, *jsk_object_get(v, "f"));
+	assert_int_equal(a.type, JSK_FLOAT_ARRAY);
+	out = jsk_to_string(h, a);
+	assert_string_equal(out, "[1.500000,2.500000,-3.000000]");
+	free(out);
+
+	/* Mixing ints and floats unpacks, so each element keeps its type */
+	const char *mixed[] = { "[1,2,3.5]", "[1.5,2]" };
+	for (unsigned i = 0; i < 2; i++) {
+		const unsigned n = strlen(mixed[i]);
+		jsk_parse_options plain = { 0 };
+		res = jsk_parse_opts(h, mixed[i], n, &opts);
+		assert_int_equal(res.data.value.type, JSK_ARRAY);
+		char *packed = jsk_to_string(h, res.data.value);
+		out = jsk_to_string(h, jsk_parse_opts(h, mixed[i], n,
+					&plain).data.value);
+		assert_int_equal(strlen(packed), strlen(out));
+		assert_memory_equal(packed, out, strlen(out));
+		free(out);
+
+		res = jsk_parse_opts(h, packed, strlen(packed), &opts);
+		out = jsk_to_string(h, res.data.value);
+		assert_string_equal(out, packed);
+		free(out);
+		free(packed);
+	}
+	res = jsk_parse_opts(h, "[1,2,3.5]", 9, &opts);
+	assert_int_equal(jsk_array_at(res.data.value, 1).type, JSK_INT);
+	assert_int_equal(jsk_array_at(res.data.value, 2).type, JSK_FLOAT);
+
+	/* Pushing a string unpacks */
+	a = *jsk_object_get(v, "i");
+	jsk_array_push(h, &a, jsk_new_int(11));
+	assert_int_equal(a.type, JSK_INT_ARRAY);
+	jsk_array_push(h, &a, jsk_new_string(h, "y"));
+	assert_int_equal(a.type, JSK_ARRAY);
+	assert_int_equal(jsk_array_length(a), 12);
+	assert_int_equal(jsk_get_int(jsk_array_at(a, 10)), 11);
+	assert_string_equal(jsk_get_string(jsk_array_at(a, 11)), "y");
+
+	/* Integers that wouldn't be exact as doubles keep the array generic */
+	res = jsk_parse_opts(h, "[9007199254740993,0.5]", 22, &opts);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(res.data.value.type, JSK_ARRAY);
+	assert_true(jsk_get_int(jsk_array_at(res.data.value, 0)) ==
+			9007199254740993LL);
+
+	jsk_heap_free(h);
+}
+
+static void test_shred(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_columns cols;
+
+	const char *json = "[{\"id\":1,\"name\":\"a\\tb\",\"ok\":true},"
+		"{\"name\":null,\"id\":2.5},"
+		"{\"id\":3,\"ok\":false,\"extra\":\"x\",\"id\":4}]";
+	jsk_result res = jsk_shred(h, json, strlen(json), NULL, &cols);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(cols.rows, 3);
+	assert_int_equal(cols.count, 4);
+
+	/* The float turns the integers before it into floats */
+	const jsk_column *c = &cols.columns[0];
+	assert_string_equal(c->name, "id");
+	assert_int_equal(c->type, JSK_FLOAT);
+	assert_int_equal(c->null_count, 0);
+	assert_true(c->values.f[0] == 1.0 && c->values.f[1] == 2.5 &&
+			c->values.f[2] == 3.0);
+
+	/* Strings are unescaped, and nulls are empty */
+	c = &cols.columns[1];
+	assert_string_equal(c->name, "name");
+	assert_int_equal(c->type, JSK_STRING);
+	assert_int_equal(c->null_count, 2);
+	assert_true(jsk_column_is_valid(c, 0));
+	assert_false(jsk_column_is_valid(c, 1));
+	assert_int_equal(c->offsets[0], 0);
+	assert_int_equal(c->offsets[1], 3);
+	assert_int_equal(c->offsets[2], 3);
+	assert_int_equal(c->offsets[3], 3);
+	assert_memory_equal(c->data, "a\tb", 3);
+
+	c = &cols.columns[2];
+	assert_int_equal(c->type, JSK_BOOL);
+	assert_int_equal(c->null_count, 1);
+	assert_int_equal(c->values.b[0], 1);
+	assert_false(jsk_column_is_valid(c, 1));
+	assert_int_equal(c->values.b[2], 0);
+
+	/* Columns first seen late are null before that */
+	c = &cols.columns[3];
+	assert_string_equal(c->name, "extra");
+	assert_int_equal(c->null_count, 2);
+	assert_true(jsk_column_is_valid(c, 2));
+	assert_int_equal(c->offsets[2], 0);
+	assert_int_equal(c->offsets[3], 1);
+
+	/* NDJSON, with more rows than the first allocation */
+	char ndjson[4096] = "";
+	for (int i = 0; i < 100; i++)
+		sprintf(&ndjson[strlen(ndjson)], "{\"n\":%d,\"s\":\"%d\"}\n",
+				i, i % 10);
+	res = jsk_shred(h, ndjson, strlen(ndjson), NULL, &cols);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(cols.rows, 100);
+	assert_int_equal(cols.columns[0].type, JSK_INT);
+	assert_int_equal(cols.columns[0].values.i[99], 99);
+	assert_int_equal(cols.columns[1].offsets[100], 100);
+	assert_memory_equal(&cols.columns[1].data[97], "789", 3);
+
+	res = jsk_shred(h, "[{\"a\":1},{\"a\":\"x\"}]", 19, NULL, &cols);
+	assert_int_equal(res.status, JSK_ERROR);
+	assert_string_equal(res.data.error,
+			"Column \"a\" has both integer and string values at row 1");
+	res = jsk_shred(h, "{\"a\":[1]}", 9, NULL, &cols);
+	assert_int_equal(res.status, JSK_ERROR);
+	assert_string_equal(res.data.error,
+			"Nested value in column \"a\" at row 0");
+	res = jsk_shred(h, "[{},2]", 6, NULL, &cols);
+	assert_int_equal(res.status, JSK_ERROR);
+	assert_string_equal(res.data.error, "Row 1 is not an object");
+
+	jsk_heap_free(h);
+}
+
+static void test_parse_schema(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	const char *text = "{\"type\":\"object\",\"required\":[\"id\",\"tags\"],"
+		"\"properties\":{"
+		"\"id\":{\"type\":\"integer\",\"minimum\":1},"
+		"\"kind\":{\"enum\":[\"a\",\"b\",null]},"
+		"\"name\":{\"type\":\"string\",\"maxLength\":3},"
+		"\"score\":{\"type\":\"number\",\"exclusiveMaximum\":10},"
+		"\"tags\":{\"type\":\"array\",\"maxItems\":2,"
+		"\"items\":{\"type\":\"string\"}},"
+		"\"extra\":{}},"
+		"\"additionalProperties\":false,\"title\":\"t\"}";
+	jsk_result res = jsk_parse(h, text, strlen(text));
+	assert_int_equal(res.status, JSK_OK);
+
+	char *error = NULL;
+	jsk_schema *schema = jsk_schema_compile(h, res.data.value, &error);
+	assert_non_null(schema);
+
+	jsk_parse_options opts = { 0 };
+	opts.schema = schema;
+
+	const char *json = "{\"id\":2,\"kind\":\"b\",\"name\":\"\\u00e9\\u00e9\\u00e9\","
+		"\"score\":9.5,\"tags\":[\"x\"],\"extra\":{\"any\":[1,{}]}}";
+	res = jsk_parse_opts(h, json, strlen(json), &opts);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_get_int(*jsk_object_get(res.data.value, "id")), 2);
+
+	/* 2.0 is an integer, and lazy numbers are checked too */
+	opts.lazy_numbers = 1;
+	res = jsk_parse_opts(h, "{\"id\":2.0,\"tags\":[]}", 20, &opts);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_object_get(res.data.value, "id")->type,
+			JSK_NUMBER);
+	res = jsk_parse_opts(h, "{\"id\":1e300,\"tags\":[]}", 22, &opts);
+	assert_int_equal(res.status, JSK_OK);
+	res = jsk_parse_opts(h, "{\"id\":0,\"tags\":[]}", 18, &opts);
+	assert_int_equal(res.status, JSK_SCHEMA);
+	assert_string_equal(res.data.error,
+			"Value violates minimum at index 6");
+	opts.lazy_numbers = 0;
+
+	static const struct {
+		const char *json;
+		const char *error;
+	} bad[] = {
+		{ "[]", "Schema does not allow array at index 0" },
+		{ "{\"id\":1.5,\"tags\":[]}",
+			"Schema does not allow number at index 6" },
+		{ "{\"id\":-1e300,\"tags\":[]}",
+			"Value violates minimum at index 6" },
+		{ "{\"id\":1,\"kind\":\"c\",\"tags\":[]}",
+			"Value not in schema enum at index 15" },
+		{ "{\"id\":1,\"name\":\"abcd\",\"tags\":[]}",
+			"Value violates maxLength at index 15" },
+		{ "{\"id\":1,\"score\":10,\"tags\":[]}",
+			"Value violates exclusiveMaximum at index 16" },
+		{ "{\"id\":1,\"tags\":[\"a\",\"b\",\"c\"]}",
+			"Value violates maxItems at index 27" },
+		{ "{\"id\":1,\"tags\":[1]}",
+			"Schema does not allow integer at index 16" },
+		{ "{\"id\":1,\"other\":1,\"tags\":[]}",
+			"Key \"other\" not allowed by schema at index 8" },
+		{ "{\"id\":1}", "Missing required key \"tags\" at index 7" },
+		/* Escaped keys match their properties all the same */
+		{ "{\"id\":1,\"t\\u0061gs\":[1]}",
+			"Schema does not allow integer at index 21" },
+		{ "{\"id\":1,\"\\u006fther\":1,\"tags\":[]}",
+			"Key \"other\" not allowed by schema at index 8" },
+	};
+
+	for (unsigned i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+		res = jsk_parse_opts(h, bad[i].json, strlen(bad[i].json),
+				&opts);
+		assert_int_equal(res.status, JSK_SCHEMA);
+		assert_string_equal(res.data.error, bad[i].error);
+	}
+
+	/* A key that is only required still gets additionalProperties */
+	text = "{\"required\":[\"a\"],\"additionalProperties\":false}";
+	res = jsk_parse(h, text, strlen(text));
+	jsk_parse_options strict = { 0 };
+	strict.schema = jsk_schema_compile(h, res.data.value, &error);
+	res = jsk_parse_opts(h, "{\"a\":1}", 7, &strict);
+	assert_int_equal(res.status, JSK_SCHEMA);
+	assert_string_equal(res.data.error,
+			"Key \"a\" not allowed by schema at index 1");
+	text = "{\"required\":[\"a\"],\"additionalProperties\":"
+		"{\"type\":\"string\"}}";
+	res = jsk_parse(h, text, strlen(text));
+	strict.schema = jsk_schema_compile(h, res.data.value, &error);
+	res = jsk_parse_opts(h, "{\"a\":\"x\"}", 9, &strict);
+	assert_int_equal(res.status, JSK_OK);
+	res = jsk_parse_opts(h, "{\"a\":1}", 7, &strict);
+	assert_int_equal(res.status, JSK_SCHEMA);
+
+	/* SAX consumers only see documents up to the violation */
+	const jsk_handler handler = {
+		sax_null, sax_bool, sax_int, sax_float, sax_string, sax_key,
+		sax_start_object, sax_end, sax_start_array, sax_end, NULL,
+	};
+	sax_counts c = { 0 };
+	res = jsk_parse_sax_opts(h, "{\"id\":3,\"tags\":[true]}", 22,
+			&handler, &c, &opts);
+	assert_int_equal(res.status, JSK_SCHEMA);
+	assert_int_equal(c.ints, 1);
+	assert_int_equal(c.bools, 0);
+
+	res = jsk_parse(h, "{\"pattern\":\"a*\"}", 16);
+	assert_null(jsk_schema_compile(h, res.data.value, &error));
+	assert_string_equal(error, "Unsupported schema keyword \"pattern\"");
+
+	jsk_heap_free(h);
+}
+
+static void test_query(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	const char *json = "{\"items\":["
+		"{\"id\":1,\"status\":\"ok\",\"tags\":[\"a\",\"b\"],\"n\":5},"
+		"{\"id\":2,\"status\":\"bad\",\"tags\":[],\"n\":50},"
+		"{\"id\":3,\"status\":\"ok\",\"tags\":[\"c\"],\"n\":7.5},"
+		"{\"status\":\"ok\"}],"
+		"\"meta\":{\"a b\":{\"x\":1},\"grid\":[[1,2],[3]]}}";
+	jsk_result res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
+	const jsk_value doc = res.data.value;
+
+	static const struct {
+		const char *expr;
+		const char *result;
+	} cases[] = {
+		{ "items[?status=='ok'].id", "[1,3]" },
+		{ "items[?status != 'ok'].id", "[2]" },
+		{ "items[?n > `5` && n < `10`].id", "[3]" },
+		{ "items[?!(n >= `7`) || id == `2`].id", "[1,2]" },
+		{ "items[?tags].tags[0]", "[\"a\",\"c\"]" },
+		{ "items[?@.tags == `[\"c\"]`].id", "[3]" },
+		{ "items[*].tags[]", "[\"a\",\"b\",\"c\"]" },
+		{ "items[-1].status", "\"ok\"" },
+		{ "items[9]", "null" },
+		{ "meta.\"a b\".x", "1" },
+		{ "meta.grid[]", "[1,2,3]" },
+		{ "meta.grid[*][0]", "[1,3]" },
+		{ "meta.*.x", "[1]" },
+		{ "@.items[0].n", "5" },
+		{ "missing.path", "null" },
+	};
+
+	for (unsigned i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		char *error = NULL;
+		const jsk_query *q = jsk_query_compile(h, cases[i].expr,
+				&error);
+		assert_non_null(q);
+		char *out = jsk_to_string(h, jsk_query_eval(h, q, doc));
+		assert_string_equal(out, cases[i].result);
+		free(out);
+	}
+
+	/* Compiled once, run against packed arrays and lazy numbers */
+	jsk_parse_options opts = { 0 };
+	opts.pack_arrays = 1;
+	opts.lazy_numbers = 1;
+	res = jsk_parse_opts(h, "{\"v\":[1,20,3]}", 14, &opts);
+	const jsk_query *q = jsk_query_compile(h, "v[?@ > `2`]", NULL);
+	char *out = jsk_to_string(h, jsk_query_eval(h, q, res.data.value));
+	assert_string_equal(out, "[20,3]");
+	free(out);
+
+	char *error = NULL;
+	assert_null(jsk_query_compile(h, "items[?a[*]]", &error));
+	assert_string_equal(error, "Expected an index at offset 9 of query");
+	assert_null(jsk_query_compile(h, "items[?a == ", &error));
+	assert_string_equal(error, "Expected an identifier at end of query");
+	assert_null(jsk_query_compile(h, "a.`1`", &error));
+	assert_string_equal(error,
+			"Expected an identifier at offset 2 of query");
+
+	jsk_heap_free(h);
+}
+
+static void test_parse_stream(void **state)
+{
+	(void)state;
+
+	const char *json =
+		"{\"id\": 1}\n"
+		"[2, 3]\n"
+		"{\"id\": oops}\n"
+		"\n"
+		"  4  \n";
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_stream s = jsk_stream_new(h, json, strlen(json));
+	jsk_result res;
+
+	assert_true(jsk_stream_next(&s, &res));
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(res.data.value.type, JSK_OBJECT);
+	assert_int_equal(jsk_get_int_p(jsk_object_get(res.data.value, "id")), 1);
+
+	assert_true(jsk_stream_next(&s, &res));
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(res.data.value.type, JSK_ARRAY);
+	assert_int_equal(jsk_array_length(res.data.value), 2);
+
+	assert_true(jsk_stream_next(&s, &res));
+	assert_int_equal(res.status, JSK_ERROR);
+
+	assert_true(jsk_stream_next(&s, &res));
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(res.data.value.type, JSK_INT);
+	assert_int_equal(jsk_get_int(res.data.value), 4);
+
+	assert_false(jsk_stream_next(&s, &res));
+	assert_false(jsk_stream_next(&s, &res));
+
+	jsk_heap_free(h);
+}
+
+typedef struct ndjson_state {
+	unsigned long long next;
+	long long sum;
+	int errors;
+} ndjson_state;
+
+static int ndjson_collect(void *user, unsigned long long index, jsk_result res)
+{
+	ndjson_state *st = user;
+
+	assert_int_equal(index, st->next);
+	st->next++;
+
+	if (res.status != JSK_OK) {
+		st->errors++;
+		return 0;
+	}
+
+	jsk_value *v = jsk_object_get(res.data.value, "n");
+	assert_non_null(v);
+	assert_int_equal(jsk_get_int_p(v), (long long)index);
+	st->sum += jsk_get_int_p(v);
+
+	return 0;
+}
+
+static void test_parse_ndjson_parallel(void **state)
+{
+	(void)state;
+
+	const unsigned n = 500;
+	char *json = malloc(n * 32);
+	unsigned len = 0;
+
+	for (unsigned i = 0; i < n; i++)
+		len += sprintf(&json[len], "{\"n\": %u, \"s\": \"x\"}\n", i);
+
+	ndjson_state st = { 0, 0, 0 };
+	jsk_status status = jsk_parse_ndjson_parallel(NULL, json, len, 4,
+			ndjson_collect, &st);
+	assert_int_equal(status, JSK_OK);
+	assert_int_equal(st.next, n);
+	assert_int_equal(st.errors, 0);
+	assert_int_equal(st.sum, (long long)n * (n - 1) / 2);
+
+	memcpy(&json[5], "?", 1);
+	st = (ndjson_state){ 0, 0, 0 };
+	status = jsk_parse_ndjson_parallel(NULL, json, len, 0,
+			ndjson_collect, &st);
+	assert_int_equal(status, JSK_OK);
+	assert_int_equal(st.next, n);
+	assert_int_equal(st.errors, 1);
+
+	free(json);
+}
+
+static void test_parse_array_parallel(void **state)
+{
+	(void)state;
+
+	const unsigned n = 300;
+	char *json = malloc(n * 64);
+	unsigned len = sprintf(json, " [");
+
+	for (unsigned i = 0; i < n; i++)
+		len += sprintf(&json[len], "%s{\"n\": %u, \"s\": \"a,]\\\"[\"}",
+				i ? ", " : "", i);
+	len += sprintf(&json[len], "] ");
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	jsk_result res = jsk_parse_array_parallel(h, json, len, 4);
+	assert_int_equal(res.status, JSK_OK);
+	jsk_value a = res.data.value;
+	assert_int_equal(a.type, JSK_ARRAY);
+	assert_int_equal(jsk_array_length(a), n);
+
+	for (unsigned i = 0; i < n; i++) {
+		jsk_value *v = jsk_object_get(jsk_array_at(a, i), "n");
+		assert_non_null(v);
+		assert_int_equal(jsk_get_int_p(v), i);
+		v = jsk_object_get(jsk_array_at(a, i), "s");
+		assert_string_equal(jsk_get_string_p(v), "a,]\"[");
+	}
+
+	res = jsk_parse_array_parallel(h, "[]", 2, 4);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_array_length(res.data.value), 0);
+
+	/* Long enough to split, with nothing or a trailing comma to split on */
+	char sparse[128];
+	memset(sparse, ' ', sizeof(sparse));
+	sparse[0] = '[';
+	sparse[sizeof(sparse) - 1] = ']';
+	res = jsk_parse_array_parallel(h, sparse, sizeof(sparse), 2);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_array_length(res.data.value), 0);
+	sparse[1] = '1';
+	sparse[sizeof(sparse) / 2] = ',';
+	res = jsk_parse_array_parallel(h, sparse, sizeof(sparse), 2);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_array_length(res.data.value), 1);
+
+	json[len / 2] = '}';
+	res = jsk_parse_array_parallel(h, json, len, 4);
+	assert_int_equal(res.status, JSK_ERROR);
+
+	jsk_heap_free(h);
+	free(json);
+}
+
+static void test_cursor(void **state)
+{
+	(void)state;
+
+	const char *json =
+		" {"
+		"	\"skip\": { \"a\": [1, {\"b\": \"}]\\\"\"}], \"c\": null },"
+		"	\"id\": 42,"
+		"	\"ratio\": 0.5,"
+		"	\"name\": \"Hello\\nWorld\","
+		"	\"ok\": true,"
+		"	\"none\": null,"
+		"	\"list\": [10, 20, [30], 40]"
+		"}";
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_cursor root = jsk_cursor_new(json, strlen(json));
+	jsk_cursor c;
+	jsk_type type;
+	long long i;
+	double d;
+	int b;
+	char *s;
+	const char *raw;
+	unsigned len;
+
+	assert_int_equal(jsk_cursor_type(root, &type), JSK_OK);
+	assert_int_equal(type, JSK_OBJECT);
+
+	assert_int_equal(jsk_cursor_find_field(root, "id", &c), JSK_OK);
+	assert_int_equal(jsk_cursor_type(c, &type), JSK_OK);
+	assert_int_equal(type, JSK_INT);
+	assert_int_equal(jsk_cursor_get_int(c, &i), JSK_OK);
+	assert_int_equal(i, 42);
+	assert_int_equal(jsk_cursor_get_bool(c, &b), JSK_ERROR);
+
+	assert_int_equal(jsk_cursor_find_field(root, "ratio", &c), JSK_OK);
+	assert_int_equal(jsk_cursor_get_float(c, &d), JSK_OK);
+	assert_float_equal(d, 0.5, 0.0001);
+	assert_int_equal(jsk_cursor_get_int(c, &i), JSK_ERROR);
+
+	assert_int_equal(jsk_cursor_find_field(root, "name", &c), JSK_OK);
+	assert_int_equal(jsk_cursor_get_raw_string(c, &raw, &len), JSK_OK);
+	assert_int_equal(len, 12);
+	assert_int_equal(jsk_cursor_get_string(h, c, &s), JSK_OK);
+	assert_string_equal(s, "Hello\nWorld");
+
+	assert_int_equal(jsk_cursor_find_field(root, "ok", &c), JSK_OK);
+	assert_int_equal(jsk_cursor_get_bool(c, &b), JSK_OK);
+	assert_true(b);
+
+	assert_int_equal(jsk_cursor_find_field(root, "none", &c), JSK_OK);
+	assert_true(jsk_cursor_is_null(c));
+
+	assert_int_equal(jsk_cursor_find_field(root, "missing", &c), JSK_ERROR);
+	assert_int_equal(jsk_cursor_find_field(root, "c", &c), JSK_ERROR);
+
+	assert_int_equal(jsk_cursor_find_field(root, "list", &c), JSK_OK);
+	jsk_cursor_iter it = jsk_cursor_iterate(c);
+	jsk_cursor e;
+	long long sum = 0;
+	unsigned n = 0;
+	while (jsk_cursor_next(&it, &e)) {
+		if (jsk_cursor_get_int(e, &i) == JSK_OK)
+			sum += i;
+		n++;
+	}
+	assert_int_equal(it.status, JSK_OK);
+	assert_int_equal(n, 4);
+	assert_int_equal(sum, 70);
+
+	assert_int_equal(jsk_cursor_at(c, 3, &e), JSK_OK);
+	assert_int_equal(jsk_cursor_get_int(e, &i), JSK_OK);
+	assert_int_equal(i, 40);
+	assert_int_equal(jsk_cursor_at(c, 4, &e), JSK_ERROR);
+
+	assert_int_equal(jsk_cursor_find_field(root, "skip", &c), JSK_OK);
+	jsk_result res = jsk_cursor_value(h, c);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(res.data.value.type, JSK_OBJECT);
+	assert_int_equal(jsk_object_count(res.data.value), 2);
+
+	const char *bad = "[1, 2 3]";
+	it = jsk_cursor_iterate(jsk_cursor_new(bad, strlen(bad)));
+	n = 0;
+	while (jsk_cursor_next(&it, &e))
+		n++;
+	assert_int_equal(n, 2);
+	assert_int_equal(it.status, JSK_ERROR);
+
+	jsk_heap_free(h);
+}
+
+static void test_extract(void **state)
+{
+	(void)state;
+
+	const char *json =
+		"{"
+		"	\"big\": [[1, 2, 3], {\"x\": \"}\"}],"
+		"	\"a/b\": 1,"
+		"	\"m~n\": 2,"
+		"	\"user\": { \"id\": 7, \"tags\": [\"p\", \"q\"] },"
+		"	\"list\": [10, 11, 12]"
+		"}";
+
+	const char *paths[] = {
+		"/user/id",
+		"/list/2",
+		"/a~1b",
+		"/m~0n",
+		"/missing",
+		"/user",
+		"/user/tags/1",
+		"/list/01",
+		"/user/id",
+	};
+	const unsigned n = sizeof(paths) / sizeof(paths[0]);
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	jsk_result res = jsk_extract(h, json, strlen(json), paths, n);
+	assert_int_equal(res.status, JSK_OK);
+
+	jsk_value a = res.data.value;
+	assert_int_equal(jsk_array_length(a), n);
+	assert_int_equal(jsk_get_int(jsk_array_at(a, 0)), 7);
+	assert_int_equal(jsk_get_int(jsk_array_at(a, 1)), 12);
+	assert_int_equal(jsk_get_int(jsk_array_at(a, 2)), 1);
+	assert_int_equal(jsk_get_int(jsk_array_at(a, 3)), 2);
+	assert_int_equal(jsk_array_at(a, 4).type, JSK_NULL);
+	assert_int_equal(jsk_array_at(a, 5).type, JSK_OBJECT);
+	assert_string_equal(jsk_get_string(jsk_array_at(a, 6)), "q");
+	assert_int_equal(jsk_array_at(a, 7).type, JSK_NULL);
+	assert_int_equal(jsk_get_int(jsk_array_at(a, 8)), 7);
+
+	const char *root[] = { "" };
+	res = jsk_extract(h, json, strlen(json), root, 1);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_array_at(res.data.value, 0).type, JSK_OBJECT);
+
+	/* Repeated keys keep their first value and don't end the walk early */
+	const char *dup = "{\"a\":1,\"a\":2,\"u\":{\"id\":4},"
+		"\"u\":{\"id\":5},\"b\":3}";
+	const char *ab[] = { "/a", "/u/id", "/b" };
+	res = jsk_extract(h, dup, strlen(dup), ab, 3);
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_get_int(jsk_array_at(res.data.value, 0)), 1);
+	assert_int_equal(jsk_get_int(jsk_array_at(res.data.value, 1)), 4);
+	assert_int_equal(jsk_get_int(jsk_array_at(res.data.value, 2)), 3);
+
+	const char *bad[] = { "user" };
+	res = jsk_extract(h, json, strlen(json), bad, 1);
+	assert_int_equal(res.status, JSK_ERROR);
+
+	const char *broken = "{\"a\": 1 \"b\": 2}";
+	const char *b[] = { "/b" };
+	res = jsk_extract(h, broken, strlen(broken), b, 1);
+	assert_int_equal(res.status, JSK_ERROR);
+
+	jsk_heap_free(h);
+}
+
+static void test_validate(void **state)
+{
+	(void)state;
+
+	static const char *const valid[] = {
+		"0",
+		"-0.5e+10",
+		" true ",
+		"null",
+		"\"\"",
+		"\"\\u00e9\\n\\\"\"",
+		"\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\"",
+		"[]",
+		"{}",
+		"[1, [2, {\"a\": [3, {}]}], \"long string without specials\"]",
+		"{\"a\": {\"b\": [true, false, null]}, \"c\": 1E3}",
+	};
+
+	static const struct {
+		const char *json;
+		unsigned long long offset;
+	} invalid[] = {
+		{ "", 0 },
+		{ "01", 1 },
+		{ "1.", 0 },
+		{ "-", 0 },
+		{ "1e", 0 },
+		{ "tru", 0 },
+		{ "[1,]", 3 },
+		{ "[1 2]", 3 },
+		{ "{\"a\" 1}", 5 },
+		{ "{\"a\": 1,}", 8 },
+		{ "{1: 2}", 1 },
+		{ "[1}", 2 },
+		{ "[1", 2 },
+		{ "1 2", 2 },
+		{ "\"abc", 4 },
+		{ "\"a\tb\"", 2 },
+		{ "\"\\x\"", 1 },
+		{ "\"\\u12g4\"", 1 },
+		{ "[\"a\\u0000b\"]", 3 },
+		{ "\"\xc0\xaf\"", 1 },
+		{ "\"\xed\xa0\x80\"", 1 },
+		{ "\"abcdefghij\xe2\x82\"", 11 },
+		{ "\"\xf4\x90\x80\x80\"", 1 },
+	};
+
+	unsigned long long offset;
+
+	for (unsigned i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+		assert_int_equal(jsk_validate(valid[i], strlen(valid[i]),
+					&offset), JSK_OK);
+
+	for (unsigned i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		offset = ~0ULL;
+		assert_int_equal(jsk_validate(invalid[i].json,
+					strlen(invalid[i].json), &offset),
+				JSK_ERROR);
+		assert_int_equal(offset, invalid[i].offset);
+	}
+
+	char deep[2 * JSK_VALIDATE_MAX_DEPTH + 2];
+	memset(deep, '[', JSK_VALIDATE_MAX_DEPTH + 1);
+	memset(&deep[JSK_VALIDATE_MAX_DEPTH + 1], ']',
+			JSK_VALIDATE_MAX_DEPTH + 1);
+	assert_int_equal(jsk_validate(deep, sizeof(deep), NULL), JSK_ERROR);
+	assert_int_equal(jsk_validate(&deep[1], sizeof(deep) - 2, NULL),
+			JSK_OK);
+}
+
+static void test_binary_image(void **state)
+{
+	(void)state;
+
+	const char *json =
+		"{"
+		"	\"name\": \"config\","
+		"	\"version\": 3,"
+		"	\"ratio\": 0.25,"
+		"	\"enabled\": true,"
+		"	\"nothing\": null,"
+		"	\"empty\": [],"
+		"	\"servers\": ["
+		"		{ \"host\": \"a\", \"port\": 80 },"
+		"		{ \"host\": \"b\", \"port\": 8080 }"
+		"	]"
+		"}";
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_result res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
+
+	unsigned long long size;
+	char *image = jsk_save_binary(h, res.data.value, &size);
+	assert_non_null(image);
+	assert_int_equal(size % 8, 0);
+
+	/* Move the image to show that nothing in it is address dependent */
+	char *copy = malloc(size);
+	memcpy(copy, image, size);
+	memset(image, 0, size);
+	free(image);
+
+	jsk_bin_value root, v, w;
+	assert_int_equal(jsk_load_binary(copy, size - 8, &root), JSK_ERROR);
+	assert_int_equal(jsk_load_binary(copy, size, &root), JSK_OK);
+	assert_int_equal(jsk_bin_type(root), JSK_OBJECT);
+	assert_int_equal(jsk_bin_length(root), 7);
+
+	/* Offsets and lengths inside the image are checked too */
+	assert_int_equal(jsk_bin_object_get(root, "servers", &v), JSK_OK);
+	jsk_bin_node *node = (jsk_bin_node *)v.node;
+	const jsk_bin_node saved = *node;
+	const jsk_bin_node corrupt[] = {
+		{ JSK_ARRAY, 2, size },
+		{ JSK_ARRAY, 1000, saved.payload },
+		{ JSK_ARRAY, 2, saved.payload + 4 },
+		{ JSK_STRING, 4, saved.payload },
+		{ JSK_OBJECT, 0, sizeof(jsk_image_header) },
+		{ JSK_NUMBER, 0, 0 },
+	};
+	for (unsigned i = 0; i < sizeof(corrupt) / sizeof(*corrupt); i++) {
+		*node = corrupt[i];
+		assert_int_equal(jsk_load_binary(copy, size, &v), JSK_ERROR);
+	}
+	*node = saved;
+	assert_int_equal(jsk_load_binary(copy, size, &root), JSK_OK);
+
+	assert_int_equal(jsk_bin_object_get(root, "name", &v), JSK_OK);
+	assert_int_equal(jsk_bin_type(v), JSK_STRING);
+	assert_int_equal(jsk_bin_length(v), 6);
+	assert_string_equal(jsk_bin_get_string(v), "config");
+
+	assert_int_equal(jsk_bin_object_get(root, "version", &v), JSK_OK);
+	assert_int_equal(jsk_bin_get_int(v), 3);
+	assert_int_equal(jsk_bin_object_get(root, "ratio", &v), JSK_OK);
+	assert_float_equal(jsk_bin_get_float(v), 0.25, 0.0001);
+	assert_int_equal(jsk_bin_object_get(root, "enabled", &v), JSK_OK);
+	assert_true(jsk_bin_get_bool(v));
+	assert_int_equal(jsk_bin_object_get(root, "nothing", &v), JSK_OK);
+	assert_int_equal(jsk_bin_type(v), JSK_NULL);
+	assert_int_equal(jsk_bin_object_get(root, "empty", &v), JSK_OK);
+	assert_int_equal(jsk_bin_length(v), 0);
+	assert_int_equal(jsk_bin_object_get(root, "missing", &v), JSK_ERROR);
+
+	assert_int_equal(jsk_bin_object_get(root, "servers", &v), JSK_OK);
+	assert_int_equal(jsk_bin_type(v), JSK_ARRAY);
+	assert_int_equal(jsk_bin_length(v), 2);
+	assert_int_equal(jsk_bin_object_get(jsk_bin_at(v, 1), "port", &w),
+			JSK_OK);
+	assert_int_equal(jsk_bin_get_int(w), 8080);
+
+	unsigned bucket = 0, n = 0;
+	const char *key;
+	while (jsk_bin_object_next(root, &bucket, &key, &v))
+		n++;
+	assert_int_equal(n, 7);
+
+	jsk_value d;
+	assert_int_equal(jsk_bin_to_value(h, root, &d), JSK_OK);
+	assert_int_equal(jsk_object_count(d), 7);
+	jsk_value *servers = jsk_object_get(d, "servers");
+	assert_non_null(servers);
+	jsk_value *host = jsk_object_get(jsk_array_at(*servers, 0), "host");
+	assert_string_equal(jsk_get_string_p(host), "a");
+
+	/* Copying out fails cleanly however far it gets */
+	jsk_value many = jsk_new_array();
+	for (unsigned i = 0; i < 64; i++)
+		jsk_array_push(h, &many, res.data.value);
+	char *big = jsk_save_binary(h, many, &size);
+	assert_int_equal(jsk_load_binary(big, size, &root), JSK_OK);
+	for (unsigned budget = 0; ; budget++) {
+		unsigned left = ~0U;
+		jsk_heap *oom = jsk_heap_new(&left);
+		left = budget;
+		const jsk_status status = jsk_bin_to_value(oom, root, &d);
+		if (status == JSK_OK) {
+			assert_int_equal(jsk_array_length(d), 64);
+			assert_int_equal(jsk_object_count(jsk_array_at(d, 63)),
+					7);
+		}
+		jsk_heap_free(oom);
+		if (status == JSK_OK)
+			break;
+		assert_int_equal(status, JSK_ERROR);
+	}
+	free(big);
+
+	free(copy);
+	jsk_heap_free(h);
+}
+
+static void test_cbor_msgpack(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	jsk_value a = jsk_new_array();
+	jsk_array_push(h, &a, jsk_new_int(1));
+	jsk_array_push(h, &a, jsk_new_int(-500));
+	jsk_array_push(h, &a, jsk_new_string(h, "hi"));
+	jsk_array_push(h, &a, jsk_new_float(1.5));
+
+	const unsigned char cbor[] = {
+		0x84, 0x01, 0x39, 0x01, 0xf3, 0x62, 'h', 'i',
+		0xfa, 0x3f, 0xc0, 0x00, 0x00,
+	};
+	const unsigned char msgpack[] = {
+		0x94, 0x01, 0xd1, 0xfe, 0x0c, 0xa2, 'h', 'i',
+		0xca, 0x3f, 0xc0, 0x00, 0x00,
+	};
+
+	unsigned long long size;
+	unsigned char *out = jsk_to_cbor(h, a, &size);
+	assert_int_equal(size, sizeof(cbor));
+	assert_memory_equal(out, cbor, sizeof(cbor));
+	free(out);
+
+	out = jsk_to_msgpack(h, a, &size);
+	assert_int_equal(size, sizeof(msgpack));
+	assert_memory_equal(out, msgpack, sizeof(msgpack));
+	free(out);
+
+	jsk_result res = jsk_parse_msgpack(h, msgpack, sizeof(msgpack));
+	assert_int_equal(res.status, JSK_OK);
+	assert_int_equal(jsk_array_length(res.data.value), 4);
+	assert_int_equal(jsk_get_int(jsk_array_at(res.data.value, 1)), -500);
+	assert_string_equal(jsk_get_string(jsk_array_at(res.data.value, 2)),
+			"hi");
+
+	/* Indefinite lengths, a chunked string, a half float and a tag */
+	const unsigned char indefinite[] = {
+		0xbf, 0x61, 'a', 0xf9, 0x3c, 0x00,
+		0x7f, 0x61, 'b', 0x61, 'c', 0xff,
+		0x9f, 0xc1, 0x1a, 0x00, 0x00, 0x00, 0x2a, 0xf7, 0xff,
+		0xff,
+	};
+	res = jsk_parse_cbor(h, indefinite, sizeof(indefinite));
+	assert_int_equal(res.status, JSK_OK);
+	jsk_value *v = jsk_object_get(res.data.value, "a");
+	assert_float_equal(jsk_get_float_p(v), 1.0, 0.0001);
+	v = jsk_object_get(res.data.value, "bc");
+	assert_non_null(v);
+	assert_int_equal(jsk_get_int(jsk_array_at(*v, 0)), 42);
+	assert_int_equal(jsk_array_at(*v, 1).type, JSK_NULL);
+
+	const char *json = "{\"k\\\"ey\":[1,2.5,\"a\\nb\",{\"x\":null}],"
+		"\"t\":true,\"f\":3.0}";
+	res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
+
+	out = jsk_to_msgpack(h, res.data.value, &size);
+	res = jsk_parse_msgpack(h, out, size);
+	free(out);
+	assert_int_equal(res.status, JSK_OK);
+	v = jsk_object_get(res.data.value, "k\\\"ey");
+	assert_non_null(v);
+	assert_string_equal(jsk_get_string(jsk_array_at(*v, 2)), "a\nb");
+
+	void *bytes;
+	res = jsk_json_to_cbor(h, json, strlen(json), &bytes, &size);
+	assert_int_equal(res.status, JSK_OK);
+
+	char *text;
+	res = jsk_cbor_to_json(h, bytes, size, &text);
+	assert_int_equal(res.status, JSK_OK);
+	assert_string_equal(text, json);
+	free(text);
+
+	res = jsk_cbor_to_json(h, bytes, size - 1, &text);
+	assert_int_equal(res.status, JSK_ERROR);
+	free(bytes);
+
+	/* Each allocation in turn fails cleanly, escaped strings included */
+	char big[JSK_HEAP_CHUNK_SIZE + 16];
+	memset(big, 'a', sizeof(big) - 1);
+	memcpy(big, "[\"\\n", 4);
+	memcpy(&big[sizeof(big) - 3], "\"]", 3);
+	unsigned left = ~0U;
+	jsk_heap *oom = jsk_heap_new(&left);
+	for (unsigned budget = 0; ; budget++) {
+		left = budget;
+		res = jsk_json_to_cbor(oom, big, strlen(big), &bytes, &size);
+		if (res.status != JSK_OK)
+			continue;
+		assert_non_null(bytes);
+
+		left = ~0U;
+		res = jsk_cbor_to_json(oom, bytes, size, &text);
+		assert_int_equal(res.status, JSK_OK);
+		assert_string_equal(text, big);
+		for (unsigned b = 0; b < 3; b++) {
+			left = b;
+			free(text);
+			text = NULL;
+			res = jsk_cbor_to_json(oom, bytes, size, &text);
+			assert_int_equal(res.status, JSK_ERROR);
+		}
+		free(bytes);
+		break;
+	}
+	jsk_heap_free(oom);
+
+	const unsigned char truncated[] = { 0x82, 0x01, 0x61 };
+	res = jsk_parse_cbor(h, truncated, sizeof(truncated));
+	assert_int_equal(res.status, JSK_ERROR);
+	assert_string_equal(res.data.error,
+			"Unexpected end of input at index 3");
+
+	const unsigned char ext[] = { 0xd4, 0x01, 0x00 };
+	res = jsk_parse_msgpack(h, ext, sizeof(ext));
+	assert_int_equal(res.status, JSK_ERROR);
+
+	jsk_heap_free(h);
+}
+
+static unsigned long long heap_bytes(jsk_heap *h)
+{
+	unsigned long long n = 0;
+	for (; h; h = h->next)
+		n += h->ptr;
+	return n;
+}
+
+static void test_clone_compact(void **state)
+{
+	(void)state;
+
+	jsk_heap *h = jsk_heap_new(NULL);
+	jsk_value root = jsk_new_object(h);
+	jsk_value list = jsk_new_array();
+
+	char names[64][16];
+	for (int i = 0; i < 64; i++) {
+		snprintf(names[i], sizeof(names[i]), "k%d", i);
+		jsk_object_insert(&root, names[i], jsk_new_int(i));
+		jsk_array_push(h, &list, jsk_new_string(h, names[i]));
+	}
+	jsk_object_insert(&root, "list", list);
+	jsk_object_insert(&root, "empty", jsk_new_object(h));
+
+	const unsigned long long used = heap_bytes(h);
+
+	jsk_heap *h2 = jsk_heap_new(NULL);
+	jsk_value copy = jsk_clone(h2, root);
+	assert_int_equal(jsk_object_count(copy), 66);
+	assert_int_equal(jsk_get_int_p(jsk_object_get(copy, "k42")), 42);
+	jsk_heap_free(h2);
+
+	assert_int_equal(jsk_compact(&h, &root), JSK_OK);
+	assert_true(heap_bytes(h) < used);
+
+	/* Names were copied, so the originals can go */
+	char name[16];
+	memset(names, 0, sizeof(names));
+
+	jsk_value *v = jsk_object_get(root, "list");
+	assert_non_null(v);
+	assert_int_equal(jsk_object_count(root), 66);
+	for (int i = 0; i < 64; i++) {
+		snprintf(name, sizeof(name), "k%d", i);
+		assert_int_equal(jsk_get_int_p(jsk_object_get(root, name)), i);
+		assert_string_equal(jsk_get_string(jsk_array_at(*v, i)), name);
+	}
+
+	jsk_array_push(h, v, jsk_new_int(1));
+	assert_int_equal(jsk_array_length(*v), 65);
+	jsk_object_insert(jsk_object_get(root, "empty"), "x", jsk_new_null());
+	assert_int_equal(jsk_object_count_p(jsk_object_get(root, "empty")), 1);
+
+	jsk_heap_free(h);
+}
+
 static void test_to_string_simple_values(void **state)
 {
 	(void)state;
@@ -458,6 +2110,85 @@ static void test_to_string_strings(void **state)
 	jsk_heap_free(h);
 }
 
+static void test_to_string_escapes(void **state)
+{
+	(void)state;
+
+	char *s;
+	jsk_value v;
+	jsk_heap *h = jsk_heap_new(NULL);
+
+	/* Long enough to cross several scan blocks */
+	v = jsk_new_string(h, "0123456789abcdef\x01/0123456789\t\x1f"
+			"0123456789abcdefghij\"");
+	s = jsk_to_string(h, v);
+	assert_string_equal(s, "\"0123456789abcdef\\u0001\\/0123456789\\t"
+			"\\u001f0123456789abcdefghij\\\"\"");
+	free(s);
+
+	const char *json = "{\"caf\xc3\xa9\":[\"na\xc3\xafve \xf0\x9f\x98\x80\"]}";
+	jsk_result res = jsk_parse(h, json, strlen(json));
+	assert_int_equal(res.status, JSK_OK);
+
+	s = jsk_to_string(h, res.data.value);
+	assert_string_equal(s, json);
+	free(s);
+
+	s = jsk_to_string_ascii(h, res.data.value);
+	assert_string_equal(s, "{\"caf\\u00e9\":[\"na\\u00efve "
+			"\\ud83d\\ude00\"]}");
+	free(s);
+
+	jsk_heap_free(h);
+}
+
+static void test_simd_levels(void **state)
+{
+	(void)state;
+
+	/* Long enough for the widest kernels, with work near the end */
+	const char *good = "\"0123456789abcdef0123456789abcdef0123456789abcdef"
+		"0123456789abcdef caf\xc3\xa9 \xf0\x9f\x98\x80 \\n/\"";
+	const char *bad = "\"0123456789abcdef0123456789abcdef0123456789abcdef"
+		"0123456789abcdef \xe2\x82\"";
+	const jsk_simd_level initial = jsk_simd_get();
+
+	for (unsigned l = JSK_SIMD_SCALAR; l <= JSK_SIMD_AVX512; l++) {
+		const jsk_simd_level level = jsk_simd_set((jsk_simd_level)l);
+		assert_true((unsigned)level <= l);
+		assert_int_equal(jsk_simd_get(), level);
+
+		jsk_heap *h = jsk_heap_new(NULL);
+
+		jsk_result res = jsk_parse(h, good, strlen(good));
+		assert_int_equal(res.status, JSK_OK);
+
+		char *s = jsk_to_string_ascii(h, res.data.value);
+		assert_string_equal(s, "\"0123456789abcdef0123456789abcdef"
+				"0123456789abcdef0123456789abcdef "
+				"caf\\u00e9 \\ud83d\\ude00 \\n\\/\"");
+		free(s);
+
+		res = jsk_parse(h, bad, strlen(bad));
+		assert_int_equal(res.status, JSK_ERROR);
+		assert_string_equal(res.data.error,
+				"Unexpected invalid token at index 66");
+
+		jsk_heap_free(h);
+	}
+
+	jsk_simd_set(initial);
+
+	/* Every level can be named in JSK_SIMD */
+	jsk_simd_level level = JSK_SIMD_SCALAR;
+	assert_true(jsk_simd_parse("avx512", &level));
+	assert_int_equal(level, JSK_SIMD_AVX512);
+	assert_true(jsk_simd_parse("sse4.2", &level));
+	assert_int_equal(level, JSK_SIMD_SSE42);
+	assert_false(jsk_simd_parse("avx", &level));
+	assert_int_equal(level, JSK_SIMD_SSE42);
+}
+
 static void test_to_string_arrays(void **state)
 {
 	(void)state;
@@ -516,18 +2247,41 @@ int main(void)
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_heap),
 		cmocka_unit_test(test_heap_oversized),
+		cmocka_unit_test(test_heap_stats),
 		cmocka_unit_test(test_string_formatting),
 		cmocka_unit_test(test_simple_values),
 		cmocka_unit_test(test_strings),
 		cmocka_unit_test(test_arrays),
 		cmocka_unit_test(test_objects),
 		cmocka_unit_test(test_object_rehash),
+		cmocka_unit_test(test_object_hashing),
+		cmocka_unit_test(test_object_get_len),
+		cmocka_unit_test(test_object_get_key),
 		cmocka_unit_test(test_parse_simple_values),
 		cmocka_unit_test(test_parse_strings),
+		cmocka_unit_test(test_parse_unicode),
 		cmocka_unit_test(test_parse_arrays),
 		cmocka_unit_test(test_parse_objects),
+		cmocka_unit_test(test_parse_sax),
+		cmocka_unit_test(test_parse_limits),
+		cmocka_unit_test(test_parse_lazy_numbers),
+		cmocka_unit_test(test_parse_packed_arrays),
+		cmocka_unit_test(test_parse_schema),
+		cmocka_unit_test(test_shred),
+		cmocka_unit_test(test_query),
+		cmocka_unit_test(test_parse_stream),
+		cmocka_unit_test(test_parse_ndjson_parallel),
+		cmocka_unit_test(test_parse_array_parallel),
+		cmocka_unit_test(test_cursor),
+		cmocka_unit_test(test_extract),
+		cmocka_unit_test(test_validate),
+		cmocka_unit_test(test_binary_image),
+		cmocka_unit_test(test_cbor_msgpack),
+		cmocka_unit_test(test_clone_compact),
 		cmocka_unit_test(test_to_string_simple_values),
 		cmocka_unit_test(test_to_string_strings),
+		cmocka_unit_test(test_to_string_escapes),
+		cmocka_unit_test(test_simd_levels),
 		cmocka_unit_test(test_to_string_arrays),
 		cmocka_unit_test(test_to_string_objects),
 	};
@@ -0,0 +1,175 @@
+#define JSKOROST_IMPLEMENTATION
+#define JSK_DEBUG
+#include "jskorost.hpp"
+#include <cstdarg>
+#include <cstddef>
+#include <csetjmp>
+#include <cmocka.h>
+
+namespace shop {
+
+struct address {
+	std::string city;
+	std::optional<std::string> zip;
+};
+
+JSK_FIELDS(address, city, zip)
+
+struct order {
+	long long id;
+	unsigned qty;
+	double price;
+	bool paid;
+	std::string note;
+	std::vector<int> codes;
+	std::vector<address> stops;
+	std::optional<int> rating;
+};
+
+JSK_FIELDS(order, id, qty, price, paid, note, codes, stops, rating)
+
+/* Enough fields that several land in the same bucket */
+struct wide {
+	int f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14,
+	    f15, f16, f17, f18, f19;
+};
+
+JSK_FIELDS(wide, f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13,
+		f14, f15, f16, f17, f18, f19)
+
+} /* namespace shop */
+
+static void test_round_trip(void **state)
+{
+	(void)state;
+
+	const char *json = "{\"id\":-42,\"qty\":3,\"price\":9.5,\"paid\":true,"
+		"\"note\":\"a \\\"b\\\"\\n\\u00e9\",\"codes\":[1,2,3],"
+		"\"stops\":[{\"city\":\"Oslo\",\"zip\":\"0150\"},"
+		"{\"city\":\"Bergen\",\"zip\":null}],\"rating\":5}";
+
+	const shop::order o = jsk::read<shop::order>(json);
+	assert_int_equal(o.id, -42);
+	assert_int_equal(o.qty, 3);
+	assert_float_equal(o.price, 9.5, 0);
+	assert_true(o.paid);
+	assert_string_equal(o.note.c_str(), "a \"b\"\n\xc3\xa9");
+	assert_int_equal(o.codes.size(), 3);
+	assert_int_equal(o.codes[2], 3);
+	assert_int_equal(o.stops.size(), 2);
+	assert_string_equal(o.stops[1].city.c_str(), "Bergen");
+	assert_string_equal(o.stops[0].zip->c_str(), "0150");
+	assert_false(o.stops[1].zip.has_value());
+	assert_int_equal(*o.rating, 5);
+
+	const std::string out = jsk::write(o);
+	assert_string_equal(out.c_str(), "{\"id\":-42,\"qty\":3,\"price\":9.5,"
+		"\"paid\":true,\"note\":\"a \\\"b\\\"\\n\xc3\xa9\","
+		"\"codes\":[1,2,3],\"stops\":[{\"city\":\"Oslo\","
+		"\"zip\":\"0150\"},{\"city\":\"Bergen\",\"zip\":null}],"
+		"\"rating\":5}");
+
+	const std::string again = jsk::write(jsk::read<shop::order>(out));
+	assert_string_equal(again.c_str(), out.c_str());
+
+	shop::wide w = jsk::read<shop::wide>("{\"f19\":19,\"f7\":7,\"f0\":0,"
+			"\"f13\":13}");
+	assert_int_equal(w.f19, 19);
+	assert_int_equal(w.f7, 7);
+	assert_int_equal(w.f13, 13);
+}
+
+static bool fails(const char *json, const char *prefix)
+{
+	try {
+		jsk::read<shop::order>(json);
+	} catch (const jsk::error &e) {
+		return !std::strncmp(e.what(), prefix, std::strlen(prefix));
+	}
+
+	return false;
+}
+
+static void test_type_mismatch(void **state)
+{
+	(void)state;
+
+	assert_true(fails("{\"id\":\"7\"}", "Type mismatch"));
+	assert_true(fails("{\"qty\":-1}", "Type mismatch"));
+	assert_true(fails("{\"paid\":1}", "Type mismatch"));
+	assert_true(fails("{\"codes\":{}}", "Type mismatch"));
+	assert_true(fails("{\"stops\":[1]}", "Type mismatch"));
+	assert_true(fails("[]", "Type mismatch"));
+	assert_true(fails("{\"id\":1", "Expected"));
+
+	/* A reader stays usable after an error */
+	jsk::reader r;
+	shop::order o{};
+	try {
+		r.read("{\"note\":false}", o);
+		fail();
+	} catch (const jsk::error &) {
+	}
+	r.read("{\"note\":\"ok\"}", o);
+	assert_string_equal(o.note.c_str(), "ok");
+}
+
+static void test_unknown_and_missing_keys(void **state)
+{
+	(void)state;
+
+	shop::order o{};
+	o.id = 1;
+	o.note = "kept";
+	o.codes = { 9 };
+
+	jsk::reader r;
+	r.read("{\"extra\":{\"id\":5,\"codes\":[7]},\"skip\":[[{}],null],"
+			"\"qty\":2,\"ID\":3}", o);
+
+	assert_int_equal(o.id, 1);
+	assert_int_equal(o.qty, 2);
+	assert_string_equal(o.note.c_str(), "kept");
+	assert_int_equal(o.codes.size(), 1);
+	assert_int_equal(o.codes[0], 9);
+	assert_false(o.rating.has_value());
+}
+
+static void test_optional_fields(void **state)
+{
+	(void)state;
+
+	shop::order o{};
+	o.rating = 4;
+
+	jsk::reader r;
+	r.read("{\"id\":1}", o);
+	assert_int_equal(*o.rating, 4);
+
+	r.read("{\"rating\":null}", o);
+	assert_false(o.rating.has_value());
+
+	r.read("{\"rating\":2}", o);
+	assert_int_equal(*o.rating, 2);
+
+	o.rating.reset();
+	const std::string out = jsk::write(o);
+	assert_non_null(std::strstr(out.c_str(), "\"rating\":null"));
+
+	shop::address a = jsk::read<shop::address>("{\"city\":\"x\"}");
+	assert_false(a.zip.has_value());
+	const std::string s = jsk::write(a);
+	assert_string_equal(s.c_str(), "{\"city\":\"x\",\"zip\":null}");
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_round_trip),
+		cmocka_unit_test(test_type_mismatch),
+		cmocka_unit_test(test_unknown_and_missing_keys),
+		cmocka_unit_test(test_optional_fields),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}